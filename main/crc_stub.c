@@ -0,0 +1,268 @@
+/*
+ * On-target CRC32 for qCRC and delta flashing
+ *
+ * The stubs in target/flashstub/crc32*.s take the CRC so far, the address
+ * and the length, and stop once done with the CRC in their first argument
+ * register. The target's RAM under the stub and its registers are saved
+ * before and put back after, so GDB sees the target as it left it. Regions
+ * are done in chunks so a slow target clock can't run into the timeout.
+ *
+ * On STM32F1/F2/F4/F7 the stub feeds word aligned data through the CRC
+ * unit, whose clock is turned on for the duration if it was off. The value
+ * the target's own firmware had in the unit is lost.
+ *
+ * The ESP32-C3 driver's run control turns the watchdogs back on when the
+ * core resumes and saves their settings again on every halt, which would
+ * lose the originals to the disabled ones. Its stub is run with the RISC-V
+ * functions underneath, as the flash loader is, so the watchdogs stay off.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "target_internal.h"
+#include "cortex_internal.h"
+#include "riscv_debug.h"
+#include "crc32.h"
+#include "crc_stub.h"
+
+/* Below this reading the region back is about as quick as setting the stub up */
+#define CRC_STUB_MIN_LEN    1024U
+#define CRC_STUB_CHUNK      0x10000U
+#define CRC_STUB_TIMEOUT_MS 2000U
+
+#define CRC_STUB_CORTEXM_SRAM_BASE 0x20000000U
+#define CRC_STUB_CORTEXM_SRAM_END  0x40000000U
+#define CRC_STUB_CORTEXM_XPSR_T    0x01000000U
+
+#define CRC_STUB_ESP32_C3_RTC_SRAM_BASE   0x50000000U
+#define CRC_STUB_ESP32_C3_IBUS_FLASH_BASE 0x42000000U
+#define CRC_STUB_ESP32_C3_DBUS_FLASH_BASE 0x3c000000U
+#define CRC_STUB_ESP32_C3_FLASH_SIZE      0x00800000U
+
+static const uint16_t crc_stub_cortexm_code[] = {
+#include "flashstub/crc32.stub"
+};
+
+static const uint16_t crc_stub_rv32_code[] = {
+#include "flashstub/crc32_rv32.stub"
+};
+
+#define CRC_STUB_MAX_SIZE MAX(sizeof(crc_stub_cortexm_code), sizeof(crc_stub_rv32_code))
+
+typedef struct crc_stub_reg {
+	uint32_t reg;
+	uint32_t value;
+} crc_stub_reg_s;
+
+typedef struct crc_stub_arch {
+	const uint16_t *code;
+	size_t size;
+	size_t end;         /* Offset of the instruction the stub stops on */
+	bool needs_breakpoint;
+	uint32_t pc_reg;
+	uint32_t arg_regs[4]; /* CRC, address, length, CRC unit */
+	size_t arg_count;
+	crc_stub_reg_s extra_regs[2];
+	size_t extra_reg_count;
+	target_addr32_t (*data_address)(target_addr32_t addr);
+	/* Run control for the stub */
+	void (*halt_request)(target_s *target);
+	void (*halt_resume)(target_s *target, bool step);
+	target_halt_reason_e (*halt_poll)(target_s *target, target_addr64_t *watch);
+} crc_stub_arch_s;
+
+typedef struct crc_stub_crc_unit {
+	const char *driver;
+	target_addr32_t base;
+	target_addr32_t clock_enable_reg;
+	uint32_t clock_enable_bit;
+} crc_stub_crc_unit_s;
+
+/* Data loads from the instruction bus mapping of the flash go through its data bus alias */
+static target_addr32_t crc_stub_esp32c3_data_address(const target_addr32_t addr)
+{
+	if (addr - CRC_STUB_ESP32_C3_IBUS_FLASH_BASE < CRC_STUB_ESP32_C3_FLASH_SIZE)
+		return addr - CRC_STUB_ESP32_C3_IBUS_FLASH_BASE + CRC_STUB_ESP32_C3_DBUS_FLASH_BASE;
+	return addr;
+}
+
+static const crc_stub_arch_s crc_stub_cortexm = {
+	.code = crc_stub_cortexm_code,
+	.size = sizeof(crc_stub_cortexm_code),
+	.end = 0x46U,
+	.needs_breakpoint = false,
+	.pc_reg = 15U,
+	.arg_regs = {0U, 1U, 2U, 3U},
+	.arg_count = 4U,
+	/* Thumb state, and PRIMASK set so the target's interrupts stay out of the way */
+	.extra_regs = {{16U, CRC_STUB_CORTEXM_XPSR_T}, {19U, 1U}},
+	.extra_reg_count = 2U,
+	.data_address = NULL,
+	.halt_request = target_halt_request,
+	.halt_resume = target_halt_resume,
+	.halt_poll = target_halt_poll,
+};
+
+static const crc_stub_arch_s crc_stub_esp32c3 = {
+	.code = crc_stub_rv32_code,
+	.size = sizeof(crc_stub_rv32_code),
+	.end = 0x48U,
+	.needs_breakpoint = true,
+	.pc_reg = 32U,
+	.arg_regs = {10U, 11U, 12U},
+	.arg_count = 3U,
+	.extra_reg_count = 0U,
+	.data_address = crc_stub_esp32c3_data_address,
+	.halt_request = riscv_halt_request,
+	.halt_resume = riscv_halt_resume,
+	.halt_poll = riscv_halt_poll,
+};
+
+/* CRC units that can't be reconfigured, so they always compute what qCRC wants */
+static const crc_stub_crc_unit_s crc_stub_crc_units[] = {
+	{"STM32F1", 0x40023000U, 0x40021014U, 1U << 6U},
+	{"STM32F2", 0x40023000U, 0x40023830U, 1U << 12U},
+	{"STM32F4", 0x40023000U, 0x40023830U, 1U << 12U},
+	{"STM32F7", 0x40023000U, 0x40023830U, 1U << 12U},
+};
+
+static crc_stub_stats_s stats;
+
+static const crc_stub_arch_s *crc_stub_arch(target_s *const target, target_addr32_t *const load_addr)
+{
+	if (target->driver && !strcmp(target->driver, "ESP32-C3")) {
+		/* RTC fast memory is executable and out of the way of the code in SRAM */
+		*load_addr = CRC_STUB_ESP32_C3_RTC_SRAM_BASE;
+		return &crc_stub_esp32c3;
+	}
+
+	if (target->priv_free != cortex_priv_free || !target->core || target->core[0] != 'M')
+		return NULL;
+	/* Only the SRAM region is executable on every Cortex-M, CCM and the like may not be */
+	for (const target_ram_s *ram = target->ram; ram; ram = ram->next) {
+		if (ram->start >= CRC_STUB_CORTEXM_SRAM_BASE && ram->start < CRC_STUB_CORTEXM_SRAM_END &&
+			ram->length >= sizeof(crc_stub_cortexm_code)) {
+			*load_addr = ram->start;
+			return &crc_stub_cortexm;
+		}
+	}
+	return NULL;
+}
+
+static const crc_stub_crc_unit_s *crc_stub_crc_unit(target_s *const target)
+{
+	if (!target->driver)
+		return NULL;
+	for (size_t i = 0; i < ARRAY_LENGTH(crc_stub_crc_units); ++i) {
+		const crc_stub_crc_unit_s *const unit = &crc_stub_crc_units[i];
+		if (!strncmp(target->driver, unit->driver, strlen(unit->driver)))
+			return unit;
+	}
+	return NULL;
+}
+
+static bool crc_stub_wait(target_s *const target, const crc_stub_arch_s *const arch, const uint32_t timeout_ms)
+{
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, timeout_ms);
+	target_halt_reason_e reason;
+	while ((reason = arch->halt_poll(target, NULL)) == TARGET_HALT_RUNNING) {
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+	return reason != TARGET_HALT_ERROR;
+}
+
+/* Run the stub over one chunk, *crc going in as the CRC so far */
+static bool crc_stub_run(target_s *const target, const crc_stub_arch_s *const arch, const target_addr32_t load_addr,
+	uint32_t *const crc, const target_addr32_t addr, const uint32_t len, const target_addr32_t crc_unit)
+{
+	const uint32_t args[4] = {*crc, addr, len, crc_unit};
+	for (size_t i = 0; i < arch->arg_count; ++i)
+		target_reg_write(target, arch->arg_regs[i], &args[i], sizeof(args[i]));
+	for (size_t i = 0; i < arch->extra_reg_count; ++i)
+		target_reg_write(target, arch->extra_regs[i].reg, &arch->extra_regs[i].value, sizeof(uint32_t));
+	target_reg_write(target, arch->pc_reg, &load_addr, sizeof(load_addr));
+	if (target_check_error(target))
+		return false;
+
+	arch->halt_resume(target, false);
+	if (!crc_stub_wait(target, arch, CRC_STUB_TIMEOUT_MS)) {
+		arch->halt_request(target);
+		crc_stub_wait(target, arch, 100U);
+		return false;
+	}
+
+	/* Anything else halting the stub (a watchpoint GDB set, a fault) leaves it elsewhere */
+	uint32_t pc = 0;
+	target_reg_read(target, arch->pc_reg, &pc, sizeof(pc));
+	if (pc != load_addr + arch->end)
+		return false;
+	target_reg_read(target, arch->arg_regs[0], crc, sizeof(*crc));
+	return !target_check_error(target);
+}
+
+static bool crc_stub_run_all(target_s *const target, const crc_stub_arch_s *const arch, const target_addr32_t load_addr,
+	uint32_t *const result, target_addr32_t base, const size_t len)
+{
+	uint8_t saved_ram[CRC_STUB_MAX_SIZE];
+	uint8_t saved_regs[target->regs_size];
+	target_regs_read(target, saved_regs);
+	if (target_mem32_read(target, saved_ram, load_addr, arch->size) ||
+		target_mem32_write(target, load_addr, arch->code, arch->size))
+		return false;
+
+	const crc_stub_crc_unit_s *const unit = arch == &crc_stub_cortexm ? crc_stub_crc_unit(target) : NULL;
+	uint32_t clock_enable = 0;
+	if (unit) {
+		clock_enable = target_mem32_read32(target, unit->clock_enable_reg);
+		if (!(clock_enable & unit->clock_enable_bit))
+			target_mem32_write32(target, unit->clock_enable_reg, clock_enable | unit->clock_enable_bit);
+	}
+	const target_addr32_t end = load_addr + arch->end;
+	bool ok = !arch->needs_breakpoint || target_breakwatch_set(target, TARGET_BREAK_HARD, end, 4U) == 0;
+
+	if (arch->data_address)
+		base = arch->data_address(base);
+	uint32_t crc = 0xffffffffU;
+	for (size_t offset = 0; ok && offset < len; offset += CRC_STUB_CHUNK)
+		ok = crc_stub_run(target, arch, load_addr, &crc, base + offset, MIN(len - offset, CRC_STUB_CHUNK),
+			unit ? unit->base : 0U);
+
+	if (arch->needs_breakpoint)
+		target_breakwatch_clear(target, TARGET_BREAK_HARD, end, 4U);
+	if (unit && !(clock_enable & unit->clock_enable_bit))
+		target_mem32_write32(target, unit->clock_enable_reg, clock_enable);
+	target_mem32_write(target, load_addr, saved_ram, arch->size);
+	target_regs_write(target, saved_regs);
+	if (ok)
+		*result = crc;
+	return ok && !target_check_error(target);
+}
+
+bool crc_stub_crc32(target_s *const target, uint32_t *const result, const target_addr32_t base, const size_t len)
+{
+	target_addr32_t load_addr = 0;
+	const crc_stub_arch_s *const arch = len >= CRC_STUB_MIN_LEN ? crc_stub_arch(target, &load_addr) : NULL;
+	if (arch) {
+		const uint32_t start = platform_time_ms();
+		if (crc_stub_run_all(target, arch, load_addr, result, base, len)) {
+			++stats.runs;
+			stats.bytes += len;
+			stats.time_ms += platform_time_ms() - start;
+			return true;
+		}
+	}
+	++stats.fallbacks;
+	return bmd_crc32(target, result, base, len);
+}
+
+void crc_stub_get_stats(crc_stub_stats_s *const result)
+{
+	*result = stats;
+}
+
+void crc_stub_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
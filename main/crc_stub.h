@@ -0,0 +1,29 @@
+/*
+ * On-target CRC32 for qCRC and delta flashing
+ *
+ * bmd_crc32() reads the whole region back over the debug link to compute
+ * the CRC on the probe. Here a small stub is loaded into the target's RAM
+ * and computes it there, so only the 4 byte result comes back. Targets
+ * the stub doesn't know how to run on, or without RAM it can run from,
+ * get bmd_crc32() as before.
+ */
+
+#ifndef __CRC_STUB_H
+#define __CRC_STUB_H
+
+#include "target.h"
+
+typedef struct crc_stub_stats {
+	uint32_t runs;      /* CRCs computed by the stub */
+	uint32_t fallbacks; /* CRCs computed by reading the region back */
+	uint32_t bytes;     /* Bytes the stub went over */
+	uint32_t time_ms;   /* and how long that took */
+} crc_stub_stats_s;
+
+/* Same contract as bmd_crc32(), true with the CRC in *result on success */
+bool crc_stub_crc32(target_s *target, uint32_t *result, target_addr32_t base, size_t len);
+
+void crc_stub_get_stats(crc_stub_stats_s *stats);
+void crc_stub_reset_stats(void);
+
+#endif /* __CRC_STUB_H */
@@ -0,0 +1,340 @@
+/*
+ * Differential flash loads for the ESP32 GDB server
+ *
+ * GDB erases every region of the load before writing it, in address order.
+ * The erases are kept as pending ranges, and a block staged from one of them
+ * starts out as erased bytes with the written data laid over it, which is
+ * exactly what the block would hold after a normal erase and write. Writes
+ * landing in a block outside the pending ranges (one already programmed,
+ * because GDB went back to it) are laid over the target's current contents
+ * instead. Blocks that were erased but never written are blank checked the
+ * same way at vFlashDone.
+ *
+ * Regions with blocks too large to stage, and addresses outside any flash
+ * region, are erased and written straight away as before.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "target_internal.h"
+#include "crc_stub.h"
+#include "flash_pipeline.h"
+#include "flash_delta.h"
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+
+#ifdef CONFIG_BMP_FLASH_DELTA_BLOCK_MAX
+#define FLASH_DELTA_BLOCK_MAX CONFIG_BMP_FLASH_DELTA_BLOCK_MAX
+#else
+#define FLASH_DELTA_BLOCK_MAX 16384U
+#endif
+
+/* Separate erased ranges GDB can have pending, more get erased straight away */
+#define FLASH_DELTA_RANGES 8U
+
+typedef struct flash_delta_range {
+	target_addr32_t start;
+	target_addr32_t end;
+} flash_delta_range_s;
+
+static const char *TAG = "flash_delta";
+
+/* Only used from the GDB thread */
+static bool delta_enabled = FLASH_DELTA_BLOCK_MAX > 0U;
+static flash_delta_range_s pending[FLASH_DELTA_RANGES];
+static size_t pending_count;
+
+static uint8_t *block_buffer;
+static target_flash_s *block_flash; /* Flash the staged block is in, NULL if none is */
+static target_addr32_t block_addr;
+static size_t block_lo; /* Part of the block GDB wrote, all of it if it was read back */
+static size_t block_hi;
+/* The buffer still holds what the target has in this block since it was committed */
+static target_flash_s *committed_flash;
+static target_addr32_t committed_addr;
+
+static uint32_t load_start;
+static uint32_t skipped_bytes;
+static uint32_t programmed_bytes;
+static uint32_t programmed_ms;
+/* Erase and program time per byte from the last load that programmed anything */
+static uint32_t rate_bytes;
+static uint32_t rate_ms;
+static flash_delta_stats_s stats;
+
+/* The CRC qCRC uses: MSB first, initial value ~0, no final inversion */
+static uint32_t flash_delta_crc32(const uint8_t *const data, const size_t len)
+{
+	/* The ROM version inverts the value on the way in and out */
+	return ~esp_rom_crc32_be(0U, data, len);
+}
+
+static target_flash_s *flash_delta_flash(target_s *const target, const target_addr32_t addr)
+{
+	for (target_flash_s *flash = target->flash; flash; flash = flash->next) {
+		if (addr >= flash->start && addr - flash->start < flash->length)
+			return flash;
+	}
+	return NULL;
+}
+
+static bool flash_delta_stageable(const target_flash_s *const flash)
+{
+	return flash && flash->blocksize && flash->blocksize <= FLASH_DELTA_BLOCK_MAX;
+}
+
+static target_addr32_t flash_delta_block_start(const target_flash_s *const flash, const target_addr32_t addr)
+{
+	return addr - ((addr - flash->start) % flash->blocksize);
+}
+
+static flash_delta_range_s *flash_delta_pending(const target_addr32_t addr)
+{
+	for (size_t i = 0; i < pending_count; ++i) {
+		if (addr >= pending[i].start && addr < pending[i].end)
+			return &pending[i];
+	}
+	return NULL;
+}
+
+static bool flash_delta_add_pending(target_s *const target, target_addr32_t start, target_addr32_t end)
+{
+	/*
+	 * GDB erasing a region one section at a time gives back to back ranges, and
+	 * rounding to whole blocks can make them overlap. Either way they become one,
+	 * so no block is ever pending in two ranges.
+	 */
+	for (size_t i = 0; i < pending_count;) {
+		if (pending[i].start <= end && pending[i].end >= start) {
+			start = MIN(start, pending[i].start);
+			end = MAX(end, pending[i].end);
+			pending[i] = pending[--pending_count];
+		} else
+			++i;
+	}
+	if (pending_count == FLASH_DELTA_RANGES) {
+		/* The copy of the last committed block may be in what this erases */
+		committed_flash = NULL;
+		return target_flash_erase(target, start, end - start);
+	}
+	pending[pending_count++] = (flash_delta_range_s){.start = start, .end = end};
+	return true;
+}
+
+/* The block got its final contents, take it out of the range it was pending in */
+static bool flash_delta_remove_pending(
+	target_s *const target, flash_delta_range_s *const range, const target_addr32_t start, const target_addr32_t end)
+{
+	if (range->start == start)
+		range->start = end;
+	else if (range->end == end)
+		range->end = start;
+	else if (pending_count < FLASH_DELTA_RANGES) {
+		pending[pending_count++] = (flash_delta_range_s){.start = end, .end = range->end};
+		range->end = start;
+	} else {
+		/* No room to split the range, erase the part after the block now */
+		const target_addr32_t tail = range->end;
+		range->end = start;
+		if (!target_flash_erase(target, end, tail - end))
+			return false;
+	}
+	if (range->start == range->end)
+		*range = pending[--pending_count];
+	return true;
+}
+
+/* Erase, write or write through the pipeline the parts that can't be staged */
+static bool flash_delta_write_through(
+	target_s *const target, const target_addr32_t addr, const void *const data, const size_t len)
+{
+	if (flash_pipeline_enabled())
+		return flash_pipeline_write(target, addr, data, len);
+	return target_flash_write(target, addr, data, len);
+}
+
+static bool flash_delta_stage(target_s *const target, target_flash_s *const flash, const target_addr32_t addr)
+{
+	block_addr = flash_delta_block_start(flash, addr);
+	if (flash_delta_pending(block_addr)) {
+		memset(block_buffer, flash->erased, flash->blocksize);
+		block_lo = flash->blocksize;
+		block_hi = 0;
+	} else {
+		/*
+		 * The target may still hold the end of the block it was last written in
+		 * a flash write buffer, so going back to that one reuses the copy here.
+		 */
+		if (committed_flash != flash || block_addr != committed_addr) {
+			if (target_mem32_read(target, block_buffer, block_addr, flash->blocksize))
+				return false;
+		}
+		block_lo = 0;
+		block_hi = flash->blocksize;
+	}
+	committed_flash = NULL;
+	block_flash = flash;
+	return true;
+}
+
+static bool flash_delta_commit(target_s *const target)
+{
+	if (!block_flash)
+		return true;
+	target_flash_s *const flash = block_flash;
+	const size_t size = flash->blocksize;
+	block_flash = NULL;
+	++stats.blocks;
+
+	uint32_t start = platform_time_ms();
+	uint32_t crc = 0;
+	const bool unchanged = crc_stub_crc32(target, &crc, block_addr, size) && crc == flash_delta_crc32(block_buffer, size);
+	uint32_t now = platform_time_ms();
+	stats.check_ms += now - start;
+	start = now;
+
+	if (unchanged) {
+		++stats.skipped;
+		skipped_bytes += size;
+	} else {
+		if (!target_flash_erase(target, block_addr, size))
+			return false;
+		if (block_hi > block_lo &&
+			!target_flash_write(target, block_addr + block_lo, block_buffer + block_lo, block_hi - block_lo))
+			return false;
+		programmed_bytes += size;
+		programmed_ms += platform_time_ms() - start;
+	}
+	committed_flash = flash;
+	committed_addr = block_addr;
+
+	flash_delta_range_s *const range = flash_delta_pending(block_addr);
+	if (range)
+		return flash_delta_remove_pending(target, range, block_addr, block_addr + size);
+	return true;
+}
+
+bool flash_delta_enabled(void)
+{
+	return delta_enabled;
+}
+
+void flash_delta_enable(const bool enable)
+{
+	delta_enabled = enable && FLASH_DELTA_BLOCK_MAX > 0U;
+}
+
+void flash_delta_begin(void)
+{
+	flash_delta_abort();
+	load_start = platform_time_ms();
+	skipped_bytes = 0;
+	programmed_bytes = 0;
+	programmed_ms = 0;
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool flash_delta_erase(target_s *const target, target_addr32_t addr, const size_t len)
+{
+	if (!flash_delta_commit(target))
+		return false;
+	const target_addr32_t end = addr + len;
+	while (addr < end) {
+		target_flash_s *const flash = flash_delta_flash(target, addr);
+		if (!flash)
+			return target_flash_erase(target, addr, end - addr);
+		const target_addr32_t flash_end = flash->start + flash->length;
+		const target_addr32_t chunk_end = MIN(end, flash_end);
+
+		if (!flash_delta_stageable(flash)) {
+			if (!target_flash_erase(target, addr, chunk_end - addr))
+				return false;
+		} else {
+			/* Erases cover whole blocks, whatever GDB asked for */
+			const target_addr32_t start = flash_delta_block_start(flash, addr);
+			target_addr32_t stop = flash_delta_block_start(flash, chunk_end - 1U) + flash->blocksize;
+			if (!block_buffer) {
+				block_buffer = malloc(FLASH_DELTA_BLOCK_MAX);
+				if (!block_buffer) {
+					ESP_LOGW(TAG, "No memory to stage blocks, erasing as usual");
+					return target_flash_erase(target, addr, end - addr);
+				}
+			}
+			stop = MIN(stop, flash_end);
+			if (!flash_delta_add_pending(target, start, stop))
+				return false;
+		}
+		addr = chunk_end;
+	}
+	return true;
+}
+
+bool flash_delta_write(target_s *const target, target_addr32_t addr, const void *const data, size_t len)
+{
+	const uint8_t *src = (const uint8_t *)data;
+	while (len) {
+		target_flash_s *const flash = flash_delta_flash(target, addr);
+		if (!flash_delta_stageable(flash) || !block_buffer) {
+			size_t chunk = len;
+			if (flash)
+				chunk = MIN(len, flash->start + flash->length - addr);
+			if (!flash_delta_write_through(target, addr, src, chunk))
+				return false;
+			addr += chunk;
+			src += chunk;
+			len -= chunk;
+			continue;
+		}
+
+		if (block_flash != flash || flash_delta_block_start(flash, addr) != block_addr) {
+			if (!flash_delta_commit(target) || !flash_delta_stage(target, flash, addr))
+				return false;
+		}
+		const size_t offset = addr - block_addr;
+		const size_t chunk = MIN(len, flash->blocksize - offset);
+		memcpy(block_buffer + offset, src, chunk);
+		block_lo = MIN(block_lo, offset);
+		block_hi = MAX(block_hi, offset + chunk);
+		addr += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	return true;
+}
+
+bool flash_delta_done(target_s *const target)
+{
+	if (!flash_delta_commit(target))
+		return false;
+	/* Erased but never written, these only need erasing if they aren't blank already */
+	while (pending_count) {
+		target_flash_s *const flash = flash_delta_flash(target, pending[0].start);
+		if (!flash || !flash_delta_stage(target, flash, pending[0].start) || !flash_delta_commit(target))
+			return false;
+	}
+
+	if (programmed_bytes) {
+		rate_bytes = programmed_bytes;
+		rate_ms = programmed_ms;
+	}
+	stats.saved_known = rate_bytes != 0U;
+	if (stats.saved_known)
+		stats.saved_ms = (int32_t)(((uint64_t)skipped_bytes * rate_ms) / rate_bytes) - (int32_t)stats.check_ms;
+	if (stats.blocks)
+		ESP_LOGI(TAG, "%" PRIu32 " of %" PRIu32 " blocks unchanged, load took %" PRIu32 " ms, about %" PRId32 " ms saved",
+			stats.skipped, stats.blocks, platform_time_ms() - load_start, stats.saved_ms);
+	return true;
+}
+
+void flash_delta_abort(void)
+{
+	block_flash = NULL;
+	committed_flash = NULL;
+	pending_count = 0;
+}
+
+void flash_delta_get_stats(flash_delta_stats_s *const result)
+{
+	*result = stats;
+}
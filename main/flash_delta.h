@@ -0,0 +1,41 @@
+/*
+ * Differential flash loads for the ESP32 GDB server
+ *
+ * Reloading a build that barely changed still erases and programs every
+ * block GDB asked for. Here vFlashErase only records the range, and the
+ * vFlashWrite data is collected into a copy of one erase block at a time.
+ * Once a block is complete its CRC is compared with the target's, and a
+ * block that already holds the new contents is neither erased nor written.
+ */
+
+#ifndef __FLASH_DELTA_H
+#define __FLASH_DELTA_H
+
+#include "target.h"
+
+typedef struct flash_delta_stats {
+	uint32_t blocks;    /* Erase blocks the last load covered */
+	uint32_t skipped;   /* of which already held the new contents */
+	uint32_t check_ms;  /* Time spent comparing blocks */
+	int32_t saved_ms;   /* Estimated time saved, net of the comparisons */
+	bool saved_known;   /* False until some block was programmed to estimate from */
+} flash_delta_stats_s;
+
+/* Whether vFlashErase/vFlashWrite go through here (needs BMP_FLASH_DELTA_BLOCK_MAX > 0) */
+bool flash_delta_enabled(void);
+void flash_delta_enable(bool enable);
+
+/* A load starts, forget anything left over from one that was abandoned */
+void flash_delta_begin(void);
+/* vFlashErase: blocks that can be staged are erased once their new contents are known */
+bool flash_delta_erase(target_s *target, target_addr32_t addr, size_t len);
+/* vFlashWrite: stage the data, programming the previous block if this moves past it */
+bool flash_delta_write(target_s *target, target_addr32_t addr, const void *data, size_t len);
+/* vFlashDone: program the last block and erase what was erased but not written */
+bool flash_delta_done(target_s *target);
+/* The load failed, drop what was staged */
+void flash_delta_abort(void);
+
+void flash_delta_get_stats(flash_delta_stats_s *stats);
+
+#endif /* __FLASH_DELTA_H */
@@ -0,0 +1,193 @@
+/*
+ * Pipelined vFlashWrite for the ESP32 GDB server
+ *
+ * Blocks travel from the GDB thread to the writer task through a queue, and
+ * the buffers they were copied into come back on another one once written.
+ * The writer takes the target bus lock for each block, which it only gets
+ * while the GDB thread is waiting for the next packet, so programming one
+ * block overlaps receiving the next. When all buffers are in use the GDB
+ * thread waits for one before acknowledging, which paces GDB to the flash.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target.h"
+#include "gdb_packet.h"
+#include "flash_pipeline.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_BMP_FLASH_PIPELINE_BUFFERS
+#define FLASH_PIPELINE_BUFFERS CONFIG_BMP_FLASH_PIPELINE_BUFFERS
+#else
+#define FLASH_PIPELINE_BUFFERS 3U
+#endif
+
+#define FLASH_PIPELINE_TASK_STACK 4096U
+/* Same as the GDB thread, the two take turns on the target anyway */
+#define FLASH_PIPELINE_TASK_PRIORITY 17U
+
+typedef struct flash_pipeline_block {
+	target_s *target;
+	target_addr32_t addr;
+	size_t len;
+	uint8_t *data;
+} flash_pipeline_block_s;
+
+static QueueHandle_t free_queue;    /* Buffers ready to take a block */
+static QueueHandle_t pending_queue; /* Blocks waiting for the writer */
+static bool pipeline_enabled = FLASH_PIPELINE_BUFFERS > 0U;
+static bool pipeline_failed;        /* Setting the pipeline up failed, writes are done in line */
+static volatile bool pipeline_error;
+static flash_pipeline_stats_s stats;
+
+static void flash_pipeline_task(void *arg)
+{
+	(void)arg;
+	flash_pipeline_block_s block;
+
+	while (true) {
+		xQueueReceive(pending_queue, &block, portMAX_DELAY);
+		platform_target_lock();
+		/* After a failure the rest of the load is dropped until GDB has been told */
+		if (!pipeline_error) {
+			volatile bool written = false;
+			TRY (EXCEPTION_ALL) {
+				written = target_flash_write(block.target, block.addr, block.data, block.len);
+			}
+			CATCH () {
+			default:
+				break;
+			}
+			if (!written) {
+				pipeline_error = true;
+				++stats.errors;
+			}
+		}
+		platform_target_unlock();
+		xQueueSend(free_queue, &block.data, portMAX_DELAY);
+	}
+}
+
+static bool flash_pipeline_init(void)
+{
+	if (free_queue)
+		return true;
+	if (pipeline_failed)
+		return false;
+	pipeline_failed = true;
+
+	free_queue = xQueueCreate(FLASH_PIPELINE_BUFFERS, sizeof(uint8_t *));
+	pending_queue = xQueueCreate(FLASH_PIPELINE_BUFFERS, sizeof(flash_pipeline_block_s));
+	if (!free_queue || !pending_queue)
+		goto fail;
+	for (size_t i = 0; i < FLASH_PIPELINE_BUFFERS; ++i) {
+		uint8_t *const buffer = gdb_packet_buffer_alloc(GDB_PACKET_BUFFER_SIZE);
+		if (!buffer)
+			goto fail;
+		xQueueSend(free_queue, &buffer, 0);
+	}
+	if (xTaskCreatePinnedToCore(flash_pipeline_task, "flash_writer", FLASH_PIPELINE_TASK_STACK, NULL,
+			FLASH_PIPELINE_TASK_PRIORITY, NULL, PLATFORM_DEBUG_CORE) != pdPASS)
+		goto fail;
+
+	pipeline_failed = false;
+	return true;
+
+fail:
+	if (free_queue) {
+		uint8_t *buffer;
+		while (xQueueReceive(free_queue, &buffer, 0) == pdTRUE)
+			free(buffer);
+		vQueueDelete(free_queue);
+		free_queue = NULL;
+	}
+	if (pending_queue) {
+		vQueueDelete(pending_queue);
+		pending_queue = NULL;
+	}
+	return false;
+}
+
+bool flash_pipeline_enabled(void)
+{
+	return pipeline_enabled && !pipeline_failed;
+}
+
+void flash_pipeline_enable(const bool enable)
+{
+	flash_pipeline_wait();
+	pipeline_enabled = enable && FLASH_PIPELINE_BUFFERS > 0U;
+}
+
+static uint8_t *flash_pipeline_buffer(void)
+{
+	uint8_t *buffer;
+	if (xQueueReceive(free_queue, &buffer, 0) == pdTRUE)
+		return buffer;
+
+	++stats.stalls;
+	/* Let the writer at the target while we wait for it to finish a block */
+	platform_target_unlock();
+	xQueueReceive(free_queue, &buffer, portMAX_DELAY);
+	platform_target_lock();
+	return buffer;
+}
+
+bool flash_pipeline_write(target_s *const target, const target_addr32_t addr, const void *const data,
+	const size_t len)
+{
+	if (!flash_pipeline_init())
+		return target_flash_write(target, addr, data, len);
+	if (pipeline_error) {
+		flash_pipeline_flush();
+		return false;
+	}
+
+	flash_pipeline_block_s block = {
+		.target = target,
+		.addr = addr,
+		.len = len,
+		.data = flash_pipeline_buffer(),
+	};
+	memcpy(block.data, data, len);
+	xQueueSend(pending_queue, &block, portMAX_DELAY);
+	++stats.blocks;
+	return true;
+}
+
+void flash_pipeline_wait(void)
+{
+	if (!free_queue || uxQueueMessagesWaiting(free_queue) == FLASH_PIPELINE_BUFFERS)
+		return;
+
+	/* Every buffer back on the free queue means every queued block has been written */
+	uint8_t *buffers[FLASH_PIPELINE_BUFFERS];
+	platform_target_unlock();
+	for (size_t i = 0; i < FLASH_PIPELINE_BUFFERS; ++i)
+		xQueueReceive(free_queue, &buffers[i], portMAX_DELAY);
+	platform_target_lock();
+	for (size_t i = 0; i < FLASH_PIPELINE_BUFFERS; ++i)
+		xQueueSend(free_queue, &buffers[i], 0);
+}
+
+bool flash_pipeline_flush(void)
+{
+	flash_pipeline_wait();
+	const bool ok = !pipeline_error;
+	pipeline_error = false;
+	return ok;
+}
+
+void flash_pipeline_get_stats(flash_pipeline_stats_s *const result)
+{
+	*result = stats;
+}
+
+void flash_pipeline_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
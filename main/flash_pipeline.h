@@ -0,0 +1,40 @@
+/*
+ * Pipelined vFlashWrite for the ESP32 GDB server
+ *
+ * GDB sends the next vFlashWrite only once the previous one is answered,
+ * so writing each block before replying puts the WiFi round trip and the
+ * flash programming time back to back. Here a block is copied into one of
+ * a few buffers and acknowledged straight away, and a worker task programs
+ * it while the next packet is on its way. A failed write is reported on
+ * the next vFlashWrite or at vFlashDone.
+ */
+
+#ifndef __FLASH_PIPELINE_H
+#define __FLASH_PIPELINE_H
+
+#include "target.h"
+
+typedef struct flash_pipeline_stats {
+	uint32_t blocks; /* Blocks written through the pipeline */
+	uint32_t stalls; /* Blocks that had to wait for a free buffer */
+	uint32_t errors;
+} flash_pipeline_stats_s;
+
+/* Whether vFlashWrite goes through the pipeline (needs BMP_FLASH_PIPELINE_BUFFERS > 0) */
+bool flash_pipeline_enabled(void);
+void flash_pipeline_enable(bool enable);
+
+/*
+ * Queue a block for writing. Returns false without queueing it if an earlier
+ * block failed, the error is then cleared and the caller reports it.
+ */
+bool flash_pipeline_write(target_s *target, target_addr32_t addr, const void *data, size_t len);
+/* Wait for the queued blocks to be written, any error is kept for the next flush */
+void flash_pipeline_wait(void);
+/* Wait for the queued blocks to be written, false (and the error cleared) if any failed */
+bool flash_pipeline_flush(void);
+
+void flash_pipeline_get_stats(flash_pipeline_stats_s *stats);
+void flash_pipeline_reset_stats(void);
+
+#endif /* __FLASH_PIPELINE_H */
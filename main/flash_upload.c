@@ -0,0 +1,280 @@
+/*
+ * Compressed firmware upload for the ESP32 probe
+ *
+ * The image is an LZ4 frame as the lz4 tool writes it: a header, blocks
+ * each prefixed by their size (the top bit set for one stored as is) and an
+ * end mark. Blocks have to be independent and at most 64 KiB, which is what
+ * "lz4 -B4" gives, so each one can be decoded as it arrives into a single
+ * buffer and programmed before the next is read. The optional checksums are
+ * skipped, the data already came over TCP.
+ *
+ * The target bus lock is only held while a block is programmed, the GDB
+ * thread gets it back in between.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+#include "lz4.h"
+#include "flash_upload.h"
+
+#include "esp_log.h"
+
+#define FLASH_UPLOAD_MAGIC     0x184d2204U
+#define FLASH_UPLOAD_CHUNK     1024U
+#define FLASH_UPLOAD_RAW_BLOCK 0x80000000U
+
+/* Frame descriptor flags and block size */
+#define FLASH_UPLOAD_FLG_VERSION_MASK    0xc0U
+#define FLASH_UPLOAD_FLG_VERSION         0x40U
+#define FLASH_UPLOAD_FLG_INDEPENDENT     0x20U
+#define FLASH_UPLOAD_FLG_BLOCK_CHECKSUM  0x10U
+#define FLASH_UPLOAD_FLG_CONTENT_SIZE    0x08U
+#define FLASH_UPLOAD_FLG_DICT_ID         0x01U
+#define FLASH_UPLOAD_BD_SIZE_SHIFT       4U
+#define FLASH_UPLOAD_BD_SIZE_MASK        7U
+#define FLASH_UPLOAD_BD_SIZE_64K         4U
+
+static const char *TAG = "flash_upload";
+
+typedef struct flash_upload {
+	flash_upload_read_f read;
+	void *ctx;
+	target_s *target;
+	target_addr32_t addr;     /* Where the next block goes */
+	target_addr32_t erased;   /* End of what has been erased so far */
+	uint8_t *block;
+	uint8_t *chunk;
+	bool block_checksums;
+} flash_upload_s;
+
+static bool flash_upload_read(flash_upload_s *const upload, void *const data, const size_t len)
+{
+	uint8_t *dest = (uint8_t *)data;
+	for (size_t offset = 0; offset < len;) {
+		const int amount = upload->read(upload->ctx, dest + offset, len - offset);
+		if (amount <= 0)
+			return false;
+		offset += (size_t)amount;
+	}
+	return true;
+}
+
+static uint32_t flash_upload_le32(const uint8_t *const data)
+{
+	return data[0] | ((uint32_t)data[1] << 8U) | ((uint32_t)data[2] << 16U) | ((uint32_t)data[3] << 24U);
+}
+
+static bool flash_upload_read32(flash_upload_s *const upload, uint32_t *const value)
+{
+	uint8_t data[4];
+	if (!flash_upload_read(upload, data, sizeof(data)))
+		return false;
+	*value = flash_upload_le32(data);
+	return true;
+}
+
+static flash_upload_status_e flash_upload_header(flash_upload_s *const upload)
+{
+	/* Magic, flags and block size */
+	uint8_t header[6];
+	if (!flash_upload_read(upload, header, sizeof(header)))
+		return FLASH_UPLOAD_READ_ERROR;
+	const uint8_t flags = header[4];
+	const uint8_t block_size = (header[5] >> FLASH_UPLOAD_BD_SIZE_SHIFT) & FLASH_UPLOAD_BD_SIZE_MASK;
+	if (flash_upload_le32(header) != FLASH_UPLOAD_MAGIC ||
+		(flags & FLASH_UPLOAD_FLG_VERSION_MASK) != FLASH_UPLOAD_FLG_VERSION ||
+		!(flags & FLASH_UPLOAD_FLG_INDEPENDENT) || (flags & FLASH_UPLOAD_FLG_DICT_ID) ||
+		block_size != FLASH_UPLOAD_BD_SIZE_64K)
+		return FLASH_UPLOAD_BAD_FORMAT;
+	upload->block_checksums = flags & FLASH_UPLOAD_FLG_BLOCK_CHECKSUM;
+
+	/* Then the content size if there is one, and the header checksum */
+	uint8_t rest[9];
+	const size_t rest_len = flags & FLASH_UPLOAD_FLG_CONTENT_SIZE ? 9U : 1U;
+	if (!flash_upload_read(upload, rest, rest_len))
+		return FLASH_UPLOAD_READ_ERROR;
+	return FLASH_UPLOAD_OK;
+}
+
+/* Decode a compressed block as it is read, into the block buffer */
+static flash_upload_status_e flash_upload_inflate(flash_upload_s *const upload, size_t len, size_t *const decoded)
+{
+	lz4_decoder_s decoder;
+	lz4_decoder_init(&decoder, upload->block, FLASH_UPLOAD_BLOCK_SIZE);
+	while (len) {
+		const size_t amount = MIN(len, FLASH_UPLOAD_CHUNK);
+		if (!flash_upload_read(upload, upload->chunk, amount))
+			return FLASH_UPLOAD_READ_ERROR;
+		if (!lz4_decode(&decoder, upload->chunk, amount))
+			return FLASH_UPLOAD_BAD_FORMAT;
+		len -= amount;
+	}
+	if (!lz4_decoder_done(&decoder))
+		return FLASH_UPLOAD_BAD_FORMAT;
+	*decoded = decoder.len;
+	return FLASH_UPLOAD_OK;
+}
+
+static target_flash_s *flash_upload_flash(target_s *const target, const target_addr32_t addr)
+{
+	for (target_flash_s *flash = target->flash; flash; flash = flash->next) {
+		if (addr >= flash->start && addr - flash->start < flash->length)
+			return flash;
+	}
+	return NULL;
+}
+
+/*
+ * Erase what the block needs that earlier ones didn't already get erased, and
+ * program it. Erases cover whole flash blocks, which can be larger than a frame
+ * block, so the end of the last one is remembered rather than erasing it again.
+ */
+static bool flash_upload_program(flash_upload_s *const upload, const size_t len)
+{
+	target_s *const target = upload->target;
+	const target_addr32_t end = upload->addr + len;
+	if (end > upload->erased) {
+		const target_addr32_t start = MAX(upload->addr, upload->erased);
+		if (!target_flash_erase(target, start, end - start))
+			return false;
+		const target_flash_s *const flash = flash_upload_flash(target, end - 1U);
+		if (!flash || !flash->blocksize)
+			return false;
+		upload->erased = end - 1U - ((end - 1U - flash->start) % flash->blocksize) + flash->blocksize;
+	}
+	return target_flash_write(target, upload->addr, upload->block, len);
+}
+
+static flash_upload_status_e flash_upload_block(flash_upload_s *const upload, const size_t len)
+{
+	platform_target_lock();
+	flash_upload_status_e status = FLASH_UPLOAD_OK;
+	/* GDB may have moved on to another target, or let this one run, since the upload started */
+	if (cur_target != upload->target || gdb_target_running)
+		status = FLASH_UPLOAD_NO_TARGET;
+	else {
+		volatile bool programmed = false;
+		TRY (EXCEPTION_ALL) {
+			programmed = flash_upload_program(upload, len);
+		}
+		CATCH () {
+		default:
+			break;
+		}
+		if (!programmed)
+			status = FLASH_UPLOAD_FLASH_ERROR;
+		gdb_cache_invalidate();
+	}
+	platform_target_unlock();
+	return status;
+}
+
+static flash_upload_status_e flash_upload_blocks(flash_upload_s *const upload, size_t *const written)
+{
+	while (true) {
+		uint32_t size = 0;
+		if (!flash_upload_read32(upload, &size))
+			return FLASH_UPLOAD_READ_ERROR;
+		/* End mark, anything after it (the content checksum) isn't needed */
+		if (!size)
+			return FLASH_UPLOAD_OK;
+
+		const bool raw = size & FLASH_UPLOAD_RAW_BLOCK;
+		size &= ~FLASH_UPLOAD_RAW_BLOCK;
+		if (size > FLASH_UPLOAD_BLOCK_SIZE)
+			return FLASH_UPLOAD_BAD_FORMAT;
+		size_t len = size;
+		flash_upload_status_e status = FLASH_UPLOAD_OK;
+		if (raw) {
+			if (!flash_upload_read(upload, upload->block, size))
+				return FLASH_UPLOAD_READ_ERROR;
+		} else if ((status = flash_upload_inflate(upload, size, &len)) != FLASH_UPLOAD_OK)
+			return status;
+
+		uint32_t checksum = 0;
+		if (upload->block_checksums && !flash_upload_read32(upload, &checksum))
+			return FLASH_UPLOAD_READ_ERROR;
+		if (len && (status = flash_upload_block(upload, len)) != FLASH_UPLOAD_OK)
+			return status;
+		upload->addr += len;
+		*written += len;
+	}
+}
+
+flash_upload_status_e flash_upload_lz4(
+	const target_addr32_t addr, const flash_upload_read_f read, void *const ctx, size_t *const written)
+{
+	*written = 0;
+	platform_target_lock();
+	target_s *const target = gdb_target_running ? NULL : cur_target;
+	platform_target_unlock();
+	if (!target)
+		return FLASH_UPLOAD_NO_TARGET;
+
+	flash_upload_s upload = {
+		.read = read,
+		.ctx = ctx,
+		.target = target,
+		.addr = addr,
+		.erased = addr,
+		.block = malloc(FLASH_UPLOAD_BLOCK_SIZE + FLASH_UPLOAD_CHUNK),
+	};
+	if (!upload.block)
+		return FLASH_UPLOAD_NO_MEMORY;
+	upload.chunk = upload.block + FLASH_UPLOAD_BLOCK_SIZE;
+
+	const uint32_t start = platform_time_ms();
+	flash_upload_status_e status = flash_upload_header(&upload);
+	if (status == FLASH_UPLOAD_OK)
+		status = flash_upload_blocks(&upload, written);
+	free(upload.block);
+
+	/* Leave flash mode whatever happened, as the end of a GDB load does */
+	platform_target_lock();
+	if (cur_target == target && target->flash_mode) {
+		volatile bool completed = false;
+		TRY (EXCEPTION_ALL) {
+			completed = target_flash_complete(target);
+		}
+		CATCH () {
+		default:
+			break;
+		}
+		if (!completed && status == FLASH_UPLOAD_OK)
+			status = FLASH_UPLOAD_FLASH_ERROR;
+		gdb_cache_invalidate();
+	}
+	platform_target_unlock();
+
+	if (status == FLASH_UPLOAD_OK)
+		ESP_LOGI(TAG, "Programmed %u bytes at 0x%08" PRIx32 " in %" PRIu32 " ms", (unsigned)*written, addr,
+			platform_time_ms() - start);
+	else
+		ESP_LOGW(TAG, "Upload to 0x%08" PRIx32 " failed after %u bytes: %s", addr, (unsigned)*written,
+			flash_upload_status_string(status));
+	return status;
+}
+
+const char *flash_upload_status_string(const flash_upload_status_e status)
+{
+	switch (status) {
+	case FLASH_UPLOAD_OK:
+		return "OK";
+	case FLASH_UPLOAD_NO_TARGET:
+		return "No halted target, attach to one with GDB first";
+	case FLASH_UPLOAD_NO_MEMORY:
+		return "Not enough memory for a 64 KiB block";
+	case FLASH_UPLOAD_BAD_FORMAT:
+		return "Not an LZ4 frame with independent 64 KiB blocks, compress with lz4 -B4";
+	case FLASH_UPLOAD_READ_ERROR:
+		return "Upload incomplete";
+	case FLASH_UPLOAD_FLASH_ERROR:
+		return "Erasing or programming the flash failed";
+	default:
+		return "Unknown error";
+	}
+}
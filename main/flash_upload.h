@@ -0,0 +1,35 @@
+/*
+ * Compressed firmware upload for the ESP32 probe
+ *
+ * A load through GDB sends the image as it will sit in flash, so a build
+ * that is mostly padding and erased space still crosses the network at its
+ * full size. Here the web server takes an image compressed with the lz4
+ * tool, and it is decompressed on the probe a frame block at a time as it
+ * arrives and programmed into the current GDB target.
+ */
+
+#ifndef __FLASH_UPLOAD_H
+#define __FLASH_UPLOAD_H
+
+#include "target.h"
+
+/* Frame block size the image has to be compressed with (lz4 -B4) */
+#define FLASH_UPLOAD_BLOCK_SIZE 65536U
+
+typedef enum flash_upload_status {
+	FLASH_UPLOAD_OK,
+	FLASH_UPLOAD_NO_TARGET,   /* No target attached, or it is running */
+	FLASH_UPLOAD_NO_MEMORY,   /* No room for the decompressed block */
+	FLASH_UPLOAD_BAD_FORMAT,  /* Not an LZ4 frame, or one that can't be taken a block at a time */
+	FLASH_UPLOAD_READ_ERROR,  /* The upload stopped part way */
+	FLASH_UPLOAD_FLASH_ERROR, /* Erasing or programming the target failed */
+} flash_upload_status_e;
+
+/* Source of the compressed image, returns the bytes read, 0 at the end or -1 on error */
+typedef int (*flash_upload_read_f)(void *ctx, void *data, size_t len);
+
+/* Erase and program the image read from read() at addr, *written is set to the bytes programmed */
+flash_upload_status_e flash_upload_lz4(target_addr32_t addr, flash_upload_read_f read, void *ctx, size_t *written);
+const char *flash_upload_status_string(flash_upload_status_e status);
+
+#endif /* __FLASH_UPLOAD_H */
@@ -0,0 +1,493 @@
+/*
+ * Target side breakpoint conditions for the ESP32 GDB server
+ *
+ * The interpreter implements the agent expression bytecode described in
+ * the "Agent Expressions" appendix of the GDB manual (opcodes from GDB's
+ * ax.def). Values are 64 bits wide, operands in the bytecode are big
+ * endian, and memory read with the ref opcodes is taken to be little
+ * endian like every target we support. Floating point, trace state
+ * variables and printf aren't supported; GDB doesn't use them in
+ * breakpoint conditions.
+ *
+ * A breakpoint can carry several conditions (one per location GDB merged
+ * into it), the hit is reported if any of them is true. As gdbserver does,
+ * a condition that fails to evaluate counts as true so a broken condition
+ * shows up as a stop rather than silently never triggering.
+ */
+
+#include "general.h"
+#include "ctype.h"
+#include "hex_utils.h"
+#include "target_internal.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+#include "gdb_ax.h"
+
+typedef enum gdb_ax_opcode {
+	AX_FLOAT = 0x01U,
+	AX_ADD = 0x02U,
+	AX_SUB = 0x03U,
+	AX_MUL = 0x04U,
+	AX_DIV_SIGNED = 0x05U,
+	AX_DIV_UNSIGNED = 0x06U,
+	AX_REM_SIGNED = 0x07U,
+	AX_REM_UNSIGNED = 0x08U,
+	AX_LSH = 0x09U,
+	AX_RSH_SIGNED = 0x0aU,
+	AX_RSH_UNSIGNED = 0x0bU,
+	AX_TRACE = 0x0cU,
+	AX_TRACE_QUICK = 0x0dU,
+	AX_LOG_NOT = 0x0eU,
+	AX_BIT_AND = 0x0fU,
+	AX_BIT_OR = 0x10U,
+	AX_BIT_XOR = 0x11U,
+	AX_BIT_NOT = 0x12U,
+	AX_EQUAL = 0x13U,
+	AX_LESS_SIGNED = 0x14U,
+	AX_LESS_UNSIGNED = 0x15U,
+	AX_EXT = 0x16U,
+	AX_REF8 = 0x17U,
+	AX_REF16 = 0x18U,
+	AX_REF32 = 0x19U,
+	AX_REF64 = 0x1aU,
+	AX_IF_GOTO = 0x20U,
+	AX_GOTO = 0x21U,
+	AX_CONST8 = 0x22U,
+	AX_CONST16 = 0x23U,
+	AX_CONST32 = 0x24U,
+	AX_CONST64 = 0x25U,
+	AX_REG = 0x26U,
+	AX_END = 0x27U,
+	AX_DUP = 0x28U,
+	AX_POP = 0x29U,
+	AX_ZERO_EXT = 0x2aU,
+	AX_SWAP = 0x2bU,
+	AX_TRACEV = 0x2eU,
+	AX_TRACENZ = 0x2fU,
+	AX_TRACE16 = 0x30U,
+	AX_PICK = 0x32U,
+	AX_ROT = 0x33U,
+} gdb_ax_opcode_e;
+
+static gdb_ax_breakpoint_s ax_breakpoints[GDB_AX_BP_COUNT];
+static gdb_ax_stats_s ax_stats;
+
+/* Fetch a big endian operand of width bytes following the opcode */
+static bool gdb_ax_operand(const uint8_t *const code, const size_t len, size_t *const pc, const size_t width,
+	uint64_t *const value)
+{
+	if (len - *pc < width)
+		return false;
+	*value = 0;
+	for (size_t i = 0; i < width; ++i)
+		*value = (*value << 8U) | code[(*pc)++];
+	return true;
+}
+
+gdb_ax_status_e gdb_ax_eval(
+	const uint8_t *const code, const size_t len, const gdb_ax_access_s *const access, uint64_t *const result)
+{
+	uint64_t stack[GDB_AX_STACK_SIZE];
+	size_t sp = 0;
+	size_t pc = 0;
+
+/* Number of items the current opcode consumes and produces, checked before it runs */
+#define AX_NEED(pops, pushes)                                           \
+	do {                                                                \
+		if (sp < (pops) || sp - (pops) + (pushes) > GDB_AX_STACK_SIZE) \
+			return GDB_AX_ERROR_STACK;                                  \
+	} while (0)
+#define AX_TOP  stack[sp - 1U]
+#define AX_NEXT stack[sp - 2U]
+
+	for (size_t steps = 0; pc < len; ++steps) {
+		if (steps == GDB_AX_MAX_STEPS)
+			return GDB_AX_ERROR_LIMIT;
+
+		const uint8_t opcode = code[pc++];
+		uint64_t operand = 0;
+		switch (opcode) {
+		case AX_ADD:
+			AX_NEED(2U, 1U);
+			AX_NEXT += AX_TOP;
+			--sp;
+			break;
+		case AX_SUB:
+			AX_NEED(2U, 1U);
+			AX_NEXT -= AX_TOP;
+			--sp;
+			break;
+		case AX_MUL:
+			AX_NEED(2U, 1U);
+			AX_NEXT *= AX_TOP;
+			--sp;
+			break;
+		case AX_DIV_SIGNED:
+		case AX_REM_SIGNED: {
+			AX_NEED(2U, 1U);
+			const int64_t dividend = (int64_t)AX_NEXT;
+			const int64_t divisor = (int64_t)AX_TOP;
+			if (!divisor)
+				return GDB_AX_ERROR_DIVIDE;
+			/* INT64_MIN / -1 overflows, the wrapped result is what the target would compute */
+			if (divisor == -1)
+				AX_NEXT = opcode == AX_DIV_SIGNED ? 0U - (uint64_t)dividend : 0U;
+			else
+				AX_NEXT = (uint64_t)(opcode == AX_DIV_SIGNED ? dividend / divisor : dividend % divisor);
+			--sp;
+			break;
+		}
+		case AX_DIV_UNSIGNED:
+		case AX_REM_UNSIGNED:
+			AX_NEED(2U, 1U);
+			if (!AX_TOP)
+				return GDB_AX_ERROR_DIVIDE;
+			AX_NEXT = opcode == AX_DIV_UNSIGNED ? AX_NEXT / AX_TOP : AX_NEXT % AX_TOP;
+			--sp;
+			break;
+		case AX_LSH:
+			AX_NEED(2U, 1U);
+			AX_NEXT = AX_TOP < 64U ? AX_NEXT << AX_TOP : 0U;
+			--sp;
+			break;
+		case AX_RSH_SIGNED: {
+			AX_NEED(2U, 1U);
+			const uint64_t shift = AX_TOP < 64U ? AX_TOP : 63U;
+			const uint64_t fill = (AX_NEXT >> 63U) && shift ? ~(UINT64_MAX >> shift) : 0U;
+			AX_NEXT = (AX_NEXT >> shift) | fill;
+			--sp;
+			break;
+		}
+		case AX_RSH_UNSIGNED:
+			AX_NEED(2U, 1U);
+			AX_NEXT = AX_TOP < 64U ? AX_NEXT >> AX_TOP : 0U;
+			--sp;
+			break;
+		case AX_LOG_NOT:
+			AX_NEED(1U, 1U);
+			AX_TOP = !AX_TOP;
+			break;
+		case AX_BIT_AND:
+			AX_NEED(2U, 1U);
+			AX_NEXT &= AX_TOP;
+			--sp;
+			break;
+		case AX_BIT_OR:
+			AX_NEED(2U, 1U);
+			AX_NEXT |= AX_TOP;
+			--sp;
+			break;
+		case AX_BIT_XOR:
+			AX_NEED(2U, 1U);
+			AX_NEXT ^= AX_TOP;
+			--sp;
+			break;
+		case AX_BIT_NOT:
+			AX_NEED(1U, 1U);
+			AX_TOP = ~AX_TOP;
+			break;
+		case AX_EQUAL:
+			AX_NEED(2U, 1U);
+			AX_NEXT = AX_NEXT == AX_TOP;
+			--sp;
+			break;
+		case AX_LESS_SIGNED:
+			AX_NEED(2U, 1U);
+			AX_NEXT = (int64_t)AX_NEXT < (int64_t)AX_TOP;
+			--sp;
+			break;
+		case AX_LESS_UNSIGNED:
+			AX_NEED(2U, 1U);
+			AX_NEXT = AX_NEXT < AX_TOP;
+			--sp;
+			break;
+		case AX_EXT:
+		case AX_ZERO_EXT:
+			/* Sign or zero extend the top of the stack from the given number of bits */
+			if (!gdb_ax_operand(code, len, &pc, 1U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			AX_NEED(1U, 1U);
+			if (operand && operand < 64U) {
+				const uint64_t mask = UINT64_MAX >> (64U - operand);
+				if (opcode == AX_EXT && (AX_TOP >> (operand - 1U)) & 1U)
+					AX_TOP |= ~mask;
+				else
+					AX_TOP &= mask;
+			}
+			break;
+		case AX_REF8:
+		case AX_REF16:
+		case AX_REF32:
+		case AX_REF64: {
+			AX_NEED(1U, 1U);
+			const size_t width = 1U << (opcode - AX_REF8);
+			uint8_t data[8];
+			if (!access || !access->mem_read || access->mem_read(access->priv, AX_TOP, data, width))
+				return GDB_AX_ERROR_MEMORY;
+			AX_TOP = 0;
+			for (size_t i = width; i > 0; --i)
+				AX_TOP = (AX_TOP << 8U) | data[i - 1U];
+			break;
+		}
+		case AX_IF_GOTO:
+		case AX_GOTO:
+			if (!gdb_ax_operand(code, len, &pc, 2U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			if (opcode == AX_IF_GOTO) {
+				AX_NEED(1U, 0U);
+				if (!stack[--sp])
+					break;
+			}
+			/* Jump targets are offsets from the start of the expression */
+			if (operand >= len)
+				return GDB_AX_ERROR_BOUNDS;
+			pc = operand;
+			break;
+		case AX_CONST8:
+		case AX_CONST16:
+		case AX_CONST32:
+		case AX_CONST64:
+			if (!gdb_ax_operand(code, len, &pc, 1U << (opcode - AX_CONST8), &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			if (sp == GDB_AX_STACK_SIZE)
+				return GDB_AX_ERROR_STACK;
+			stack[sp++] = operand;
+			break;
+		case AX_REG:
+			if (!gdb_ax_operand(code, len, &pc, 2U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			if (sp == GDB_AX_STACK_SIZE)
+				return GDB_AX_ERROR_STACK;
+			if (!access || !access->reg_read || access->reg_read(access->priv, operand, &stack[sp]))
+				return GDB_AX_ERROR_REGISTER;
+			++sp;
+			break;
+		case AX_END:
+			AX_NEED(1U, 1U);
+			*result = AX_TOP;
+			return GDB_AX_OK;
+		case AX_DUP:
+			AX_NEED(1U, 2U);
+			stack[sp] = AX_TOP;
+			++sp;
+			break;
+		case AX_POP:
+			AX_NEED(1U, 0U);
+			--sp;
+			break;
+		case AX_SWAP: {
+			AX_NEED(2U, 2U);
+			const uint64_t top = AX_TOP;
+			AX_TOP = AX_NEXT;
+			AX_NEXT = top;
+			break;
+		}
+		case AX_PICK:
+			/* Push a copy of the item operand places below the top (0 duplicates the top) */
+			if (!gdb_ax_operand(code, len, &pc, 1U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			AX_NEED(operand + 1U, operand + 2U);
+			stack[sp] = stack[sp - 1U - operand];
+			++sp;
+			break;
+		case AX_ROT: {
+			/* a b c => c a b */
+			AX_NEED(3U, 3U);
+			const uint64_t top = AX_TOP;
+			AX_TOP = AX_NEXT;
+			AX_NEXT = stack[sp - 3U];
+			stack[sp - 3U] = top;
+			break;
+		}
+		/* Tracepoint collection has nothing to do in a condition, only keep the stack right */
+		case AX_TRACE:
+		case AX_TRACENZ:
+			AX_NEED(2U, 0U);
+			sp -= 2U;
+			break;
+		case AX_TRACE_QUICK:
+			if (!gdb_ax_operand(code, len, &pc, 1U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			break;
+		case AX_TRACEV:
+		case AX_TRACE16:
+			if (!gdb_ax_operand(code, len, &pc, 2U, &operand))
+				return GDB_AX_ERROR_BOUNDS;
+			break;
+		default:
+			return GDB_AX_ERROR_OPCODE;
+		}
+	}
+
+#undef AX_NEED
+#undef AX_TOP
+#undef AX_NEXT
+
+	/* Ran off the end without an end opcode */
+	return GDB_AX_ERROR_BOUNDS;
+}
+
+static gdb_ax_breakpoint_s *gdb_ax_bp_lookup(const uint32_t type, const target_addr32_t addr, const uint32_t kind)
+{
+	for (size_t i = 0; i < GDB_AX_BP_COUNT; ++i) {
+		gdb_ax_breakpoint_s *const breakpoint = &ax_breakpoints[i];
+		if (breakpoint->used && breakpoint->type == type && breakpoint->addr == addr && breakpoint->kind == kind)
+			return breakpoint;
+	}
+	return NULL;
+}
+
+/*
+ * Parse a condition list, "X len,bytes" repeated with no separator, into
+ * length prefixed bytecode. Anything after a ';' (breakpoint commands) is ignored.
+ */
+static bool gdb_ax_parse_conditions(const char *conditions, uint8_t *const code, uint16_t *const code_len,
+	uint8_t *const cond_count)
+{
+	size_t offset = 0;
+	size_t count = 0;
+	while (*conditions == 'X') {
+		char *end = NULL;
+		const unsigned long len = strtoul(conditions + 1U, &end, 16);
+		if (end == conditions + 1U || *end != ',' || !len || count == UINT8_MAX ||
+			len + 2U > GDB_AX_BP_CODE_SIZE - offset)
+			return false;
+		conditions = end + 1U;
+
+		code[offset++] = (uint8_t)(len >> 8U);
+		code[offset++] = (uint8_t)len;
+		for (size_t i = 0; i < len; ++i, conditions += 2U) {
+			if (!isxdigit((unsigned char)conditions[0]) || !isxdigit((unsigned char)conditions[1]))
+				return false;
+			code[offset++] = (unhex_digit(conditions[0]) << 4U) | unhex_digit(conditions[1]);
+		}
+		++count;
+	}
+	if (*conditions != '\0' && *conditions != ';')
+		return false;
+
+	*code_len = (uint16_t)offset;
+	*cond_count = (uint8_t)count;
+	return true;
+}
+
+bool gdb_ax_bp_inserted(const target_s *const target, const uint32_t type, const target_addr32_t addr,
+	const uint32_t kind)
+{
+	for (const breakwatch_s *breakwatch = target->bw_list; breakwatch; breakwatch = breakwatch->next) {
+		if (breakwatch->type == type && breakwatch->addr == addr && breakwatch->size == kind)
+			return true;
+	}
+	return false;
+}
+
+bool gdb_ax_bp_set(const uint32_t type, const target_addr32_t addr, const uint32_t kind, const char *const conditions)
+{
+	uint16_t code_len = 0;
+	uint8_t cond_count = 0;
+	uint8_t code[GDB_AX_BP_CODE_SIZE];
+	if (conditions && !gdb_ax_parse_conditions(conditions, code, &code_len, &cond_count))
+		return false;
+
+	gdb_ax_breakpoint_s *breakpoint = gdb_ax_bp_lookup(type, addr, kind);
+	if (!cond_count) {
+		/* Unconditional, so nothing to keep */
+		if (breakpoint)
+			breakpoint->used = false;
+		return true;
+	}
+	for (size_t i = 0; i < GDB_AX_BP_COUNT && !breakpoint; ++i) {
+		if (!ax_breakpoints[i].used)
+			breakpoint = &ax_breakpoints[i];
+	}
+	if (!breakpoint)
+		return false;
+
+	breakpoint->used = true;
+	breakpoint->type = (uint8_t)type;
+	breakpoint->kind = kind;
+	breakpoint->addr = addr;
+	breakpoint->cond_count = cond_count;
+	breakpoint->code_len = code_len;
+	memcpy(breakpoint->code, code, code_len);
+	return true;
+}
+
+void gdb_ax_bp_clear(const uint32_t type, const target_addr32_t addr, const uint32_t kind)
+{
+	gdb_ax_breakpoint_s *const breakpoint = gdb_ax_bp_lookup(type, addr, kind);
+	if (breakpoint)
+		breakpoint->used = false;
+}
+
+void gdb_ax_bp_clear_all(void)
+{
+	for (size_t i = 0; i < GDB_AX_BP_COUNT; ++i)
+		ax_breakpoints[i].used = false;
+}
+
+const gdb_ax_breakpoint_s *gdb_ax_bp_find(const target_addr32_t addr)
+{
+	for (size_t i = 0; i < GDB_AX_BP_COUNT; ++i) {
+		const gdb_ax_breakpoint_s *const breakpoint = &ax_breakpoints[i];
+		if (breakpoint->used && breakpoint->addr == addr)
+			return breakpoint;
+	}
+	return NULL;
+}
+
+static bool gdb_ax_target_mem_read(void *const priv, const uint64_t addr, void *const dest, const size_t len)
+{
+	if (addr > UINT32_MAX - len + 1U)
+		return true;
+	return target_mem32_read((target_s *)priv, dest, (target_addr_t)addr, len);
+}
+
+static bool gdb_ax_target_reg_read(void *const priv, const uint32_t reg, uint64_t *const value)
+{
+	uint8_t data[8] = {0};
+	const size_t size = gdb_cache_reg_read((target_s *)priv, reg, data, sizeof(data));
+	if (!size)
+		return true;
+	*value = 0;
+	for (size_t i = size; i > 0; --i)
+		*value = (*value << 8U) | data[i - 1U];
+	return false;
+}
+
+bool gdb_ax_bp_condition(target_s *const target, const gdb_ax_breakpoint_s *const breakpoint)
+{
+	const gdb_ax_access_s access = {
+		.mem_read = gdb_ax_target_mem_read,
+		.reg_read = gdb_ax_target_reg_read,
+		.priv = target,
+	};
+
+	++ax_stats.evaluations;
+	for (size_t offset = 0; offset + 2U <= breakpoint->code_len;) {
+		const size_t len = ((size_t)breakpoint->code[offset] << 8U) | breakpoint->code[offset + 1U];
+		offset += 2U;
+		uint64_t value = 0;
+		const gdb_ax_status_e status = gdb_ax_eval(breakpoint->code + offset, len, &access, &value);
+		offset += len;
+		if (status != GDB_AX_OK) {
+			DEBUG_GDB("Breakpoint condition at 0x%08" PRIx32 " failed: %u\n", breakpoint->addr, status);
+			++ax_stats.errors;
+			return true;
+		}
+		if (value)
+			return true;
+	}
+	++ax_stats.suppressed;
+	return false;
+}
+
+void gdb_ax_get_stats(gdb_ax_stats_s *const stats)
+{
+	*stats = ax_stats;
+}
+
+void gdb_ax_reset_stats(void)
+{
+	memset(&ax_stats, 0, sizeof(ax_stats));
+}
@@ -0,0 +1,80 @@
+/*
+ * Target side breakpoint conditions for the ESP32 GDB server
+ *
+ * With ConditionalBreakpoints+ advertised, GDB sends the condition of a
+ * breakpoint along with the Z packet as agent expression bytecode, and
+ * leaves it to the stub to only report the breakpoint when the condition
+ * holds. Evaluating it here saves a stop reply, the register and memory
+ * reads GDB needs for the condition, and a resume for every false hit.
+ */
+
+#ifndef __GDB_AX_H
+#define __GDB_AX_H
+
+#include "target.h"
+
+/* Evaluation limits: stack depth and instructions executed (bytecode can loop with goto) */
+#define GDB_AX_STACK_SIZE 32U
+#define GDB_AX_MAX_STEPS  1024U
+
+/* Conditional breakpoints tracked, and bytecode stored for the conditions of each */
+#define GDB_AX_BP_COUNT     16U
+#define GDB_AX_BP_CODE_SIZE 256U
+
+typedef enum gdb_ax_status {
+	GDB_AX_OK,
+	GDB_AX_ERROR_OPCODE,   /* Unknown opcode, or one only meaningful for tracepoints */
+	GDB_AX_ERROR_BOUNDS,   /* Operand past the end of the bytecode or jump outside it */
+	GDB_AX_ERROR_STACK,    /* Stack overflow or underflow */
+	GDB_AX_ERROR_DIVIDE,   /* Division by zero */
+	GDB_AX_ERROR_MEMORY,   /* Target memory read failed */
+	GDB_AX_ERROR_REGISTER, /* Target register read failed */
+	GDB_AX_ERROR_LIMIT,    /* GDB_AX_MAX_STEPS exceeded */
+} gdb_ax_status_e;
+
+/* Access to the target for the ref and reg opcodes, both return true on error */
+typedef struct gdb_ax_access {
+	bool (*mem_read)(void *priv, uint64_t addr, void *dest, size_t len);
+	bool (*reg_read)(void *priv, uint32_t reg, uint64_t *value);
+	void *priv;
+} gdb_ax_access_s;
+
+/* Run an agent expression, the value on top of the stack at the end opcode goes in result */
+gdb_ax_status_e gdb_ax_eval(const uint8_t *code, size_t len, const gdb_ax_access_s *access, uint64_t *result);
+
+typedef struct gdb_ax_breakpoint {
+	bool used;
+	uint8_t type;
+	uint8_t cond_count;
+	uint16_t code_len;
+	uint32_t kind;
+	target_addr32_t addr;
+	/* Conditions back to back, each prefixed by its length as two bytes big endian */
+	uint8_t code[GDB_AX_BP_CODE_SIZE];
+} gdb_ax_breakpoint_s;
+
+typedef struct gdb_ax_stats {
+	uint32_t evaluations; /* Breakpoint hits whose conditions were evaluated */
+	uint32_t suppressed;  /* Hits not reported because no condition held */
+	uint32_t errors;      /* Conditions that failed to evaluate, these report the hit */
+} gdb_ax_stats_s;
+
+/* Whether a Z0/Z1 breakpoint is already set on the target, in which case a new Z only updates its conditions */
+bool gdb_ax_bp_inserted(const target_s *target, uint32_t type, target_addr32_t addr, uint32_t kind);
+/*
+ * Set the conditions of an inserted breakpoint to those that followed the ';' in its Z packet
+ * (NULL for none). Only breakpoints with conditions take a slot, none frees it. Returns false
+ * if the conditions can't be parsed or there is no slot left for them.
+ */
+bool gdb_ax_bp_set(uint32_t type, target_addr32_t addr, uint32_t kind, const char *conditions);
+void gdb_ax_bp_clear(uint32_t type, target_addr32_t addr, uint32_t kind);
+void gdb_ax_bp_clear_all(void);
+/* The conditional breakpoint at addr, NULL if there is none */
+const gdb_ax_breakpoint_s *gdb_ax_bp_find(target_addr32_t addr);
+/* Evaluate the conditions of a breakpoint the target halted on, true if the stop is to be reported */
+bool gdb_ax_bp_condition(target_s *target, const gdb_ax_breakpoint_s *breakpoint);
+
+void gdb_ax_get_stats(gdb_ax_stats_s *stats);
+void gdb_ax_reset_stats(void);
+
+#endif /* __GDB_AX_H */
@@ -0,0 +1,320 @@
+/*
+ * Target memory and register caches for the ESP32 GDB server
+ *
+ * Page-granular, filled on demand: a small read fetches the whole page
+ * it falls in, so the neighbouring reads GDB issues next (stack frames,
+ * locals, structure members) are served without touching the target.
+ *
+ * Only pages that lie completely inside a RAM or flash region of the
+ * target memory map are cached. Everything else (peripherals, system
+ * control space, unmapped areas) is always read directly so reads with
+ * side effects still reach the target.
+ *
+ * The register snapshot holds the g packet register block, read with a
+ * single target_regs_read() the first time g or p is seen after a stop.
+ * p requests are served from it using the register layout described by
+ * the target description XML; registers outside the g block are read
+ * from the target as before. G and P write through to the target.
+ *
+ * The caches are only valid while the target is halted and nothing else
+ * writes to its memory. gdb_main.c drops them on every write, resume,
+ * step, reset, flash operation, monitor command and target change.
+ */
+
+#include "general.h"
+#include "target_internal.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+
+typedef struct gdb_cache_page {
+	target_addr_t base;
+	bool valid;
+	uint8_t data[GDB_CACHE_PAGE_SIZE];
+} gdb_cache_page_s;
+
+static gdb_cache_page_s cache_pages[GDB_CACHE_PAGE_COUNT];
+static size_t cache_victim = 0;
+static target_s *cache_target = NULL;
+static bool cache_enabled = true;
+static gdb_cache_stats_s cache_stats;
+
+/* Where each register lives in the g packet block, size 0 if it doesn't */
+typedef struct gdb_cache_reg {
+	uint16_t offset;
+	uint8_t size;
+} gdb_cache_reg_s;
+
+static uint8_t reg_snapshot[GDB_CACHE_REGS_SIZE];
+static size_t reg_snapshot_size = 0;
+static bool reg_snapshot_valid = false;
+static target_s *reg_target = NULL;
+static gdb_cache_reg_s reg_map[GDB_CACHE_REG_MAP_SIZE];
+static uint32_t reg_pc = UINT32_MAX; /* Register number of "pc" in the target description */
+
+void gdb_cache_invalidate_memory(void)
+{
+	for (size_t i = 0; i < GDB_CACHE_PAGE_COUNT; ++i)
+		cache_pages[i].valid = false;
+	cache_victim = 0;
+	cache_target = NULL;
+}
+
+void gdb_cache_invalidate(void)
+{
+	gdb_cache_invalidate_memory();
+	reg_snapshot_valid = false;
+}
+
+void gdb_cache_release_target(void)
+{
+	gdb_cache_invalidate();
+	reg_target = NULL;
+}
+
+void gdb_cache_enable(const bool enable)
+{
+	cache_enabled = enable;
+	gdb_cache_invalidate();
+}
+
+bool gdb_cache_enabled(void)
+{
+	return cache_enabled;
+}
+
+void gdb_cache_get_stats(gdb_cache_stats_s *const stats)
+{
+	*stats = cache_stats;
+}
+
+void gdb_cache_reset_stats(void)
+{
+	memset(&cache_stats, 0, sizeof(cache_stats));
+}
+
+/* A page is cacheable if it lies completely inside one RAM or flash region */
+static bool gdb_cache_page_cacheable(const target_s *const target, const target_addr_t base)
+{
+	const target_addr_t end = base + GDB_CACHE_PAGE_SIZE;
+	if (end < base)
+		return false;
+
+	for (const target_ram_s *ram = target->ram; ram; ram = ram->next) {
+		if (base >= ram->start && end <= ram->start + ram->length)
+			return true;
+	}
+	for (const target_flash_s *flash = target->flash; flash; flash = flash->next) {
+		if (base >= flash->start && end <= flash->start + flash->length)
+			return true;
+	}
+	return false;
+}
+
+static gdb_cache_page_s *gdb_cache_lookup(const target_addr_t base)
+{
+	for (size_t i = 0; i < GDB_CACHE_PAGE_COUNT; ++i) {
+		if (cache_pages[i].valid && cache_pages[i].base == base)
+			return &cache_pages[i];
+	}
+	return NULL;
+}
+
+/* Fetch a page with a single full-page burst, replacing pages round robin */
+static gdb_cache_page_s *gdb_cache_fill(target_s *const target, const target_addr_t base)
+{
+	gdb_cache_page_s *const page = &cache_pages[cache_victim];
+	cache_victim = (cache_victim + 1U) % GDB_CACHE_PAGE_COUNT;
+
+	page->valid = false;
+	if (target_mem32_read(target, page->data, base, GDB_CACHE_PAGE_SIZE))
+		return NULL;
+	page->base = base;
+	page->valid = true;
+	return page;
+}
+
+bool gdb_cache_mem_read(target_s *const target, void *const dest, const target_addr_t src, const size_t len)
+{
+	/* Only a halted target's memory is stable enough to cache */
+	if (!cache_enabled || gdb_target_running) {
+		++cache_stats.bypass;
+		return target_mem32_read(target, dest, src, len);
+	}
+
+	/* The register snapshot is checked against reg_target on its own, so keep it */
+	if (target != cache_target) {
+		gdb_cache_invalidate_memory();
+		cache_target = target;
+	}
+
+	uint8_t *out = (uint8_t *)dest;
+	target_addr_t addr = src;
+	size_t remaining = len;
+	while (remaining) {
+		const target_addr_t base = addr & ~(target_addr_t)(GDB_CACHE_PAGE_SIZE - 1U);
+		const size_t offset = addr - base;
+		const size_t chunk = MIN(remaining, GDB_CACHE_PAGE_SIZE - offset);
+
+		if (!gdb_cache_page_cacheable(target, base)) {
+			++cache_stats.bypass;
+			if (target_mem32_read(target, out, addr, chunk))
+				return true;
+		} else {
+			const gdb_cache_page_s *page = gdb_cache_lookup(base);
+			if (page)
+				++cache_stats.hits;
+			else {
+				++cache_stats.misses;
+				page = gdb_cache_fill(target, base);
+			}
+			if (page)
+				memcpy(out, page->data + offset, chunk);
+			/* The full page couldn't be read, try just what was asked for */
+			else if (target_mem32_read(target, out, addr, chunk))
+				return true;
+		}
+
+		out += chunk;
+		addr += chunk;
+		remaining -= chunk;
+	}
+	return false;
+}
+
+/* Parse a numeric XML attribute of the element between start and end */
+static bool gdb_cache_xml_attr(const char *const start, const char *const end, const char *const name, uint32_t *const value)
+{
+	const size_t name_len = strlen(name);
+	for (const char *attr = start; attr + name_len + 2U < end; ++attr) {
+		if (attr[-1] != ' ' || strncmp(attr, name, name_len) != 0 || attr[name_len] != '=' || attr[name_len + 1U] != '"')
+			continue;
+		*value = strtoul(attr + name_len + 2U, NULL, 0);
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Work out where each register sits in the g packet block. GDB lays the
+ * block out as the described registers in register number order, so walk
+ * the description accumulating sizes until the block is full.
+ */
+static void gdb_cache_build_reg_map(target_s *const target, const size_t regs_size)
+{
+	memset(reg_map, 0, sizeof(reg_map));
+	reg_target = target;
+	reg_snapshot_size = regs_size;
+	reg_pc = UINT32_MAX;
+
+	const char *const description = target_regs_description(target);
+	if (!description)
+		return;
+
+	size_t offset = 0;
+	uint32_t next_regnum = 0;
+	bool in_block = true;
+	for (const char *reg = strstr(description, "<reg "); reg; reg = strstr(reg + 1U, "<reg ")) {
+		const char *const end = strchr(reg, '>');
+		uint32_t bitsize = 0;
+		if (!end || !gdb_cache_xml_attr(reg + 5U, end, "bitsize", &bitsize) || bitsize == 0 || bitsize % 8U)
+			break;
+		uint32_t regnum = next_regnum;
+		gdb_cache_xml_attr(reg + 5U, end, "regnum", &regnum);
+		const char *const pc_name = strstr(reg, " name=\"pc\"");
+		if (pc_name && pc_name < end)
+			reg_pc = regnum;
+
+		/* A gap in the numbering or a register past the end of the block ends the g layout */
+		const size_t size = bitsize / 8U;
+		if (regnum != next_regnum || offset + size > regs_size || regnum >= GDB_CACHE_REG_MAP_SIZE)
+			in_block = false;
+		if (in_block) {
+			reg_map[regnum].offset = (uint16_t)offset;
+			reg_map[regnum].size = (uint8_t)size;
+			offset += size;
+		}
+		next_regnum = regnum + 1U;
+	}
+	free((void *)description);
+}
+
+static void gdb_cache_update_reg_map(target_s *const target, const size_t regs_size)
+{
+	if (target != reg_target || regs_size != reg_snapshot_size) {
+		reg_snapshot_valid = false;
+		gdb_cache_build_reg_map(target, regs_size);
+	}
+}
+
+static bool gdb_cache_regs_fill(target_s *const target)
+{
+	const size_t regs_size = target_regs_size(target);
+	if (!cache_enabled || gdb_target_running || !regs_size || regs_size > sizeof(reg_snapshot))
+		return false;
+
+	gdb_cache_update_reg_map(target, regs_size);
+	if (reg_snapshot_valid) {
+		++cache_stats.reg_hits;
+		return true;
+	}
+
+	++cache_stats.reg_misses;
+	target_regs_read(target, reg_snapshot);
+	reg_snapshot_valid = true;
+	return true;
+}
+
+void gdb_cache_regs_read(target_s *const target, void *const data, const size_t size)
+{
+	if (size == target_regs_size(target) && gdb_cache_regs_fill(target))
+		memcpy(data, reg_snapshot, size);
+	else
+		target_regs_read(target, data);
+}
+
+size_t gdb_cache_reg_read(target_s *const target, const uint32_t reg, void *const data, const size_t max)
+{
+	if (reg < GDB_CACHE_REG_MAP_SIZE && gdb_cache_regs_fill(target)) {
+		const gdb_cache_reg_s *const entry = &reg_map[reg];
+		if (entry->size && entry->size <= max) {
+			memcpy(data, reg_snapshot + entry->offset, entry->size);
+			return entry->size;
+		}
+	}
+	return target_reg_read(target, reg, data, max);
+}
+
+void gdb_cache_regs_write(target_s *const target, const void *const data, const size_t size)
+{
+	target_regs_write(target, data);
+	if (target == reg_target && size == reg_snapshot_size && size <= sizeof(reg_snapshot)) {
+		memcpy(reg_snapshot, data, size);
+		reg_snapshot_valid = true;
+	} else
+		reg_snapshot_valid = false;
+}
+
+size_t gdb_cache_reg_write(target_s *const target, const uint32_t reg, const void *const data, const size_t size)
+{
+	const size_t written = target_reg_write(target, reg, data, size);
+	if (reg_snapshot_valid && target == reg_target && reg < GDB_CACHE_REG_MAP_SIZE && written &&
+		reg_map[reg].size == size)
+		memcpy(reg_snapshot + reg_map[reg].offset, data, size);
+	else
+		/* Not part of the snapshot, but writing it may still affect what is in it */
+		reg_snapshot_valid = false;
+	return written;
+}
+
+bool gdb_cache_read_pc(target_s *const target, uint32_t *const pc)
+{
+	gdb_cache_update_reg_map(target, target_regs_size(target));
+	if (reg_pc == UINT32_MAX)
+		return false;
+
+	if (reg_snapshot_valid && reg_pc < GDB_CACHE_REG_MAP_SIZE && reg_map[reg_pc].size == sizeof(*pc)) {
+		memcpy(pc, reg_snapshot + reg_map[reg_pc].offset, sizeof(*pc));
+		return true;
+	}
+	return target_reg_read(target, reg_pc, pc, sizeof(*pc)) == sizeof(*pc);
+}
@@ -0,0 +1,55 @@
+/*
+ * Target memory and register caches for the ESP32 GDB server
+ *
+ * While the target is halted GDB re-reads the same stack frames and
+ * variables many times, and asks for the registers with both g and p
+ * for every stop. This keeps recently read pages of target RAM and
+ * flash, and a snapshot of the register file, on the probe so those
+ * reads don't go over SWD/JTAG again.
+ */
+
+#ifndef __GDB_CACHE_H
+#define __GDB_CACHE_H
+
+#include "target.h"
+
+#define GDB_CACHE_PAGE_SIZE  256U
+#define GDB_CACHE_PAGE_COUNT 16U
+
+/* Largest g packet register block that is snapshotted, and register numbers mapped into it */
+#define GDB_CACHE_REGS_SIZE    512U
+#define GDB_CACHE_REG_MAP_SIZE 128U
+
+typedef struct gdb_cache_stats {
+	uint32_t hits;   /* Pages served from the cache */
+	uint32_t misses; /* Pages fetched from the target */
+	uint32_t bypass; /* Reads not eligible for caching */
+	uint32_t reg_hits;   /* g/p requests served from the register snapshot */
+	uint32_t reg_misses; /* Register snapshots read from the target */
+} gdb_cache_stats_s;
+
+/* Read target memory through the cache, returns true on error like target_mem32_read() */
+bool gdb_cache_mem_read(target_s *target, void *dest, target_addr_t src, size_t len);
+
+/* Read the g packet register block / a single register through the register snapshot */
+void gdb_cache_regs_read(target_s *target, void *data, size_t size);
+size_t gdb_cache_reg_read(target_s *target, uint32_t reg, void *data, size_t max);
+/* Write registers to the target, keeping the snapshot up to date */
+void gdb_cache_regs_write(target_s *target, const void *data, size_t size);
+size_t gdb_cache_reg_write(target_s *target, uint32_t reg, const void *data, size_t size);
+/* Read the program counter, located through the target description */
+bool gdb_cache_read_pc(target_s *target, uint32_t *pc);
+
+/* Drop everything cached, must be called whenever the target may have changed state */
+void gdb_cache_invalidate(void);
+/* Drop only cached memory, the register snapshot stays valid */
+void gdb_cache_invalidate_memory(void);
+/* Also forget the register layout learnt from the target description */
+void gdb_cache_release_target(void);
+
+void gdb_cache_enable(bool enable);
+bool gdb_cache_enabled(void);
+void gdb_cache_get_stats(gdb_cache_stats_s *stats);
+void gdb_cache_reset_stats(void);
+
+#endif /* __GDB_CACHE_H */
@@ -49,9 +49,28 @@ extern target_s *cur_target;
 
 static int gdb_if_serv, gdb_if_conn;
 
+/*
+ * Receive buffer: each recv() pulls whatever lwIP has queued for the
+ * connection and gdb_if_getchar() hands it out one character at a time.
+ */
+static uint8_t rx_buf[1536];
+static size_t rx_head = 0;
+static size_t rx_tail = 0;
+
+/* Receive statistics, reported by "mon gdb_stats" */
+static uint32_t rx_recv_calls = 0;
+static uint32_t rx_recv_bytes = 0;
+
+static inline void gdb_if_rx_reset(void)
+{
+	rx_head = 0;
+	rx_tail = 0;
+}
+
 void set_gdb_socket(int socket)
 {
 	gdb_if_conn=socket;
+	gdb_if_rx_reset();
 }
 
 void set_gdb_listen(int socket)
@@ -92,11 +111,25 @@ int gdb_if_init(void)
 }
 
 
+void gdb_if_rx_stats(uint32_t *calls, uint32_t *bytes)
+{
+	*calls = rx_recv_calls;
+	*bytes = rx_recv_bytes;
+}
+
+void gdb_if_rx_stats_reset(void)
+{
+	rx_recv_calls = 0;
+	rx_recv_bytes = 0;
+}
+
 char gdb_if_getchar(void)
 {
-	char ret;
 	int i = 0;
 
+	if (rx_head < rx_tail)
+		return (char)rx_buf[rx_head++];
+
 	while(i <= 0) {
 		if(gdb_if_conn <= 0) {
 			gdb_if_conn = accept(gdb_if_serv, NULL, NULL);
@@ -112,18 +145,24 @@ char gdb_if_getchar(void)
             gdb_poll_target();
 			*/
 		}
-		i = recv(gdb_if_conn, (void*)&ret, 1, 0);
+		i = recv(gdb_if_conn, (void*)rx_buf, sizeof(rx_buf), 0);
 		if(i <= 0) {
 			gdb_if_conn = -1;
+			gdb_if_rx_reset();
+			/*
+			 * Only noted here, this can run without the target lock. bmp_poll_loop()
+			 * lets go of the target once it has the lock back.
+			 */
 			DEBUG_INFO("Dropped broken connection\n");
-			// TODO!!! 
-			if (cur_target)
-				target_detach(cur_target);
 			/* Return '+' in case we were waiting for an ACK */
 			return '+';
 		}
 	}
-	return ret;
+	rx_recv_calls++;
+	rx_recv_bytes += (uint32_t)i;
+	rx_head = 1;
+	rx_tail = (size_t)i;
+	return (char)rx_buf[0];
 }
 
 char gdb_if_getchar_to(uint32_t timeout)
@@ -134,6 +173,10 @@ char gdb_if_getchar_to(uint32_t timeout)
 	if (gdb_if_conn == -1)
 		return (char)-1;
 
+	/* Data already pulled out of the socket doesn't need a select() */
+	if (rx_head < rx_tail)
+		return (char)rx_buf[rx_head++];
+
 	tv.tv_sec = timeout / 1000;
 	tv.tv_usec = (timeout % 1000) * 1000;
 
@@ -146,6 +189,40 @@ char gdb_if_getchar_to(uint32_t timeout)
 	return 0;
 }
 
+/*
+ * Block until there is GDB data to read or wake_fd (if not -1) becomes readable,
+ * for at most timeout ms, UINT32_MAX waits indefinitely. Returns true if there is
+ * data, or the connection has gone and the next read will find out.
+ */
+bool gdb_if_wait(uint32_t timeout, int wake_fd, bool *woken)
+{
+	fd_set fds;
+	struct timeval tv;
+
+	if (woken)
+		*woken = false;
+	if (gdb_if_conn <= 0 || rx_head < rx_tail)
+		return true;
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	FD_ZERO(&fds);
+	FD_SET(gdb_if_conn, &fds);
+	if (wake_fd >= 0)
+		FD_SET(wake_fd, &fds);
+
+	const int nfds = (wake_fd > gdb_if_conn ? wake_fd : gdb_if_conn) + 1;
+	const int ready = select(nfds, &fds, NULL, NULL, timeout == UINT32_MAX ? NULL : &tv);
+	if (ready < 0)
+		return true;
+	if (ready == 0)
+		return false;
+	if (woken && wake_fd >= 0)
+		*woken = FD_ISSET(wake_fd, &fds);
+	return FD_ISSET(gdb_if_conn, &fds);
+}
+
 static uint8_t buf[2048];
 static size_t bufsize = 0;
 
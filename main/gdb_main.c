@@ -31,11 +31,18 @@
 #include "gdb_if.h"
 #include "gdb_packet.h"
 #include "gdb_main.h"
+#include "gdb_cache.h"
+#include "gdb_ax.h"
+#include "profile.h"
+#include "flash_pipeline.h"
+#include "flash_delta.h"
 #include "target.h"
 #include "target_internal.h"
 #include "semihosting.h"
 #include "command.h"
-#include "crc32.h"
+#include "crc_stub.h"
+#include "swd_queue.h"
+#include "warm_scan.h"
 #include "morse.h"
 #ifdef ENABLE_RTT
 #include "rtt.h"
@@ -69,8 +76,6 @@ typedef enum gdb_signal {
 	GDB_SIGLOST = 29,
 } gdb_signal_e;
 
-#define GDB_MAX_PACKET_SIZE 1024U
-
 #define ERROR_IF_NO_TARGET()   \
 	if (!cur_target) {         \
 		gdb_putpacketz("EFF"); \
@@ -87,14 +92,56 @@ target_s *last_target;
 bool gdb_target_running = false;
 static bool gdb_needs_detach_notify = false;
 
+/*
+ * Range stepping (vCont;r): keep single stepping on the probe while the PC stays
+ * inside [start, end) and only report a stop to GDB once it leaves the range.
+ */
+typedef struct gdb_range_step {
+	bool active;
+	target_addr32_t start;
+	target_addr32_t end;
+} gdb_range_step_s;
+
+static gdb_range_step_s range_step;
+static uint32_t range_step_ranges = 0;
+static uint32_t range_step_steps = 0;
+
+/*
+ * Conditional breakpoints: when none of the conditions of the breakpoint the target
+ * halted on hold, the probe steps over it with the breakpoint removed, puts it back
+ * and resumes, all without involving GDB.
+ */
+typedef struct gdb_bp_step_over {
+	bool active;
+	uint32_t type;
+	target_addr32_t addr;
+	uint32_t kind;
+} gdb_bp_step_over_s;
+
+static gdb_bp_step_over_s bp_step_over;
+
+/* GDB asked for the target to be halted, the probe must not resume it on its own any more */
+static bool gdb_halt_requested = false;
+
+/* Flash load (vFlashErase .. vFlashDone) throughput, reported by "mon gdb_stats" */
+static bool flash_load_active = false;
+static uint32_t flash_load_start = 0;
+static uint32_t flash_load_bytes = 0;
+static uint32_t flash_load_time = 0;
+/* Whether the load in progress skips blocks that are already up to date */
+static bool flash_load_delta = false;
+
 static void handle_q_packet(char *packet, size_t len);
 static void handle_v_packet(char *packet, size_t len);
 static void handle_z_packet(char *packet, size_t len);
 static void handle_kill_target(void);
+static void handle_vcont_packet(const char *packet);
 
 static void gdb_target_destroy_callback(target_controller_s *tc, target_s *t)
 {
 	(void)tc;
+	gdb_cache_release_target();
+	gdb_ax_bp_clear_all();
 	if (cur_target == t) {
 		gdb_put_notificationz("%Stop:W00");
 		gdb_out("You are now detached from the previous target.\n");
@@ -123,6 +170,10 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 {
 	bool single_step = false;
 
+	/* Blocks still queued for the flash writer must land before anything else touches the target */
+	if (strncmp(pbuf, "vFlashWrite:", 12U) != 0)
+		flash_pipeline_wait();
+
 	/* GDB protocol main loop */
 	switch (pbuf[0]) {
 	/* Implementation of these is mandatory! */
@@ -131,7 +182,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 		const size_t reg_size = target_regs_size(cur_target);
 		if (reg_size) {
 			uint8_t gp_regs[reg_size];
-			target_regs_read(cur_target, gp_regs);
+			gdb_cache_regs_read(cur_target, gp_regs, reg_size);
 			gdb_putpacket(hexify(pbuf, gp_regs, reg_size), reg_size * 2U);
 		} else {
 			gdb_putpacketz("00");
@@ -147,20 +198,42 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 		DEBUG_GDB("m packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
-		uint8_t mem[len];
-		if (target_mem32_read(cur_target, mem, addr, len))
+		/*
+		 * Read into the top half of the packet buffer and hexify in place:
+		 * each output pair lands at or before the byte it was made from.
+		 */
+		uint8_t *const mem = (uint8_t *)pbuf + len;
+		if (gdb_cache_mem_read(cur_target, mem, addr, len))
 			gdb_putpacketz("E01");
 		else
 			gdb_putpacket(hexify(pbuf, mem, len), len * 2U);
 		break;
 	}
+	case 'x': { /* 'x addr,len': Read len bytes from addr, reply in binary */
+		uint32_t addr, len;
+		ERROR_IF_NO_TARGET();
+		sscanf(pbuf, "x%" SCNx32 ",%" SCNx32, &addr, &len);
+		if (len > pbuf_size) {
+			gdb_putpacketz("E02");
+			break;
+		}
+		DEBUG_GDB("x packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
+		/* The request has been parsed, so the packet buffer can take the data */
+		if (gdb_cache_mem_read(cur_target, pbuf, addr, len))
+			gdb_putpacketz("E01");
+		else
+			/* The reply is escaped as needed on the way out by gdb_putpacket2() */
+			gdb_putpacket2("b", 1U, pbuf, len);
+		break;
+	}
 	case 'G': { /* 'G XX': Write general registers */
 		ERROR_IF_NO_TARGET();
+		gdb_cache_invalidate_memory();
 		const size_t reg_size = target_regs_size(cur_target);
 		if (reg_size) {
 			uint8_t gp_regs[reg_size];
 			unhexify(gp_regs, &pbuf[1], reg_size);
-			target_regs_write(cur_target, gp_regs);
+			gdb_cache_regs_write(cur_target, gp_regs, reg_size);
 		}
 		gdb_putpacketz("OK");
 		break;
@@ -176,7 +249,9 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 		DEBUG_GDB("M packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
-		uint8_t mem[len];
+		gdb_cache_invalidate();
+		/* Decode in place, the binary data is always behind the hex it came from */
+		uint8_t *const mem = (uint8_t *)pbuf;
 		unhexify(mem, pbuf + hex, len);
 		if (target_mem32_write(cur_target, addr, mem, len))
 			gdb_putpacketz("E01");
@@ -208,6 +283,9 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 
+		gdb_cache_invalidate();
+		range_step.active = false;
+		gdb_halt_requested = false;
 		target_halt_resume(cur_target, single_step);
 		SET_RUN_STATE(true);
 		single_step = false;
@@ -239,7 +317,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			uint32_t reg;
 			sscanf(pbuf, "p%" SCNx32, &reg);
 			uint8_t val[8];
-			size_t s = target_reg_read(cur_target, reg, val, sizeof(val));
+			size_t s = gdb_cache_reg_read(cur_target, reg, val, sizeof(val));
 			if (s > 0)
 				gdb_putpacket(hexify(pbuf, val, s), s * 2U);
 			else
@@ -251,6 +329,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 	}
 	case 'P': { /* Write single register */
 		ERROR_IF_NO_TARGET();
+		gdb_cache_invalidate_memory();
 		if (cur_target->reg_write) {
 			uint32_t reg;
 			int n;
@@ -258,7 +337,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			// TODO: FIXME, VLAs considered harmful.
 			uint8_t val[strlen(pbuf + n) / 2U];
 			unhexify(val, pbuf + n, sizeof(val));
-			if (target_reg_write(cur_target, reg, val, sizeof(val)) > 0)
+			if (gdb_cache_reg_write(cur_target, reg, val, sizeof(val)) > 0)
 				gdb_putpacketz("OK");
 			else
 				gdb_putpacketz("EFF");
@@ -269,6 +348,8 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 	}
 
 	case 'F': /* Semihosting call finished */
+		/* The semihosting call may well have written to target memory */
+		gdb_cache_invalidate();
 		if (in_syscall)
 			/* Trim off the 'F' before calling semihosting_reply so it doesn't have to skip it */
 			return semihosting_reply(tc, pbuf + 1);
@@ -293,6 +374,8 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 		if (shutdown_bmda)
 			return 0;
 #endif
+		gdb_cache_release_target();
+		gdb_ax_bp_clear_all();
 		if (cur_target) {
 			SET_RUN_STATE(true);
 			target_detach(cur_target);
@@ -310,10 +393,12 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 
 	case 'r': /* Reset the target system */
 	case 'R': /* Restart the target program */
+		gdb_cache_invalidate();
 		if (cur_target)
 			target_reset(cur_target);
 		else if (last_target) {
 			cur_target = target_attach(last_target, &gdb_controller);
+			swd_queue_attach(cur_target);
 			if (cur_target)
 				morse(NULL, false);
 			target_reset(cur_target);
@@ -330,6 +415,7 @@ int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t
 			break;
 		}
 		DEBUG_GDB("X packet: addr = %" PRIx32 ", len = %" PRIx32 "\n", addr, len);
+		gdb_cache_invalidate();
 		if (target_mem32_write(cur_target, addr, pbuf + bin, len))
 			gdb_putpacketz("E01");
 		else
@@ -384,7 +470,12 @@ static void exec_q_rcmd(const char *packet, const size_t length)
 	unhexify(data, packet, datalen);
 	data[datalen] = 0; /* add terminating null */
 
-	const int c = command_process(cur_target, data);
+	/* Monitor commands can do anything to the target, don't trust the cache afterwards */
+	gdb_cache_invalidate();
+
+	int c;
+	if (!warm_scan_command(cur_target, data, &c))
+		c = command_process(cur_target, data);
 	if (c < 0)
 		gdb_putpacketz("");
 	else if (c == 0)
@@ -431,9 +522,12 @@ static void exec_q_supported(const char *packet, const size_t length)
 	 * the previous session was terminated abruptly with NoAckMode enabled
 	 */
 	gdb_set_noackmode(false);
+	/* New session, restart the compression statistics */
+	gdb_packet_tx_stats_reset();
 
 	gdb_putpacket_f(
-		"PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+" GDB_QSUPPORTED_NOACKMODE, GDB_MAX_PACKET_SIZE);
+		"PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;binary-upload+;vContSupported+;"
+		"ConditionalBreakpoints+" GDB_QSUPPORTED_NOACKMODE, (unsigned)GDB_PACKET_BUFFER_SIZE);
 }
 
 static void exec_q_memory_map(const char *packet, const size_t length)
@@ -481,7 +575,7 @@ static void exec_q_crc(const char *packet, const size_t length)
 			return;
 		}
 		uint32_t crc;
-		if (!bmd_crc32(cur_target, &crc, addr, addr_length))
+		if (!crc_stub_crc32(cur_target, &crc, addr, addr_length))
 			gdb_putpacketz("E03");
 		else
 			gdb_putpacket_f("C%lx", crc);
@@ -544,6 +638,8 @@ static const cmd_executer_s q_commands[] = {
 
 static void handle_kill_target(void)
 {
+	gdb_cache_release_target();
+	gdb_ax_bp_clear_all();
 	if (cur_target) {
 		target_reset(cur_target);
 		target_detach(cur_target);
@@ -560,15 +656,54 @@ static void handle_q_packet(char *packet, const size_t length)
 	gdb_putpacket("", 0);
 }
 
+void gdb_flash_load_stats(uint32_t *const bytes, uint32_t *const time_ms)
+{
+	*bytes = flash_load_bytes;
+	*time_ms = flash_load_time;
+}
+
+static void flash_load_begin(void)
+{
+	if (flash_load_active)
+		return;
+	flash_load_active = true;
+	flash_load_delta = flash_delta_enabled();
+	if (flash_load_delta)
+		flash_delta_begin();
+	flash_load_start = platform_time_ms();
+	flash_load_bytes = 0;
+	flash_load_time = 0;
+}
+
+static void flash_load_end(void)
+{
+	if (!flash_load_active)
+		return;
+	flash_load_active = false;
+	flash_load_time = platform_time_ms() - flash_load_start;
+}
+
 static void handle_v_packet(char *packet, const size_t plen)
 {
 	uint32_t addr = 0;
 	uint32_t len = 0;
 	int bin;
 
+	/*
+	 * Everything here other than vStopped attaches, resets or programs the target,
+	 * so what's in the read cache can't be relied on afterwards.
+	 */
+	if (strcmp(packet, "vStopped") != 0)
+		gdb_cache_invalidate();
+	if (!strncmp(packet, "vAttach;", 8U)) {
+		gdb_cache_release_target();
+		gdb_ax_bp_clear_all();
+	}
+
 	if (sscanf(packet, "vAttach;%08" PRIx32, &addr) == 1) {
 		/* Attach to remote target processor */
 		cur_target = target_attach_n(addr, &gdb_controller);
+		swd_queue_attach(cur_target);
 		if (cur_target) {
 			morse(NULL, false);
 			/*
@@ -631,6 +766,7 @@ static void handle_v_packet(char *packet, const size_t plen)
 			gdb_putpacketz("T05");
 		} else if (last_target) {
 			cur_target = target_attach(last_target, &gdb_controller);
+			swd_queue_attach(cur_target);
 
 			/* If we were able to attach to the target again */
 			if (cur_target) {
@@ -651,10 +787,16 @@ static void handle_v_packet(char *packet, const size_t plen)
 			gdb_putpacketz("EFF");
 			return;
 		}
+		flash_load_begin();
 
-		if (target_flash_erase(cur_target, addr, len))
+		/* A queued write that failed is reported here if this follows it */
+		bool ok = flash_pipeline_flush();
+		if (ok)
+			ok = flash_load_delta ? flash_delta_erase(cur_target, addr, len) : target_flash_erase(cur_target, addr, len);
+		if (ok)
 			gdb_putpacketz("OK");
 		else {
+			flash_delta_abort();
 			target_flash_complete(cur_target);
 			gdb_putpacketz("EFF");
 		}
@@ -663,20 +805,50 @@ static void handle_v_packet(char *packet, const size_t plen)
 		/* Write Flash Memory */
 		const uint32_t count = plen - bin;
 		DEBUG_GDB("Flash Write %08" PRIX32 " %08" PRIX32 "\n", addr, count);
-		if (cur_target && target_flash_write(cur_target, addr, (void *)packet + bin, count))
+		flash_load_begin();
+		flash_load_bytes += count;
+		/*
+		 * With the pipeline the block is acknowledged once queued, a write that fails
+		 * is reported on the next vFlashWrite or at vFlashDone. Delta loads only
+		 * program the data once the erase block it is in is complete.
+		 */
+		bool ok = false;
+		if (cur_target) {
+			if (flash_load_delta)
+				ok = flash_delta_write(cur_target, addr, packet + bin, count);
+			else if (flash_pipeline_enabled())
+				ok = flash_pipeline_write(cur_target, addr, packet + bin, count);
+			else
+				ok = target_flash_write(cur_target, addr, (void *)packet + bin, count);
+		}
+		if (ok)
 			gdb_putpacketz("OK");
 		else {
+			flash_delta_abort();
 			target_flash_complete(cur_target);
 			gdb_putpacketz("EFF");
 		}
 
 	} else if (!strcmp(packet, "vFlashDone")) {
-		/* Commit flash operations. */
-		if (target_flash_complete(cur_target))
+		/* Commit flash operations, once everything staged or queued has been written */
+		bool written = !flash_load_delta || (cur_target && flash_delta_done(cur_target));
+		if (!written)
+			flash_delta_abort();
+		written = flash_pipeline_flush() && written;
+		const bool complete = target_flash_complete(cur_target);
+		flash_load_end();
+		if (written && complete)
 			gdb_putpacketz("OK");
 		else
 			gdb_putpacketz("EFF");
 
+	} else if (!strcmp(packet, "vCont?")) {
+		/* Continue, step and range step, with or without a signal (which we ignore) */
+		gdb_putpacketz("vCont;c;C;s;S;r");
+
+	} else if (!strncmp(packet, "vCont;", 6U)) {
+		handle_vcont_packet(packet + 6U);
+
 	} else if (!strcmp(packet, "vStopped")) {
 		if (gdb_needs_detach_notify) {
 			gdb_putpacketz("W00");
@@ -695,6 +867,104 @@ static void handle_v_packet(char *packet, const size_t plen)
 	}
 }
 
+void gdb_range_step_stats(uint32_t *const ranges, uint32_t *const steps)
+{
+	*ranges = range_step_ranges;
+	*steps = range_step_steps;
+}
+
+static void gdb_resume_target(const bool step)
+{
+	gdb_cache_invalidate();
+	gdb_halt_requested = false;
+	target_halt_resume(cur_target, step);
+	SET_RUN_STATE(true);
+	/* The stop reply is sent by gdb_poll_target() */
+	gdb_target_running = true;
+}
+
+/*
+ * 'vCont[;action[:thread-id]]...': Resume with per-thread actions. We only have the one
+ * thread, so the first action is the one that applies.
+ */
+static void handle_vcont_packet(const char *const packet)
+{
+	if (!cur_target) {
+		gdb_putpacketz("X1D");
+		return;
+	}
+
+	range_step.active = false;
+	switch (packet[0]) {
+	case 'c': /* 'c': Continue */
+	case 'C': /* 'C sig': Continue with signal */
+		gdb_resume_target(false);
+		break;
+	case 's': /* 's': Step */
+	case 'S': /* 'S sig': Step with signal */
+		gdb_resume_target(true);
+		break;
+	case 'r': { /* 'r start,end': Step while the PC is in [start, end) */
+		uint32_t start = 0;
+		uint32_t end = 0;
+		if (sscanf(packet, "r%" SCNx32 ",%" SCNx32, &start, &end) != 2) {
+			gdb_putpacketz("E01");
+			return;
+		}
+		range_step.active = start < end;
+		range_step.start = start;
+		range_step.end = end;
+		++range_step_ranges;
+		gdb_resume_target(true);
+		break;
+	}
+	default:
+		DEBUG_GDB("*** Unsupported vCont action: %s\n", packet);
+		gdb_putpacketz("E01");
+		break;
+	}
+}
+
+/*
+ * Called when a step finishes during range stepping. Returns true if the step
+ * was absorbed and the target has been stepped again.
+ */
+static bool gdb_range_step_continue(void)
+{
+	uint32_t pc = 0;
+	if (gdb_halt_requested || !gdb_cache_read_pc(cur_target, &pc) || pc < range_step.start ||
+		pc >= range_step.end)
+		return false;
+
+	++range_step_steps;
+	gdb_cache_invalidate();
+	target_halt_resume(cur_target, true);
+	return true;
+}
+
+/*
+ * Called when the target halts on a breakpoint. Returns true if the breakpoint has
+ * conditions, none of them hold, and the target is now stepping over it.
+ */
+static bool gdb_bp_step_over_start(void)
+{
+	uint32_t pc = 0;
+	if (!gdb_cache_read_pc(cur_target, &pc))
+		return false;
+	const gdb_ax_breakpoint_s *const breakpoint = gdb_ax_bp_find(pc);
+	if (!breakpoint || gdb_ax_bp_condition(cur_target, breakpoint))
+		return false;
+
+	bp_step_over.active = true;
+	bp_step_over.type = breakpoint->type;
+	bp_step_over.addr = breakpoint->addr;
+	bp_step_over.kind = breakpoint->kind;
+	gdb_cache_invalidate();
+	target_breakwatch_clear(cur_target, bp_step_over.type, bp_step_over.addr, bp_step_over.kind);
+	target_halt_resume(cur_target, true);
+	return true;
+}
+
 static void handle_z_packet(char *packet, const size_t plen)
 {
 	(void)plen;
@@ -703,12 +973,34 @@ static void handle_z_packet(char *packet, const size_t plen)
 	uint32_t len;
 	uint32_t addr;
 	sscanf(packet, "%*[zZ]%" PRIu32 ",%08" PRIx32 ",%" PRIu32, &type, &addr, &len);
+	/* Breakpoint conditions as agent expressions: 'Z type,addr,kind;X len,bytecode...' */
+	const char *const conditions = strchr(packet, ';');
+	const bool breakpoint = type == TARGET_BREAK_SOFT || type == TARGET_BREAK_HARD;
+
+	/* Software breakpoints are memory writes */
+	gdb_cache_invalidate();
+
+	/* GDB sends Z again for an inserted breakpoint when its conditions change */
+	if (packet[0] == 'Z' && breakpoint && gdb_ax_bp_inserted(cur_target, type, addr, len)) {
+		if (gdb_ax_bp_set(type, addr, len, conditions ? conditions + 1U : NULL))
+			gdb_putpacketz("OK");
+		else
+			gdb_putpacketz("E01");
+		return;
+	}
 
 	int ret = 0;
-	if (packet[0] == 'Z')
+	if (packet[0] == 'Z') {
 		ret = target_breakwatch_set(cur_target, type, addr, len);
-	else
+		if (ret == 0 && breakpoint && !gdb_ax_bp_set(type, addr, len, conditions ? conditions + 1U : NULL)) {
+			/* GDB relies on us for the condition, so don't leave an unconditional breakpoint behind */
+			target_breakwatch_clear(cur_target, type, addr, len);
+			ret = -1;
+		}
+	} else {
 		ret = target_breakwatch_clear(cur_target, type, addr, len);
+		gdb_ax_bp_clear(type, addr, len);
+	}
 
 	if (ret < 0)
 		gdb_putpacketz("E01");
@@ -726,9 +1018,11 @@ void gdb_main(char *pbuf, size_t pbuf_size, size_t size)
 /* halt target */
 void gdb_halt_target(void)
 {
-	if (cur_target)
+	if (cur_target) {
+		/* Don't let range stepping or breakpoint conditions swallow the interrupt */
+		gdb_halt_requested = true;
 		target_halt_request(cur_target);
-	else
+	} else
 		/* Report "target exited" if no target */
 		gdb_putpacketz("W00");
 }
@@ -742,14 +1036,40 @@ void gdb_poll_target(void)
 		return;
 	}
 
-	/* poll target */
+	/* poll target, the profiler may already have seen it stop */
 	target_addr64_t watch;
-	target_halt_reason_e reason = target_halt_poll(cur_target, &watch);
+	target_halt_reason_e reason = profile_halt_reason(&watch);
+	if (!reason)
+		reason = target_halt_poll(cur_target, &watch);
 	if (!reason)
 		return;
 
+	if (range_step.active) {
+		if (reason == TARGET_HALT_STEPPING && gdb_range_step_continue())
+			return;
+		if (gdb_halt_requested)
+			reason = TARGET_HALT_REQUEST;
+		range_step.active = false;
+	}
+
+	if (bp_step_over.active) {
+		/* Stepped off a breakpoint whose condition was false, put it back */
+		bp_step_over.active = false;
+		target_breakwatch_set(cur_target, bp_step_over.type, bp_step_over.addr, bp_step_over.kind);
+		if (reason == TARGET_HALT_STEPPING) {
+			if (!gdb_halt_requested) {
+				target_halt_resume(cur_target, false);
+				return;
+			}
+			reason = TARGET_HALT_REQUEST;
+		}
+	} else if (reason == TARGET_HALT_BREAKPOINT && !gdb_halt_requested && gdb_bp_step_over_start())
+		return;
+
 	/* switch polling off */
 	gdb_target_running = false;
+	gdb_halt_requested = false;
+	gdb_cache_invalidate();
 	SET_RUN_STATE(0);
 
 	/* Translate reason to GDB signal */
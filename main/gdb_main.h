@@ -23,14 +23,19 @@
 
 #include "target.h"
 
+#ifndef GDB_PACKET_BUFFER_SIZE
 #define GDB_PACKET_BUFFER_SIZE 1024U
+#endif
 
 extern bool gdb_target_running;
 extern target_s *cur_target;
 
 void gdb_poll_target(void);
+void gdb_halt_target(void);
 void gdb_main(char *pbuf, size_t pbuf_size, size_t size);
 int gdb_main_loop(target_controller_s *tc, char *pbuf, size_t pbuf_size, size_t size, bool in_syscall);
 char *gdb_packet_buffer();
+void gdb_flash_load_stats(uint32_t *bytes, uint32_t *time_ms);
+void gdb_range_step_stats(uint32_t *ranges, uint32_t *steps);
 
 #endif /* INCLUDE_GDB_MAIN_H */
@@ -30,6 +30,7 @@
 #include "remote.h"
 
 #include <stdarg.h>
+#include "esp_heap_caps.h"
 
 typedef enum packet_state {
 	PACKET_IDLE,
@@ -40,6 +41,8 @@ typedef enum packet_state {
 } packet_state_e;
 
 static bool noackmode = false;
+/* In gdb_getpacket_unlocked(), with the target lock dropped */
+static bool getpacket_unlocked = false;
 
 /* https://sourceware.org/gdb/onlinedocs/gdb/Packet-Acknowledgment.html */
 void gdb_set_noackmode(bool enable)
@@ -84,8 +87,16 @@ packet_state_e consume_remote_packet(char *const packet, const size_t size)
 
 			/* Null terminate packet */
 			packet[offset] = '\0';
-			/* Handle packet */
-			remote_packet_process(packet, offset);
+			/* Handle packet, with the target lock as everything else driving the target */
+			if (getpacket_unlocked) {
+				/* Cleared while locked so an exception out of here leaves the lock to the CATCH that gets it */
+				getpacket_unlocked = false;
+				platform_target_lock();
+				remote_packet_process(packet, offset);
+				platform_target_unlock();
+				getpacket_unlocked = true;
+			} else
+				remote_packet_process(packet, offset);
 
 			/* Restart packet capture */
 			packet[0] = '\0';
@@ -244,13 +255,98 @@ size_t gdb_getpacket(char *const packet, const size_t size)
 	}
 }
 
+void *gdb_packet_buffer_alloc(const size_t size)
+{
+	void *buffer = NULL;
+#ifdef CONFIG_BMP_GDB_PACKET_BUFFER_PSRAM
+	buffer = heap_caps_aligned_alloc(8U, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (buffer)
+		return buffer;
+#endif
+	buffer = heap_caps_aligned_alloc(8U, size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+	return buffer;
+}
+
+size_t gdb_getpacket_unlocked(char *const packet, const size_t size)
+{
+	platform_target_unlock();
+	getpacket_unlocked = true;
+	const size_t result = gdb_getpacket(packet, size);
+	getpacket_unlocked = false;
+	platform_target_lock();
+	return result;
+}
+
 gdb_packet_s *gdb_packet_receive(void)
 {
-	static gdb_packet_s packet;
+	/* Allocated on first use as it is sized by the (configurable) packet size */
+	static gdb_packet_s *packet = NULL;
+	if (!packet) {
+		packet = gdb_packet_buffer_alloc(sizeof(*packet));
+		if (!packet)
+			return NULL;
+	}
+
+	packet->notification = false;
+	packet->size = gdb_getpacket(packet->data, GDB_PACKET_BUFFER_SIZE);
+	return packet;
+}
+
+/*
+ * Run-length encoding as described in
+ * https://sourceware.org/gdb/onlinedocs/gdb/Overview.html#Binary-Data
+ *
+ * A character followed by '*' and a repeat count character means the
+ * character is repeated (count - 29) more times. The counts that would
+ * encode as '#' or '$' must not be used, and anything which has to be
+ * escaped is never run-length encoded.
+ */
+#define GDB_RLE_COUNT_OFFSET 29U
+#define GDB_RLE_MIN_REPEAT   3U
+#define GDB_RLE_MAX_REPEAT   (126U - GDB_RLE_COUNT_OFFSET)
 
-	packet.notification = false;
-	packet.size = gdb_getpacket(packet.data, GDB_PACKET_BUFFER_SIZE);
-	return &packet;
+typedef struct gdb_rle {
+	char value;
+	size_t count;
+	uint8_t csum;
+} gdb_rle_s;
+
+/* Outbound packet statistics for the current GDB session */
+static uint32_t tx_payload_bytes = 0;
+static uint32_t tx_encoded_bytes = 0;
+static uint32_t tx_heap_allocs = 0;
+
+/*
+ * Formatted packets and console output are built here rather than on the heap.
+ * Only output that doesn't fit falls back to vasprintf(), which is counted.
+ */
+#define GDB_FORMAT_BUFFER_SIZE 512U
+static char format_buffer[GDB_FORMAT_BUFFER_SIZE];
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void gdb_packet_tx_stats(uint32_t *payload, uint32_t *encoded)
+{
+	*payload = tx_payload_bytes;
+	*encoded = tx_encoded_bytes;
+}
+
+uint32_t gdb_packet_heap_allocs(void)
+{
+	return tx_heap_allocs;
+}
+
+void gdb_packet_tx_stats_reset(void)
+{
+	tx_payload_bytes = 0;
+	tx_encoded_bytes = 0;
+	tx_heap_allocs = 0;
+}
+
+static inline bool gdb_needs_escape(const char value)
+{
+	return value == GDB_PACKET_START || value == GDB_PACKET_END || value == GDB_PACKET_ESCAPE ||
+		value == GDB_PACKET_RUNLENGTH_START;
 }
 
 static void gdb_next_char(const char value, uint8_t *const csum)
@@ -259,85 +355,155 @@ static void gdb_next_char(const char value, uint8_t *const csum)
 		DEBUG_GDB("%c", value);
 	else
 		DEBUG_GDB("\\x%02X", (uint8_t)value);
-	if (value == GDB_PACKET_START || value == GDB_PACKET_END || value == GDB_PACKET_ESCAPE ||
-		value == GDB_PACKET_RUNLENGTH_START) {
+	if (gdb_needs_escape(value)) {
 		gdb_if_putchar(GDB_PACKET_ESCAPE, 0);
 		gdb_if_putchar((char)((uint8_t)value ^ GDB_PACKET_ESCAPE_XOR), 0);
 		*csum += GDB_PACKET_ESCAPE + ((uint8_t)value ^ GDB_PACKET_ESCAPE_XOR);
+		tx_encoded_bytes += 2U;
 	} else {
 		gdb_if_putchar(value, 0);
 		*csum += value;
+		++tx_encoded_bytes;
 	}
 }
 
-void gdb_putpacket2(const char *const packet1, const size_t size1, const char *const packet2, const size_t size2)
+static void gdb_rle_flush(gdb_rle_s *const rle)
 {
-	char xmit_csum[3];
-	size_t tries = 0;
+	size_t remaining = rle->count;
+	while (remaining) {
+		gdb_next_char(rle->value, &rle->csum);
+		--remaining;
+		/* Short runs are cheaper sent as they are */
+		if (remaining < GDB_RLE_MIN_REPEAT)
+			continue;
+
+		size_t repeat = MIN(remaining, GDB_RLE_MAX_REPEAT);
+		/* Repeat counts of 6 and 7 would be sent as '#' and '$' */
+		if (repeat == 6U || repeat == 7U)
+			repeat = 5U;
+		const char count = (char)(repeat + GDB_RLE_COUNT_OFFSET);
+		gdb_if_putchar(GDB_PACKET_RUNLENGTH_START, 0);
+		gdb_if_putchar(count, 0);
+		rle->csum += GDB_PACKET_RUNLENGTH_START + count;
+		tx_encoded_bytes += 2U;
+		remaining -= repeat;
+	}
+	rle->count = 0;
+}
 
-	do {
-		DEBUG_GDB("%s: ", __func__);
-		uint8_t csum = 0;
-		gdb_if_putchar(GDB_PACKET_START, 0);
-
-		for (size_t i = 0; i < size1; ++i)
-			gdb_next_char(packet1[i], &csum);
-		for (size_t i = 0; i < size2; ++i)
-			gdb_next_char(packet2[i], &csum);
-
-		gdb_if_putchar(GDB_PACKET_END, 0);
-		snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-		gdb_if_putchar(xmit_csum[0], 0);
-		gdb_if_putchar(xmit_csum[1], 1);
-		DEBUG_GDB("\n");
-	} while (!noackmode && gdb_if_getchar_to(2000) != GDB_PACKET_ACK && tries++ < 3U);
+static void gdb_rle_put(gdb_rle_s *const rle, const char value)
+{
+	++tx_payload_bytes;
+	if (rle->count && rle->value == value) {
+		++rle->count;
+		return;
+	}
+
+	gdb_rle_flush(rle);
+	if (gdb_needs_escape(value)) {
+		gdb_next_char(value, &rle->csum);
+		return;
+	}
+	rle->value = value;
+	rle->count = 1;
 }
 
-void gdb_putpacket(const char *const packet, const size_t size)
+/*
+ * Encode and send a packet made of packet1 followed by packet2. When hex2 is set
+ * packet2 is raw data which is hex encoded on the fly, so no hex copy is needed.
+ */
+static void gdb_packet_send(const char start, const char *const packet1, const size_t size1,
+	const char *const packet2, const size_t size2, const bool hex2)
 {
 	char xmit_csum[3];
+	gdb_rle_s rle = {0};
+
+	gdb_if_putchar(start, 0);
+	for (size_t i = 0; i < size1; ++i)
+		gdb_rle_put(&rle, packet1[i]);
+	for (size_t i = 0; i < size2; ++i) {
+		if (hex2) {
+			const uint8_t value = (uint8_t)packet2[i];
+			gdb_rle_put(&rle, hex_digits[value >> 4U]);
+			gdb_rle_put(&rle, hex_digits[value & 0xfU]);
+		} else
+			gdb_rle_put(&rle, packet2[i]);
+	}
+	gdb_rle_flush(&rle);
+
+	gdb_if_putchar(GDB_PACKET_END, 0);
+	snprintf(xmit_csum, sizeof(xmit_csum), "%02X", rle.csum);
+	gdb_if_putchar(xmit_csum[0], 0);
+	gdb_if_putchar(xmit_csum[1], 1);
+}
+
+static void gdb_putpacket_ack(const char *const packet1, const size_t size1, const char *const packet2,
+	const size_t size2, const bool hex2)
+{
 	size_t tries = 0;
 
 	do {
 		DEBUG_GDB("%s: ", __func__);
-		uint8_t csum = 0;
-		gdb_if_putchar(GDB_PACKET_START, 0);
-		for (size_t i = 0; i < size; ++i)
-			gdb_next_char(packet[i], &csum);
-		gdb_if_putchar(GDB_PACKET_END, 0);
-		snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-		gdb_if_putchar(xmit_csum[0], 0);
-		gdb_if_putchar(xmit_csum[1], 1);
+		gdb_packet_send(GDB_PACKET_START, packet1, size1, packet2, size2, hex2);
 		DEBUG_GDB("\n");
 	} while (!noackmode && gdb_if_getchar_to(2000) != GDB_PACKET_ACK && tries++ < 3U);
 }
 
-void gdb_put_notification(const char *const packet, const size_t size)
+void gdb_putpacket2(const char *const packet1, const size_t size1, const char *const packet2, const size_t size2)
 {
-	char xmit_csum[3];
+	gdb_putpacket_ack(packet1, size1, packet2, size2, false);
+}
 
+void gdb_putpacket(const char *const packet, const size_t size)
+{
+	gdb_putpacket_ack(packet, size, NULL, 0, false);
+}
+
+void gdb_put_notification(const char *const packet, const size_t size)
+{
 	DEBUG_GDB("%s: ", __func__);
-	uint8_t csum = 0;
-	gdb_if_putchar(GDB_PACKET_NOTIFICATION_START, 0);
-	for (size_t i = 0; i < size; ++i)
-		gdb_next_char(packet[i], &csum);
-	gdb_if_putchar(GDB_PACKET_END, 0);
-	snprintf(xmit_csum, sizeof(xmit_csum), "%02X", csum);
-	gdb_if_putchar(xmit_csum[0], 0);
-	gdb_if_putchar(xmit_csum[1], 1);
+	gdb_packet_send(GDB_PACKET_NOTIFICATION_START, packet, size, NULL, 0, false);
 	DEBUG_GDB("\n");
 }
 
+/*
+ * Format into format_buffer, or onto the heap if the result doesn't fit.
+ * Release the result with gdb_format_free().
+ */
+static int gdb_vformat(char **const result, const char *const fmt, va_list ap)
+{
+	va_list ap_copy;
+	va_copy(ap_copy, ap);
+	int size = vsnprintf(format_buffer, sizeof(format_buffer), fmt, ap_copy);
+	va_end(ap_copy);
+
+	*result = format_buffer;
+	if (size < 0 || (size_t)size < sizeof(format_buffer))
+		return size;
+
+	++tx_heap_allocs;
+	size = vasprintf(result, fmt, ap);
+	if (size < 0)
+		*result = NULL;
+	return size;
+}
+
+static void gdb_format_free(char *const buf)
+{
+	if (buf != format_buffer)
+		free(buf);
+}
+
 void gdb_putpacket_f(const char *const fmt, ...)
 {
 	va_list ap;
 	char *buf;
 
 	va_start(ap, fmt);
-	const int size = vasprintf(&buf, fmt, ap);
+	const int size = gdb_vformat(&buf, fmt, ap);
 	if (size > 0)
 		gdb_putpacket(buf, size);
-	free(buf);
+	gdb_format_free(buf);
 	va_end(ap);
 }
 
@@ -347,33 +513,35 @@ void gdb_putpacket_str_f(const char *const fmt, ...)
 	char *buf;
 
 	va_start(ap, fmt);
-	const int size = vasprintf(&buf, fmt, ap);
+	const int size = gdb_vformat(&buf, fmt, ap);
 	if (size > 0)
 		gdb_putpacket(buf, size);
-	free(buf);
+	gdb_format_free(buf);
 	va_end(ap);
 }
 
-void gdb_out(const char *const buf)
+void gdb_out_len(const char *const buf, const size_t len)
 {
-	const size_t buf_len = strlen(buf);
-	char *hexdata = calloc(1, 2U * buf_len + 1U);
-	if (!hexdata)
-		return;
+	/* Keep each console packet within the packet size we advertised */
+	const size_t chunk_max = GDB_PACKET_BUFFER_SIZE / 2U - 1U;
+	for (size_t offset = 0; offset < len; offset += chunk_max) {
+		const size_t chunk = MIN(len - offset, chunk_max);
+		gdb_putpacket_ack("O", 1U, buf + offset, chunk, true);
+	}
+}
 
-	hexify(hexdata, buf, buf_len);
-	gdb_putpacket2("O", 1, hexdata, 2U * buf_len);
-	free(hexdata);
+void gdb_out(const char *const buf)
+{
+	gdb_out_len(buf, strlen(buf));
 }
 
 void gdb_voutf(const char *const fmt, va_list ap)
 {
 	char *buf;
-	if (vasprintf(&buf, fmt, ap) < 0)
-		return;
-
-	gdb_out(buf);
-	free(buf);
+	const int size = gdb_vformat(&buf, fmt, ap);
+	if (size > 0)
+		gdb_out_len(buf, size);
+	gdb_format_free(buf);
 }
 
 void gdb_outf(const char *const fmt, ...)
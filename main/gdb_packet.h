@@ -24,6 +24,7 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 /* Allow override in other platforms if needed */
@@ -52,6 +53,12 @@ typedef struct gdb_packet {
 
 void gdb_set_noackmode(bool enable);
 size_t gdb_getpacket(char *packet, size_t size);
+/*
+ * gdb_getpacket() with the target lock, held on entry, dropped while waiting
+ * for the packet. It is taken back to run remote protocol packets, which
+ * drive the target, and is held again on return.
+ */
+size_t gdb_getpacket_unlocked(char *packet, size_t size);
 void gdb_putpacket(const char *packet, size_t size);
 void gdb_putpacket2(const char *packet1, size_t size1, const char *packet2, size_t size2);
 #define gdb_putpacketz(packet) gdb_putpacket((packet), strlen(packet))
@@ -60,9 +67,19 @@ void gdb_put_notification(const char *packet, size_t size);
 #define gdb_put_notificationz(packet) gdb_put_notification((packet), strlen(packet))
 
 void gdb_out(const char *buf);
+void gdb_out_len(const char *buf, size_t len);
 void gdb_voutf(const char *fmt, va_list);
 void gdb_outf(const char *fmt, ...);
 
+/* Allocate a packet-sized buffer, from PSRAM when configured to */
+void *gdb_packet_buffer_alloc(size_t size);
+
+/* Outbound payload vs. encoded (escaped and run-length encoded) byte counts */
+void gdb_packet_tx_stats(uint32_t *payload, uint32_t *encoded);
+void gdb_packet_tx_stats_reset(void);
+/* Number of times formatted output had to fall back to a heap allocation */
+uint32_t gdb_packet_heap_allocs(void);
+
 /* Functions needed by upstream semihosting */
 gdb_packet_s *gdb_packet_receive(void);
 void gdb_putpacket_str_f(const char *fmt, ...);
@@ -0,0 +1,154 @@
+/*
+ * Word-wide JTAG shifts for the ESP32 probe
+ *
+ * Each clock is three stores and, when TDO is wanted, a load: TCK falls in
+ * the same store that clears TDI (or TMS) for the next bit, another sets the
+ * bits that go high, then TCK rises and TDO is read, as jtagtap.c reads it.
+ * TDI is only ever changed with TCK low, so the target sees it settled well
+ * before the rising edge it samples on. The bits come from a 32 bit word, and
+ * the loop over a whole word is unrolled so every mask is a constant.
+ *
+ * With a delay set, each edge waits target_clk_divider turns of the same
+ * delay loop as jtagtap.c, so "mon frequency" still sets the clock. The delay
+ * then sets the pace, so that loop is left rolled up.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "jtagtap.h"
+#include "jtag_shift.h"
+
+#include <string.h>
+
+#define JTAG_SHIFT_TCK (1U << TCK_PIN)
+#define JTAG_SHIFT_TMS (1U << TMS_PIN)
+#define JTAG_SHIFT_TDI (1U << TDI_PIN)
+
+typedef void (*jtag_shift_tdi_tdo_seq_f)(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+typedef void (*jtag_shift_tdi_seq_f)(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+
+#ifdef CONFIG_BMP_JTAG_SHIFT
+static bool shift_enabled = true;
+#else
+static bool shift_enabled = false;
+#endif
+
+/* jtagtap.c's sequence functions, put back when this is disabled */
+static jtag_shift_tdi_tdo_seq_f bit_tdi_tdo_seq;
+static jtag_shift_tdi_seq_f bit_tdi_seq;
+
+static inline __attribute__((always_inline)) void jtag_shift_delay(const bool delay)
+{
+	if (delay) {
+		for (volatile uint32_t counter = target_clk_divider; counter > 0; --counter)
+			continue;
+	}
+}
+
+/* One clock, with TCK low on entry and left high. Returns TDO if capturing */
+static inline __attribute__((always_inline)) uint32_t jtag_shift_clock(
+	const uint32_t set, const uint32_t clear, const bool capture, const bool delay)
+{
+	REG_WRITE(GPIO_OUT_W1TC_REG, clear | JTAG_SHIFT_TCK);
+	REG_WRITE(GPIO_OUT_W1TS_REG, set);
+	jtag_shift_delay(delay);
+	REG_WRITE(GPIO_OUT_W1TS_REG, JTAG_SHIFT_TCK);
+	const uint32_t tdo = capture ? (REG_READ(GPIO_IN_REG) >> TDO_PIN) & 1U : 0U;
+	jtag_shift_delay(delay);
+	return tdo;
+}
+
+static inline __attribute__((always_inline)) uint32_t jtag_shift_bit(
+	const uint32_t out, const size_t bit, const uint32_t tms, const bool capture, const bool delay)
+{
+	const uint32_t tdi = ((out >> bit) & 1U) << TDI_PIN;
+	return jtag_shift_clock(tdi | tms, tdi ^ JTAG_SHIFT_TDI, capture, delay) << bit;
+}
+
+static inline __attribute__((always_inline)) uint32_t jtag_shift_word(
+	const uint32_t out, const bool capture, const bool delay)
+{
+	uint32_t in = 0;
+	if (delay) {
+		for (size_t bit = 0; bit < 32U; ++bit)
+			in |= jtag_shift_bit(out, bit, 0U, capture, true);
+	} else {
+#pragma GCC unroll 32
+		for (size_t bit = 0; bit < 32U; ++bit)
+			in |= jtag_shift_bit(out, bit, 0U, capture, false);
+	}
+	return in;
+}
+
+static inline __attribute__((always_inline)) void jtag_shift_seq(uint8_t *const data_out, const bool final_tms,
+	const uint8_t *const data_in, const size_t clock_cycles, const bool capture, const bool delay)
+{
+	if (!clock_cycles)
+		return;
+	/* TMS low keeps the TAP in Shift-xR up to the last bit */
+	REG_WRITE(GPIO_OUT_W1TC_REG, JTAG_SHIFT_TMS);
+	size_t cycle = 0;
+	/* Whole words, as long as there is a bit after them to take final_tms */
+	for (; cycle + 32U < clock_cycles; cycle += 32U) {
+		uint32_t out;
+		memcpy(&out, data_in + cycle / 8U, sizeof(out));
+		const uint32_t in = jtag_shift_word(out, capture, delay);
+		if (capture)
+			memcpy(data_out + cycle / 8U, &in, sizeof(in));
+	}
+
+	/* The 1 to 32 bits left, the last of them with TMS at final_tms */
+	const size_t bits = clock_cycles - cycle;
+	const size_t bytes = (bits + 7U) / 8U;
+	uint32_t out = 0;
+	memcpy(&out, data_in + cycle / 8U, bytes);
+	uint32_t in = 0;
+	for (size_t bit = 0; bit + 1U < bits; ++bit)
+		in |= jtag_shift_bit(out, bit, 0U, capture, delay);
+	in |= jtag_shift_bit(out, bits - 1U, final_tms ? JTAG_SHIFT_TMS : 0U, capture, delay);
+	REG_WRITE(GPIO_OUT_W1TC_REG, JTAG_SHIFT_TCK);
+	if (capture)
+		memcpy(data_out + cycle / 8U, &in, bytes);
+}
+
+static void jtag_shift_tdi_tdo_seq(
+	uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	if (target_clk_divider != UINT32_MAX)
+		jtag_shift_seq(data_out, final_tms, data_in, clock_cycles, true, true);
+	else
+		jtag_shift_seq(data_out, final_tms, data_in, clock_cycles, true, false);
+}
+
+static void jtag_shift_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	if (target_clk_divider != UINT32_MAX)
+		jtag_shift_seq(NULL, final_tms, data_in, clock_cycles, false, true);
+	else
+		jtag_shift_seq(NULL, final_tms, data_in, clock_cycles, false, false);
+}
+
+static void jtag_shift_install(void)
+{
+	jtag_proc.jtagtap_tdi_tdo_seq = shift_enabled ? jtag_shift_tdi_tdo_seq : bit_tdi_tdo_seq;
+	jtag_proc.jtagtap_tdi_seq = shift_enabled ? jtag_shift_tdi_seq : bit_tdi_seq;
+}
+
+void jtag_shift_attach(void)
+{
+	bit_tdi_tdo_seq = jtag_proc.jtagtap_tdi_tdo_seq;
+	bit_tdi_seq = jtag_proc.jtagtap_tdi_seq;
+	jtag_shift_install();
+}
+
+bool jtag_shift_enabled(void)
+{
+	return shift_enabled;
+}
+
+void jtag_shift_enable(const bool enable)
+{
+	shift_enabled = enable;
+	if (bit_tdi_seq)
+		jtag_shift_install();
+}
@@ -0,0 +1,24 @@
+/*
+ * Word-wide JTAG shifts for the ESP32 probe
+ *
+ * jtagtap.c shifts TDI/TDO sequences a bit at a time, looking up the byte and
+ * bit of each one as it goes. RISC-V DMI accesses shift a 41 bit or longer DR
+ * several times for every word of target memory, which makes that loop most
+ * of the time spent on a JTAG target. These replace the two sequence
+ * functions in jtag_proc with ones that load 32 bits at a time and clock
+ * them out with the GPIO masks worked out up front.
+ */
+
+#ifndef __JTAG_SHIFT_H
+#define __JTAG_SHIFT_H
+
+#include <stdbool.h>
+
+/* Called after each jtagtap_init(), which sets jtag_proc up afresh */
+void jtag_shift_attach(void);
+
+bool jtag_shift_enabled(void);
+/* Takes effect straight away if JTAG is set up, otherwise from the next scan */
+void jtag_shift_enable(bool enable);
+
+#endif /* __JTAG_SHIFT_H */
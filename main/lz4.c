@@ -0,0 +1,214 @@
+/*
+ * LZ4 block compression for the ESP32 probe
+ *
+ * A block is a series of sequences, each a token byte whose high nibble is
+ * the number of literals and low nibble the match length less 4, the literal
+ * bytes, a 16 bit little endian offset back to the match and any extra length
+ * bytes for the match. Lengths of 15 carry on in following bytes, adding up
+ * until one is not 255. The last sequence is only literals: the format wants
+ * the last 5 bytes to be literals and no match to start in the last 12.
+ */
+
+#include <string.h>
+
+#include "lz4.h"
+
+#define LZ4_MIN_MATCH     4U
+#define LZ4_LAST_LITERALS 5U
+#define LZ4_MATCH_LIMIT   12U
+#define LZ4_LENGTH_MASK   15U
+
+static uint32_t lz4_read32(const uint8_t *const data)
+{
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint32_t lz4_hash(const uint32_t sequence)
+{
+	return (sequence * 2654435761U) >> (32U - LZ4_HASH_BITS);
+}
+
+static uint8_t *lz4_write_length(uint8_t *out, size_t len)
+{
+	for (; len >= 255U; len -= 255U)
+		*out++ = 255U;
+	*out++ = (uint8_t)len;
+	return out;
+}
+
+/* One sequence, match_len 0 for the closing one with only literals. NULL if it doesn't fit */
+static uint8_t *lz4_write_sequence(uint8_t *out, const uint8_t *const end, const uint8_t *const literals,
+	const size_t literal_len, const size_t offset, const size_t match_len)
+{
+	const size_t match_bytes = match_len ? 2U + match_len / 255U + 1U : 0U;
+	if ((size_t)(end - out) < 1U + literal_len / 255U + 1U + literal_len + match_bytes)
+		return NULL;
+
+	uint8_t *const token = out++;
+	if (literal_len >= LZ4_LENGTH_MASK) {
+		*token = LZ4_LENGTH_MASK << 4U;
+		out = lz4_write_length(out, literal_len - LZ4_LENGTH_MASK);
+	} else
+		*token = (uint8_t)(literal_len << 4U);
+	memcpy(out, literals, literal_len);
+	out += literal_len;
+	if (!match_len)
+		return out;
+
+	*out++ = (uint8_t)offset;
+	*out++ = (uint8_t)(offset >> 8U);
+	const size_t extra = match_len - LZ4_MIN_MATCH;
+	if (extra >= LZ4_LENGTH_MASK) {
+		*token |= LZ4_LENGTH_MASK;
+		out = lz4_write_length(out, extra - LZ4_LENGTH_MASK);
+	} else
+		*token |= (uint8_t)extra;
+	return out;
+}
+
+size_t lz4_compress(const uint8_t *const src, const size_t len, uint8_t *const dst, const size_t capacity,
+	uint16_t *const table)
+{
+	const uint8_t *const dst_end = dst + capacity;
+	uint8_t *out = dst;
+	size_t anchor = 0;
+
+	if (len > LZ4_MAX_INPUT_SIZE)
+		return 0;
+	if (len > LZ4_MATCH_LIMIT) {
+		memset(table, 0, LZ4_HASH_SIZE * sizeof(*table));
+		const size_t match_end = len - LZ4_LAST_LITERALS;
+		size_t pos = 0;
+		while (pos < len - LZ4_MATCH_LIMIT) {
+			const uint32_t sequence = lz4_read32(src + pos);
+			const uint32_t hash = lz4_hash(sequence);
+			size_t ref = table[hash];
+			table[hash] = (uint16_t)pos;
+			if (ref >= pos || lz4_read32(src + ref) != sequence) {
+				++pos;
+				continue;
+			}
+
+			/* Take in what matches on either side of the 4 bytes found */
+			while (pos > anchor && ref > 0 && src[pos - 1U] == src[ref - 1U]) {
+				--pos;
+				--ref;
+			}
+			size_t match_len = LZ4_MIN_MATCH;
+			while (pos + match_len < match_end && src[pos + match_len] == src[ref + match_len])
+				++match_len;
+
+			out = lz4_write_sequence(out, dst_end, src + anchor, pos - anchor, pos - ref, match_len);
+			if (!out)
+				return 0;
+			pos += match_len;
+			anchor = pos;
+		}
+	}
+
+	out = lz4_write_sequence(out, dst_end, src + anchor, len - anchor, 0U, 0U);
+	return out ? (size_t)(out - dst) : 0U;
+}
+
+void lz4_decoder_init(lz4_decoder_s *const decoder, uint8_t *const out, const size_t capacity)
+{
+	decoder->out = out;
+	decoder->capacity = capacity;
+	decoder->len = 0;
+	decoder->state = LZ4_DECODER_TOKEN;
+	decoder->token = 0;
+	decoder->count = 0;
+	decoder->offset = 0;
+}
+
+/* Copy the match, byte by byte as it may overlap what it produces */
+static bool lz4_decode_match(lz4_decoder_s *const decoder)
+{
+	const size_t len = decoder->count + LZ4_MIN_MATCH;
+	if (decoder->capacity - decoder->len < len)
+		return false;
+	uint8_t *out = decoder->out + decoder->len;
+	const uint8_t *ref = out - decoder->offset;
+	for (size_t i = 0; i < len; ++i)
+		out[i] = ref[i];
+	decoder->len += len;
+	decoder->state = LZ4_DECODER_TOKEN;
+	return true;
+}
+
+static bool lz4_decode_byte(lz4_decoder_s *const decoder, const uint8_t byte)
+{
+	switch (decoder->state) {
+	case LZ4_DECODER_TOKEN:
+		decoder->token = byte;
+		decoder->count = byte >> 4U;
+		if (decoder->count == LZ4_LENGTH_MASK)
+			decoder->state = LZ4_DECODER_LITERAL_LENGTH;
+		else
+			decoder->state = decoder->count ? LZ4_DECODER_LITERALS : LZ4_DECODER_OFFSET_LOW;
+		return true;
+	case LZ4_DECODER_LITERAL_LENGTH:
+		decoder->count += byte;
+		if (byte != 255U)
+			decoder->state = LZ4_DECODER_LITERALS;
+		return true;
+	case LZ4_DECODER_OFFSET_LOW:
+		decoder->offset = byte;
+		decoder->state = LZ4_DECODER_OFFSET_HIGH;
+		return true;
+	case LZ4_DECODER_OFFSET_HIGH:
+		decoder->offset |= (uint32_t)byte << 8U;
+		if (!decoder->offset || decoder->offset > decoder->len)
+			return false;
+		decoder->count = decoder->token & LZ4_LENGTH_MASK;
+		if (decoder->count == LZ4_LENGTH_MASK) {
+			decoder->state = LZ4_DECODER_MATCH_LENGTH;
+			return true;
+		}
+		return lz4_decode_match(decoder);
+	case LZ4_DECODER_MATCH_LENGTH:
+		decoder->count += byte;
+		if (byte != 255U)
+			return lz4_decode_match(decoder);
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool lz4_decode(lz4_decoder_s *const decoder, const uint8_t *data, size_t len)
+{
+	while (len) {
+		if (decoder->state == LZ4_DECODER_LITERALS) {
+			/* Literals go across in one piece, as far as this part of the input reaches */
+			const size_t chunk = decoder->count < len ? decoder->count : len;
+			if (decoder->capacity - decoder->len < chunk) {
+				decoder->state = LZ4_DECODER_ERROR;
+				return false;
+			}
+			memcpy(decoder->out + decoder->len, data, chunk);
+			decoder->len += chunk;
+			decoder->count -= chunk;
+			if (!decoder->count)
+				decoder->state = LZ4_DECODER_OFFSET_LOW;
+			data += chunk;
+			len -= chunk;
+			continue;
+		}
+		if (!lz4_decode_byte(decoder, *data)) {
+			decoder->state = LZ4_DECODER_ERROR;
+			return false;
+		}
+		++data;
+		--len;
+	}
+	return true;
+}
+
+bool lz4_decoder_done(const lz4_decoder_s *const decoder)
+{
+	/* The closing sequence ends after its literals, where an offset would otherwise follow */
+	return decoder->state == LZ4_DECODER_OFFSET_LOW;
+}
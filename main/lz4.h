@@ -0,0 +1,59 @@
+/*
+ * LZ4 block compression for the ESP32 probe
+ *
+ * Firmware images are mostly padding, erased 0xff runs and repeated code
+ * sequences, so they shrink two to three times even with the plain greedy
+ * LZ4 matcher here. The block format is the one the lz4 tool uses inside
+ * its frames, which is also what the ESP32-C3 flash loader inflates.
+ *
+ * The decoder takes its input in pieces of any size, so a block can be
+ * decoded as it is received without buffering the compressed data.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Positions are kept in 16 bits, which is also as far back as a match can reach */
+#define LZ4_MAX_INPUT_SIZE 65536U
+#define LZ4_HASH_BITS      12U
+#define LZ4_HASH_SIZE      (1U << LZ4_HASH_BITS)
+
+typedef enum lz4_decoder_state {
+	LZ4_DECODER_TOKEN,
+	LZ4_DECODER_LITERAL_LENGTH,
+	LZ4_DECODER_LITERALS,
+	LZ4_DECODER_OFFSET_LOW,
+	LZ4_DECODER_OFFSET_HIGH,
+	LZ4_DECODER_MATCH_LENGTH,
+	LZ4_DECODER_ERROR,
+} lz4_decoder_state_e;
+
+typedef struct lz4_decoder {
+	uint8_t *out;
+	size_t capacity;
+	size_t len; /* Bytes decoded so far */
+	lz4_decoder_state_e state;
+	uint8_t token;
+	size_t count; /* Literal or match length being collected */
+	uint32_t offset;
+} lz4_decoder_s;
+
+/*
+ * Compress len bytes (at most LZ4_MAX_INPUT_SIZE) into one block, using table
+ * (LZ4_HASH_SIZE entries) as scratch. Returns the size of the block, or 0 if
+ * it would not fit in capacity.
+ */
+size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity, uint16_t *table);
+
+/* Start decoding a block into out */
+void lz4_decoder_init(lz4_decoder_s *decoder, uint8_t *out, size_t capacity);
+/* Feed the next part of the block, false if it is corrupt or decodes past capacity */
+bool lz4_decode(lz4_decoder_s *decoder, const uint8_t *data, size_t len);
+/* Whether the data fed so far ends on a sequence boundary, as a complete block does */
+bool lz4_decoder_done(const lz4_decoder_s *decoder);
+
+#endif /* __LZ4_H */
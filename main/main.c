@@ -43,6 +43,9 @@
 #endif
 
 #include "web_server.h"
+#include "run_loop.h"
+#include "flash_pipeline.h"
+#include "warm_scan.h"
 
 
 #if __has_include("esp_idf_version.h")
@@ -64,7 +67,9 @@
 //
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
+#include "nvs.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -75,6 +80,16 @@
 unsigned short gdb_port = 2345;
 #include "platform.h"
 
+/* Pinning the probe's tasks apart is for little if WiFi or lwIP can still run on the debug core */
+#ifdef CONFIG_BMP_TASK_PLACEMENT_SPLIT
+#if !defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY) || CONFIG_LWIP_TCPIP_TASK_AFFINITY != PLATFORM_NETWORK_CORE
+#warning "The lwIP TCP/IP task isn't pinned to the network core, set LWIP_TCPIP_TASK_AFFINITY to the core that isn't BMP_DEBUG_CORE"
+#endif
+#if defined(CONFIG_ESP_WIFI_TASK_CORE_ID) && CONFIG_ESP_WIFI_TASK_CORE_ID != PLATFORM_NETWORK_CORE
+#warning "The WiFi task runs on the debug core, set ESP_WIFI_TASK_CORE_ID to the core that isn't BMP_DEBUG_CORE"
+#endif
+#endif
+
 /* The examples use simple WiFi configuration that you can set via
    'make menuconfig'.
 
@@ -101,8 +116,11 @@ unsigned short gdb_port = 2345;
 //#endif
 //#endif
 
-/* This has to be aligned so the remote protocol can re-use it without causing Problems */
-static char pbuf[GDB_PACKET_BUFFER_SIZE + 1U] __attribute__((aligned(8)));
+/*
+ * This has to be aligned so the remote protocol can re-use it without causing Problems.
+ * It is sized by CONFIG_BMP_GDB_PACKET_SIZE and allocated in app_main().
+ */
+static char *pbuf;
 
 char *gdb_packet_buffer()
 {
@@ -134,6 +152,73 @@ static int s_retry_num = 0;
 
 static int already_connected=0;
 
+/* Boot timing, esp_timer starts counting at boot */
+#define BOOT_MS() ((long long)(esp_timer_get_time() / 1000))
+
+/*
+ * The AP we last got an address from is kept in NVS. Connecting with its BSSID
+ * and channel set skips the scan across all channels, which is most of the time
+ * WiFi takes to come up after a power cycle. If that AP can't be found the hint
+ * is dropped and the next attempt scans as usual.
+ */
+#define WIFI_AP_NVS_NAMESPACE "bmp"
+#define WIFI_AP_NVS_KEY       "wifi_ap"
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_hint_t;
+
+static bool wifi_ap_hint_active = false;
+static bool wifi_sta_associated = false;
+
+static bool wifi_ap_hint_load(wifi_ap_hint_t *hint)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_AP_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+        return false;
+    size_t len = sizeof(*hint);
+    esp_err_t err = nvs_get_blob(nvs, WIFI_AP_NVS_KEY, hint, &len);
+    nvs_close(nvs);
+    return err == ESP_OK && len == sizeof(*hint) && hint->channel != 0;
+}
+
+static void wifi_ap_hint_save(void)
+{
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK)
+        return;
+
+    wifi_ap_hint_t hint = { .channel = ap.primary };
+    memcpy(hint.bssid, ap.bssid, sizeof(hint.bssid));
+
+    // Only write when it changed, this runs on every (re)connect
+    wifi_ap_hint_t cached;
+    if (wifi_ap_hint_load(&cached) && memcmp(&cached, &hint, sizeof(hint)) == 0)
+        return;
+
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_AP_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+        return;
+    if (nvs_set_blob(nvs, WIFI_AP_NVS_KEY, &hint, sizeof(hint)) == ESP_OK)
+        nvs_commit(nvs);
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "Cached AP "MACSTR" on channel %d", MAC2STR(hint.bssid), hint.channel);
+}
+
+static void wifi_ap_hint_drop(void)
+{
+    wifi_config_t wifi_config;
+
+    wifi_ap_hint_active = false;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+        return;
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    ESP_LOGI(TAG, "Cached AP not found, scanning all channels");
+}
+
 #define EXAMPLE_ESP_MAXIMUM_RETRY  10
 
 
@@ -145,7 +230,13 @@ static void event_handler(void* arg, esp_event_base_t event_base,
 {
    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_sta_associated = true;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+        // Failing to associate with the cached AP means it moved or is gone
+        if (wifi_ap_hint_active && !wifi_sta_associated)
+            wifi_ap_hint_drop();
+        wifi_sta_associated = false;
         if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
             if (already_connected==0) {
                 esp_wifi_connect();
@@ -159,7 +250,8 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "got ip:" IPSTR " %lld ms after boot", IP2STR(&event->ip_info.ip), BOOT_MS());
+        wifi_ap_hint_save();
         s_retry_num = 0;
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
         already_connected=1;
@@ -233,6 +325,15 @@ static void initialise_wifi(void)
         },
     };
 
+    wifi_ap_hint_t hint;
+    if (wifi_ap_hint_load(&hint)) {
+        memcpy(wifi_config.sta.bssid, hint.bssid, sizeof(hint.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = hint.channel;
+        wifi_ap_hint_active = true;
+        ESP_LOGI(TAG, "Trying cached AP "MACSTR" on channel %d first", MAC2STR(hint.bssid), hint.channel);
+    }
+
     ESP_LOGI(TAG, "Setting WiFi configuration SSID %s...", wifi_config.sta.ssid);
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config) );
@@ -325,42 +426,81 @@ void old_gdb_application_thread(void *pvParameters)
 }
 
 
+/*
+ * The GDB connection dropped: let blocks still queued for the flash writer
+ * land, then detach from the target, with the target lock held.
+ */
+static void bmp_connection_lost(void)
+{
+	flash_pipeline_wait();
+	if (cur_target)
+		target_detach(cur_target);
+}
+
 static void bmp_poll_loop(void)
 {
 	if (!gdb_if_is_connected())
 		return;
 
 	SET_IDLE_STATE(false);
-	while (gdb_target_running && cur_target) {
-		if (!gdb_if_is_connected())
-			return;
-		gdb_poll_target();
-
-		// Check again, as `gdb_poll_target()` may
-		// alter these variables.
-		if (!gdb_target_running || !cur_target)
-			break;
-		char c = gdb_if_getchar_to(0);
-		if (c == '\x03' || c == '\x04')
-			target_halt_request(cur_target);
-		platform_pace_poll();
+	if (gdb_target_running && cur_target) {
+		/*
+		 * Sleep between the halt polls, RTT polls and GDB data rather than spin over
+		 * them, see run_loop.c. A halt asked for with ^C is polled for straight away.
+		 */
+		bool interrupted = false;
+		run_loop_begin();
+		while (gdb_target_running && cur_target && gdb_if_is_connected()) {
+			/* Let other users of the target (the profiler) in while we sleep */
+			platform_target_unlock();
+			uint32_t events = run_loop_wait();
+			platform_target_lock();
+
+			if (events & RUN_LOOP_SOCKET) {
+				char c = gdb_if_getchar_to(0);
+				if (c == '\x03' || c == '\x04') {
+					gdb_halt_target();
+					interrupted = true;
+					run_loop_activity();
+				}
+			}
+			if (!gdb_if_is_connected() || !cur_target)
+				break;
+			if (events & RUN_LOOP_HALT_POLL) {
+				gdb_poll_target();
+				run_loop_halt_polled(!gdb_target_running && !interrupted);
+			}
+
+			// Check again, as `gdb_poll_target()` may
+			// alter these variables.
+			if (!gdb_target_running || !cur_target)
+				break;
 #ifdef ENABLE_RTT
-		if (rtt_enabled)
-			poll_rtt(cur_target);
+			if ((events & RUN_LOOP_RTT_POLL) && rtt_enabled)
+				poll_rtt(cur_target);
 #endif
+		}
+		run_loop_end();
 	}
 
-	if (!gdb_if_is_connected())
+	if (!gdb_if_is_connected()) {
+		bmp_connection_lost();
 		return;
+	}
 
 	SET_IDLE_STATE(true);
-	size_t size = gdb_getpacket(pbuf, GDB_PACKET_BUFFER_SIZE);
-	if (!gdb_if_is_connected())
+	size_t size = gdb_getpacket_unlocked(pbuf, GDB_PACKET_BUFFER_SIZE);
+	if (!gdb_if_is_connected()) {
+		bmp_connection_lost();
 		return;
+	}
 	// If port closed and target detached, stay idle
 	if (pbuf[0] != '\x04' || cur_target)
 		SET_IDLE_STATE(false);
 	gdb_main(pbuf, GDB_PACKET_BUFFER_SIZE, size);
+	/* Waiting for an ACK in there can find the connection gone too */
+	if (!gdb_if_is_connected())
+		bmp_connection_lost();
 }
 
 static void bad_bmp_poll_loop(void)
@@ -420,6 +560,11 @@ static void bad_bmp_poll_loop(void)
 static void main_loop(void)
 {
      while (gdb_if_is_connected()) {
+		/*
+		 * The exception frame chain is global, so it may only change with the target
+		 * lock held. bmp_poll_loop() drops the lock only while waiting on the socket.
+		 */
+		platform_target_lock();
 		TRY (EXCEPTION_ALL) {
 			bmp_poll_loop();
 		}
@@ -431,6 +576,7 @@ static void main_loop(void)
 			morse("TARGET LOST.", true);
 			break;
 		}
+		platform_target_unlock();
      }
      ESP_LOGI(TAG, "GDB connection closed, waiting for new connection");
 }
@@ -508,6 +654,12 @@ static void gdb_application_thread(void *pvParameters)
         }
         ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
         printf("accepted new gdb connection\n");
+        static bool first_connection = true;
+        if (first_connection) {
+            first_connection = false;
+            ESP_LOGI(TAG, "First GDB connection %lld ms after boot", BOOT_MS());
+        }
+        warm_scan_session_start();
         set_gdb_socket(sock);
         main_loop();
 
@@ -545,32 +697,34 @@ void app_main()
     //wifi_init_softap();
 //#endif
 
-	xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT,
-						false, true, portMAX_DELAY);
-
-	EventBits_t uxBits=xEventGroupWaitBits(wifi_event_group, WIFI_FAIL_BIT,
-						false, true, 4000 / portTICK_PERIOD_MS);
-
-    if (( uxBits & WIFI_FAIL_BIT ) != 0) {
+	/* WiFi associates in the background, the probe side doesn't need it to come up */
+	pbuf = gdb_packet_buffer_alloc(GDB_PACKET_BUFFER_SIZE + 1U);
+	if (!pbuf) {
+		ESP_LOGE(TAG, "Unable to allocate %u byte GDB packet buffer", (unsigned)GDB_PACKET_BUFFER_SIZE);
+		return;
+	}
 
-        ESP_LOGI(TAG, "Late fail");
+	platform_init();
 
-        xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT,
-                            false, true, portMAX_DELAY);
+#ifdef PLATFORM_HAS_UART_PASSTHROUGH
+	uart_passthrough_init();
+#endif
 
-    }
+	ESP_LOGI(TAG, "Probe initialised %lld ms after boot, waiting for WiFi", BOOT_MS());
 
-	ESP_LOGI(TAG, "Connected to AP");
+	xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_BIT,
+						false, true, portMAX_DELAY);
 
-	platform_init();
+	ESP_LOGI(TAG, "Connected to AP %lld ms after boot", BOOT_MS());
 
+	/* The network services go up as soon as there is an address to reach them on */
 #ifdef PLATFORM_HAS_UART_PASSTHROUGH
-	uart_passthrough_init();
+	uart_passthrough_start_server();
 #endif
 
 	web_server_init();
 
-    xTaskCreate(&gdb_application_thread, "gdb_thread", 4*4096, NULL, 17, NULL);
+    xTaskCreatePinnedToCore(&gdb_application_thread, "gdb_thread", 4*4096, NULL, 17, NULL, PLATFORM_DEBUG_CORE);
 
 
    //xTaskCreate(&main_task, "main_task", 4*4096, NULL, 17, NULL);
@@ -27,6 +27,8 @@
 #include "exception.h"
 #include "gdb_packet.h"
 #include "morse.h"
+#include "swd_clock.h"
+#include "swd_engine.h"
 #include "driver/gpio.h"
 
 #include <assert.h>
@@ -35,6 +37,7 @@
 #include <esp_timer.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "platform.h"
 
 //#include <dhcpserver.h>
@@ -49,9 +52,16 @@
 //  | (1<<TMS_PIN) | (1<<TDI_PIN) | (1<<TDO_PIN) | (1<<TCK_PIN)
 #define GPIO_OUTPUT_PIN_SEL  ((1<<SWCLK_PIN) | (1<<SWDIO_PIN))
 
+#ifdef CONFIG_BMP_GPIO_DIRECT
+_Static_assert(SWCLK_PIN < 32 && SWDIO_PIN < 32 && TDI_PIN < 32 && TDO_PIN < 32 && NRST_PIN < 32,
+	"CONFIG_BMP_GPIO_DIRECT only handles GPIO0-31");
+#endif
+
 uint32_t target_clk_divider = 0;
 
-void pins_init() {
+static SemaphoreHandle_t target_lock;
+
+void pins_init(void) {
 
     gpio_config_t io_conf;
     //disable interrupt
@@ -66,13 +76,30 @@ void pins_init() {
     io_conf.pull_up_en = GPIO_PULLUP_DISABLE;
     //configure GPIO with the given settings
     gpio_config(&io_conf);
+#ifdef CONFIG_BMP_GPIO_DIRECT
+    // Keep the SWDIO input on while driving, SWDIO_MODE_FLOAT/DRIVE only switch the output enable
+    gpio_set_direction(SWDIO_PIN, GPIO_MODE_INPUT_OUTPUT);
+#endif
 }
 
 void platform_init()
 {
 
 	pins_init();
+	swd_clock_calibrate();
+	swd_engine_init();
+	target_lock = xSemaphoreCreateMutex();
+
+}
 
+void platform_target_lock(void)
+{
+	xSemaphoreTake(target_lock, portMAX_DELAY);
+}
+
+void platform_target_unlock(void)
+{
+	xSemaphoreGive(target_lock);
 }
 
 
@@ -125,14 +152,13 @@ void platform_target_clk_output_enable(bool enable)
 
 void platform_max_frequency_set(const uint32_t frequency)
 {
+	swd_clock_set(frequency);
+	swd_engine_set_frequency(frequency);
 }
 
 uint32_t platform_max_frequency_get(void)
 {
-	uint32_t result = 0;
-	//uint32_t result = rcc_ahb_frequency;
-	//result /= USED_SWD_CYCLES + CYCLES_PER_CNT * target_clk_divider;
-	return result;
+	return swd_engine_active() ? swd_engine_get_frequency() : swd_clock_get();
 }
 
 
@@ -39,12 +39,42 @@
 #define DEBUG(x, ...) do { ; } while (0)
 //#define DEBUG printf
 
+#include "sdkconfig.h"
 #include "timing.h"
 #include "driver/gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
 #include <freertos/FreeRTOS.h>
 
 #define BOARD_IDENT "Black Magic Probe (esp32), (Firmware 0.2)"
 
+/* GDB packet buffer size, also advertised to GDB as PacketSize */
+#define GDB_PACKET_BUFFER_SIZE ((size_t)CONFIG_BMP_GDB_PACKET_SIZE)
+
+/*
+ * Target bus lock. The GDB thread holds it whenever it may talk to the target and
+ * drops it while it waits on the network, so background tasks (the profiler) can
+ * use the target in between without tearing SWD/JTAG transactions.
+ */
+void platform_target_lock(void);
+void platform_target_unlock(void);
+
+/* SWD/JTAG pins as GPIOs for bit-banging, also used to take them back from the SPI SWD engine */
+void pins_init(void);
+
+/*
+ * Task placement on dual-core chips, see BMP_TASK_PLACEMENT in Kconfig. The debug
+ * core runs the GDB thread (and with it the SWD/JTAG bit-banging) and the profiler,
+ * the network core the web server, the UART bridge and SWO streaming.
+ */
+#ifdef CONFIG_BMP_TASK_PLACEMENT_SPLIT
+#define PLATFORM_DEBUG_CORE   CONFIG_BMP_DEBUG_CORE
+#define PLATFORM_NETWORK_CORE (1 - CONFIG_BMP_DEBUG_CORE)
+#else
+#define PLATFORM_DEBUG_CORE   tskNO_AFFINITY
+#define PLATFORM_NETWORK_CORE tskNO_AFFINITY
+#endif
+
 #define TMS_SET_MODE() do { } while (0)
 
 #if 1
@@ -108,6 +138,22 @@
 #define TARGET_UART_BAUD    115200
 
 
+#ifdef CONFIG_BMP_GPIO_DIRECT
+/*
+ * The pins are compile time constants, so each of these is a single store to
+ * (or load from) a GPIO register with the mask folded in, rather than calls
+ * into the GPIO driver on every clock edge. Only works for GPIO0-31. SWDIO is
+ * set up as input and output in pins_init(), so turning it around is just
+ * switching its output enable.
+ */
+#define gpio_set_val(port, pin, value) REG_WRITE((value) ? GPIO_OUT_W1TS_REG : GPIO_OUT_W1TC_REG, 1U << (pin))
+#define gpio_set(port, pin)            REG_WRITE(GPIO_OUT_W1TS_REG, 1U << (pin))
+#define gpio_clear(port, pin)          REG_WRITE(GPIO_OUT_W1TC_REG, 1U << (pin))
+#define gpio_get(port, pin)            ((REG_READ(GPIO_IN_REG) >> (pin)) & 1U)
+
+#define SWDIO_MODE_FLOAT() REG_WRITE(GPIO_ENABLE_W1TC_REG, 1U << SWDIO_PIN)
+#define SWDIO_MODE_DRIVE() REG_WRITE(GPIO_ENABLE_W1TS_REG, 1U << SWDIO_PIN)
+#else
 #define gpio_set_val(port, pin, value) do {	\
 		if (pin>38) printf("__FUNCTION__%d",pin);  \
 		gpio_set_level(pin, value);		\
@@ -131,6 +177,7 @@
 #define SWDIO_MODE_DRIVE() do {				\
            gpio_set_direction(SWDIO_PIN, GPIO_MODE_OUTPUT);		\
 	} while (0)
+#endif
 
 //#define PLATFORM_HAS_DEBUG 1
 #define ENABLE_DEBUG 1
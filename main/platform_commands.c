@@ -8,12 +8,36 @@
 #include "general.h"
 #include "target_internal.h"
 #include "gdb_packet.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+#include "gdb_ax.h"
+#include "profile.h"
+#include "run_loop.h"
+#include "warm_scan.h"
+#include "flash_pipeline.h"
+#include "flash_delta.h"
+#include "crc_stub.h"
 #include "platform.h"
 #include "timing.h"
+#include "swd.h"
+#include "swd_clock.h"
+#include "swd_engine.h"
+#include "swd_queue.h"
+#include "jtagtap.h"
+#include "jtag_shift.h"
+#include "riscv_debug.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 
 /* External functions from other ESP32 modules */
 extern void scan_uart_boot_mode(void);
 extern void send_to_uart(int argc, const char **argv);
+extern void gdb_if_rx_stats(uint32_t *calls, uint32_t *bytes);
+extern void gdb_if_rx_stats_reset(void);
 
 /*
  * uart_scan command - Scan for STM32 in UART boot mode
@@ -45,6 +69,665 @@ static bool cmd_uart_send(target_s *t, int argc, const char **argv)
 	return true;
 }
 
+/*
+ * gdb_stats command - Show GDB transport statistics
+ * Usage: mon gdb_stats [reset]
+ */
+static bool cmd_gdb_stats(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1 && !strcmp(argv[1], "reset")) {
+		gdb_if_rx_stats_reset();
+		gdb_packet_tx_stats_reset();
+		gdb_ax_reset_stats();
+		flash_pipeline_reset_stats();
+		crc_stub_reset_stats();
+		gdb_out("GDB statistics reset\n");
+		return true;
+	}
+
+	uint32_t recv_calls;
+	uint32_t recv_bytes;
+	gdb_if_rx_stats(&recv_calls, &recv_bytes);
+	gdb_outf("RX: %" PRIu32 " bytes in %" PRIu32 " recv() calls", recv_bytes, recv_calls);
+	if (recv_calls)
+		gdb_outf(", %" PRIu32 " bytes/recv avg", recv_bytes / recv_calls);
+	gdb_out("\n");
+
+	uint32_t tx_payload;
+	uint32_t tx_encoded;
+	gdb_packet_tx_stats(&tx_payload, &tx_encoded);
+	gdb_outf("TX: %" PRIu32 " payload bytes sent as %" PRIu32 " encoded bytes", tx_payload, tx_encoded);
+	if (tx_encoded)
+		gdb_outf(", compression ratio %" PRIu32 ".%02" PRIu32, tx_payload / tx_encoded,
+			(uint32_t)(((uint64_t)(tx_payload % tx_encoded) * 100U) / tx_encoded));
+	gdb_outf(", %" PRIu32 " heap allocations\n", gdb_packet_heap_allocs());
+
+	uint32_t load_bytes;
+	uint32_t load_time;
+	gdb_flash_load_stats(&load_bytes, &load_time);
+	gdb_outf("Packet size: %u bytes\n", (unsigned)GDB_PACKET_BUFFER_SIZE);
+
+	uint32_t step_ranges;
+	uint32_t step_count;
+	gdb_range_step_stats(&step_ranges, &step_count);
+	gdb_outf("Range stepping: %" PRIu32 " ranges, %" PRIu32 " steps done on the probe\n", step_ranges, step_count);
+
+	gdb_ax_stats_s ax_stats;
+	gdb_ax_get_stats(&ax_stats);
+	gdb_outf("Breakpoint conditions: %" PRIu32 " evaluated, %" PRIu32 " hits not reported, %" PRIu32 " errors\n",
+		ax_stats.evaluations, ax_stats.suppressed, ax_stats.errors);
+	flash_pipeline_stats_s flash_stats;
+	flash_pipeline_get_stats(&flash_stats);
+	gdb_outf("Flash pipeline %s: %" PRIu32 " blocks, %" PRIu32 " waited for a buffer, %" PRIu32 " errors\n",
+		flash_pipeline_enabled() ? "enabled" : "disabled", flash_stats.blocks, flash_stats.stalls, flash_stats.errors);
+	crc_stub_stats_s crc_stats;
+	crc_stub_get_stats(&crc_stats);
+	gdb_outf("CRC: %" PRIu32 " computed on the target (%" PRIu32 " bytes in %" PRIu32 " ms), %" PRIu32 " read back\n",
+		crc_stats.runs, crc_stats.bytes, crc_stats.time_ms, crc_stats.fallbacks);
+	flash_delta_stats_s delta_stats;
+	flash_delta_get_stats(&delta_stats);
+	if (delta_stats.blocks) {
+		gdb_outf("Delta flashing: %" PRIu32 " of %" PRIu32 " blocks unchanged, %" PRIu32 " ms comparing", delta_stats.skipped,
+			delta_stats.blocks, delta_stats.check_ms);
+		if (delta_stats.saved_known)
+			gdb_outf(", about %" PRId32 " ms saved\n", delta_stats.saved_ms);
+		else
+			gdb_out("\n");
+	}
+	if (load_time)
+		gdb_outf("Last load: %" PRIu32 " bytes in %" PRIu32 " ms, %" PRIu32 " bytes/s\n", load_bytes, load_time,
+			(uint32_t)(((uint64_t)load_bytes * 1000U) / load_time));
+	return true;
+}
+
+/*
+ * mem_cache command - Control the target memory read cache and register snapshot
+ * Usage: mon mem_cache [enable|disable|reset]
+ */
+static bool cmd_mem_cache(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "enable"))
+			gdb_cache_enable(true);
+		else if (!strcmp(argv[1], "disable"))
+			gdb_cache_enable(false);
+		else if (!strcmp(argv[1], "reset"))
+			gdb_cache_reset_stats();
+		else {
+			gdb_out("Usage: mem_cache [enable|disable|reset]\n");
+			return false;
+		}
+	}
+
+	gdb_cache_stats_s stats;
+	gdb_cache_get_stats(&stats);
+	gdb_outf("Memory cache %s, %u x %u byte pages\n", gdb_cache_enabled() ? "enabled" : "disabled",
+		GDB_CACHE_PAGE_COUNT, GDB_CACHE_PAGE_SIZE);
+	gdb_outf("Page hits: %" PRIu32 ", misses: %" PRIu32 ", uncached reads: %" PRIu32 "\n", stats.hits, stats.misses,
+		stats.bypass);
+	gdb_outf("Register snapshot hits: %" PRIu32 ", reads: %" PRIu32 "\n", stats.reg_hits, stats.reg_misses);
+	return true;
+}
+
+/*
+ * profile command - Statistical PC sampling profiler
+ * Usage: mon profile [start [hz]|stop|reset]
+ * The histogram can be downloaded as gmon.out from the web server.
+ */
+static bool cmd_profile(target_s *t, int argc, const char **argv)
+{
+	if (argc > 1) {
+		if (!strcmp(argv[1], "start")) {
+			if (!t) {
+				gdb_out("No target attached\n");
+				return false;
+			}
+			const uint32_t hz = argc > 2 ? strtoul(argv[2], NULL, 0) : PROFILE_DEFAULT_HZ;
+			if (!profile_start(t, hz)) {
+				gdb_out("Unable to start the profiler\n");
+				return false;
+			}
+		} else if (!strcmp(argv[1], "stop"))
+			profile_stop();
+		else if (!strcmp(argv[1], "reset"))
+			profile_reset();
+		else {
+			gdb_out("Usage: profile [start [hz]|stop|reset]\n");
+			return false;
+		}
+	}
+
+	profile_stats_s stats;
+	profile_get_stats(&stats);
+	gdb_outf("Profiler %s, %s sampling at %" PRIu32 " Hz\n", stats.running ? "running" : "stopped",
+		stats.mode == PROFILE_MODE_PCSR ? "DWT_PCSR" : "halt", stats.hz);
+	gdb_outf("Samples: %" PRIu32 " at %" PRIu32 " PCs, halted: %" PRIu32 ", dropped: %" PRIu32 ", errors: %" PRIu32
+			 "\n",
+		stats.samples, stats.pcs, stats.halted, stats.dropped, stats.errors);
+
+	profile_entry_s top[10];
+	const size_t count = profile_top(top, ARRAY_LENGTH(top));
+	for (size_t i = 0; i < count; ++i)
+		gdb_outf("  0x%08" PRIx32 " %7" PRIu32 " %3" PRIu32 "%%\n", top[i].pc, top[i].count,
+			(uint32_t)(((uint64_t)top[i].count * 100U) / stats.samples));
+	return true;
+}
+
+/*
+ * run_loop command - Show how the GDB thread spends its time while the target runs
+ * Usage: mon run_loop [reset]
+ */
+static bool cmd_run_loop(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (strcmp(argv[1], "reset")) {
+			gdb_out("Usage: run_loop [reset]\n");
+			return false;
+		}
+		run_loop_reset_stats();
+		gdb_out("Run loop statistics reset\n");
+		return true;
+	}
+
+	run_loop_stats_s stats;
+	run_loop_get_stats(&stats);
+	uint32_t min_us;
+	uint32_t max_us;
+	run_loop_get_halt_poll(&min_us, &max_us);
+	gdb_outf("Halt poll interval: %" PRIu32 "-%" PRIu32 " us\n", min_us, max_us);
+	gdb_outf("Halt polls: %" PRIu32 ", RTT polls: %" PRIu32 ", GDB data wakeups: %" PRIu32 "\n", stats.halt_polls,
+		stats.rtt_polls, stats.socket_wakes);
+	gdb_outf("Halts detected: %" PRIu32, stats.halts);
+	if (stats.halts)
+		gdb_outf(", latency avg %" PRIu32 " us, max %" PRIu32 " us",
+			(uint32_t)(stats.latency_total_us / stats.halts), stats.latency_max_us);
+	gdb_out("\n");
+	if (stats.run_us) {
+		/* The idle time is spent blocked in select(), everything else is the GDB thread on the CPU */
+		const uint64_t busy_us = stats.run_us > stats.idle_us ? stats.run_us - stats.idle_us : 0U;
+		gdb_outf("Target running for %" PRIu32 " ms, GDB thread busy %" PRIu32 ".%" PRIu32 "%%\n",
+			(uint32_t)(stats.run_us / 1000U), (uint32_t)((busy_us * 100U) / stats.run_us),
+			(uint32_t)(((busy_us * 1000U) / stats.run_us) % 10U));
+	}
+	return true;
+}
+
+/*
+ * haltpoll command - Set the adaptive halt poll interval bounds
+ * Usage: mon haltpoll [<min_us> <max_us>]
+ * Polling starts at the minimum on every resume and doubles up to the maximum
+ * while the target keeps running. Shows the halt to stop reply latency histogram.
+ */
+static bool cmd_haltpoll(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		const uint32_t min_us = strtoul(argv[1], NULL, 0);
+		const uint32_t max_us = argc > 2 ? strtoul(argv[2], NULL, 0) : min_us;
+		if (max_us > 1000000U || !run_loop_set_halt_poll(min_us, max_us)) {
+			gdb_out("Usage: haltpoll [<min_us> <max_us>], min_us <= max_us <= 1000000\n");
+			return false;
+		}
+	}
+
+	uint32_t min_us;
+	uint32_t max_us;
+	run_loop_get_halt_poll(&min_us, &max_us);
+	gdb_outf("Halt poll interval: %" PRIu32 " us, backing off to %" PRIu32 " us\n", min_us, max_us);
+
+	run_loop_stats_s stats;
+	run_loop_get_stats(&stats);
+	if (!stats.halts)
+		return true;
+	gdb_out("Halt to stop reply latency:\n");
+	for (size_t i = 0; i < RUN_LOOP_LATENCY_BUCKETS; ++i) {
+		if (!stats.latency_hist[i])
+			continue;
+		if (i == RUN_LOOP_LATENCY_BUCKETS - 1U)
+			gdb_outf("  >= %6" PRIu32 " us", (uint32_t)(RUN_LOOP_LATENCY_BASE_US << (i - 1U)));
+		else
+			gdb_outf("  <  %6" PRIu32 " us", (uint32_t)(RUN_LOOP_LATENCY_BASE_US << i));
+		gdb_outf(" %7" PRIu32 " %3" PRIu32 "%%\n", stats.latency_hist[i],
+			(uint32_t)(((uint64_t)stats.latency_hist[i] * 100U) / stats.halts));
+	}
+	return true;
+}
+
+/*
+ * flash_pipeline command - Acknowledge vFlashWrite blocks once queued and write them in the background
+ * Usage: mon flash_pipeline [enable|disable]
+ * Compare the "Last load" figures of mon gdb_stats with and without it.
+ */
+static bool cmd_flash_pipeline(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "enable"))
+			flash_pipeline_enable(true);
+		else if (!strcmp(argv[1], "disable"))
+			flash_pipeline_enable(false);
+		else {
+			gdb_out("Usage: flash_pipeline [enable|disable]\n");
+			return false;
+		}
+	}
+	gdb_outf("Flash pipeline %s\n", flash_pipeline_enabled() ? "enabled" : "disabled");
+	return true;
+}
+
+/*
+ * flash_delta command - Skip erase blocks that already hold what GDB loads into them
+ * Usage: mon flash_delta [enable|disable]
+ * mon gdb_stats shows how many blocks the last load skipped.
+ */
+static bool cmd_flash_delta(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "enable"))
+			flash_delta_enable(true);
+		else if (!strcmp(argv[1], "disable"))
+			flash_delta_enable(false);
+		else {
+			gdb_out("Usage: flash_delta [enable|disable]\n");
+			return false;
+		}
+	}
+	gdb_outf("Delta flashing %s\n", flash_delta_enabled() ? "enabled" : "disabled");
+	return true;
+}
+
+/*
+ * warm_scan command - Scan for targets, reusing the previous scan if they haven't changed
+ * Usage: mon warm_scan [swd|jtag|invalidate|status]
+ * Without a method the one that last found targets is used.
+ */
+static bool cmd_warm_scan(target_s *t, int argc, const char **argv)
+{
+	warm_scan_method_e method = warm_scan_default_method();
+	if (argc > 1) {
+		if (!strcmp(argv[1], "swd"))
+			method = WARM_SCAN_SWD;
+		else if (!strcmp(argv[1], "jtag"))
+			method = WARM_SCAN_JTAG;
+		else if (!strcmp(argv[1], "invalidate")) {
+			warm_scan_invalidate();
+			gdb_out("Scan cache invalidated\n");
+			return true;
+		} else if (!strcmp(argv[1], "status")) {
+			warm_scan_stats_s stats;
+			warm_scan_get_stats(&stats);
+			if (stats.valid)
+				gdb_outf("Cached %s scan of %u targets\n", stats.method == WARM_SCAN_JTAG ? "JTAG" : "SWD",
+					(unsigned)stats.targets);
+			else
+				gdb_out("Nothing cached\n");
+			gdb_outf("Hits: %" PRIu32 ", misses: %" PRIu32 ", last full scan %" PRIu32 " ms, last validation %" PRIu32
+					 " ms\n",
+				stats.hits, stats.misses, stats.full_ms, stats.validate_ms);
+			return true;
+		} else {
+			gdb_out("Usage: warm_scan [swd|jtag|invalidate|status]\n");
+			return false;
+		}
+	}
+	return warm_scan(t, method) != WARM_SCAN_FAILED;
+}
+
+/* Idle bits clocked per SWCLK measurement, and how many measurements to take the best of */
+#define SWD_BENCH_BITS     4096U
+#define SWD_BENCH_RUNS     4U
+#define SWD_BENCH_KIB      4U
+#define SWD_BENCH_MAX_KIB  1024U
+#define SWD_BENCH_READ_LEN 1024U
+
+/*
+ * swd_bench command - Measure the SWCLK rate and target memory read throughput
+ * Usage: mon swd_bench [kib]
+ * The bit loop is timed in CPU cycles while clocking idle (SWDIO low) cycles,
+ * taking the fastest of a few runs to leave out interrupts. Then kib KiB (4 by
+ * default) are read from the start of the target's first RAM region.
+ */
+static bool cmd_swd_bench(target_s *t, int argc, const char **argv)
+{
+	uint32_t kib = SWD_BENCH_KIB;
+	if (argc > 1) {
+		kib = strtoul(argv[1], NULL, 0);
+		if (!kib || kib > SWD_BENCH_MAX_KIB) {
+			gdb_out("Usage: swd_bench [kib]\n");
+			return false;
+		}
+	}
+
+	const uint32_t cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	if (swd_proc.seq_out) {
+		uint32_t best = UINT32_MAX;
+		for (size_t run = 0; run < SWD_BENCH_RUNS; ++run) {
+			const uint32_t start = esp_cpu_get_cycle_count();
+			for (size_t i = 0; i < SWD_BENCH_BITS / 32U; ++i)
+				swd_proc.seq_out(0U, 32U);
+			best = MIN(best, esp_cpu_get_cycle_count() - start);
+		}
+		const uint32_t centicycles = (uint32_t)(((uint64_t)best * 100U) / SWD_BENCH_BITS);
+		gdb_outf("SWCLK: %u bits in %" PRIu32 " cycles, %" PRIu32 ".%02" PRIu32 " cycles/bit, %" PRIu32
+				 " kHz at %" PRIu32 " MHz (divider %" PRIu32 ")\n",
+			SWD_BENCH_BITS, best, centicycles / 100U, centicycles % 100U,
+			(uint32_t)(((uint64_t)cpu_mhz * 100000U) / centicycles), cpu_mhz, target_clk_divider);
+	} else
+		gdb_out("SWCLK: not in SWD mode, scan with swd_scan first\n");
+
+	const target_ram_s *const ram = t ? t->ram : NULL;
+	if (!ram) {
+		gdb_out("mem32: no target attached, or it has no RAM\n");
+		return true;
+	}
+	uint8_t *const buffer = malloc(SWD_BENCH_READ_LEN);
+	if (!buffer) {
+		gdb_out("Out of memory\n");
+		return false;
+	}
+	const size_t len = MIN((size_t)kib * 1024U, ram->length);
+	const int64_t start = esp_timer_get_time();
+	bool ok = true;
+	for (size_t offset = 0; ok && offset < len; offset += SWD_BENCH_READ_LEN)
+		ok = !target_mem32_read(t, buffer, ram->start + offset, MIN(len - offset, SWD_BENCH_READ_LEN));
+	const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+	free(buffer);
+	if (!ok) {
+		gdb_out("mem32: read failed\n");
+		return false;
+	}
+	gdb_outf("mem32: %u bytes from 0x%08" PRIx32 " in %" PRIu32 " us, %" PRIu32 " KiB/s%s\n", (unsigned)len,
+		(uint32_t)ram->start, elapsed_us, elapsed_us ? (uint32_t)(((uint64_t)len * 1000000U) / 1024U / elapsed_us) : 0U,
+		swd_queue_enabled() ? " (swd_queue enabled)" : "");
+	return true;
+}
+
+/*
+ * freq_tune command - Find the fastest SWD clock the attached target keeps up with
+ * Usage: mon freq_tune
+ * From the fastest down, each speed has to read DPIDR and the AP IDR back right
+ * SWD_CLOCK_TUNE_READS times after a line reset, and the first that does is kept.
+ * "mon frequency" shows or overrides it afterwards.
+ */
+static bool cmd_freq_tune(target_s *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	if (!t || !swd_engine_transport_swd()) {
+		gdb_out("freq_tune: needs a target attached over SWD\n");
+		return false;
+	}
+	if (swd_engine_active()) {
+		gdb_out("freq_tune: only tunes bit-banged SWD, set the SPI clock with \"mon frequency\"\n");
+		return false;
+	}
+	if (!swd_clock_get()) {
+		gdb_out("freq_tune: the SWD clock wasn't calibrated at boot\n");
+		return false;
+	}
+
+	swd_clock_tune_result_s results[SWD_CLOCK_TUNE_STEPS];
+	const size_t count = swd_clock_tune(t, results);
+	gdb_cache_invalidate();
+	if (!count) {
+		gdb_out("freq_tune: the target isn't a Cortex-M, or doesn't respond at the current speed\n");
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (results[i].errors)
+			gdb_outf("%8" PRIu32 " Hz: %" PRIu32 " errors\n", results[i].frequency, results[i].errors);
+		else
+			gdb_outf("%8" PRIu32 " Hz: pass\n", results[i].frequency);
+	}
+	const bool found = !results[count - 1U].errors;
+	gdb_outf(found ? "Using %" PRIu32 " Hz\n" : "No speed passed, staying at %" PRIu32 " Hz\n", swd_clock_get());
+	return found;
+}
+
+/*
+ * swd_engine command - Choose how SWD sequences are clocked out
+ * Usage: mon swd_engine [bitbang|spi|reset]
+ * The choice is used from the next swd_scan on. Without an argument it shows
+ * which engine is in use and how many transfers the SPI one has done.
+ */
+static bool cmd_swd_engine(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "bitbang"))
+			swd_engine_select(SWD_ENGINE_BITBANG);
+		else if (!strcmp(argv[1], "spi"))
+			swd_engine_select(SWD_ENGINE_SPI);
+		else if (!strcmp(argv[1], "reset"))
+			swd_engine_reset_stats();
+		else {
+			gdb_out("Usage: swd_engine [bitbang|spi|reset]\n");
+			return false;
+		}
+	}
+
+	swd_engine_stats_s stats;
+	swd_engine_get_stats(&stats);
+	const char *const selected = stats.selected == SWD_ENGINE_SPI ? "spi" : "bitbang";
+	if (stats.active)
+		gdb_outf("SWD through SPI at %" PRIu32 " kHz, %s from the next scan\n", stats.frequency / 1000U, selected);
+	else
+		gdb_outf("SWD bit-banged, %s from the next scan\n", selected);
+	gdb_outf("%" PRIu32 " transfers, %" PRIu32 " bits, %" PRIu32 " requests sent with their ACK\n", stats.transfers,
+		stats.bits, stats.requests_merged);
+	return true;
+}
+
+/*
+ * swd_queue command - Show or switch queued SWD memory reads
+ * Usage: mon swd_queue [enable|disable|reset]
+ * Takes effect for targets attached over SWD, "mon swd_bench" compares the
+ * mem32 throughput with it on and off.
+ */
+static bool cmd_swd_queue(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "enable"))
+			swd_queue_enable(true);
+		else if (!strcmp(argv[1], "disable"))
+			swd_queue_enable(false);
+		else if (!strcmp(argv[1], "reset"))
+			swd_queue_reset_stats();
+		else {
+			gdb_out("Usage: swd_queue [enable|disable|reset]\n");
+			return false;
+		}
+	}
+
+	swd_queue_stats_s stats;
+	swd_queue_get_stats(&stats);
+	gdb_outf("Queued SWD reads %s\n", stats.enabled ? "enabled" : "disabled");
+	gdb_outf("%" PRIu32 " bursts, %" PRIu32 " transactions, %" PRIu32 " WAITs retried, %" PRIu32 " faults\n",
+		stats.bursts, stats.transactions, stats.waits, stats.faults);
+	return true;
+}
+
+/* Idle bits clocked per TCK measurement, and DMI reads timed by default */
+#define JTAG_BENCH_BITS      4096U
+#define JTAG_BENCH_READS     1000U
+#define JTAG_BENCH_MAX_READS 100000U
+/* Debug Module register read for the DMI timing, as it has no side effects */
+#define JTAG_BENCH_DMSTATUS 0x11U
+
+/* Hundredths of a CPU cycle per bit of a TDI sequence, TMS held low */
+static uint32_t jtag_bench_centicycles(void)
+{
+	static const uint8_t idle[JTAG_BENCH_BITS / 8U];
+	uint32_t best = UINT32_MAX;
+	for (size_t run = 0; run < SWD_BENCH_RUNS; ++run) {
+		const uint32_t start = esp_cpu_get_cycle_count();
+		jtag_proc.jtagtap_tdi_seq(false, idle, JTAG_BENCH_BITS);
+		best = MIN(best, esp_cpu_get_cycle_count() - start);
+	}
+	return (uint32_t)(((uint64_t)best * 100U) / JTAG_BENCH_BITS);
+}
+
+static void jtag_bench_print_tck(const char *const name, const uint32_t centicycles, const uint32_t cpu_mhz)
+{
+	gdb_outf("TCK (%s): %" PRIu32 ".%02" PRIu32 " cycles/bit, %" PRIu32 " kHz at %" PRIu32 " MHz\n", name,
+		centicycles / 100U, centicycles % 100U, (uint32_t)(((uint64_t)cpu_mhz * 100000U) / centicycles), cpu_mhz);
+}
+
+/*
+ * jtag_bench command - Measure the TCK rate and RISC-V DMI read throughput
+ * Usage: mon jtag_bench [reads]
+ * Idle cycles (TMS and TDI low, which keeps the TAPs in Run-Test/Idle) are
+ * clocked with jtagtap.c's bit loop and with the word-wide one. Then reads
+ * reads (1000 by default) of DMSTATUS on the attached RISC-V target are timed
+ * with whichever of the two "mon jtag_shift" has selected.
+ */
+static bool cmd_jtag_bench(target_s *t, int argc, const char **argv)
+{
+	uint32_t reads = JTAG_BENCH_READS;
+	if (argc > 1) {
+		reads = strtoul(argv[1], NULL, 0);
+		if (!reads || reads > JTAG_BENCH_MAX_READS) {
+			gdb_out("Usage: jtag_bench [reads]\n");
+			return false;
+		}
+	}
+	if (swd_engine_transport_swd() || !jtag_proc.jtagtap_tdi_seq) {
+		gdb_out("jtag_bench: not in JTAG mode, scan with jtag_scan first\n");
+		return false;
+	}
+
+	const uint32_t cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	const bool enabled = jtag_shift_enabled();
+	jtag_shift_enable(false);
+	jtag_bench_print_tck("bit", jtag_bench_centicycles(), cpu_mhz);
+	jtag_shift_enable(true);
+	jtag_bench_print_tck("word", jtag_bench_centicycles(), cpu_mhz);
+	jtag_shift_enable(enabled);
+
+	/* RISC-V harts name their core after the ISA, rv32... or rv64... */
+	if (!t || !t->core || strncmp(t->core, "rv", 2U) != 0) {
+		gdb_out("DMI: no RISC-V target attached\n");
+		return true;
+	}
+	riscv_hart_s *const hart = riscv_hart_struct(t);
+	uint32_t status = 0;
+	bool ok = true;
+	const int64_t start = esp_timer_get_time();
+	for (uint32_t i = 0; ok && i < reads; ++i)
+		ok = riscv_dm_read(hart->dbg_module, JTAG_BENCH_DMSTATUS, &status);
+	const uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+	if (!ok) {
+		gdb_out("DMI: read failed\n");
+		return false;
+	}
+	gdb_outf("DMI: %" PRIu32 " reads in %" PRIu32 " us, %" PRIu32 " reads/s (%s shifts)\n", reads, elapsed_us,
+		elapsed_us ? (uint32_t)(((uint64_t)reads * 1000000U) / elapsed_us) : 0U, enabled ? "word" : "bit");
+	return true;
+}
+
+/*
+ * jtag_shift command - Show or switch word-wide JTAG shifts
+ * Usage: mon jtag_shift [enable|disable]
+ * Disabled, TDI/TDO sequences go through jtagtap.c's bit loop as upstream.
+ */
+static bool cmd_jtag_shift(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 1) {
+		if (!strcmp(argv[1], "enable"))
+			jtag_shift_enable(true);
+		else if (!strcmp(argv[1], "disable"))
+			jtag_shift_enable(false);
+		else {
+			gdb_out("Usage: jtag_shift [enable|disable]\n");
+			return false;
+		}
+	}
+	gdb_outf("Word-wide JTAG shifts %s\n", jtag_shift_enabled() ? "enabled" : "disabled");
+	return true;
+}
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+/* Tasks whose run time is remembered between "mon tasks" calls */
+#define TASKS_MAX 32U
+
+typedef struct task_runtime {
+	TaskHandle_t handle;
+	uint32_t runtime;
+} task_runtime_s;
+
+static task_runtime_s tasks_last[TASKS_MAX];
+static size_t tasks_last_count;
+static uint32_t tasks_last_total;
+
+static uint32_t tasks_last_runtime(const TaskHandle_t handle)
+{
+	for (size_t i = 0; i < tasks_last_count; ++i) {
+		if (tasks_last[i].handle == handle)
+			return tasks_last[i].runtime;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * tasks command - Show the FreeRTOS tasks, where they run and their CPU use
+ * Usage: mon tasks
+ * CPU use is since the previous "mon tasks", as a share of the core the task ran on.
+ */
+static bool cmd_tasks(target_s *t, int argc, const char **argv)
+{
+	(void)t;
+	(void)argc;
+	(void)argv;
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+	/* A little slack in case tasks get created while we look */
+	UBaseType_t count = uxTaskGetNumberOfTasks() + 4U;
+	TaskStatus_t *const tasks = malloc(count * sizeof(*tasks));
+	if (!tasks) {
+		gdb_out("Out of memory\n");
+		return false;
+	}
+	configRUN_TIME_COUNTER_TYPE total_runtime = 0;
+	count = uxTaskGetSystemState(tasks, count, &total_runtime);
+	/* The counters are microseconds and wrap, differences are what matter */
+	const uint32_t total = (uint32_t)total_runtime;
+	const uint32_t elapsed = total - tasks_last_total;
+
+	gdb_out("Task             Core Prio Stack  CPU%\n");
+	for (UBaseType_t i = 0; i < count; ++i) {
+		const TaskStatus_t *const task = &tasks[i];
+		const uint32_t runtime = (uint32_t)task->ulRunTimeCounter - tasks_last_runtime(task->xHandle);
+		char core[4] = "any";
+#if configTASKLIST_INCLUDE_COREID
+		if (task->xCoreID != tskNO_AFFINITY)
+			snprintf(core, sizeof(core), "%d", (int)task->xCoreID);
+#endif
+		const uint32_t permille = elapsed ? (uint32_t)(((uint64_t)runtime * 1000U) / elapsed) : 0U;
+		gdb_outf("%-16s %4s %4u %5" PRIu32 " %3" PRIu32 ".%" PRIu32 "\n", task->pcTaskName, core,
+			(unsigned)task->uxCurrentPriority, (uint32_t)task->usStackHighWaterMark, permille / 10U,
+			permille % 10U);
+	}
+
+	tasks_last_count = MIN(count, TASKS_MAX);
+	for (size_t i = 0; i < tasks_last_count; ++i) {
+		tasks_last[i].handle = tasks[i].xHandle;
+		tasks_last[i].runtime = (uint32_t)tasks[i].ulRunTimeCounter;
+	}
+	tasks_last_total = total;
+	free(tasks);
+	return true;
+#else
+	gdb_out("Needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS\n");
+	return false;
+#endif
+}
+
 /*
  * Platform-specific command list
  * This is referenced by upstream command.c when PLATFORM_HAS_CUSTOM_COMMANDS is defined
@@ -52,5 +735,20 @@ static bool cmd_uart_send(target_s *t, int argc, const char **argv)
 const command_s platform_cmd_list[] = {
 	{"uart_scan", cmd_uart_scan, "STM32 UART boot mode scan on TRACESWO pin"},
 	{"uart_send", cmd_uart_send, "Send bytes on TRACESWO_DUMMY_TX pin"},
+	{"gdb_stats", cmd_gdb_stats, "Show GDB transport statistics: [reset]"},
+	{"mem_cache", cmd_mem_cache, "Target memory/register cache: [enable|disable|reset]"},
+	{"profile", cmd_profile, "PC sampling profiler, gmon.out on the web server: [start [hz]|stop|reset]"},
+	{"run_loop", cmd_run_loop, "Show halt poll latency and GDB thread load while running: [reset]"},
+	{"haltpoll", cmd_haltpoll, "Adaptive halt poll interval and latency histogram: [<min_us> <max_us>]"},
+	{"flash_pipeline", cmd_flash_pipeline, "Pipelined vFlashWrite: [enable|disable]"},
+	{"flash_delta", cmd_flash_delta, "Skip unchanged flash blocks on load: [enable|disable]"},
+	{"warm_scan", cmd_warm_scan, "Scan, reusing the last scan if the targets are unchanged: [swd|jtag|invalidate|status]"},
+	{"swd_bench", cmd_swd_bench, "Measure the SWCLK rate and mem32 read throughput: [kib]"},
+	{"freq_tune", cmd_freq_tune, "Pick the fastest SWD clock the target reads reliably at"},
+	{"swd_engine", cmd_swd_engine, "Bit-bang SWD or shift it through SPI: [bitbang|spi|reset]"},
+	{"swd_queue", cmd_swd_queue, "Queue SWD memory reads into bursts: [enable|disable|reset]"},
+	{"jtag_bench", cmd_jtag_bench, "Measure the TCK rate and RISC-V DMI read throughput: [reads]"},
+	{"jtag_shift", cmd_jtag_shift, "Shift JTAG sequences a word at a time: [enable|disable]"},
+	{"tasks", cmd_tasks, "Show FreeRTOS tasks, their core and CPU use since the last call"},
 	{NULL, NULL, NULL},
 };
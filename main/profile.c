@@ -0,0 +1,408 @@
+/*
+ * Statistical PC sampling profiler for the ESP32 probe
+ *
+ * An esp_timer wakes the profiler task once per sampling slot and the task
+ * takes the samples due in that slot while holding the target bus lock.
+ *
+ * On Cortex-M targets that implement DWT_PCSR a slot is one burst of AP
+ * reads of PCSR with the address increment turned off. The reads are posted,
+ * so after the CSW/TAR setup each sample costs a single SWD transaction and
+ * the target is never stopped. Elsewhere (RISC-V, ARMv6-M parts without
+ * PCSR) the target is halted, its PC read through the target description and
+ * resumed, which is a lot slower and limited to PROFILE_MAX_HALT_HZ.
+ *
+ * Samples are only taken while GDB has the target running, so time spent
+ * stopped at breakpoints doesn't show up in the profile.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortex_internal.h"
+#include "cortexm.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+#include "profile.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#define PROFILE_TASK_STACK 4096U
+/* Above the GDB thread, so GDB traffic doesn't hold sampling off */
+#define PROFILE_TASK_PRIORITY 18U
+
+/* Sampling slot, and most samples taken in one burst */
+#define PROFILE_SLOT_US   1000U
+#define PROFILE_BATCH_MAX (PROFILE_MAX_HZ / (1000000U / PROFILE_SLOT_US))
+/* Slots caught up on after the task was held off, older ones are skipped */
+#define PROFILE_MAX_CATCHUP 4U
+/* Histogram slots looked at for a PC before its sample is dropped */
+#define PROFILE_HISTOGRAM_PROBES 32U
+/* target_halt_poll() attempts after a halt request before giving up on the sample */
+#define PROFILE_HALT_TRIES 10U
+
+/* DWT program counter sample register, see DWT_PCSR in libopencm3's cm3/dwt.h */
+#define PROFILE_DWT_PCSR (CORTEXM_DWT_BASE + 0x1cU)
+/* PCSR reads as all ones while the core is halted or held in reset */
+#define PROFILE_PCSR_HALTED 0xffffffffU
+
+/* gmon.out histogram bins cover a halfword each, the smallest Thumb / RVC instruction */
+#define PROFILE_GMON_BIN_SIZE 2U
+/* Start a new histogram record rather than write out more empty bins than this */
+#define PROFILE_GMON_MAX_GAP 32U
+#define PROFILE_GMON_TAG_TIME_HIST 0U
+
+typedef struct profile_state {
+	bool running;
+	profile_mode_e mode;
+	uint32_t hz;
+	uint32_t slot_us;
+	uint32_t slot_fraction; /* Sample time carried over between slots, in Hz * us */
+	target_s *target;
+	target_halt_reason_e halt_reason;
+	target_addr64_t halt_watch;
+	uint32_t samples;
+	uint32_t halted;
+	uint32_t dropped;
+	uint32_t errors;
+	uint32_t pcs;
+} profile_state_s;
+
+/* Everything here is only touched with the target bus lock held */
+static profile_state_s profile;
+static profile_entry_s *profile_histogram;
+static TaskHandle_t profile_task_handle;
+static esp_timer_handle_t profile_timer;
+
+static void profile_record(const uint32_t pc)
+{
+	const uint32_t hash = (pc >> 1U) * 2654435761U;
+	for (size_t probe = 0; probe < PROFILE_HISTOGRAM_PROBES; ++probe) {
+		profile_entry_s *const entry = &profile_histogram[(hash + probe) % PROFILE_HISTOGRAM_SIZE];
+		if (!entry->count) {
+			entry->pc = pc;
+			++profile.pcs;
+		} else if (entry->pc != pc)
+			continue;
+		++entry->count;
+		++profile.samples;
+		return;
+	}
+	++profile.dropped;
+}
+
+static void profile_sample_pcsr(const size_t count)
+{
+	adiv5_access_port_s *const ap = cortex_ap(profile.target);
+	adiv5_debug_port_s *const dp = ap->dp;
+	uint32_t pcs[PROFILE_BATCH_MAX];
+
+	/* Point the AP at PCSR with the address increment off so every DRW read samples it */
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_NONE);
+	adiv5_ap_write(ap, ADIV5_AP_TAR_LOW, PROFILE_DWT_PCSR);
+	/* AP reads are posted, each DRW read returns the value the previous one fetched */
+	adiv5_dp_low_access(dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	for (size_t i = 1; i < count; ++i)
+		pcs[i - 1U] = adiv5_dp_low_access(dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	pcs[count - 1U] = adiv5_dp_read(dp, ADIV5_DP_RDBUFF);
+	if (adiv5_dp_error(dp)) {
+		++profile.errors;
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (pcs[i] == PROFILE_PCSR_HALTED)
+			++profile.halted;
+		else
+			profile_record(pcs[i] & ~1U);
+	}
+}
+
+static void profile_sample_halt(void)
+{
+	target_s *const target = profile.target;
+	target_addr64_t watch = 0;
+	target_halt_reason_e reason = TARGET_HALT_RUNNING;
+
+	/*
+	 * GDB single steps complete long before a halt request gets over the wire, so
+	 * the only stops seen here are ours or ones the target made on its own.
+	 */
+	target_halt_request(target);
+	for (size_t tries = 0; tries < PROFILE_HALT_TRIES && reason == TARGET_HALT_RUNNING; ++tries)
+		reason = target_halt_poll(target, &watch);
+
+	switch (reason) {
+	case TARGET_HALT_REQUEST: {
+		uint32_t pc = 0;
+		if (gdb_cache_read_pc(target, &pc))
+			profile_record(pc);
+		else
+			++profile.errors;
+		target_halt_resume(target, false);
+		break;
+	}
+	case TARGET_HALT_RUNNING:
+		/* Didn't stop in time, withdraw the request so it doesn't show up as an interrupt later */
+		++profile.errors;
+		target_halt_resume(target, false);
+		break;
+	default:
+		/* Breakpoint, fault etc, leave the target stopped for gdb_poll_target() to report */
+		profile.halt_reason = reason;
+		profile.halt_watch = watch;
+		break;
+	}
+}
+
+static void profile_sample_slots(const uint32_t slots)
+{
+	profile.slot_fraction += profile.hz * profile.slot_us * slots;
+	size_t count = profile.slot_fraction / 1000000U;
+	profile.slot_fraction %= 1000000U;
+
+	if (!count)
+		return;
+	if (profile.mode == PROFILE_MODE_PCSR)
+		profile_sample_pcsr(MIN(count, PROFILE_BATCH_MAX));
+	else
+		profile_sample_halt();
+}
+
+static void profile_timer_callback(void *arg)
+{
+	(void)arg;
+	xTaskNotifyGive(profile_task_handle);
+}
+
+static void profile_task(void *params)
+{
+	(void)params;
+	while (true) {
+		/* One notification per slot that elapsed since we last ran */
+		const uint32_t slots = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+		platform_target_lock();
+		if (profile.running && profile.target != cur_target) {
+			/* GDB moved on to another target or detached */
+			profile.running = false;
+			esp_timer_stop(profile_timer);
+		}
+		if (profile.running && gdb_target_running && profile.halt_reason == TARGET_HALT_RUNNING) {
+			TRY (EXCEPTION_ALL) {
+				profile_sample_slots(MIN(slots, PROFILE_MAX_CATCHUP));
+			}
+			CATCH () {
+			default:
+				++profile.errors;
+				break;
+			}
+		}
+		platform_target_unlock();
+	}
+}
+
+static profile_mode_e profile_detect_mode(target_s *const target)
+{
+	const char *const description = target_regs_description(target);
+	const bool m_profile = description && strstr(description, "org.gnu.gdb.arm.m-profile");
+	free((void *)description);
+	if (!m_profile)
+		return PROFILE_MODE_HALT;
+
+	/* The DWT needs trace enabled. PCSR is optional on ARMv6-M and reads as zero when absent */
+	const uint32_t demcr = target_mem32_read32(target, CORTEXM_DEMCR);
+	if (!(demcr & CORTEXM_DEMCR_TRCENA))
+		target_mem32_write32(target, CORTEXM_DEMCR, demcr | CORTEXM_DEMCR_TRCENA);
+	return target_mem32_read32(target, PROFILE_DWT_PCSR) ? PROFILE_MODE_PCSR : PROFILE_MODE_HALT;
+}
+
+bool profile_start(target_s *const target, const uint32_t hz)
+{
+	if (!profile_histogram) {
+		profile_histogram = calloc(PROFILE_HISTOGRAM_SIZE, sizeof(*profile_histogram));
+		if (!profile_histogram)
+			return false;
+	}
+	if (!profile_task_handle && xTaskCreatePinnedToCore(profile_task, "profile", PROFILE_TASK_STACK, NULL,
+									PROFILE_TASK_PRIORITY, &profile_task_handle, PLATFORM_DEBUG_CORE) != pdPASS) {
+		profile_task_handle = NULL;
+		return false;
+	}
+	if (!profile_timer) {
+		const esp_timer_create_args_t timer_args = {
+			.callback = profile_timer_callback,
+			.name = "profile",
+		};
+		if (esp_timer_create(&timer_args, &profile_timer) != ESP_OK) {
+			profile_timer = NULL;
+			return false;
+		}
+	}
+
+	/* A histogram from another target is meaningless */
+	if (target != profile.target)
+		profile_reset();
+
+	profile.mode = profile_detect_mode(target);
+	const uint32_t max_hz = profile.mode == PROFILE_MODE_PCSR ? PROFILE_MAX_HZ : PROFILE_MAX_HALT_HZ;
+	profile.hz = MAX(1U, MIN(hz, max_hz));
+	/* Slow rates get longer slots rather than lots of empty ones */
+	profile.slot_us = MAX(PROFILE_SLOT_US, 1000000U / profile.hz);
+	profile.slot_fraction = 0;
+	profile.target = target;
+	profile.halt_reason = TARGET_HALT_RUNNING;
+	profile.running = true;
+
+	esp_timer_stop(profile_timer);
+	return esp_timer_start_periodic(profile_timer, profile.slot_us) == ESP_OK;
+}
+
+void profile_stop(void)
+{
+	profile.running = false;
+	if (profile_timer)
+		esp_timer_stop(profile_timer);
+}
+
+void profile_reset(void)
+{
+	if (profile_histogram)
+		memset(profile_histogram, 0, PROFILE_HISTOGRAM_SIZE * sizeof(*profile_histogram));
+	profile.samples = 0;
+	profile.halted = 0;
+	profile.dropped = 0;
+	profile.errors = 0;
+	profile.pcs = 0;
+}
+
+void profile_get_stats(profile_stats_s *const stats)
+{
+	stats->running = profile.running;
+	stats->mode = profile.mode;
+	stats->hz = profile.hz;
+	stats->samples = profile.samples;
+	stats->halted = profile.halted;
+	stats->dropped = profile.dropped;
+	stats->errors = profile.errors;
+	stats->pcs = profile.pcs;
+}
+
+size_t profile_top(profile_entry_s *const top, const size_t count)
+{
+	size_t filled = 0;
+	for (size_t i = 0; profile_histogram && i < PROFILE_HISTOGRAM_SIZE && count; ++i) {
+		const profile_entry_s *const entry = &profile_histogram[i];
+		if (!entry->count || (filled == count && entry->count <= top[count - 1U].count))
+			continue;
+		/* Insertion sort into the (short) result list, the smallest falls off the end */
+		size_t slot = filled < count ? filled++ : count - 1U;
+		for (; slot > 0 && top[slot - 1U].count < entry->count; --slot)
+			top[slot] = top[slot - 1U];
+		top[slot] = *entry;
+	}
+	return filled;
+}
+
+target_halt_reason_e profile_halt_reason(target_addr64_t *const watch)
+{
+	const target_halt_reason_e reason = profile.halt_reason;
+	if (reason != TARGET_HALT_RUNNING) {
+		*watch = profile.halt_watch;
+		profile.halt_reason = TARGET_HALT_RUNNING;
+	}
+	return reason;
+}
+
+static void profile_write_le32(uint8_t *const buffer, const uint32_t value)
+{
+	buffer[0] = value & 0xffU;
+	buffer[1] = (value >> 8U) & 0xffU;
+	buffer[2] = (value >> 16U) & 0xffU;
+	buffer[3] = value >> 24U;
+}
+
+static int profile_entry_compare(const void *const a, const void *const b)
+{
+	const uint32_t pc_a = ((const profile_entry_s *)a)->pc;
+	const uint32_t pc_b = ((const profile_entry_s *)b)->pc;
+	return pc_a < pc_b ? -1 : pc_a > pc_b;
+}
+
+/* One GMON_TAG_TIME_HIST record covering entries, which are sorted by PC */
+static bool profile_gmon_write_hist(const profile_write_f write, void *const ctx,
+	const profile_entry_s *const entries, const size_t count, const uint32_t hz)
+{
+	const uint32_t low_pc = entries[0].pc & ~(PROFILE_GMON_BIN_SIZE - 1U);
+	const uint32_t high_pc = (entries[count - 1U].pc & ~(PROFILE_GMON_BIN_SIZE - 1U)) + PROFILE_GMON_BIN_SIZE;
+	const uint32_t bins = (high_pc - low_pc) / PROFILE_GMON_BIN_SIZE;
+
+	/* Tag, then struct gmon_hist_hdr for a little endian target with 32-bit addresses */
+	uint8_t record[1U + 4U + 4U + 4U + 4U + 15U + 1U] = {PROFILE_GMON_TAG_TIME_HIST};
+	profile_write_le32(record + 1U, low_pc);
+	profile_write_le32(record + 5U, high_pc);
+	profile_write_le32(record + 9U, bins);
+	profile_write_le32(record + 13U, hz);
+	memcpy(record + 17U, "seconds", 7U);
+	record[32] = 's';
+	if (!write(ctx, record, sizeof(record)))
+		return false;
+
+	/* The bins themselves, 16-bit counts */
+	uint8_t chunk[128];
+	size_t fill = 0;
+	size_t next = 0;
+	for (uint32_t bin = 0; bin < bins; ++bin) {
+		const uint32_t addr = low_pc + bin * PROFILE_GMON_BIN_SIZE;
+		uint32_t value = 0;
+		for (; next < count && (entries[next].pc & ~(PROFILE_GMON_BIN_SIZE - 1U)) == addr; ++next)
+			value += entries[next].count;
+		value = MIN(value, UINT16_MAX);
+		chunk[fill++] = value & 0xffU;
+		chunk[fill++] = value >> 8U;
+		if ((fill == sizeof(chunk) || bin + 1U == bins) && !write(ctx, chunk, fill))
+			return false;
+		if (fill == sizeof(chunk))
+			fill = 0;
+	}
+	return true;
+}
+
+bool profile_gmon_write(const profile_write_f write, void *const ctx)
+{
+	/* Take a copy so the target lock isn't held while the data goes out over the network */
+	platform_target_lock();
+	const size_t count = profile.pcs;
+	const uint32_t hz = profile.hz;
+	profile_entry_s *const entries = count ? malloc(count * sizeof(*entries)) : NULL;
+	if (entries) {
+		size_t copied = 0;
+		for (size_t i = 0; i < PROFILE_HISTOGRAM_SIZE && copied < count; ++i) {
+			if (profile_histogram[i].count)
+				entries[copied++] = profile_histogram[i];
+		}
+	}
+	platform_target_unlock();
+	if (!entries)
+		return false;
+	qsort(entries, count, sizeof(*entries), profile_entry_compare);
+
+	/* struct gmon_hdr: cookie, version 1 and 12 spare bytes */
+	uint8_t header[20] = {'g', 'm', 'o', 'n'};
+	profile_write_le32(header + 4U, 1U);
+	bool ok = write(ctx, header, sizeof(header));
+
+	for (size_t first = 0; ok && first < count;) {
+		/* PCs close enough together share a record, the rest of the address space is left out */
+		size_t last = first;
+		while (last + 1U < count && entries[last + 1U].pc - entries[last].pc <= PROFILE_GMON_MAX_GAP)
+			++last;
+		ok = profile_gmon_write_hist(write, ctx, entries + first, last - first + 1U, hz);
+		first = last + 1U;
+	}
+	free(entries);
+	return ok;
+}
@@ -0,0 +1,63 @@
+/*
+ * Statistical PC sampling profiler for the ESP32 probe
+ *
+ * Samples the program counter of the running target from a dedicated
+ * task and keeps a histogram of the sampled addresses, which can be
+ * downloaded as a gmon.out file from the web server and read with
+ * gprof, or summarised with "mon profile".
+ */
+
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include "target.h"
+
+/* Distinct PCs kept in the histogram, samples of further PCs are counted as dropped */
+#define PROFILE_HISTOGRAM_SIZE 2048U
+
+#define PROFILE_DEFAULT_HZ 10000U
+#define PROFILE_MAX_HZ     50000U
+/* Halting a target for every sample is much slower than reading DWT_PCSR */
+#define PROFILE_MAX_HALT_HZ 1000U
+
+typedef enum profile_mode {
+	PROFILE_MODE_PCSR, /* Cortex-M DWT program counter sample register */
+	PROFILE_MODE_HALT, /* Halt, read the PC and resume */
+} profile_mode_e;
+
+typedef struct profile_stats {
+	bool running;
+	profile_mode_e mode;
+	uint32_t hz;
+	uint32_t samples; /* PCs recorded in the histogram */
+	uint32_t halted;  /* Samples taken while the core was halted or in reset */
+	uint32_t dropped; /* Samples whose PC didn't fit in the histogram */
+	uint32_t errors;  /* Sample batches lost to target communication errors */
+	uint32_t pcs;     /* Distinct PCs in the histogram */
+} profile_stats_s;
+
+typedef struct profile_entry {
+	uint32_t pc;
+	uint32_t count;
+} profile_entry_s;
+
+/* Sink for the gmon.out data, returns false to abort */
+typedef bool (*profile_write_f)(void *ctx, const void *data, size_t len);
+
+/* Start (or change the rate of) sampling the target, which must be the current GDB target */
+bool profile_start(target_s *target, uint32_t hz);
+void profile_stop(void);
+void profile_reset(void);
+void profile_get_stats(profile_stats_s *stats);
+/* Fill top with up to count of the most sampled PCs, returns how many were filled */
+size_t profile_top(profile_entry_s *top, size_t count);
+/* Write the histogram out in gmon.out format, false if there is nothing to write or the sink failed */
+bool profile_gmon_write(profile_write_f write, void *ctx);
+
+/*
+ * Halt sampling can catch the target stopping on its own (breakpoint, fault). The
+ * stop is handed over to gdb_poll_target() through this, TARGET_HALT_RUNNING if none.
+ */
+target_halt_reason_e profile_halt_reason(target_addr64_t *watch);
+
+#endif /* __PROFILE_H */
@@ -37,6 +37,7 @@
 #include "platform.h"
 #include "rtt.h"
 #include "rtt_if.h"
+#include "run_loop.h"
 #include "gdb_packet.h"
 
 #include "freertos/FreeRTOS.h"
@@ -123,12 +124,11 @@ uint32_t rtt_write(const uint32_t channel, const char *buf, uint32_t len)
 		return len; /* Silently consume */
 	}
 
-	/* Send to GDB console - need null-terminated string */
-	char tmp[256];
-	uint32_t chunk_len = (len < sizeof(tmp) - 1) ? len : sizeof(tmp) - 1;
-	memcpy(tmp, buf, chunk_len);
-	tmp[chunk_len] = '\0';
-	gdb_out(tmp);
+	/* The target is talking, be quick to notice it stopping */
+	run_loop_activity();
+
+	/* Send to GDB console, hex encoded straight into the transmit buffer */
+	gdb_out_len(buf, len);
 
 	/* Also send to WebSocket for web UI */
 	web_server_send_rtt_data((const uint8_t *)buf, len);
@@ -161,6 +161,8 @@ int32_t rtt_getchar(const uint32_t channel)
 		xSemaphoreGive(rtt_down_mutex);
 	}
 
+	if (retval >= 0)
+		run_loop_activity();
 	return retval;
 }
 
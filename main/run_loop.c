@@ -0,0 +1,256 @@
+/*
+ * Scheduler for the GDB thread while the target runs
+ *
+ * The thread sleeps in select() on the GDB socket together with an eventfd.
+ * A one-shot esp_timer armed for the next halt or RTT poll writes to the
+ * eventfd, so the sleep ends either when GDB sends data or when a poll is
+ * due, with microsecond rather than FreeRTOS tick resolution. Without the
+ * eventfd the select() timeout is used, which rounds up to whole ticks.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "run_loop.h"
+
+#ifdef ENABLE_RTT
+#include "rtt.h"
+#endif
+
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_vfs_eventfd.h"
+
+#ifdef CONFIG_BMP_HALT_POLL_MIN_US
+#define RUN_LOOP_HALT_POLL_MIN_US CONFIG_BMP_HALT_POLL_MIN_US
+#define RUN_LOOP_HALT_POLL_MAX_US CONFIG_BMP_HALT_POLL_MAX_US
+#else
+#define RUN_LOOP_HALT_POLL_MIN_US 250U
+#define RUN_LOOP_HALT_POLL_MAX_US 10000U
+#endif
+
+#define RUN_LOOP_TICK_US (portTICK_PERIOD_MS * 1000U)
+
+/* From gdb_if.c */
+extern bool gdb_if_wait(uint32_t timeout, int wake_fd, bool *woken);
+
+static const char *TAG = "run_loop";
+
+typedef struct run_loop_state {
+	bool initialised;
+	int wake_fd;
+	esp_timer_handle_t timer;
+	int64_t start_us;
+	int64_t next_halt_us;
+	int64_t next_rtt_us;
+	int64_t halt_poll_us;      /* When the halt poll in progress was started */
+	int64_t last_halt_poll_us; /* and the one before it */
+	uint32_t halt_interval_us; /* Current halt poll interval, between the bounds below */
+	uint32_t halt_min_us;
+	uint32_t halt_max_us;
+} run_loop_state_s;
+
+/* Only used from the GDB thread */
+static run_loop_state_s run_loop = {
+	.halt_min_us = RUN_LOOP_HALT_POLL_MIN_US,
+	.halt_max_us = RUN_LOOP_HALT_POLL_MAX_US,
+};
+static run_loop_stats_s stats;
+
+static void run_loop_timer_cb(void *arg)
+{
+	(void)arg;
+	const uint64_t one = 1U;
+	write(run_loop.wake_fd, &one, sizeof(one));
+}
+
+static void run_loop_init(void)
+{
+	run_loop.initialised = true;
+	run_loop.wake_fd = -1;
+
+	const esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+	esp_err_t err = esp_vfs_eventfd_register(&config);
+	if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+		ESP_LOGW(TAG, "eventfd unavailable (%s), polls are tick aligned", esp_err_to_name(err));
+		return;
+	}
+	const int fd = eventfd(0, 0);
+	if (fd < 0) {
+		ESP_LOGW(TAG, "Unable to create eventfd, polls are tick aligned");
+		return;
+	}
+
+	const esp_timer_create_args_t timer_args = {
+		.callback = run_loop_timer_cb,
+		.name = "run_loop",
+	};
+	if (esp_timer_create(&timer_args, &run_loop.timer) != ESP_OK) {
+		close(fd);
+		return;
+	}
+	run_loop.wake_fd = fd;
+}
+
+static bool run_loop_rtt_active(void)
+{
+#ifdef ENABLE_RTT
+	return rtt_enabled;
+#else
+	return false;
+#endif
+}
+
+static uint32_t run_loop_due(const int64_t now)
+{
+	uint32_t events = 0;
+	if (now >= run_loop.next_halt_us)
+		events |= RUN_LOOP_HALT_POLL;
+	if (run_loop_rtt_active() && now >= run_loop.next_rtt_us)
+		events |= RUN_LOOP_RTT_POLL;
+	return events;
+}
+
+static void run_loop_sleep(const int64_t now)
+{
+	int64_t deadline = run_loop.next_halt_us;
+	if (run_loop_rtt_active() && run_loop.next_rtt_us < deadline)
+		deadline = run_loop.next_rtt_us;
+	const uint64_t sleep_us = (uint64_t)(deadline - now);
+
+	bool woken = false;
+	if (run_loop.wake_fd >= 0) {
+		esp_timer_start_once(run_loop.timer, sleep_us);
+		gdb_if_wait(UINT32_MAX, run_loop.wake_fd, &woken);
+		/* GDB got in first, don't let the timer cut the next sleep short */
+		if (!woken)
+			esp_timer_stop(run_loop.timer);
+	} else {
+		const uint32_t ticks = (uint32_t)((sleep_us + RUN_LOOP_TICK_US - 1U) / RUN_LOOP_TICK_US);
+		gdb_if_wait(ticks * portTICK_PERIOD_MS, -1, NULL);
+	}
+	if (woken) {
+		uint64_t count;
+		read(run_loop.wake_fd, &count, sizeof(count));
+	}
+}
+
+void run_loop_begin(void)
+{
+	if (!run_loop.initialised)
+		run_loop_init();
+
+	const int64_t now = esp_timer_get_time();
+	run_loop.start_us = now;
+	/* Poll straight away, single steps are over before we get here, then fast for a while */
+	run_loop.halt_interval_us = run_loop.halt_min_us;
+	run_loop.next_halt_us = now;
+	run_loop.next_rtt_us = now;
+	run_loop.halt_poll_us = now;
+	run_loop.last_halt_poll_us = now;
+}
+
+uint32_t run_loop_wait(void)
+{
+	int64_t now = esp_timer_get_time();
+	uint32_t events = run_loop_due(now);
+	if (!events) {
+		run_loop_sleep(now);
+		const int64_t woke = esp_timer_get_time();
+		stats.idle_us += (uint64_t)(woke - now);
+		now = woke;
+		events = run_loop_due(now);
+	}
+	/* The socket is looked at on every pass, whatever ended the sleep */
+	if (gdb_if_wait(0, -1, NULL)) {
+		events |= RUN_LOOP_SOCKET;
+		++stats.socket_wakes;
+	}
+
+	if (events & RUN_LOOP_HALT_POLL) {
+		run_loop.last_halt_poll_us = run_loop.halt_poll_us;
+		run_loop.halt_poll_us = now;
+		run_loop.next_halt_us = now + run_loop.halt_interval_us;
+		++stats.halt_polls;
+	}
+	if (events & RUN_LOOP_RTT_POLL) {
+#ifdef ENABLE_RTT
+		run_loop.next_rtt_us = now + (int64_t)rtt_min_poll_ms * 1000;
+#endif
+		++stats.rtt_polls;
+	}
+	return events;
+}
+
+static size_t run_loop_latency_bucket(const uint32_t latency)
+{
+	size_t bucket = 0;
+	while (bucket < RUN_LOOP_LATENCY_BUCKETS - 1U && latency >= (RUN_LOOP_LATENCY_BASE_US << bucket))
+		++bucket;
+	return bucket;
+}
+
+void run_loop_halt_polled(const bool halted)
+{
+	if (!halted) {
+		/* Still running, the halt is probably a while off yet */
+		uint32_t interval = run_loop.halt_interval_us * 2U;
+		if (interval > run_loop.halt_max_us)
+			interval = run_loop.halt_max_us;
+		run_loop.next_halt_us += (int64_t)(interval - run_loop.halt_interval_us);
+		run_loop.halt_interval_us = interval;
+		return;
+	}
+	/*
+	 * The target stopped at some point after the previous poll looked at it, so
+	 * from then until now, with the stop reply sent, bounds the reporting latency.
+	 */
+	const uint32_t latency = (uint32_t)(esp_timer_get_time() - run_loop.last_halt_poll_us);
+	++stats.halts;
+	stats.latency_total_us += latency;
+	if (latency > stats.latency_max_us)
+		stats.latency_max_us = latency;
+	++stats.latency_hist[run_loop_latency_bucket(latency)];
+}
+
+void run_loop_activity(void)
+{
+	run_loop.halt_interval_us = run_loop.halt_min_us;
+	const int64_t next = run_loop.halt_poll_us + run_loop.halt_min_us;
+	if (next < run_loop.next_halt_us)
+		run_loop.next_halt_us = next;
+}
+
+void run_loop_end(void)
+{
+	stats.run_us += (uint64_t)(esp_timer_get_time() - run_loop.start_us);
+}
+
+void run_loop_get_stats(run_loop_stats_s *const result)
+{
+	*result = stats;
+}
+
+void run_loop_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool run_loop_set_halt_poll(const uint32_t min_us, const uint32_t max_us)
+{
+	if (min_us > max_us)
+		return false;
+	run_loop.halt_min_us = min_us;
+	run_loop.halt_max_us = max_us;
+	run_loop.halt_interval_us = min_us;
+	return true;
+}
+
+void run_loop_get_halt_poll(uint32_t *const min_us, uint32_t *const max_us)
+{
+	*min_us = run_loop.halt_min_us;
+	*max_us = run_loop.halt_max_us;
+}
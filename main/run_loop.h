@@ -0,0 +1,69 @@
+/*
+ * Scheduler for the GDB thread while the target runs
+ *
+ * Rather than spin over the halt poll, the socket and RTT, the GDB thread
+ * sleeps until the next of them is due: halt polls and RTT polls each have
+ * their own cadence, and the socket wakes the thread through select() as
+ * soon as GDB sends something. Halt polls back off while the target keeps
+ * running, as every one of them is SWD traffic that perturbs the target. The
+ * stats measure what that costs in halt detection latency and saves in CPU
+ * time.
+ */
+
+#ifndef __RUN_LOOP_H
+#define __RUN_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Work due when run_loop_wait() returns */
+#define RUN_LOOP_HALT_POLL (1U << 0U)
+#define RUN_LOOP_RTT_POLL  (1U << 1U)
+#define RUN_LOOP_SOCKET    (1U << 2U) /* GDB data (or a closed connection) waiting to be read */
+
+/*
+ * Halt to stop reply latency histogram: bucket 0 counts latencies below
+ * RUN_LOOP_LATENCY_BASE_US, bucket n those below RUN_LOOP_LATENCY_BASE_US << n,
+ * and the last one everything longer.
+ */
+#define RUN_LOOP_LATENCY_BUCKETS 12U
+#define RUN_LOOP_LATENCY_BASE_US 64U
+
+typedef struct run_loop_stats {
+	uint32_t halt_polls;
+	uint32_t rtt_polls;
+	uint32_t socket_wakes;
+	uint32_t halts;          /* Halts the target made on its own (not ^C) */
+	uint32_t latency_max_us; /* Longest a halt could have taken to be reported */
+	uint64_t latency_total_us;
+	uint32_t latency_hist[RUN_LOOP_LATENCY_BUCKETS];
+	uint64_t run_us;         /* Time spent in the run loop */
+	uint64_t idle_us;        /* Part of run_us spent asleep */
+} run_loop_stats_s;
+
+/* The target was resumed, halt polls start over at the minimum interval */
+void run_loop_begin(void);
+/* Sleep until the next poll is due or GDB sends data, returns the RUN_LOOP_* work to do */
+uint32_t run_loop_wait(void);
+/*
+ * Report a halt poll's outcome, halted if the stop was not asked for by GDB.
+ * Called once any stop reply has gone out. Polls that find the target still
+ * running double the halt poll interval, up to the maximum.
+ */
+void run_loop_halt_polled(bool halted);
+/* Something is going on (^C, RTT traffic), halt polls snap back to the minimum interval */
+void run_loop_activity(void);
+/* The target stopped running */
+void run_loop_end(void);
+
+/*
+ * Adaptive halt polling bounds. A minimum of 0 polls continuously, a maximum
+ * equal to the minimum turns the back off off. Returns false if min > max.
+ */
+bool run_loop_set_halt_poll(uint32_t min_us, uint32_t max_us);
+void run_loop_get_halt_poll(uint32_t *min_us, uint32_t *max_us);
+
+void run_loop_get_stats(run_loop_stats_s *stats);
+void run_loop_reset_stats(void);
+
+#endif /* __RUN_LOOP_H */
@@ -0,0 +1,178 @@
+/*
+ * Calibrated SWD/JTAG clock for the ESP32 probe
+ *
+ * A bit takes a fixed number of CPU cycles plus a number per divider step,
+ * as the delay loop runs target_clk_divider times on each edge. Both are
+ * measured by clocking idle cycles (SWDIO low, which the target ignores)
+ * at two dividers, and the no delay loop separately. The fastest of a few
+ * runs is kept so an interrupt landing in one doesn't skew the result.
+ *
+ * JTAG uses the same target_clk_divider. Its bit loop isn't timed on its
+ * own, so the frequencies here are those of SWD.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortex_internal.h"
+#include "swd.h"
+#include "swd_clock.h"
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+
+#define SWD_CLOCK_BITS         1024U
+#define SWD_CLOCK_RUNS         4U
+#define SWD_CLOCK_STEP_DIVIDER 64U
+/* About 10 kHz at 160 MHz, slow enough for any cable */
+#define SWD_CLOCK_DIVIDER_MAX  1000U
+
+static const char *TAG = "swd_clock";
+
+static const uint32_t tune_dividers[SWD_CLOCK_TUNE_STEPS] = {UINT32_MAX, 0U, 1U, 2U, 4U, 8U, 16U, 32U, 64U, 128U};
+
+static swd_clock_calibration_s calibration;
+
+/* Hundredths of a CPU cycle per bit with the given divider */
+static uint32_t swd_clock_time_bits(const uint32_t divider)
+{
+	target_clk_divider = divider;
+	uint32_t best = UINT32_MAX;
+	for (size_t run = 0; run < SWD_CLOCK_RUNS; ++run) {
+		const uint32_t start = esp_cpu_get_cycle_count();
+		for (size_t i = 0; i < SWD_CLOCK_BITS / 32U; ++i)
+			swd_proc.seq_out(0U, 32U);
+		best = MIN(best, esp_cpu_get_cycle_count() - start);
+	}
+	return (uint32_t)(((uint64_t)best * 100U) / SWD_CLOCK_BITS);
+}
+
+void swd_clock_calibrate(void)
+{
+	const uint32_t divider = target_clk_divider;
+	swdptap_init();
+	calibration.cpu_mhz = esp_rom_get_cpu_ticks_per_us();
+	calibration.no_delay = swd_clock_time_bits(UINT32_MAX);
+	calibration.base = swd_clock_time_bits(0U);
+	const uint32_t slow = swd_clock_time_bits(SWD_CLOCK_STEP_DIVIDER);
+	calibration.per_step = slow > calibration.base ? (slow - calibration.base) / SWD_CLOCK_STEP_DIVIDER : 0U;
+	calibration.valid = calibration.no_delay && calibration.per_step;
+	target_clk_divider = divider;
+
+	if (calibration.valid)
+		ESP_LOGI(TAG, "SWD clock %" PRIu32 " kHz without delay, %" PRIu32 " kHz to %" PRIu32 " kHz with",
+			swd_clock_frequency(UINT32_MAX) / 1000U, swd_clock_frequency(0U) / 1000U,
+			swd_clock_frequency(SWD_CLOCK_DIVIDER_MAX) / 1000U);
+	else
+		ESP_LOGW(TAG, "SWD clock calibration failed, frequency setting unavailable");
+}
+
+void swd_clock_get_calibration(swd_clock_calibration_s *const result)
+{
+	*result = calibration;
+}
+
+uint32_t swd_clock_frequency(const uint32_t divider)
+{
+	if (!calibration.valid)
+		return 0;
+	const uint32_t centicycles =
+		divider == UINT32_MAX ? calibration.no_delay : calibration.base + divider * calibration.per_step;
+	return (uint32_t)(((uint64_t)calibration.cpu_mhz * 100000000U) / centicycles);
+}
+
+void swd_clock_set(const uint32_t frequency)
+{
+	if (!calibration.valid || !frequency)
+		return;
+	const uint64_t centicycles = ((uint64_t)calibration.cpu_mhz * 100000000U) / frequency;
+	if (centicycles <= calibration.no_delay)
+		target_clk_divider = UINT32_MAX;
+	else if (centicycles <= calibration.base)
+		target_clk_divider = 0;
+	else {
+		/* Round the divider up, so the clock never goes faster than asked */
+		const uint64_t steps = (centicycles - calibration.base + calibration.per_step - 1U) / calibration.per_step;
+		target_clk_divider = (uint32_t)MIN(steps, SWD_CLOCK_DIVIDER_MAX);
+	}
+}
+
+uint32_t swd_clock_get(void)
+{
+	return swd_clock_frequency(target_clk_divider);
+}
+
+/* Reads that went wrong at the current speed */
+static uint32_t swd_clock_stress(adiv5_access_port_s *const ap, const uint32_t dpidr, const uint32_t ap_idr)
+{
+	adiv5_debug_port_s *const dp = ap->dp;
+	volatile uint32_t errors = 0;
+	volatile size_t done = 0;
+	TRY (EXCEPTION_ALL) {
+		/*
+		 * Start from a line reset, through adiv5_swd.c's protocol recovery: a reset
+		 * deselects a multi-drop DP, so it writes TARGETSEL again on DPv2 and later
+		 * before reading DPIDR, and clears any sticky errors.
+		 */
+		dp->error(dp, true);
+		if (adiv5_dp_read(dp, ADIV5_DP_DPIDR) != dpidr)
+			++errors;
+		/* AP reads are posted, so each one also goes through RDBUFF */
+		for (; done < SWD_CLOCK_TUNE_READS; ++done) {
+			if (adiv5_dp_read(dp, ADIV5_DP_DPIDR) != dpidr)
+				++errors;
+			if (adiv5_ap_read(ap, ADIV5_AP_IDR) != ap_idr)
+				++errors;
+		}
+		if (adiv5_dp_error(dp))
+			++errors;
+	}
+	CATCH () {
+	default:
+		/* Everything not read counts as failed */
+		errors += (SWD_CLOCK_TUNE_READS - done) * 2U + 1U;
+		break;
+	}
+	return errors;
+}
+
+size_t swd_clock_tune(target_s *const target, swd_clock_tune_result_s *const results)
+{
+	if (!calibration.valid || target->priv_free != cortex_priv_free)
+		return 0;
+	adiv5_access_port_s *const ap = cortex_ap(target);
+	const uint32_t divider = target_clk_divider;
+
+	/* What the reads should return, taken at the speed that got the target attached */
+	volatile uint32_t dpidr = 0;
+	volatile uint32_t ap_idr = 0;
+	TRY (EXCEPTION_ALL) {
+		dpidr = adiv5_dp_read(ap->dp, ADIV5_DP_DPIDR);
+		ap_idr = adiv5_ap_read(ap, ADIV5_AP_IDR);
+	}
+	CATCH () {
+	default:
+		return 0;
+	}
+	if (adiv5_dp_error(ap->dp) || !dpidr || !ap_idr)
+		return 0;
+
+	size_t count = 0;
+	bool found = false;
+	for (; count < SWD_CLOCK_TUNE_STEPS && !found; ++count) {
+		target_clk_divider = tune_dividers[count];
+		results[count].divider = target_clk_divider;
+		results[count].frequency = swd_clock_get();
+		results[count].errors = swd_clock_stress(ap, dpidr, ap_idr);
+		found = !results[count].errors;
+	}
+	if (!found) {
+		/* Nothing passed, not even the slowest tried, go back to where we were */
+		target_clk_divider = divider;
+		swd_clock_stress(ap, dpidr, ap_idr);
+	}
+	return count;
+}
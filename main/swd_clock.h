@@ -0,0 +1,53 @@
+/*
+ * Calibrated SWD/JTAG clock for the ESP32 probe
+ *
+ * The bit-banged SWD loop waits target_clk_divider iterations of a delay
+ * loop on each clock edge, or not at all with it at UINT32_MAX. How long
+ * that makes a bit depends on the chip, its clock and the build, so the
+ * loop is timed at boot and requested frequencies are turned into the
+ * divider that comes closest without going over.
+ */
+
+#ifndef __SWD_CLOCK_H
+#define __SWD_CLOCK_H
+
+#include "target.h"
+
+/* Dividers tried by swd_clock_tune(), fastest first */
+#define SWD_CLOCK_TUNE_STEPS 10U
+/* DPIDR and AP IDR reads a speed has to get right to pass */
+#define SWD_CLOCK_TUNE_READS 500U
+
+typedef struct swd_clock_calibration {
+	bool valid;
+	uint32_t cpu_mhz;
+	/* Hundredths of a CPU cycle per bit */
+	uint32_t no_delay;  /* Divider UINT32_MAX */
+	uint32_t base;      /* Divider 0 */
+	uint32_t per_step;  /* Added by each step of the divider */
+} swd_clock_calibration_s;
+
+typedef struct swd_clock_tune_result {
+	uint32_t divider;
+	uint32_t frequency;
+	uint32_t errors; /* Reads that failed or returned the wrong value, 0 if it passed */
+} swd_clock_tune_result_s;
+
+/* Time the SWD bit loop, done once at boot before anything is attached */
+void swd_clock_calibrate(void);
+void swd_clock_get_calibration(swd_clock_calibration_s *calibration);
+
+/* Frequency the given divider gives, 0 if not calibrated */
+uint32_t swd_clock_frequency(uint32_t divider);
+/* platform_max_frequency_set/get */
+void swd_clock_set(uint32_t frequency);
+uint32_t swd_clock_get(void);
+
+/*
+ * Try the attached SWD target at each divider from the fastest, keeping the
+ * first that passes a read stress test. results gets a line per speed tried,
+ * returns how many or 0 if the target didn't respond at the current speed.
+ */
+size_t swd_clock_tune(target_s *target, swd_clock_tune_result_s *results);
+
+#endif /* __SWD_CLOCK_H */
@@ -0,0 +1,226 @@
+/*
+ * SWD sequence engine for the ESP32 probe
+ *
+ * swdptap.c turns SWDIO around on the first clock of a sequence that goes
+ * the other way than the one before, and seq_in_parity turns it back at its
+ * end. The same is done here by giving the transfer a turnaround phase, and
+ * reading one bit more at the end of seq_in_parity, so the line direction the
+ * target sees stays the same as with the bit-banged functions.
+ *
+ * swd_scan calls swdptap_init(), which is wrapped at link time (see
+ * CMakeLists.txt) so the engine can take swd_proc over after it. jtag_scan
+ * calls jtagtap_init(), wrapped to hand the pins back first and put the
+ * word-wide shifts of jtag_shift.c in after it.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "swd.h"
+#include "swd_engine.h"
+#include "jtag_shift.h"
+
+#include "esp_log.h"
+
+/* Start bit, park bit and parity over APnDP, RnW and A[2:3] */
+#define SWD_ENGINE_REQUEST_MASK  0xc1U
+#define SWD_ENGINE_REQUEST_BITS  0x81U
+#define SWD_ENGINE_REQUEST_PARITY_FIELDS 0x1eU
+#define SWD_ENGINE_REQUEST_PARITY 0x20U
+
+void __real_swdptap_init(void);
+void __real_jtagtap_init(void);
+
+static const char *TAG = "swd_engine";
+
+#ifdef CONFIG_BMP_SWD_SPI
+#define SWD_ENGINE_DEFAULT SWD_ENGINE_SPI
+#else
+#define SWD_ENGINE_DEFAULT SWD_ENGINE_BITBANG
+#endif
+
+/* Bit-banged until swd_engine_init(), so swd_clock_calibrate() times the loop it is meant to */
+static swd_engine_type_e selected = SWD_ENGINE_BITBANG;
+static uint32_t frequency = CONFIG_BMP_SWD_SPI_FREQ_KHZ * 1000U;
+static const swd_engine_backend_s *engine_backend;
+static swd_engine_stats_s stats;
+/* Whether the last scan set up SWD rather than JTAG */
+static bool transport_swd;
+
+/* Whether the probe drives SWDIO, as the target last saw it */
+static bool driving;
+static bool request_pending;
+static uint8_t request;
+
+static uint64_t swd_engine_mask(const size_t bits)
+{
+	return bits >= 64U ? UINT64_MAX : (UINT64_C(1) << bits) - 1U;
+}
+
+static bool swd_engine_is_request(const uint32_t value, const size_t clock_cycles)
+{
+	return clock_cycles == 8U && (value & SWD_ENGINE_REQUEST_MASK) == SWD_ENGINE_REQUEST_BITS &&
+		(bool)__builtin_parity(value & SWD_ENGINE_REQUEST_PARITY_FIELDS) == (bool)(value & SWD_ENGINE_REQUEST_PARITY);
+}
+
+static void swd_engine_run(swd_engine_transfer_s *const transfer)
+{
+	if (request_pending) {
+		transfer->request_bits = 8U;
+		transfer->request = request;
+		request_pending = false;
+		if (transfer->in_bits)
+			++stats.requests_merged;
+	}
+	engine_backend->transfer(transfer);
+	++stats.transfers;
+	stats.bits += transfer->request_bits + transfer->turnaround + transfer->out_bits + transfer->in_bits;
+}
+
+static void swd_engine_seq_out(const uint32_t tms_states, const size_t clock_cycles)
+{
+	/* Held back to go with the ACK, it is always followed by a seq_in that will send it */
+	if (driving && !request_pending && swd_engine_is_request(tms_states, clock_cycles)) {
+		request = (uint8_t)tms_states;
+		request_pending = true;
+		return;
+	}
+	swd_engine_transfer_s transfer = {
+		.turnaround = !driving,
+		.out_bits = (uint8_t)clock_cycles,
+		.out = tms_states & swd_engine_mask(clock_cycles),
+	};
+	driving = true;
+	swd_engine_run(&transfer);
+}
+
+static void swd_engine_seq_out_parity(const uint32_t tms_states, const size_t clock_cycles)
+{
+	const uint64_t value = tms_states & swd_engine_mask(clock_cycles);
+	swd_engine_transfer_s transfer = {
+		.turnaround = !driving,
+		.out_bits = (uint8_t)(clock_cycles + 1U),
+		.out = value | ((uint64_t)__builtin_parityll(value) << clock_cycles),
+	};
+	driving = true;
+	swd_engine_run(&transfer);
+}
+
+static uint32_t swd_engine_seq_in(const size_t clock_cycles)
+{
+	swd_engine_transfer_s transfer = {
+		.turnaround = driving,
+		.in_bits = (uint8_t)clock_cycles,
+	};
+	driving = false;
+	swd_engine_run(&transfer);
+	return (uint32_t)(transfer.in & swd_engine_mask(clock_cycles));
+}
+
+static bool swd_engine_seq_in_parity(uint32_t *const ret, const size_t clock_cycles)
+{
+	/* The data, its parity bit and the clock turning SWDIO back to the probe */
+	swd_engine_transfer_s transfer = {
+		.turnaround = driving,
+		.in_bits = (uint8_t)(clock_cycles + 2U),
+	};
+	driving = true;
+	swd_engine_run(&transfer);
+	const uint64_t value = transfer.in & swd_engine_mask(clock_cycles);
+	*ret = (uint32_t)value;
+	return (bool)__builtin_parityll(value) == (bool)((transfer.in >> clock_cycles) & 1U);
+}
+
+void swd_engine_attach(const swd_engine_backend_s *const backend)
+{
+	engine_backend = backend;
+	/* As swdptap_init() leaves it, the first sequence out clocks a turnaround */
+	driving = false;
+	request_pending = false;
+	swd_proc.seq_in = swd_engine_seq_in;
+	swd_proc.seq_in_parity = swd_engine_seq_in_parity;
+	swd_proc.seq_out = swd_engine_seq_out;
+	swd_proc.seq_out_parity = swd_engine_seq_out_parity;
+}
+
+static void swd_engine_stop(void)
+{
+	if (!engine_backend)
+		return;
+	engine_backend->stop();
+	engine_backend = NULL;
+}
+
+void __wrap_swdptap_init(void)
+{
+	__real_swdptap_init();
+	transport_swd = true;
+	if (selected == SWD_ENGINE_BITBANG) {
+		swd_engine_stop();
+		return;
+	}
+	if (!engine_backend) {
+		if (!swd_engine_spi.start(frequency)) {
+			ESP_LOGW(TAG, "SPI unavailable, bit-banging SWD");
+			return;
+		}
+		ESP_LOGI(TAG, "SWD through SPI at %" PRIu32 " kHz", swd_engine_spi.get_frequency() / 1000U);
+	}
+	swd_engine_attach(&swd_engine_spi);
+}
+
+void __wrap_jtagtap_init(void)
+{
+	swd_engine_stop();
+	transport_swd = false;
+	__real_jtagtap_init();
+	jtag_shift_attach();
+}
+
+void swd_engine_init(void)
+{
+	selected = SWD_ENGINE_DEFAULT;
+}
+
+void swd_engine_select(const swd_engine_type_e type)
+{
+	selected = type;
+}
+
+bool swd_engine_active(void)
+{
+	return engine_backend != NULL;
+}
+
+bool swd_engine_transport_swd(void)
+{
+	return transport_swd;
+}
+
+void swd_engine_set_frequency(const uint32_t new_frequency)
+{
+	if (!new_frequency)
+		return;
+	if (engine_backend && !engine_backend->set_frequency(new_frequency))
+		return;
+	frequency = new_frequency;
+}
+
+uint32_t swd_engine_get_frequency(void)
+{
+	return engine_backend ? engine_backend->get_frequency() : 0U;
+}
+
+void swd_engine_get_stats(swd_engine_stats_s *const result)
+{
+	*result = stats;
+	result->selected = selected;
+	result->active = engine_backend != NULL;
+	result->frequency = swd_engine_get_frequency();
+}
+
+void swd_engine_reset_stats(void)
+{
+	stats.transfers = 0;
+	stats.requests_merged = 0;
+	stats.bits = 0;
+}
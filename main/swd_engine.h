@@ -0,0 +1,81 @@
+/*
+ * SWD sequence engine for the ESP32 probe
+ *
+ * The bit-banged swd_proc from swdptap.c spends the CPU on every clock edge.
+ * This is a replacement for its four sequence functions that hands whole
+ * sequences to a peripheral instead, through a backend that only has to clock
+ * out a transfer made of up to four phases, in this order:
+ *
+ *   request     8 bits driven, the header of an SWD transaction
+ *   turnaround  1 clock with SWDIO released
+ *   out         bits driven
+ *   in          bits sampled
+ *
+ * which is what one SPI half-duplex transaction does with its command, dummy,
+ * MOSI and MISO phases. A request header is held back until the sequence after
+ * it, so it goes out in the same transfer as the turnaround and ACK. Bits go
+ * out and come in LSB first, as they do on the wire.
+ */
+
+#ifndef __SWD_ENGINE_H
+#define __SWD_ENGINE_H
+
+#include "general.h"
+
+typedef enum swd_engine_type {
+	SWD_ENGINE_BITBANG,
+	SWD_ENGINE_SPI,
+} swd_engine_type_e;
+
+typedef struct swd_engine_transfer {
+	uint8_t request_bits; /* 8 with a request header in front, 0 without */
+	uint8_t request;
+	uint8_t turnaround; /* Clocks with SWDIO released before the data, 0 or 1 */
+	uint8_t out_bits;
+	uint8_t in_bits;
+	uint64_t out;
+	uint64_t in; /* Filled in by the backend */
+} swd_engine_transfer_s;
+
+typedef struct swd_engine_backend {
+	const char *name;
+	/* Take over SWCLK and SWDIO */
+	bool (*start)(uint32_t frequency);
+	/* Give them back as GPIOs for bit-banging */
+	void (*stop)(void);
+	void (*transfer)(swd_engine_transfer_s *transfer);
+	/* Keeps the old frequency if the new one can't be had */
+	bool (*set_frequency)(uint32_t frequency);
+	uint32_t (*get_frequency)(void);
+} swd_engine_backend_s;
+
+typedef struct swd_engine_stats {
+	swd_engine_type_e selected;
+	bool active; /* swd_proc currently goes through the backend */
+	uint32_t frequency;
+	uint32_t transfers;
+	uint32_t requests_merged; /* Requests that went out with their ACK */
+	uint32_t bits;
+} swd_engine_stats_s;
+
+extern const swd_engine_backend_s swd_engine_spi;
+
+/* Pick the Kconfig default, after the bit-bang loop has been calibrated */
+void swd_engine_init(void);
+/* Used from the next swd_scan on */
+void swd_engine_select(swd_engine_type_e type);
+/* Point swd_proc at the engine, running its transfers through backend */
+void swd_engine_attach(const swd_engine_backend_s *backend);
+bool swd_engine_active(void);
+/* Whether the targets found by the last scan are on SWD, as swd_proc only works for those */
+bool swd_engine_transport_swd(void);
+
+/* Kept for the backend, and applied to it straight away while it is active */
+void swd_engine_set_frequency(uint32_t frequency);
+/* What the active backend runs at */
+uint32_t swd_engine_get_frequency(void);
+
+void swd_engine_get_stats(swd_engine_stats_s *stats);
+void swd_engine_reset_stats(void);
+
+#endif /* __SWD_ENGINE_H */
@@ -0,0 +1,150 @@
+/*
+ * SPI backend for the SWD sequence engine
+ *
+ * GPSPI in 3-wire half-duplex mode, with SWCLK on SCLK and SWDIO on MOSI,
+ * which the peripheral turns into an input for the MISO phase and leaves
+ * undriven in the dummy phase. A transfer is one SPI transaction: the request
+ * in the command phase, the turnaround as a dummy bit, then MOSI or MISO.
+ *
+ * Mode 0 keeps SWCLK low when idle, as the bit-banged loop does, and data is
+ * set up before each rising edge. Reads are sampled on the rising edge too,
+ * just before the target moves on to the next bit, which is also where the
+ * bit-banged loop reads SWDIO.
+ *
+ * Transfers are at most 8 bytes, which fit the peripheral's own data buffer,
+ * so no DMA channel is set up and transactions are polled rather than queued:
+ * the interrupt and task switch of a queued one would take longer than the
+ * transfer. The bus is acquired for as long as the engine has the pins.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "swd_engine.h"
+
+#include <string.h>
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "esp_log.h"
+
+#define SWD_ENGINE_SPI_HOST SPI2_HOST
+
+static const char *TAG = "swd_engine_spi";
+
+static spi_device_handle_t device;
+
+static bool swd_engine_spi_add_device(const uint32_t frequency)
+{
+	const spi_device_interface_config_t config = {
+		.mode = 0,
+		.clock_speed_hz = (int)frequency,
+		.spics_io_num = -1,
+		.flags = SPI_DEVICE_3WIRE | SPI_DEVICE_HALFDUPLEX | SPI_DEVICE_BIT_LSBFIRST,
+		.queue_size = 1,
+	};
+	const esp_err_t err = spi_bus_add_device(SWD_ENGINE_SPI_HOST, &config, &device);
+	if (err != ESP_OK) {
+		ESP_LOGW(TAG, "Adding the device at %" PRIu32 " Hz failed: %s", frequency, esp_err_to_name(err));
+		return false;
+	}
+	spi_device_acquire_bus(device, portMAX_DELAY);
+	return true;
+}
+
+static void swd_engine_spi_remove_device(void)
+{
+	spi_device_release_bus(device);
+	spi_bus_remove_device(device);
+	device = NULL;
+}
+
+static bool swd_engine_spi_start(const uint32_t frequency)
+{
+	const spi_bus_config_t bus = {
+		.mosi_io_num = SWDIO_PIN,
+		.miso_io_num = -1,
+		.sclk_io_num = SWCLK_PIN,
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1,
+		.max_transfer_sz = sizeof(uint64_t),
+		.flags = SPICOMMON_BUSFLAG_MASTER,
+	};
+	const esp_err_t err = spi_bus_initialize(SWD_ENGINE_SPI_HOST, &bus, SPI_DMA_DISABLED);
+	if (err != ESP_OK) {
+		ESP_LOGW(TAG, "Bus init failed: %s", esp_err_to_name(err));
+		return false;
+	}
+	if (!swd_engine_spi_add_device(frequency)) {
+		spi_bus_free(SWD_ENGINE_SPI_HOST);
+		return false;
+	}
+	/* Nothing drives SWDIO in the turnaround */
+	gpio_pullup_en(SWDIO_PIN);
+	return true;
+}
+
+static void swd_engine_spi_stop(void)
+{
+	swd_engine_spi_remove_device();
+	spi_bus_free(SWD_ENGINE_SPI_HOST);
+	pins_init();
+}
+
+static void swd_engine_spi_transfer(swd_engine_transfer_s *const transfer)
+{
+	/* LSB first from the first byte on, so a little endian word goes out bit 0 first */
+	uint8_t out[sizeof(uint64_t)];
+	uint8_t in[sizeof(uint64_t)] = {0};
+	memcpy(out, &transfer->out, sizeof(out));
+	spi_transaction_ext_t transaction = {
+		.base =
+			{
+				.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_DUMMY,
+				.cmd = transfer->request,
+				.length = transfer->out_bits,
+				.rxlength = transfer->in_bits,
+				.tx_buffer = transfer->out_bits ? out : NULL,
+				.rx_buffer = transfer->in_bits ? in : NULL,
+			},
+		.command_bits = transfer->request_bits,
+		.dummy_bits = transfer->turnaround,
+	};
+	const esp_err_t err = spi_device_polling_transmit(device, &transaction.base);
+	if (err != ESP_OK) {
+		/* Nothing was clocked, so there is no ACK or data to hand back */
+		ESP_LOGW(TAG, "Transfer failed: %s", esp_err_to_name(err));
+		raise_exception(EXCEPTION_ERROR, "SWD SPI transfer failed");
+	}
+	if (transfer->in_bits) {
+		uint64_t value = 0;
+		memcpy(&value, in, (transfer->in_bits + 7U) / 8U);
+		transfer->in = value;
+	}
+}
+
+static uint32_t swd_engine_spi_get_frequency(void)
+{
+	int khz = 0;
+	if (spi_device_get_actual_freq(device, &khz) != ESP_OK)
+		return 0;
+	return (uint32_t)khz * 1000U;
+}
+
+static bool swd_engine_spi_set_frequency(const uint32_t frequency)
+{
+	const uint32_t old_frequency = swd_engine_spi_get_frequency();
+	swd_engine_spi_remove_device();
+	if (swd_engine_spi_add_device(frequency))
+		return true;
+	swd_engine_spi_add_device(old_frequency);
+	return false;
+}
+
+const swd_engine_backend_s swd_engine_spi = {
+	.name = "spi",
+	.start = swd_engine_spi_start,
+	.stop = swd_engine_spi_stop,
+	.transfer = swd_engine_spi_transfer,
+	.set_frequency = swd_engine_spi_set_frequency,
+	.get_frequency = swd_engine_spi_get_frequency,
+};
@@ -0,0 +1,265 @@
+/*
+ * Queued SWD transactions for the ESP32 probe
+ *
+ * The transactions are clocked with swd_proc directly, as adiv5_swd.c does,
+ * so they go through the SPI engine when that is in use. With overrun
+ * detection off (as BMP leaves it) a WAIT or FAULT has no data phase, the
+ * request can just be sent again after the turnaround.
+ *
+ * Memory reads are hooked in at the DP's mem_read, which cortexm reaches
+ * through adiv5_mem_read(). Aligned words go in bursts of up to 1 KiB, the
+ * span TAR is guaranteed to auto-increment over, and any odd bytes at either
+ * end go to the DP's own mem_read.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortex_internal.h"
+#include "swd.h"
+#include "swd_engine.h"
+#include "swd_queue.h"
+
+#define SWD_QUEUE_ACK_OK    1U
+#define SWD_QUEUE_ACK_WAIT  2U
+#define SWD_QUEUE_ACK_FAULT 4U
+
+/* Request header bits */
+#define SWD_QUEUE_REQUEST_START  0x01U
+#define SWD_QUEUE_REQUEST_APNDP  0x02U
+#define SWD_QUEUE_REQUEST_RNW    0x04U
+#define SWD_QUEUE_REQUEST_ADDR   0x18U
+#define SWD_QUEUE_REQUEST_PARITY 0x20U
+#define SWD_QUEUE_REQUEST_PARK   0x80U
+
+#define SWD_QUEUE_DP_SELECT 0x8U
+#define SWD_QUEUE_DP_RDBUFF 0xcU
+
+#define SWD_QUEUE_WAIT_TIMEOUT_MS 250U
+#define SWD_QUEUE_TAR_WRAP        1024U
+
+typedef void (*swd_queue_mem_read_f)(adiv5_access_port_s *ap, void *dest, target_addr64_t src, size_t len);
+
+#ifdef CONFIG_BMP_SWD_QUEUE
+static bool queue_enabled = true;
+#else
+static bool queue_enabled = false;
+#endif
+static swd_queue_stats_s stats;
+
+/* DP mem_read the bursts were hooked in front of, the same for every DP */
+static swd_queue_mem_read_f fallback_mem_read;
+/* Only used with the target bus lock held */
+static swd_queue_s mem_queue;
+static uint32_t mem_words[SWD_QUEUE_TAR_WRAP / 4U];
+
+static uint8_t swd_queue_request(const bool ap, const bool read, const uint16_t reg)
+{
+	uint8_t request = SWD_QUEUE_REQUEST_START | SWD_QUEUE_REQUEST_PARK | ((reg << 1U) & SWD_QUEUE_REQUEST_ADDR);
+	if (ap)
+		request |= SWD_QUEUE_REQUEST_APNDP;
+	if (read)
+		request |= SWD_QUEUE_REQUEST_RNW;
+	if (__builtin_parity(request & (SWD_QUEUE_REQUEST_APNDP | SWD_QUEUE_REQUEST_RNW | SWD_QUEUE_REQUEST_ADDR)))
+		request |= SWD_QUEUE_REQUEST_PARITY;
+	return request;
+}
+
+void swd_queue_init(swd_queue_s *const queue, adiv5_debug_port_s *const dp)
+{
+	queue->dp = dp;
+	queue->count = 0;
+}
+
+static bool swd_queue_add(swd_queue_s *const queue, const uint8_t request, const uint32_t value, uint32_t *const result)
+{
+	if (queue->count == SWD_QUEUE_SIZE)
+		return false;
+	swd_queue_entry_s *const entry = &queue->entries[queue->count++];
+	entry->request = request;
+	entry->value = value;
+	entry->result = result;
+	return true;
+}
+
+bool swd_queue_dp_read(swd_queue_s *const queue, const uint16_t reg, uint32_t *const result)
+{
+	return swd_queue_add(queue, swd_queue_request(false, true, reg), 0U, result);
+}
+
+bool swd_queue_dp_write(swd_queue_s *const queue, const uint16_t reg, const uint32_t value)
+{
+	return swd_queue_add(queue, swd_queue_request(false, false, reg), value, NULL);
+}
+
+bool swd_queue_ap_read(swd_queue_s *const queue, const uint16_t reg, uint32_t *const result)
+{
+	return swd_queue_add(queue, swd_queue_request(true, true, reg), 0U, result);
+}
+
+bool swd_queue_ap_write(swd_queue_s *const queue, const uint16_t reg, const uint32_t value)
+{
+	return swd_queue_add(queue, swd_queue_request(true, false, reg), value, NULL);
+}
+
+/* One access, asked again for as long as the target answers WAIT */
+static bool swd_queue_transaction(adiv5_debug_port_s *const dp, const uint8_t request, uint32_t *const value)
+{
+	platform_timeout_s timeout;
+	bool waited = false;
+	uint32_t ack = 0;
+	while (true) {
+		++stats.transactions;
+		swd_proc.seq_out(request, 8U);
+		ack = swd_proc.seq_in(3U);
+		if (ack != SWD_QUEUE_ACK_WAIT)
+			break;
+		++stats.waits;
+		/* The timeout is only set up once it is needed, most accesses never wait */
+		if (!waited) {
+			platform_timeout_set(&timeout, SWD_QUEUE_WAIT_TIMEOUT_MS);
+			waited = true;
+		} else if (platform_timeout_is_expired(&timeout)) {
+			adiv5_dp_abort(dp, ADIV5_DP_ABORT_DAPABORT);
+			dp->fault = 1U;
+			return false;
+		}
+	}
+	/* STICKYERR is set, adiv5_dp_error() reports and clears it */
+	if (ack == SWD_QUEUE_ACK_FAULT)
+		return false;
+	if (ack != SWD_QUEUE_ACK_OK) {
+		dp->fault = 1U;
+		raise_exception(EXCEPTION_ERROR, "SWD invalid ACK");
+	}
+
+	if (request & SWD_QUEUE_REQUEST_RNW) {
+		if (!swd_proc.seq_in_parity(value, 32U)) {
+			dp->fault = 1U;
+			raise_exception(EXCEPTION_ERROR, "SWD parity error");
+		}
+	} else
+		swd_proc.seq_out_parity(*value, 32U);
+	return true;
+}
+
+bool swd_queue_flush(swd_queue_s *const queue)
+{
+	const uint8_t ap_read = SWD_QUEUE_REQUEST_APNDP | SWD_QUEUE_REQUEST_RNW;
+	const uint8_t rdbuff = swd_queue_request(false, true, SWD_QUEUE_DP_RDBUFF);
+	const size_t count = queue->count;
+	queue->count = 0;
+	++stats.bursts;
+
+	/* Result of the last AP read, which the next read brings back */
+	uint32_t *posted = NULL;
+	bool ok = true;
+	for (size_t i = 0; ok && i < count; ++i) {
+		const swd_queue_entry_s *const entry = &queue->entries[i];
+		const bool is_ap_read = (entry->request & ap_read) == ap_read;
+		if (posted && !is_ap_read) {
+			ok = swd_queue_transaction(queue->dp, rdbuff, posted);
+			posted = NULL;
+			if (!ok)
+				break;
+		}
+		uint32_t value = entry->value;
+		ok = swd_queue_transaction(queue->dp, entry->request, &value);
+		if (!ok)
+			break;
+		if (is_ap_read) {
+			if (posted)
+				*posted = value;
+			posted = entry->result;
+		} else if (entry->request & SWD_QUEUE_REQUEST_RNW)
+			*entry->result = value;
+	}
+	if (ok && posted)
+		ok = swd_queue_transaction(queue->dp, rdbuff, posted);
+	/* Idle clocks after the burst, to let the last access complete */
+	swd_proc.seq_out(0U, 8U);
+	if (!ok)
+		++stats.faults;
+	return ok;
+}
+
+static bool swd_queue_mem_read_words(
+	adiv5_access_port_s *const ap, uint8_t *const dest, const uint32_t src, const size_t len)
+{
+	const uint32_t csw = ap->csw | ADIV5_AP_CSW_SIZE_WORD | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	for (size_t offset = 0; offset < len;) {
+		const uint32_t addr = src + offset;
+		const size_t amount = MIN(len - offset, SWD_QUEUE_TAR_WRAP - (addr & (SWD_QUEUE_TAR_WRAP - 1U)));
+		swd_queue_init(&mem_queue, ap->dp);
+		if (!offset) {
+			swd_queue_dp_write(&mem_queue, SWD_QUEUE_DP_SELECT, (uint32_t)ap->apsel << 24U);
+			swd_queue_ap_write(&mem_queue, ADIV5_AP_CSW, csw);
+		}
+		swd_queue_ap_write(&mem_queue, ADIV5_AP_TAR_LOW, addr);
+		for (size_t i = 0; i < amount / 4U; ++i)
+			swd_queue_ap_read(&mem_queue, ADIV5_AP_DRW, &mem_words[i]);
+		if (!swd_queue_flush(&mem_queue))
+			return false;
+		memcpy(dest + offset, mem_words, amount);
+		offset += amount;
+	}
+	return true;
+}
+
+static void swd_queue_mem_read(adiv5_access_port_s *const ap, void *const dest, const target_addr64_t src, const size_t len)
+{
+	/* Whole aligned words below 4 GiB go in bursts, the odd bytes either side the usual way */
+	const target_addr64_t start = (src + 3U) & ~(target_addr64_t)3U;
+	const target_addr64_t end = (src + len) & ~(target_addr64_t)3U;
+	if (!queue_enabled || end <= start || end > UINT32_MAX) {
+		fallback_mem_read(ap, dest, src, len);
+		return;
+	}
+
+	uint8_t *const data = (uint8_t *)dest;
+	const size_t head = start - src;
+	if (head)
+		fallback_mem_read(ap, data, src, head);
+	if (!swd_queue_mem_read_words(ap, data + head, (uint32_t)start, end - start)) {
+		/* Cut short by a fault, which the caller's error check picks up */
+		memset(data + head, 0, len - head);
+		return;
+	}
+	if (end < src + len)
+		fallback_mem_read(ap, data + (end - src), end, src + len - end);
+}
+
+void swd_queue_attach(target_s *const target)
+{
+	if (!target || !swd_engine_transport_swd() || target->priv_free != cortex_priv_free)
+		return;
+	adiv5_debug_port_s *const dp = cortex_ap(target)->dp;
+	/* ADIv6 DPs select APs by address rather than APSEL */
+	if (dp->version >= 3U || dp->mem_read == swd_queue_mem_read)
+		return;
+	fallback_mem_read = dp->mem_read;
+	dp->mem_read = swd_queue_mem_read;
+}
+
+bool swd_queue_enabled(void)
+{
+	return queue_enabled;
+}
+
+void swd_queue_enable(const bool enable)
+{
+	queue_enabled = enable;
+}
+
+void swd_queue_get_stats(swd_queue_stats_s *const result)
+{
+	*result = stats;
+	result->enabled = queue_enabled;
+}
+
+void swd_queue_reset_stats(void)
+{
+	memset(&stats, 0, sizeof(stats));
+}
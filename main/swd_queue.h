@@ -0,0 +1,70 @@
+/*
+ * Queued SWD transactions for the ESP32 probe
+ *
+ * Every DP/AP access through adiv5_swd.c is run on its own, through the
+ * DP's function pointers with its WAIT timeout set up before the request
+ * goes out. Here accesses are queued and run back to back when the queue is
+ * flushed, with idle clocks only at the end. AP reads are posted, each returns what the one before it
+ * fetched, so their results are handed to the previous AP read in the queue
+ * and a final RDBUFF read collects the last. A WAIT is retried in place.
+ *
+ * Only ADIv5 DPs on SWD, and only with the target bus lock held.
+ */
+
+#ifndef __SWD_QUEUE_H
+#define __SWD_QUEUE_H
+
+#include "target.h"
+#include "adiv5.h"
+
+/* A 1 KiB block of word reads, with the SELECT, CSW and TAR writes ahead of it */
+#define SWD_QUEUE_SIZE 260U
+
+typedef struct swd_queue_entry {
+	uint8_t request;
+	uint32_t value;   /* Written, for writes */
+	uint32_t *result; /* Where a read's value goes */
+} swd_queue_entry_s;
+
+typedef struct swd_queue {
+	adiv5_debug_port_s *dp;
+	size_t count;
+	swd_queue_entry_s entries[SWD_QUEUE_SIZE];
+} swd_queue_s;
+
+typedef struct swd_queue_stats {
+	bool enabled;
+	uint32_t bursts;       /* Flushes */
+	uint32_t transactions; /* Accesses run, including RDBUFF reads and retries */
+	uint32_t waits;        /* WAIT responses retried */
+	uint32_t faults;       /* Bursts cut short by a FAULT or a WAIT that didn't clear */
+} swd_queue_stats_s;
+
+void swd_queue_init(swd_queue_s *queue, adiv5_debug_port_s *dp);
+/*
+ * reg is an ADIV5_DP_* or ADIV5_AP_* address, of which only A[3:2] goes in the
+ * request, the bank is whatever SELECT holds. All return false with the queue full.
+ */
+bool swd_queue_dp_read(swd_queue_s *queue, uint16_t reg, uint32_t *result);
+bool swd_queue_dp_write(swd_queue_s *queue, uint16_t reg, uint32_t value);
+bool swd_queue_ap_read(swd_queue_s *queue, uint16_t reg, uint32_t *result);
+bool swd_queue_ap_write(swd_queue_s *queue, uint16_t reg, uint32_t value);
+/*
+ * Run what is queued. False if the target answered FAULT, or kept answering
+ * WAIT, the DP then has the error for adiv5_dp_error() and results from that
+ * point on are left as they were. Raises an exception on a protocol error.
+ */
+bool swd_queue_flush(swd_queue_s *queue);
+
+/*
+ * Route memory reads of the target's DP through queued bursts, if it is a
+ * Cortex target on an ADIv5 SWD DP. Called whenever GDB attaches.
+ */
+void swd_queue_attach(target_s *target);
+
+bool swd_queue_enabled(void);
+void swd_queue_enable(bool enable);
+void swd_queue_get_stats(swd_queue_stats_s *stats);
+void swd_queue_reset_stats(void);
+
+#endif /* __SWD_QUEUE_H */
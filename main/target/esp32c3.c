@@ -36,6 +36,7 @@
 #include "target_probe.h"
 #include "riscv_debug.h"
 #include "sfdp.h"
+#include "lz4.h"
 
 #define ESP32_C3_ARCH_ID 0x80000001U
 #define ESP32_C3_IMPL_ID 0x00000001U
@@ -154,9 +155,54 @@
 #define SPI_FLASH_STATUS_BUSY          0x01U
 #define SPI_FLASH_STATUS_WRITE_ENABLED 0x02U
 
+/*
+ * The RAM resident flash loader (flashstub/esp32c3_loader_rv32.s) runs from the
+ * instruction bus mapping of SRAM1, above where application IRAM normally ends.
+ * The loader, its control block and its two buffers are written through the
+ * data bus mapping of the same memory. The buffer the loader inflates LZ4
+ * blocks into comes right after the second one.
+ */
+#define ESP32_C3_LOADER_IBUS_BASE   0x403c0000U
+#define ESP32_C3_LOADER_DBUS_BASE   0x3fcc0000U
+#define ESP32_C3_LOADER_CTRL        (ESP32_C3_LOADER_DBUS_BASE + 0x400U)
+#define ESP32_C3_LOADER_CTRL_SIZE   0x30U
+#define ESP32_C3_LOADER_READY       (ESP32_C3_LOADER_CTRL + 0x00U)
+#define ESP32_C3_LOADER_DESC(n)     (ESP32_C3_LOADER_CTRL + 0x08U + ((n)*16U))
+#define ESP32_C3_LOADER_DESC_STATE  0x0cU
+#define ESP32_C3_LOADER_BUFFER_SIZE 2048U
+#define ESP32_C3_LOADER_BUFFER(n)   (ESP32_C3_LOADER_CTRL + ESP32_C3_LOADER_CTRL_SIZE + ((n)*ESP32_C3_LOADER_BUFFER_SIZE))
+
+#define ESP32_C3_LOADER_READY_MAGIC 0x4c4f4144U
+#define ESP32_C3_LOADER_STATE_EMPTY 0U
+#define ESP32_C3_LOADER_STATE_FULL  1U
+#define ESP32_C3_LOADER_STATE_ERROR 2U
+
+#define ESP32_C3_LOADER_START_TIMEOUT_MS  100U
+#define ESP32_C3_LOADER_BUFFER_TIMEOUT_MS 1000U
+
+#define ESP32_C3_REG_A0 10U
+#define ESP32_C3_REG_A1 11U
+#define ESP32_C3_REG_PC 32U
+
+static const uint16_t esp32c3_flash_loader[] = {
+#include "flashstub/esp32c3_loader_rv32.stub"
+};
+
+/* Probe side scratch for compressing what goes into the flash loader's buffers */
+typedef struct esp32c3_lz4_work {
+	uint16_t table[LZ4_HASH_SIZE];
+	uint8_t block[ESP32_C3_LOADER_BUFFER_SIZE];
+} esp32c3_lz4_work_s;
+
 typedef struct esp32c3_priv {
 	uint32_t wdt_config[4];
 	target_addr32_t last_invalidated_sector;
+	bool loader_loaded;   /* The flash loader is in RAM from earlier in this flash session */
+	bool loader_unusable; /* The flash loader failed, use register level writes */
+	uint8_t loader_next;  /* Buffer the next write goes into */
+	esp32c3_lz4_work_s *lz4_work; /* Only while in flash mode, NULL to send data as is */
+	uint32_t loader_bytes;        /* Bytes programmed through the loader this flash session */
+	uint32_t loader_bytes_sent;   /* and what crossed the debug link for them */
 } esp32c3_priv_s;
 
 typedef struct esp32c3_spi_flash {
@@ -213,6 +259,9 @@ static void esp32c3_add_flash(target_s *const target)
 	flash->start = ESP32_C3_IBUS_FLASH_BASE;
 	flash->length = MIN(spi_parameters.capacity, ESP32_C3_IBUS_FLASH_SIZE);
 	flash->blocksize = spi_parameters.sector_size;
+	/* Let writes build up to fill both flash loader buffers at once */
+	if (spi_parameters.sector_size >= ESP32_C3_LOADER_BUFFER_SIZE * 2U)
+		flash->writebufsize = ESP32_C3_LOADER_BUFFER_SIZE * 2U;
 	flash->write = esp32c3_spi_flash_write;
 	flash->erase = esp32c3_spi_flash_erase;
 	flash->erased = 0xffU;
@@ -469,13 +518,25 @@ static bool esp32c3_mass_erase(target_s *const target, platform_timeout_s *const
 
 static bool esp32c3_enter_flash_mode(target_s *const target)
 {
+	esp32c3_priv_s *const priv = (esp32c3_priv_s *)target->target_storage;
 	esp32c3_disable_wdts(target);
+	/* The application may have used the RAM since the last time */
+	priv->loader_loaded = false;
+	priv->loader_bytes = 0;
+	priv->loader_bytes_sent = 0;
+	if (!priv->lz4_work)
+		priv->lz4_work = malloc(sizeof(*priv->lz4_work));
 	return true;
 }
 
 static bool esp32c3_exit_flash_mode(target_s *const target)
 {
 	esp32c3_priv_s *const priv = (esp32c3_priv_s *)target->target_storage;
+	free(priv->lz4_work);
+	priv->lz4_work = NULL;
+	if (priv->loader_bytes)
+		DEBUG_INFO("ESP32-C3 flash loader: %" PRIu32 " bytes sent for %" PRIu32 " programmed\n",
+			priv->loader_bytes_sent, priv->loader_bytes);
 	/* Calculate the length of the region to invalidate and reload */
 	const uint32_t region_length = priv->last_invalidated_sector - ESP32_C3_IBUS_FLASH_BASE;
 	/* Invalidate the i-cache for the required length */
@@ -517,6 +578,109 @@ static bool esp32c3_spi_flash_erase(target_flash_s *const flash, const target_ad
 	return true;
 }
 
+static void esp32c3_loader_stop(target_s *const target)
+{
+	riscv_halt_request(target);
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, ESP32_C3_LOADER_START_TIMEOUT_MS);
+	while (riscv_halt_poll(target, NULL) == TARGET_HALT_RUNNING && !platform_timeout_is_expired(&timeout))
+		continue;
+}
+
+static bool esp32c3_loader_start(target_s *const target)
+{
+	esp32c3_priv_s *const priv = (esp32c3_priv_s *)target->target_storage;
+	if (priv->loader_unusable)
+		return false;
+	if (!priv->loader_loaded) {
+		if (target_mem32_write(target, ESP32_C3_LOADER_DBUS_BASE, esp32c3_flash_loader, sizeof(esp32c3_flash_loader))) {
+			priv->loader_unusable = true;
+			return false;
+		}
+		priv->loader_loaded = true;
+	}
+
+	/* Not ready, and both buffers empty */
+	const uint32_t control[ESP32_C3_LOADER_CTRL_SIZE / 4U] = {0};
+	target_mem32_write(target, ESP32_C3_LOADER_CTRL, control, sizeof(control));
+	const uint32_t control_block = ESP32_C3_LOADER_CTRL;
+	const uint32_t buffer_size = ESP32_C3_LOADER_BUFFER_SIZE;
+	const uint32_t entry = ESP32_C3_LOADER_IBUS_BASE;
+	target_reg_write(target, ESP32_C3_REG_A0, &control_block, sizeof(control_block));
+	target_reg_write(target, ESP32_C3_REG_A1, &buffer_size, sizeof(buffer_size));
+	target_reg_write(target, ESP32_C3_REG_PC, &entry, sizeof(entry));
+	if (target_check_error(target)) {
+		priv->loader_unusable = true;
+		return false;
+	}
+
+	/* Not esp32c3_halt_resume(), the watchdogs have to stay off */
+	riscv_halt_resume(target, false);
+	/* This also finds out if memory can be accessed while the core runs, which streaming needs */
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, ESP32_C3_LOADER_START_TIMEOUT_MS);
+	while (target_mem32_read32(target, ESP32_C3_LOADER_READY) != ESP32_C3_LOADER_READY_MAGIC) {
+		if (target_check_error(target) || platform_timeout_is_expired(&timeout)) {
+			esp32c3_loader_stop(target);
+			priv->loader_unusable = true;
+			DEBUG_WARN("ESP32-C3 flash loader did not start, using register level writes\n");
+			return false;
+		}
+	}
+	priv->loader_next = 0U;
+	return true;
+}
+
+/* Wait for the loader to be done with a buffer, false if it failed to program it */
+static bool esp32c3_loader_wait(target_s *const target, const uint8_t buffer)
+{
+	platform_timeout_s timeout;
+	platform_timeout_set(&timeout, ESP32_C3_LOADER_BUFFER_TIMEOUT_MS);
+	while (true) {
+		const uint32_t state = target_mem32_read32(target, ESP32_C3_LOADER_DESC(buffer) + ESP32_C3_LOADER_DESC_STATE);
+		if (target_check_error(target) || state == ESP32_C3_LOADER_STATE_ERROR)
+			return false;
+		if (state == ESP32_C3_LOADER_STATE_EMPTY)
+			return true;
+		if (platform_timeout_is_expired(&timeout))
+			return false;
+	}
+}
+
+static bool esp32c3_loader_write(
+	target_s *const target, const target_addr_t address, const uint8_t *const data, const size_t length)
+{
+	esp32c3_priv_s *const priv = (esp32c3_priv_s *)target->target_storage;
+	for (size_t offset = 0U; offset < length; offset += ESP32_C3_LOADER_BUFFER_SIZE) {
+		const uint8_t buffer = priv->loader_next;
+		const uint32_t amount = MIN(length - offset, ESP32_C3_LOADER_BUFFER_SIZE);
+		/* Compressed while the loader is still busy with the other buffer, sent as is unless it got smaller */
+		const uint8_t *payload = data + offset;
+		uint32_t payload_length = amount;
+		uint32_t inflated_length = 0U;
+		if (priv->lz4_work) {
+			const size_t compressed = lz4_compress(
+				payload, amount, priv->lz4_work->block, amount - 1U, priv->lz4_work->table);
+			if (compressed) {
+				payload = priv->lz4_work->block;
+				payload_length = compressed;
+				inflated_length = amount;
+			}
+		}
+		/* One buffer is filled while the loader programs the other */
+		if (!esp32c3_loader_wait(target, buffer))
+			return false;
+		target_mem32_write(target, ESP32_C3_LOADER_BUFFER(buffer), payload, payload_length);
+		/* The state is the last word written, so the loader never sees half a descriptor */
+		const uint32_t descriptor[4] = {address + offset, payload_length, inflated_length, ESP32_C3_LOADER_STATE_FULL};
+		target_mem32_write(target, ESP32_C3_LOADER_DESC(buffer), descriptor, sizeof(descriptor));
+		priv->loader_next = buffer ^ 1U;
+		priv->loader_bytes += amount;
+		priv->loader_bytes_sent += payload_length;
+	}
+	return esp32c3_loader_wait(target, 0U) && esp32c3_loader_wait(target, 1U);
+}
+
 static bool esp32c3_spi_flash_write(
 	target_flash_s *const flash, const target_addr_t dest, const void *const src, const size_t length)
 {
@@ -524,6 +688,17 @@ static bool esp32c3_spi_flash_write(
 	// const esp32c3_spi_flash_s *const spi_flash = (esp32c3_spi_flash_s *)flash;
 	const target_addr_t begin = dest - flash->start;
 	const char *const buffer = (const char *)src;
+
+	if (esp32c3_loader_start(target)) {
+		const bool written = esp32c3_loader_write(target, begin, (const uint8_t *)buffer, length);
+		esp32c3_loader_stop(target);
+		if (written)
+			return true;
+		/* Redo all of it register by register, programming the same data twice does no harm */
+		esp32c3_priv_s *const priv = (esp32c3_priv_s *)target->target_storage;
+		priv->loader_unusable = true;
+		DEBUG_WARN("ESP32-C3 flash loader failed, using register level writes\n");
+	}
 	for (size_t offset = 0; offset < length; offset += 64U) {
 		esp32c3_spi_run_command(target, SPI_FLASH_CMD_WRITE_ENABLE, 0U);
 		if (!(esp32c3_spi_read_status(target) & SPI_FLASH_STATUS_WRITE_ENABLED))
@@ -0,0 +1,66 @@
+@ CRC32 of a target memory region, as GDB's qCRC computes it
+@ (polynomial 0x04c11db7, MSB first, no final inversion).
+@
+@ r0: CRC so far (0xffffffff to start), r1: data, r2: length in bytes,
+@ r3: base of an STM32 style CRC unit, or 0 to do it all in software.
+@ Returns the CRC in r0 and stops on the bkpt.
+@
+@ The CRC unit only takes whole words and can't be seeded, so it is used
+@ for word aligned data when starting over (r0 = 0xffffffff) or when it
+@ still holds the CRC passed in from the previous chunk. Bytes are fed
+@ MSB first, so each word is byte reversed before going in. Whatever is
+@ left over is done one bit at a time.
+
+	.syntax unified
+	.thumb
+	.text
+	.global crc32_stub
+	.type crc32_stub, %function
+crc32_stub:
+	cmp r3, #0
+	beq crc32_soft
+	lsls r4, r1, #30
+	bne crc32_soft
+	ldr r4, [r3]
+	cmp r4, r0
+	beq crc32_words
+	adds r4, r0, #1
+	bne crc32_soft
+	movs r4, #1
+	str r4, [r3, #8]
+crc32_words:
+	cmp r2, #4
+	blo crc32_words_done
+	ldr r4, [r1]
+	rev r4, r4
+	str r4, [r3]
+	adds r1, #4
+	subs r2, #4
+	b crc32_words
+crc32_words_done:
+	ldr r0, [r3]
+crc32_soft:
+	ldr r5, crc32_poly
+crc32_byte:
+	cmp r2, #0
+	beq crc32_done
+	ldrb r4, [r1]
+	lsls r4, r4, #24
+	eors r0, r4
+	movs r6, #8
+crc32_bit:
+	lsls r0, r0, #1
+	bcc crc32_bit_next
+	eors r0, r5
+crc32_bit_next:
+	subs r6, #1
+	bne crc32_bit
+	adds r1, #1
+	subs r2, #1
+	b crc32_byte
+crc32_done:
+	bkpt #0
+	b crc32_done
+	.align 2
+crc32_poly:
+	.word 0x04c11db7
@@ -0,0 +1,38 @@
+# CRC32 of a target memory region, as GDB's qCRC computes it
+# (polynomial 0x04c11db7, MSB first, no final inversion).
+#
+# a0: CRC so far (0xffffffff to start), a1: data, a2: length in bytes.
+# Returns the CRC in a0 and spins on the last instruction, where the
+# debugger has put a hardware breakpoint, as ebreak only enters debug
+# mode if dcsr.ebreakm is set. Interrupts are masked while it runs.
+#
+# The ESP32-C3 has no CRC unit, so this is all software.
+
+	.option norvc
+	.text
+	.global crc32_stub
+	.type crc32_stub, %function
+crc32_stub:
+	csrrci t3, mstatus, 8
+	li t1, 0x04c11db7
+crc32_byte:
+	beqz a2, crc32_done
+	lbu t0, 0(a1)
+	slli t0, t0, 24
+	xor a0, a0, t0
+	li t2, 8
+crc32_bit:
+	slli t4, a0, 1
+	bgez a0, crc32_bit_next
+	xor t4, t4, t1
+crc32_bit_next:
+	mv a0, t4
+	addi t2, t2, -1
+	bnez t2, crc32_bit
+	addi a1, a1, 1
+	addi a2, a2, -1
+	j crc32_byte
+crc32_done:
+	csrw mstatus, t3
+crc32_end:
+	j crc32_end
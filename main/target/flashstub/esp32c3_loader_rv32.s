@@ -0,0 +1,234 @@
+# SPI flash loader for the ESP32-C3
+#
+# a0: control block, a1: size of each of its two data buffers.
+#
+# The control block holds a ready word, two descriptors of { flash offset,
+# length, inflated length, state } and then the two buffers, followed by a
+# scratch buffer of the same size. The loader marks itself ready, then takes
+# the buffers in turn: it waits for the debugger to mark one full, programs
+# it with write enable/page program/read status sequences on SPI1, marks it
+# empty again, and moves on to the other. A buffer with a non-zero inflated
+# length holds an LZ4 block, which is inflated into the scratch buffer and
+# programmed from there; if it doesn't come out at that length the buffer
+# is marked as failed. Page programs are at most 64 bytes (the SPI1 data
+# registers) and never cross a 64 byte boundary, so never a flash page
+# boundary either. It runs with interrupts masked until the debugger halts it.
+
+	.option norvc
+	.equ SPI1_BASE, 0x60002000
+	.equ SPI_CMD, 0x00
+	.equ SPI_ADDR, 0x04
+	.equ SPI_USER0, 0x18
+	.equ SPI_USER1, 0x1c
+	.equ SPI_USER2, 0x20
+	.equ SPI_DATA_OUT_LEN, 0x24
+	.equ SPI_DATA_IN_LEN, 0x28
+	.equ SPI_MISC, 0x34
+	.equ SPI_DATA, 0x58
+	.equ LOADER_READY, 0x4c4f4144
+	.equ STATE_EMPTY, 0
+	.equ STATE_FULL, 1
+	.equ STATE_ERROR, 2
+
+	.text
+	.global esp32c3_loader
+	.type esp32c3_loader, %function
+esp32c3_loader:
+	csrci mstatus, 8
+	li s0, SPI1_BASE
+	addi s1, a0, 8
+	addi s2, a0, 48
+	slli s7, a1, 1
+	add s7, s7, s2
+	li t0, LOADER_READY
+	sw t0, 0(a0)
+
+wait_full:
+	lw t0, 12(s1)
+	li t1, STATE_FULL
+	bne t0, t1, wait_full
+	lw s3, 0(s1)
+	lw s4, 4(s1)
+	mv s5, s2
+	lw t0, 8(s1)
+	beqz t0, next_chunk
+
+	# Compressed, inflate it into the scratch buffer and program that
+	mv a2, s2
+	add a3, s2, s4
+	mv a4, s7
+	add a5, s7, a1
+	jal ra, lz4_inflate
+	sub t1, a4, s7
+	lw s4, 8(s1)
+	bne t1, s4, buffer_error
+	mv s5, s7
+
+next_chunk:
+	beqz s4, buffer_done
+	andi t0, s3, 63
+	li s6, 64
+	sub s6, s6, t0
+	bgeu s4, s6, 1f
+	mv s6, s4
+1:
+	# Write enable
+	li t0, 0x70000006
+	sw t0, SPI_USER2(s0)
+	sw zero, SPI_USER1(s0)
+	li t0, 0x80000000
+	sw t0, SPI_USER0(s0)
+	jal ra, spi_exec
+	jal ra, read_status
+	andi t2, t2, 2
+	beqz t2, buffer_error
+
+	# Page program
+	li t0, 0x70000002
+	sw t0, SPI_USER2(s0)
+	sw s3, SPI_ADDR(s0)
+	li t0, 0x5c000000
+	sw t0, SPI_USER1(s0)
+	slli t0, s6, 3
+	addi t0, t0, -1
+	sw t0, SPI_DATA_OUT_LEN(s0)
+	li t0, 0xc8000000
+	sw t0, SPI_USER0(s0)
+	addi t3, s0, SPI_DATA
+	mv t4, s5
+	li t2, 0
+copy:
+	bgeu t2, s6, copied
+	lbu t0, 0(t4)
+	lbu t1, 1(t4)
+	slli t1, t1, 8
+	or t0, t0, t1
+	lbu t1, 2(t4)
+	slli t1, t1, 16
+	or t0, t0, t1
+	lbu t1, 3(t4)
+	slli t1, t1, 24
+	or t0, t0, t1
+	sw t0, 0(t3)
+	addi t3, t3, 4
+	addi t4, t4, 4
+	addi t2, t2, 4
+	j copy
+copied:
+	jal ra, spi_exec
+busy:
+	jal ra, read_status
+	andi t2, t2, 1
+	bnez t2, busy
+	add s3, s3, s6
+	add s5, s5, s6
+	sub s4, s4, s6
+	j next_chunk
+
+buffer_error:
+	li t0, STATE_ERROR
+	sw t0, 12(s1)
+	j next_buffer
+buffer_done:
+	sw zero, 12(s1)
+next_buffer:
+	addi t0, a0, 8
+	bne s1, t0, 2f
+	addi s1, a0, 24
+	add s2, s2, a1
+	j wait_full
+2:
+	addi s1, a0, 8
+	addi s2, a0, 48
+	j wait_full
+
+# Inflate the LZ4 block from a2 up to a3 into a4, which ends up past the last
+# byte written, or 0 if the output would go past a5. Clobbers a2 and t0-t4
+lz4_inflate:
+	li t3, 15
+sequence:
+	bgeu a2, a3, inflated
+	lbu t0, 0(a2)
+	addi a2, a2, 1
+	srli t1, t0, 4
+	bne t1, t3, literals
+literal_length:
+	lbu t2, 0(a2)
+	addi a2, a2, 1
+	add t1, t1, t2
+	li t4, 255
+	beq t2, t4, literal_length
+literals:
+	add t2, a4, t1
+	bltu a5, t2, inflate_error
+1:
+	beqz t1, 2f
+	lbu t2, 0(a2)
+	sb t2, 0(a4)
+	addi a2, a2, 1
+	addi a4, a4, 1
+	addi t1, t1, -1
+	j 1b
+2:
+	# The last sequence is only literals
+	bgeu a2, a3, inflated
+	lbu t1, 0(a2)
+	lbu t2, 1(a2)
+	slli t2, t2, 8
+	or t1, t1, t2
+	addi a2, a2, 2
+	sub t1, a4, t1
+	andi t0, t0, 15
+	bne t0, t3, match
+match_length:
+	lbu t2, 0(a2)
+	addi a2, a2, 1
+	add t0, t0, t2
+	li t4, 255
+	beq t2, t4, match_length
+match:
+	addi t0, t0, 4
+	add t2, a4, t0
+	bltu a5, t2, inflate_error
+	# Byte by byte, the match can overlap what it produces
+3:
+	lbu t2, 0(t1)
+	sb t2, 0(a4)
+	addi t1, t1, 1
+	addi a4, a4, 1
+	addi t0, t0, -1
+	bnez t0, 3b
+	j sequence
+inflate_error:
+	li a4, 0
+inflated:
+	ret
+
+# Read the status register into t2, clobbers t0 and t5
+read_status:
+	mv t5, ra
+	li t0, 0x70000005
+	sw t0, SPI_USER2(s0)
+	sw zero, SPI_USER1(s0)
+	li t0, 7
+	sw t0, SPI_DATA_IN_LEN(s0)
+	li t0, 0x90000000
+	sw t0, SPI_USER0(s0)
+	jal ra, spi_exec
+	lw t2, SPI_DATA(s0)
+	andi t2, t2, 0xff
+	mv ra, t5
+	ret
+
+# Run the configured transaction with chip select released at the end, clobbers t0 and t6
+spi_exec:
+	lw t0, SPI_MISC(s0)
+	andi t0, t0, ~0x400
+	sw t0, SPI_MISC(s0)
+	li t6, 0x40000
+	sw t6, SPI_CMD(s0)
+1:
+	lw t0, SPI_CMD(s0)
+	and t0, t0, t6
+	bnez t0, 1b
+	ret
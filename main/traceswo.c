@@ -231,7 +231,7 @@ void traceswo_init(uint32_t baudrate, uint32_t swo_chan_bitmask) {
     strcpy(serial_no,"esp32");
 
     task_started = 1;
-    xTaskCreate(&routeTask, "swo_thread", 4*4096, NULL, 8, NULL);
+    xTaskCreatePinnedToCore(&routeTask, "swo_thread", 4*4096, NULL, 8, NULL, PLATFORM_NETWORK_CORE);
 
 }
 
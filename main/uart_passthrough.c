@@ -200,12 +200,18 @@ void uart_passthrough_init(void)
     // Initialize UART hardware
     uart_hw_init();
 
-    // Create tasks for bidirectional data transfer
-    xTaskCreate(uart_tcp_server_task, "uart_tcp_srv", 4096, NULL, 5, NULL);
-    xTaskCreate(uart_to_tcp_task, "uart_to_tcp", 4096, NULL, 6, NULL);
-    xTaskCreate(tcp_to_uart_task, "tcp_to_uart", 4096, NULL, 6, NULL);
+    // Create tasks for bidirectional data transfer, they idle until a client connects
+    xTaskCreatePinnedToCore(uart_to_tcp_task, "uart_to_tcp", 4096, NULL, 6, NULL, PLATFORM_NETWORK_CORE);
+    xTaskCreatePinnedToCore(tcp_to_uart_task, "tcp_to_uart", 4096, NULL, 6, NULL, PLATFORM_NETWORK_CORE);
 
-    ESP_LOGI(TAG, "UART passthrough initialized on port %d", UART_PASSTHROUGH_PORT);
+    ESP_LOGI(TAG, "UART passthrough initialized");
+}
+
+void uart_passthrough_start_server(void)
+{
+    xTaskCreatePinnedToCore(uart_tcp_server_task, "uart_tcp_srv", 4096, NULL, 5, NULL, PLATFORM_NETWORK_CORE);
+
+    ESP_LOGI(TAG, "UART passthrough listening on port %d", UART_PASSTHROUGH_PORT);
 }
 
 #endif /* PLATFORM_HAS_UART_PASSTHROUGH */
@@ -12,9 +12,12 @@
 // Default TCP port for UART passthrough (GDB is on 2345)
 #define UART_PASSTHROUGH_PORT 2346
 
-// Initialize UART passthrough (call after WiFi is connected)
+// Initialize the UART and the bridge tasks (can be called before WiFi is up)
 void uart_passthrough_init(void);
 
+// Start the TCP server for the bridge (call once the network is up)
+void uart_passthrough_start_server(void);
+
 // Set UART baud rate (can be changed at runtime)
 void uart_passthrough_set_baud(uint32_t baud);
 
@@ -0,0 +1,221 @@
+/*
+ * Warm attach cache for the ESP32 probe
+ *
+ * After a full scan the identity of every target is recorded as the DPIDR
+ * and TARGETID of its debug port plus the IDR and BASE (ROM table pointer)
+ * of its access port. Validating the cache reads those registers again
+ * through the targets' own AP handles, so nothing stale is ever dereferenced
+ * even if the list was rebuilt by a plain swd_scan in between. A target that
+ * was power cycled fails the DP read and gets a full scan.
+ *
+ * The first plain swd_scan/jtag_scan of a GDB session goes through the
+ * cache on its own, later ones in the same session always scan in full (and
+ * key the result) since asking again usually means the hardware changed.
+ *
+ * Only ADIv5 (Cortex) targets can be keyed this way, scans that find
+ * anything else are not cached. The target objects can't outlive a reboot,
+ * so only the scan method is kept in NVS.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortex_internal.h"
+#include "command.h"
+#include "gdb_packet.h"
+#include "warm_scan.h"
+
+#include "nvs.h"
+
+#define WARM_SCAN_NVS_NAMESPACE "bmp"
+#define WARM_SCAN_NVS_KEY       "scan_method"
+
+typedef struct warm_scan_key {
+	uint32_t dp_idr;
+	uint16_t target_designer;
+	uint16_t target_partno;
+	uint32_t ap_idr;
+	uint32_t ap_base;
+} warm_scan_key_s;
+
+typedef struct warm_scan_keys {
+	size_t count;
+	bool keyable; /* All targets so far were ADIv5 ones and fitted */
+	warm_scan_key_s keys[WARM_SCAN_MAX_TARGETS];
+} warm_scan_keys_s;
+
+/* Only used from the GDB thread */
+static warm_scan_keys_s warm_scan_cache;
+static warm_scan_stats_s stats;
+static bool method_loaded;
+/* Set when a GDB session starts, until its first scan */
+static bool session_fresh;
+
+static bool warm_scan_read_key(target_s *const target, warm_scan_key_s *const key)
+{
+	if (target->priv_free != cortex_priv_free)
+		return false;
+	adiv5_access_port_s *const ap = cortex_ap(target);
+	adiv5_debug_port_s *const dp = ap->dp;
+
+	key->dp_idr = adiv5_dp_read(dp, ADIV5_DP_DPIDR);
+	key->target_designer = dp->target_designer_code;
+	key->target_partno = dp->target_partno;
+	key->ap_idr = adiv5_ap_read(ap, ADIV5_AP_IDR);
+	key->ap_base = adiv5_ap_read(ap, ADIV5_AP_BASE_LOW);
+	return !adiv5_dp_error(dp);
+}
+
+static void warm_scan_read_keys_cb(const size_t index, target_s *const target, void *const context)
+{
+	(void)index;
+	warm_scan_keys_s *const keys = (warm_scan_keys_s *)context;
+	if (!keys->keyable)
+		return;
+	if (keys->count == WARM_SCAN_MAX_TARGETS || !warm_scan_read_key(target, &keys->keys[keys->count])) {
+		keys->keyable = false;
+		return;
+	}
+	++keys->count;
+}
+
+/* Key the current target list, false if some target can't be keyed or the link failed */
+static bool warm_scan_read_keys(warm_scan_keys_s *const keys)
+{
+	keys->count = 0;
+	keys->keyable = true;
+	size_t targets = 0;
+	TRY (EXCEPTION_ALL) {
+		targets = target_foreach(warm_scan_read_keys_cb, keys);
+	}
+	CATCH () {
+	default:
+		keys->keyable = false;
+		break;
+	}
+	return keys->keyable && targets == keys->count && targets;
+}
+
+static void warm_scan_display_cb(const size_t index, target_s *const target, void *const context)
+{
+	(void)context;
+	const char *const core_name = target_core_name(target);
+	gdb_outf("%2u   %c  %s %s\n", (unsigned)index, target_attached(target) ? '*' : ' ', target_driver_name(target),
+		core_name ? core_name : "");
+}
+
+static void warm_scan_count_cb(const size_t index, target_s *const target, void *const context)
+{
+	(void)index;
+	(void)target;
+	(void)context;
+}
+
+static void warm_scan_save_method(const warm_scan_method_e method)
+{
+	nvs_handle_t nvs;
+	uint8_t saved = UINT8_MAX;
+	if (nvs_open(WARM_SCAN_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK)
+		return;
+	/* Only write when it changed, to spare the flash */
+	if (nvs_get_u8(nvs, WARM_SCAN_NVS_KEY, &saved) != ESP_OK || saved != (uint8_t)method) {
+		if (nvs_set_u8(nvs, WARM_SCAN_NVS_KEY, (uint8_t)method) == ESP_OK)
+			nvs_commit(nvs);
+	}
+	nvs_close(nvs);
+}
+
+warm_scan_method_e warm_scan_default_method(void)
+{
+	if (!method_loaded) {
+		method_loaded = true;
+		nvs_handle_t nvs;
+		uint8_t saved = WARM_SCAN_SWD;
+		if (nvs_open(WARM_SCAN_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+			nvs_get_u8(nvs, WARM_SCAN_NVS_KEY, &saved);
+			nvs_close(nvs);
+		}
+		stats.method = saved == WARM_SCAN_JTAG ? WARM_SCAN_JTAG : WARM_SCAN_SWD;
+	}
+	return stats.method;
+}
+
+static warm_scan_result_e warm_scan_run(target_s *const target, const warm_scan_method_e method, const bool reuse)
+{
+	uint32_t start = platform_time_ms();
+	if (reuse && stats.valid && stats.method == method) {
+		warm_scan_keys_s current;
+		if (warm_scan_read_keys(&current) && current.count == warm_scan_cache.count &&
+			!memcmp(current.keys, warm_scan_cache.keys, current.count * sizeof(*current.keys))) {
+			stats.validate_ms = platform_time_ms() - start;
+			++stats.hits;
+			gdb_out("Targets unchanged since the last scan\n");
+			gdb_out("Available Targets:\n");
+			gdb_out("No. Att Driver\n");
+			target_foreach(warm_scan_display_cb, NULL);
+			return WARM_SCAN_CACHED;
+		}
+	}
+
+	++stats.misses;
+	warm_scan_invalidate();
+	/* command_process() splits the command line in place */
+	char command[sizeof("jtag_scan")];
+	strcpy(command, method == WARM_SCAN_JTAG ? "jtag_scan" : "swd_scan");
+	start = platform_time_ms();
+	command_process(target, command);
+	stats.full_ms = platform_time_ms() - start;
+	stats.method = method;
+	method_loaded = true;
+
+	if (!target_foreach(warm_scan_count_cb, NULL))
+		return WARM_SCAN_FAILED;
+	warm_scan_save_method(method);
+	if (warm_scan_read_keys(&warm_scan_cache)) {
+		stats.valid = true;
+		stats.targets = warm_scan_cache.count;
+	} else
+		gdb_out("Scan result can't be cached, only ADIv5 targets can\n");
+	return WARM_SCAN_FULL;
+}
+
+warm_scan_result_e warm_scan(target_s *const target, const warm_scan_method_e method)
+{
+	session_fresh = false;
+	return warm_scan_run(target, method, true);
+}
+
+void warm_scan_session_start(void)
+{
+	session_fresh = true;
+}
+
+bool warm_scan_command(target_s *const target, const char *const command, int *const result)
+{
+	warm_scan_method_e method;
+	if (!strcmp(command, "swd_scan") || !strcmp(command, "swdp_scan"))
+		method = WARM_SCAN_SWD;
+	else if (!strcmp(command, "jtag_scan"))
+		method = WARM_SCAN_JTAG;
+	else
+		return false;
+	const bool reuse = session_fresh;
+	session_fresh = false;
+	*result = warm_scan_run(target, method, reuse) == WARM_SCAN_FAILED ? 1 : 0;
+	return true;
+}
+
+void warm_scan_invalidate(void)
+{
+	stats.valid = false;
+	stats.targets = 0;
+	warm_scan_cache.count = 0;
+}
+
+void warm_scan_get_stats(warm_scan_stats_s *const result)
+{
+	warm_scan_default_method();
+	*result = stats;
+}
@@ -0,0 +1,55 @@
+/*
+ * Warm attach cache for the ESP32 probe
+ *
+ * A swd_scan/jtag_scan walks the DP, the APs and their ROM tables and runs
+ * every target probe routine, which takes a while over a bit-banged link.
+ * The target list it builds outlives the GDB session, so when the next
+ * session starts with a scan of the same chain, a few DP/AP register reads
+ * confirm it is still the same hardware and the list is reused as is.
+ */
+
+#ifndef __WARM_SCAN_H
+#define __WARM_SCAN_H
+
+#include "target.h"
+
+/* Targets whose identity is remembered, a scan finding more isn't cached */
+#define WARM_SCAN_MAX_TARGETS 8U
+
+typedef enum warm_scan_method {
+	WARM_SCAN_SWD,
+	WARM_SCAN_JTAG,
+} warm_scan_method_e;
+
+typedef enum warm_scan_result {
+	WARM_SCAN_CACHED, /* The previous scan still matches the hardware */
+	WARM_SCAN_FULL,   /* A full scan was done */
+	WARM_SCAN_FAILED, /* The full scan found no targets */
+} warm_scan_result_e;
+
+typedef struct warm_scan_stats {
+	bool valid;
+	warm_scan_method_e method;
+	size_t targets;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t full_ms;     /* Duration of the last full scan */
+	uint32_t validate_ms; /* and of the last successful validation */
+} warm_scan_stats_s;
+
+/* The method the last successful scan used, remembered across reboots */
+warm_scan_method_e warm_scan_default_method(void);
+/* Reuse the previous scan if the targets still answer as they did, otherwise scan */
+warm_scan_result_e warm_scan(target_s *target, warm_scan_method_e method);
+void warm_scan_invalidate(void);
+/* Called for each new GDB connection, lets its first plain scan use the cache */
+void warm_scan_session_start(void);
+/*
+ * Runs a plain "swd_scan"/"jtag_scan" monitor command through the cache, the
+ * first one of a session may reuse it. False if the command is anything else,
+ * otherwise result is set as command_process() would.
+ */
+bool warm_scan_command(target_s *target, const char *command, int *result);
+void warm_scan_get_stats(warm_scan_stats_s *stats);
+
+#endif /* __WARM_SCAN_H */
@@ -8,6 +8,8 @@
 #include "platform.h"
 #include "web_server.h"
 #include "uart_passthrough.h"
+#include "profile.h"
+#include "flash_upload.h"
 
 #include "esp_http_server.h"
 #include "esp_log.h"
@@ -165,6 +167,90 @@ static esp_err_t index_handler(httpd_req_t *req)
     return httpd_resp_send(req, index_html, strlen(index_html));
 }
 
+// ============== Profiler Download ==============
+
+typedef struct gmon_request {
+    httpd_req_t *req;
+    bool started;
+} gmon_request_s;
+
+static bool gmon_send_chunk(void *ctx, const void *data, size_t len)
+{
+    gmon_request_s *gmon = (gmon_request_s *)ctx;
+    gmon->started = true;
+    return httpd_resp_send_chunk(gmon->req, (const char *)data, len) == ESP_OK;
+}
+
+/*
+ * GET /gmon.out - PC sampling histogram from "mon profile", for gprof
+ */
+static esp_err_t gmon_handler(httpd_req_t *req)
+{
+    gmon_request_s gmon = { .req = req, .started = false };
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"gmon.out\"");
+    if (!profile_gmon_write(gmon_send_chunk, &gmon)) {
+        if (gmon.started)
+            return ESP_FAIL;
+        return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No profile data, use \"mon profile start\"");
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// ============== Compressed Flash Upload ==============
+
+#define FLASH_UPLOAD_RECV_RETRIES 5
+
+static int flash_upload_recv(void *ctx, void *data, size_t len)
+{
+    httpd_req_t *req = (httpd_req_t *)ctx;
+    for (int retry = 0; retry < FLASH_UPLOAD_RECV_RETRIES; retry++) {
+        int received = httpd_req_recv(req, (char *)data, len);
+        if (received != HTTPD_SOCK_ERR_TIMEOUT)
+            return received;
+    }
+    return -1;
+}
+
+/*
+ * POST /flash?addr=0x08000000 - image compressed with "lz4 -B4", programmed
+ * into the target GDB is attached to
+ */
+static esp_err_t flash_handler(httpd_req_t *req)
+{
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "addr", value, sizeof(value)) != ESP_OK)
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing address, use /flash?addr=0x08000000");
+    const uint32_t addr = strtoul(value, NULL, 0);
+
+    size_t written = 0;
+    const flash_upload_status_e status = flash_upload_lz4(addr, flash_upload_recv, req, &written);
+    switch (status) {
+    case FLASH_UPLOAD_OK: {
+        char reply[64];
+        snprintf(reply, sizeof(reply), "Programmed %u bytes at 0x%08" PRIx32 "\n", (unsigned)written, addr);
+        return httpd_resp_sendstr(req, reply);
+    }
+    case FLASH_UPLOAD_READ_ERROR:
+        // Nobody left to answer
+        return ESP_FAIL;
+    case FLASH_UPLOAD_NO_TARGET:
+        httpd_resp_set_status(req, "409 Conflict");
+        break;
+    case FLASH_UPLOAD_BAD_FORMAT:
+        httpd_resp_set_status(req, "400 Bad Request");
+        break;
+    default:
+        httpd_resp_set_status(req, "500 Internal Server Error");
+        break;
+    }
+    httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_sendstr(req, flash_upload_status_string(status));
+}
+
 // ============== WebSocket Handler ==============
 
 static esp_err_t ws_handler(httpd_req_t *req)
@@ -402,8 +488,10 @@ void web_server_init(void)
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = WEB_SERVER_PORT;
     config.lru_purge_enable = true;
-    config.max_uri_handlers = 4;
-    config.stack_size = 4096;
+    config.max_uri_handlers = 5;
+    // Room for target flash writes, which /flash does from the server task
+    config.stack_size = 6144;
+    config.core_id = PLATFORM_NETWORK_CORE;
 
     ESP_LOGI(TAG, "Starting web server on port %d", WEB_SERVER_PORT);
 
@@ -412,10 +500,16 @@ void web_server_init(void)
         return;
     }
 
-    // Register handlers - only index and websocket
+    // Register handlers - index, websocket, the profiler download and the flash upload
     httpd_uri_t index_uri = { .uri = "/", .method = HTTP_GET, .handler = index_handler };
     httpd_register_uri_handler(server, &index_uri);
 
+    httpd_uri_t gmon_uri = { .uri = "/gmon.out", .method = HTTP_GET, .handler = gmon_handler };
+    httpd_register_uri_handler(server, &gmon_uri);
+
+    httpd_uri_t flash_uri = { .uri = "/flash", .method = HTTP_POST, .handler = flash_handler };
+    httpd_register_uri_handler(server, &flash_uri);
+
     httpd_uri_t ws_uri = { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true };
     httpd_register_uri_handler(server, &ws_uri);
 
@@ -0,0 +1,24 @@
+/*
+ * raise_exception() for the host tests, as upstream's exception.c has it
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "exception.h"
+
+exception_s *innermost_exception;
+
+void raise_exception(const uint32_t type, const char *const msg)
+{
+	for (exception_s *exception = innermost_exception; exception; exception = exception->outer) {
+		if (exception->mask & type) {
+			exception->type = type;
+			exception->msg = msg;
+			innermost_exception = exception->outer;
+			longjmp(exception->jmpbuf, (int)type);
+		}
+	}
+	fprintf(stderr, "Unhandled exception: %s\n", msg);
+	abort();
+}
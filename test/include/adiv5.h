@@ -0,0 +1,52 @@
+/*
+ * Host build stand-in for upstream's adiv5.h
+ *
+ * The register addresses and CSW bits are upstream's, the structures have
+ * only the fields the code under test uses.
+ */
+
+#ifndef __ADIV5_H
+#define __ADIV5_H
+
+#include "general.h"
+
+#define ADIV5_APnDP       0x100U
+#define ADIV5_DP_REG(x)   (x)
+#define ADIV5_AP_REG(x)   (ADIV5_APnDP | (x))
+
+#define ADIV5_DP_DPIDR    ADIV5_DP_REG(0x0U)
+#define ADIV5_DP_ABORT    ADIV5_DP_REG(0x0U)
+#define ADIV5_DP_CTRLSTAT ADIV5_DP_REG(0x4U)
+#define ADIV5_DP_SELECT   ADIV5_DP_REG(0x8U)
+#define ADIV5_DP_RDBUFF   ADIV5_DP_REG(0xcU)
+
+#define ADIV5_DP_ABORT_DAPABORT   (1U << 0U)
+#define ADIV5_DP_ABORT_STKERRCLR  (1U << 2U)
+#define ADIV5_DP_CTRLSTAT_STICKYERR (1U << 5U)
+
+#define ADIV5_AP_CSW      ADIV5_AP_REG(0x00U)
+#define ADIV5_AP_TAR_LOW  ADIV5_AP_REG(0x04U)
+#define ADIV5_AP_DRW      ADIV5_AP_REG(0x0cU)
+
+#define ADIV5_AP_CSW_SIZE_WORD      (2U << 0U)
+#define ADIV5_AP_CSW_ADDRINC_SINGLE (1U << 4U)
+
+typedef struct adiv5_debug_port adiv5_debug_port_s;
+typedef struct adiv5_access_port adiv5_access_port_s;
+
+struct adiv5_debug_port {
+	uint8_t version;
+	uint8_t fault;
+	void (*mem_read)(adiv5_access_port_s *ap, void *dest, target_addr64_t src, size_t len);
+};
+
+struct adiv5_access_port {
+	adiv5_debug_port_s *dp;
+	uint8_t apsel;
+	uint32_t csw;
+};
+
+/* Provided by each test */
+void adiv5_dp_abort(adiv5_debug_port_s *dp, uint32_t abort);
+
+#endif /* __ADIV5_H */
@@ -0,0 +1,23 @@
+/*
+ * Host build stand-in for upstream's cortex_internal.h
+ */
+
+#ifndef __CORTEX_INTERNAL_H
+#define __CORTEX_INTERNAL_H
+
+#include "target_internal.h"
+#include "adiv5.h"
+
+typedef struct cortex_priv {
+	adiv5_access_port_s *ap;
+} cortex_priv_s;
+
+/* Provided by each test, only ever compared against */
+void cortex_priv_free(void *priv);
+
+static inline adiv5_access_port_s *cortex_ap(target_s *const target)
+{
+	return ((cortex_priv_s *)target->priv)->ap;
+}
+
+#endif /* __CORTEX_INTERNAL_H */
@@ -0,0 +1,25 @@
+/*
+ * Host build stand-in for ESP-IDF's esp_log.h
+ *
+ * Logging goes nowhere, but the arguments are still checked against the format.
+ */
+
+#ifndef __ESP_LOG_H
+#define __ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOG_NONE(tag, ...)     \
+	do {                           \
+		(void)(tag);               \
+		if (0)                     \
+			printf(__VA_ARGS__);   \
+	} while (0)
+
+#define ESP_LOGE(tag, ...) ESP_LOG_NONE(tag, __VA_ARGS__)
+#define ESP_LOGW(tag, ...) ESP_LOG_NONE(tag, __VA_ARGS__)
+#define ESP_LOGI(tag, ...) ESP_LOG_NONE(tag, __VA_ARGS__)
+#define ESP_LOGD(tag, ...) ESP_LOG_NONE(tag, __VA_ARGS__)
+#define ESP_LOGV(tag, ...) ESP_LOG_NONE(tag, __VA_ARGS__)
+
+#endif /* __ESP_LOG_H */
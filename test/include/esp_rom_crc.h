@@ -0,0 +1,13 @@
+/*
+ * Host build stand-in for ESP-IDF's esp_rom_crc.h
+ */
+
+#ifndef __ESP_ROM_CRC_H
+#define __ESP_ROM_CRC_H
+
+#include <stdint.h>
+
+/* Provided by each test, as the ROM does: the CRC is inverted on the way in and out */
+uint32_t esp_rom_crc32_be(uint32_t crc, const uint8_t *buf, uint32_t len);
+
+#endif /* __ESP_ROM_CRC_H */
@@ -0,0 +1,45 @@
+/*
+ * Host build stand-in for upstream's exception.h
+ *
+ * The same setjmp based TRY/CATCH, raise_exception() is in test/exception.c.
+ */
+
+#ifndef __EXCEPTION_H
+#define __EXCEPTION_H
+
+#include <setjmp.h>
+#include <stdint.h>
+
+#define EXCEPTION_ERROR   0x01U
+#define EXCEPTION_TIMEOUT 0x02U
+#define EXCEPTION_ALL     (-1)
+
+typedef struct exception exception_s;
+
+struct exception {
+	uint32_t type;
+	const char *msg;
+	/* private */
+	uint32_t mask;
+	jmp_buf jmpbuf;
+	exception_s *outer;
+};
+
+extern exception_s *innermost_exception;
+
+#define TRY(type_mask)                              \
+	exception_s exception_frame;                    \
+	exception_frame.type = 0;                       \
+	exception_frame.mask = (type_mask);             \
+	exception_frame.outer = innermost_exception;    \
+	innermost_exception = &exception_frame;         \
+	if (setjmp(exception_frame.jmpbuf) == 0)
+
+#define CATCH()                                     \
+	innermost_exception = exception_frame.outer;    \
+	if (exception_frame.type)                       \
+		switch (exception_frame.type)
+
+void raise_exception(uint32_t type, const char *msg);
+
+#endif /* __EXCEPTION_H */
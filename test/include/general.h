@@ -0,0 +1,31 @@
+/*
+ * Host build stand-in for upstream's general.h
+ *
+ * Only what the code under test uses from it, without platform.h and the
+ * ESP-IDF headers it pulls in.
+ */
+
+#ifndef __GENERAL_H
+#define __GENERAL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "target.h"
+
+#define DEBUG_GDB(...)    do { } while (0)
+#define DEBUG_INFO(...)   do { } while (0)
+#define DEBUG_WARN(...)   do { } while (0)
+#define DEBUG_ERROR(...)  do { } while (0)
+#define DEBUG_TARGET(...) do { } while (0)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define ARRAY_LENGTH(array) (sizeof(array) / sizeof((array)[0]))
+
+#endif /* __GENERAL_H */
@@ -0,0 +1,17 @@
+/*
+ * Host build stand-in for upstream's hex_utils.h
+ */
+
+#ifndef __HEX_UTILS_H
+#define __HEX_UTILS_H
+
+#include <stdint.h>
+
+static inline uint8_t unhex_digit(const char hex)
+{
+	if (hex >= '0' && hex <= '9')
+		return (uint8_t)(hex - '0');
+	return (uint8_t)((hex | 0x20) - 'a' + 10);
+}
+
+#endif /* __HEX_UTILS_H */
@@ -0,0 +1,20 @@
+/*
+ * Host build stand-in for upstream's jtagtap.h
+ */
+
+#ifndef __JTAGTAP_H
+#define __JTAGTAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct jtag_proc {
+	void (*jtagtap_tdi_tdo_seq)(uint8_t *data_out, bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+	void (*jtagtap_tdi_seq)(bool final_tms, const uint8_t *data_in, size_t clock_cycles);
+} jtag_proc_s;
+
+/* Provided by each test, as jtagtap.c would */
+extern jtag_proc_s jtag_proc;
+
+#endif /* __JTAGTAP_H */
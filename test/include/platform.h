@@ -0,0 +1,55 @@
+/*
+ * Host build stand-in for the probe's platform.h
+ *
+ * There is only the one thread, so the target lock does nothing, and time
+ * stands still. Timeouts are left to the tests that use them, as are the
+ * GPIO registers.
+ */
+
+#ifndef __PLATFORM_H
+#define __PLATFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+static inline void platform_target_lock(void)
+{
+}
+
+static inline void platform_target_unlock(void)
+{
+}
+
+static inline uint32_t platform_time_ms(void)
+{
+	return 0;
+}
+
+typedef struct platform_timeout {
+	uint32_t time;
+} platform_timeout_s;
+
+void platform_timeout_set(platform_timeout_s *target, uint32_t ms);
+bool platform_timeout_is_expired(const platform_timeout_s *target);
+
+/* The probe's JTAG pins */
+#define TMS_PIN 2
+#define TDI_PIN 0
+#define TDO_PIN 21
+#define TCK_PIN 1
+
+#define GPIO_OUT_W1TS_REG 0x3ff44008U
+#define GPIO_OUT_W1TC_REG 0x3ff4400cU
+#define GPIO_IN_REG       0x3ff4403cU
+
+#define REG_WRITE(reg, value) platform_reg_write(reg, value)
+#define REG_READ(reg)         platform_reg_read(reg)
+
+void platform_reg_write(uint32_t reg, uint32_t value);
+uint32_t platform_reg_read(uint32_t reg);
+
+extern uint32_t target_clk_divider;
+
+#endif /* __PLATFORM_H */
@@ -0,0 +1,14 @@
+/*
+ * Host build stand-in for the sdkconfig.h ESP-IDF generates, with the
+ * Kconfig defaults of the options the code under test reads
+ */
+
+#ifndef __SDKCONFIG_H
+#define __SDKCONFIG_H
+
+#define CONFIG_BMP_SWD_SPI_FREQ_KHZ      4000
+#define CONFIG_BMP_SWD_QUEUE             1
+#define CONFIG_BMP_JTAG_SHIFT            1
+#define CONFIG_BMP_FLASH_DELTA_BLOCK_MAX 16384
+
+#endif /* __SDKCONFIG_H */
@@ -0,0 +1,22 @@
+/*
+ * Host build stand-in for upstream's swd.h
+ */
+
+#ifndef __SWD_H
+#define __SWD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct swd_proc {
+	uint32_t (*seq_in)(size_t clock_cycles);
+	bool (*seq_in_parity)(uint32_t *ret, size_t clock_cycles);
+	void (*seq_out)(uint32_t tms_states, size_t clock_cycles);
+	void (*seq_out_parity)(uint32_t tms_states, size_t clock_cycles);
+} swd_proc_s;
+
+/* Provided by each test, as swdptap.c would */
+extern swd_proc_s swd_proc;
+
+#endif /* __SWD_H */
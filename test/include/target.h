@@ -0,0 +1,35 @@
+/*
+ * Host build stand-in for upstream's target.h
+ */
+
+#ifndef __TARGET_H
+#define __TARGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t target_addr_t;
+typedef uint32_t target_addr32_t;
+typedef uint64_t target_addr64_t;
+typedef struct target target_s;
+typedef struct target_controller target_controller_s;
+typedef struct target_flash target_flash_s;
+typedef struct breakwatch breakwatch_s;
+
+typedef enum target_breakwatch {
+	TARGET_BREAK_SOFT,
+	TARGET_BREAK_HARD,
+	TARGET_WATCH_WRITE,
+	TARGET_WATCH_READ,
+	TARGET_WATCH_ACCESS,
+} target_breakwatch_e;
+
+/* Provided by each test, returns true on error as upstream's does */
+bool target_mem32_read(target_s *target, void *dest, target_addr_t src, size_t len);
+/* Return true on success */
+bool target_flash_erase(target_s *target, target_addr_t addr, size_t len);
+bool target_flash_write(target_s *target, target_addr_t dest, const void *src, size_t len);
+bool target_flash_complete(target_s *target);
+
+#endif /* __TARGET_H */
@@ -0,0 +1,34 @@
+/*
+ * Host build stand-in for upstream's target_internal.h
+ */
+
+#ifndef __TARGET_INTERNAL_H
+#define __TARGET_INTERNAL_H
+
+#include "target.h"
+
+struct target_flash {
+	target_addr_t start;
+	size_t length;
+	size_t blocksize;
+	uint8_t erased;
+	target_flash_s *next;
+};
+
+struct breakwatch {
+	breakwatch_s *next;
+	target_breakwatch_e type;
+	target_addr_t addr;
+	size_t size;
+};
+
+/* Only the fields the code under test looks at */
+struct target {
+	void *priv;
+	void (*priv_free)(void *priv);
+	target_flash_s *flash;
+	bool flash_mode;
+	breakwatch_s *bw_list;
+};
+
+#endif /* __TARGET_INTERNAL_H */
@@ -0,0 +1,500 @@
+/*
+ * Simulated SWD target for the host tests
+ *
+ * Each clock the probe either drives SWDIO or leaves it to the target, and
+ * the target drives it only during the ACK and read data, so the line is
+ * whichever of them drives it, or high from the pull-up. The phase the
+ * target is in says which of them should be driving, and an ACK other than
+ * OK goes straight to the turnaround back to the probe, as with overrun
+ * detection off.
+ */
+
+#include "general.h"
+#include "swd.h"
+#include "swd_engine.h"
+#include "swd_sim.h"
+
+#define SWD_SIM_ACK_OK    1U
+#define SWD_SIM_ACK_WAIT  2U
+#define SWD_SIM_ACK_FAULT 4U
+
+#define SWD_SIM_REQUEST_APNDP  0x02U
+#define SWD_SIM_REQUEST_RNW    0x04U
+#define SWD_SIM_REQUEST_FIXED  0xc1U /* Start, stop and park */
+#define SWD_SIM_REQUEST_START  0x81U
+#define SWD_SIM_REQUEST_FIELDS 0x1eU
+#define SWD_SIM_REQUEST_PARITY 0x20U
+
+/* A[3:2] of the DP registers */
+#define SWD_SIM_DP_DPIDR    0U /* ABORT when written */
+#define SWD_SIM_DP_CTRLSTAT 1U
+#define SWD_SIM_DP_SELECT   2U /* RESEND when read */
+#define SWD_SIM_DP_RDBUFF   3U
+
+#define SWD_SIM_AP_CSW  0x00U
+#define SWD_SIM_AP_TAR  0x04U
+#define SWD_SIM_AP_DRW  0x0cU
+#define SWD_SIM_AP_BASE_REG 0xf8U
+#define SWD_SIM_AP_IDR_REG  0xfcU
+
+#define SWD_SIM_CSW_SIZE_MASK   0x07U
+#define SWD_SIM_CSW_SIZE_WORD   0x02U
+#define SWD_SIM_CSW_ADDRINC     0x30U
+#define SWD_SIM_CSW_ADDRINC_ONE 0x10U
+#define SWD_SIM_TAR_WRAP        1024U
+
+#define SWD_SIM_LINE_RESET_CLOCKS 50U
+
+typedef enum swd_sim_phase {
+	SWD_SIM_LOCKED, /* Waiting for a line reset */
+	SWD_SIM_RESET,  /* Line reset, until the line goes low */
+	SWD_SIM_IDLE,
+	SWD_SIM_REQUEST,
+	SWD_SIM_TURNAROUND_ACK,
+	SWD_SIM_ACK,
+	SWD_SIM_READ_DATA,
+	SWD_SIM_TURNAROUND_DATA,
+	SWD_SIM_WRITE_DATA,
+	SWD_SIM_TURNAROUND_IDLE,
+} swd_sim_phase_e;
+
+/* What the probe does with SWDIO on a clock */
+#define SWD_SIM_RELEASED (-1)
+
+uint8_t swd_sim_mem[SWD_SIM_MEM_SIZE];
+
+static swd_sim_stats_s stats;
+static swd_sim_phase_e phase;
+static size_t bit;
+static uint32_t ones;
+static uint32_t frequency;
+
+/* Only DPIDR can be read after a line reset */
+static bool dpidr_needed;
+/*
+ * A line reset from idle starts out looking like a bad header of all 1s, so
+ * one only counts as an error if the line goes low before the reset is done
+ */
+static bool bad_header;
+static uint8_t request;
+static uint32_t ack;
+static uint64_t data; /* 32 bits and the parity */
+static uint32_t last_read;
+
+static uint32_t ctrlstat;
+static uint32_t select_reg;
+static uint32_t csw;
+static uint32_t tar;
+/* Result of the last AP read, which the next AP read or RDBUFF returns */
+static uint32_t ap_buffer;
+
+static uint32_t wait_count;
+static uint32_t wait_percentage;
+static uint32_t random_state;
+static bool corrupt_read;
+
+static bool swd_sim_random_wait(void)
+{
+	random_state = random_state * 1103515245U + 12345U;
+	return (random_state >> 16U) % 100U < wait_percentage;
+}
+
+/* The RAM word TAR points at, NULL and STICKYERR set for a bus error */
+static uint8_t *swd_sim_mem_word(void)
+{
+	if ((csw & SWD_SIM_CSW_SIZE_MASK) != SWD_SIM_CSW_SIZE_WORD || (tar & 3U) || tar < SWD_SIM_MEM_BASE ||
+		tar - SWD_SIM_MEM_BASE >= SWD_SIM_MEM_SIZE) {
+		++stats.bus_errors;
+		ctrlstat |= SWD_SIM_CTRLSTAT_STICKYERR;
+		return NULL;
+	}
+	return swd_sim_mem + (tar - SWD_SIM_MEM_BASE);
+}
+
+/* Auto-increment only carries within the 1 KiB block, as the TAR is allowed to */
+static void swd_sim_tar_increment(void)
+{
+	if ((csw & SWD_SIM_CSW_ADDRINC) == SWD_SIM_CSW_ADDRINC_ONE)
+		tar = (tar & ~(SWD_SIM_TAR_WRAP - 1U)) | ((tar + 4U) & (SWD_SIM_TAR_WRAP - 1U));
+}
+
+static uint8_t swd_sim_ap_reg(const uint8_t addr)
+{
+	return (uint8_t)((select_reg & 0xf0U) | (addr << 2U));
+}
+
+static uint32_t swd_sim_ap_read(const uint8_t addr)
+{
+	uint32_t value = 0;
+	/* There's only the one AP */
+	if (!(select_reg >> 24U)) {
+		switch (swd_sim_ap_reg(addr)) {
+		case SWD_SIM_AP_CSW:
+			value = csw;
+			break;
+		case SWD_SIM_AP_TAR:
+			value = tar;
+			break;
+		case SWD_SIM_AP_DRW: {
+			const uint8_t *const word = swd_sim_mem_word();
+			if (word)
+				memcpy(&value, word, sizeof(value));
+			swd_sim_tar_increment();
+			break;
+		}
+		case SWD_SIM_AP_BASE_REG:
+			value = SWD_SIM_AP_BASE;
+			break;
+		case SWD_SIM_AP_IDR_REG:
+			value = SWD_SIM_AP_IDR;
+			break;
+		default:
+			break;
+		}
+	}
+	/* Posted, this read returns what the one before it fetched */
+	const uint32_t posted = ap_buffer;
+	ap_buffer = value;
+	return posted;
+}
+
+static void swd_sim_ap_write(const uint8_t addr, const uint32_t value)
+{
+	if (select_reg >> 24U)
+		return;
+	switch (swd_sim_ap_reg(addr)) {
+	case SWD_SIM_AP_CSW:
+		csw = value;
+		break;
+	case SWD_SIM_AP_TAR:
+		tar = value;
+		break;
+	case SWD_SIM_AP_DRW: {
+		uint8_t *const word = swd_sim_mem_word();
+		if (word)
+			memcpy(word, &value, sizeof(value));
+		swd_sim_tar_increment();
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static uint32_t swd_sim_dp_read(const uint8_t addr)
+{
+	switch (addr) {
+	case SWD_SIM_DP_DPIDR:
+		dpidr_needed = false;
+		return SWD_SIM_DPIDR;
+	case SWD_SIM_DP_CTRLSTAT:
+		return select_reg & 0xfU ? 0U : ctrlstat;
+	case SWD_SIM_DP_SELECT:
+		return last_read;
+	default:
+		return ap_buffer;
+	}
+}
+
+static void swd_sim_dp_write(const uint8_t addr, const uint32_t value)
+{
+	switch (addr) {
+	case SWD_SIM_DP_DPIDR:
+		if (value & SWD_SIM_ABORT_STKERRCLR)
+			ctrlstat &= ~SWD_SIM_CTRLSTAT_STICKYERR;
+		if (value & SWD_SIM_ABORT_WDERRCLR)
+			ctrlstat &= ~SWD_SIM_CTRLSTAT_WDATAERR;
+		break;
+	case SWD_SIM_DP_CTRLSTAT:
+		if (!(select_reg & 0xfU)) {
+			/* Power-up requests are acknowledged straight away */
+			const uint32_t powerup = value & SWD_SIM_CTRLSTAT_POWERUP;
+			ctrlstat = (ctrlstat & (SWD_SIM_CTRLSTAT_STICKYERR | SWD_SIM_CTRLSTAT_WDATAERR)) | powerup | (powerup << 1U);
+		}
+		break;
+	case SWD_SIM_DP_SELECT:
+		select_reg = value;
+		break;
+	default:
+		break;
+	}
+}
+
+/* The header is in, work out the ACK and do the access if it is a read */
+static void swd_sim_request(void)
+{
+	const bool ap = request & SWD_SIM_REQUEST_APNDP;
+	const bool read = request & SWD_SIM_REQUEST_RNW;
+	const uint8_t addr = (request >> 3U) & 3U;
+	/* With an error flagged, only DPIDR and CTRL/STAT reads and ABORT writes get through */
+	const bool always_allowed = !ap && (read ? addr <= SWD_SIM_DP_CTRLSTAT : addr == SWD_SIM_DP_DPIDR);
+	const bool may_wait = ap || (read && addr == SWD_SIM_DP_RDBUFF);
+
+	if ((ctrlstat & (SWD_SIM_CTRLSTAT_STICKYERR | SWD_SIM_CTRLSTAT_WDATAERR)) && !always_allowed) {
+		ack = SWD_SIM_ACK_FAULT;
+		++stats.faults;
+	} else if (may_wait && (wait_count || swd_sim_random_wait())) {
+		if (wait_count)
+			--wait_count;
+		ack = SWD_SIM_ACK_WAIT;
+		++stats.waits;
+	} else {
+		ack = SWD_SIM_ACK_OK;
+		if (read) {
+			const uint32_t value = ap ? swd_sim_ap_read(addr) : swd_sim_dp_read(addr);
+			last_read = value;
+			data = value | ((uint64_t)__builtin_parity(value) << 32U);
+			if (corrupt_read) {
+				data ^= UINT64_C(1) << 32U;
+				corrupt_read = false;
+			}
+		}
+	}
+}
+
+static void swd_sim_write(void)
+{
+	const uint32_t value = (uint32_t)data;
+	if ((bool)__builtin_parity(value) != (bool)(data >> 32U)) {
+		ctrlstat |= SWD_SIM_CTRLSTAT_WDATAERR;
+		return;
+	}
+	const uint8_t addr = (request >> 3U) & 3U;
+	if (request & SWD_SIM_REQUEST_APNDP)
+		swd_sim_ap_write(addr, value);
+	else
+		swd_sim_dp_write(addr, value);
+}
+
+static bool swd_sim_target_drives(void)
+{
+	return phase == SWD_SIM_ACK || phase == SWD_SIM_READ_DATA;
+}
+
+static bool swd_sim_turnaround(void)
+{
+	return phase == SWD_SIM_TURNAROUND_ACK || phase == SWD_SIM_TURNAROUND_DATA || phase == SWD_SIM_TURNAROUND_IDLE;
+}
+
+static bool swd_sim_probe_drives(void)
+{
+	return phase == SWD_SIM_IDLE || phase == SWD_SIM_REQUEST || phase == SWD_SIM_WRITE_DATA;
+}
+
+/* One clock, host is 0 or 1 if the probe drives SWDIO. Returns the level of the line */
+static bool swd_sim_clock(const int host)
+{
+	++stats.clocks;
+	bool target = true;
+	if (phase == SWD_SIM_ACK)
+		target = (ack >> bit) & 1U;
+	else if (phase == SWD_SIM_READ_DATA)
+		target = (data >> bit) & 1U;
+
+	if (host != SWD_SIM_RELEASED && swd_sim_target_drives())
+		++stats.protocol_errors;
+	else if (host != SWD_SIM_RELEASED && swd_sim_turnaround())
+		++stats.protocol_errors;
+	else if (host == SWD_SIM_RELEASED && swd_sim_probe_drives())
+		++stats.protocol_errors;
+	const bool line = host != SWD_SIM_RELEASED ? host : target;
+
+	/* 50 clocks high from the probe is a line reset, whatever the target was doing */
+	ones = host == 1 ? ones + 1U : 0U;
+	if (ones >= SWD_SIM_LINE_RESET_CLOCKS) {
+		phase = SWD_SIM_RESET;
+		dpidr_needed = true;
+		bad_header = false;
+		return line;
+	}
+
+	switch (phase) {
+	case SWD_SIM_LOCKED:
+		if (bad_header && host == 0) {
+			++stats.protocol_errors;
+			bad_header = false;
+		}
+		break;
+	case SWD_SIM_RESET:
+		if (!line)
+			phase = SWD_SIM_IDLE;
+		break;
+	case SWD_SIM_IDLE:
+		if (line) {
+			phase = SWD_SIM_REQUEST;
+			request = 1U;
+			bit = 1;
+		}
+		break;
+	case SWD_SIM_REQUEST:
+		request |= (uint8_t)(line << bit);
+		if (++bit < 8U)
+			break;
+		++stats.requests;
+		if ((request & SWD_SIM_REQUEST_FIXED) != SWD_SIM_REQUEST_START ||
+			(bool)__builtin_parity(request & SWD_SIM_REQUEST_FIELDS) != (bool)(request & SWD_SIM_REQUEST_PARITY)) {
+			/* The target doesn't answer, and needs a line reset */
+			bad_header = true;
+			phase = SWD_SIM_LOCKED;
+		} else if (dpidr_needed && request != 0xa5U) {
+			++stats.protocol_errors;
+			phase = SWD_SIM_LOCKED;
+		} else {
+			swd_sim_request();
+			phase = SWD_SIM_TURNAROUND_ACK;
+		}
+		break;
+	case SWD_SIM_TURNAROUND_ACK:
+		phase = SWD_SIM_ACK;
+		bit = 0;
+		break;
+	case SWD_SIM_ACK:
+		if (++bit < 3U)
+			break;
+		bit = 0;
+		if (ack != SWD_SIM_ACK_OK)
+			phase = SWD_SIM_TURNAROUND_IDLE;
+		else if (request & SWD_SIM_REQUEST_RNW)
+			phase = SWD_SIM_READ_DATA;
+		else
+			phase = SWD_SIM_TURNAROUND_DATA;
+		break;
+	case SWD_SIM_READ_DATA:
+		if (++bit == 33U)
+			phase = SWD_SIM_TURNAROUND_IDLE;
+		break;
+	case SWD_SIM_TURNAROUND_DATA:
+		phase = SWD_SIM_WRITE_DATA;
+		data = 0;
+		bit = 0;
+		break;
+	case SWD_SIM_WRITE_DATA:
+		data |= (uint64_t)line << bit;
+		if (++bit == 33U) {
+			swd_sim_write();
+			phase = SWD_SIM_IDLE;
+		}
+		break;
+	case SWD_SIM_TURNAROUND_IDLE:
+		phase = SWD_SIM_IDLE;
+		break;
+	}
+	return line;
+}
+
+static void swd_sim_transfer(swd_engine_transfer_s *const transfer)
+{
+	++stats.transfers;
+	for (size_t i = 0; i < transfer->request_bits; ++i)
+		swd_sim_clock((transfer->request >> i) & 1U);
+	for (size_t i = 0; i < transfer->turnaround; ++i)
+		swd_sim_clock(SWD_SIM_RELEASED);
+	for (size_t i = 0; i < transfer->out_bits; ++i)
+		swd_sim_clock((int)((transfer->out >> i) & 1U));
+	transfer->in = 0;
+	for (size_t i = 0; i < transfer->in_bits; ++i)
+		transfer->in |= (uint64_t)swd_sim_clock(SWD_SIM_RELEASED) << i;
+}
+
+static bool swd_sim_start(const uint32_t new_frequency)
+{
+	frequency = new_frequency;
+	return true;
+}
+
+static void swd_sim_stop(void)
+{
+}
+
+static bool swd_sim_set_frequency(const uint32_t new_frequency)
+{
+	frequency = new_frequency;
+	return true;
+}
+
+static uint32_t swd_sim_get_frequency(void)
+{
+	return frequency;
+}
+
+static bool swd_sim_spi_start(const uint32_t new_frequency)
+{
+	(void)new_frequency;
+	return false;
+}
+
+const swd_engine_backend_s swd_engine_sim = {
+	.name = "sim",
+	.start = swd_sim_start,
+	.stop = swd_sim_stop,
+	.transfer = swd_sim_transfer,
+	.set_frequency = swd_sim_set_frequency,
+	.get_frequency = swd_sim_get_frequency,
+};
+
+/* The SPI peripheral is never available on the host */
+const swd_engine_backend_s swd_engine_spi = {
+	.name = "spi",
+	.start = swd_sim_spi_start,
+};
+
+swd_proc_s swd_proc;
+
+/* swdptap_init() puts the bit-banged functions in, which the tests never call */
+void __real_swdptap_init(void)
+{
+	memset(&swd_proc, 0, sizeof(swd_proc));
+}
+
+void __real_jtagtap_init(void)
+{
+}
+
+void jtag_shift_attach(void)
+{
+}
+
+void swd_sim_reset(void)
+{
+	memset(&stats, 0, sizeof(stats));
+	phase = SWD_SIM_LOCKED;
+	bit = 0;
+	ones = 0;
+	dpidr_needed = true;
+	bad_header = false;
+	ctrlstat = 0;
+	select_reg = 0;
+	csw = 0;
+	tar = 0;
+	ap_buffer = 0;
+	last_read = 0;
+	wait_count = 0;
+	wait_percentage = 0;
+	random_state = 1;
+	corrupt_read = false;
+}
+
+void swd_sim_wait_next(const uint32_t count)
+{
+	wait_count = count;
+}
+
+void swd_sim_wait_percent(const uint32_t percent)
+{
+	wait_percentage = percent;
+}
+
+void swd_sim_corrupt_next_read(void)
+{
+	corrupt_read = true;
+}
+
+bool swd_sim_idle(void)
+{
+	return phase == SWD_SIM_IDLE;
+}
+
+void swd_sim_get_stats(swd_sim_stats_s *const result)
+{
+	*result = stats;
+}
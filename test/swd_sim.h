@@ -0,0 +1,68 @@
+/*
+ * Simulated SWD target for the host tests
+ *
+ * swd_engine_sim is a backend like swd_engine_spi, but instead of clocking
+ * pins it hands each clock of a transfer to a model of an ADIv5 SW-DP with
+ * one MEM-AP in front of a block of RAM. The model follows the line a bit at
+ * a time as a target would: a line reset and a DPIDR read before anything
+ * else, request parity, turnarounds, WAIT and FAULT without a data phase,
+ * posted AP reads collected through RDBUFF and TAR auto-incrementing within
+ * 1 KiB. Anything the probe gets wrong on the wire is counted as a protocol
+ * error rather than stopping the test.
+ *
+ * This also provides what swd_engine.c links against on the probe: swd_proc,
+ * the swdptap_init() and jtagtap_init() it wraps, and an SPI backend that is
+ * never available.
+ */
+
+#ifndef __SWD_SIM_H
+#define __SWD_SIM_H
+
+#include "general.h"
+#include "swd_engine.h"
+
+#define SWD_SIM_DPIDR    0x2ba01477U
+#define SWD_SIM_AP_IDR   0x24770011U
+#define SWD_SIM_AP_BASE  0xe00ff003U
+#define SWD_SIM_MEM_BASE 0x20000000U
+#define SWD_SIM_MEM_SIZE 65536U
+
+/* CTRL/STAT and ABORT bits the model implements */
+#define SWD_SIM_CTRLSTAT_STICKYERR  0x00000020U
+#define SWD_SIM_CTRLSTAT_WDATAERR   0x00000080U
+#define SWD_SIM_CTRLSTAT_POWERUP    0x50000000U
+#define SWD_SIM_ABORT_STKERRCLR     0x00000004U
+#define SWD_SIM_ABORT_WDERRCLR      0x00000008U
+
+typedef struct swd_sim_stats {
+	uint32_t clocks;
+	uint32_t transfers;
+	uint32_t requests;        /* Headers taken, bad ones included */
+	uint32_t waits;           /* Answered WAIT */
+	uint32_t faults;          /* Answered FAULT */
+	uint32_t bus_errors;      /* MEM-AP accesses outside the RAM, or not words */
+	uint32_t protocol_errors; /* Bad headers, and the line driven or released when it shouldn't be */
+} swd_sim_stats_s;
+
+extern const swd_engine_backend_s swd_engine_sim;
+
+/* What swd_scan and jtag_scan call, in swd_engine.c */
+void __wrap_swdptap_init(void);
+void __wrap_jtagtap_init(void);
+
+/* The RAM behind the MEM-AP, at SWD_SIM_MEM_BASE */
+extern uint8_t swd_sim_mem[SWD_SIM_MEM_SIZE];
+
+/* Power on: waiting for a line reset, registers cleared, no WAITs, stats zeroed */
+void swd_sim_reset(void);
+/* Answer WAIT to the next count AP accesses or RDBUFF reads */
+void swd_sim_wait_next(uint32_t count);
+/* And to this percentage of all of them, picked at random */
+void swd_sim_wait_percent(uint32_t percent);
+/* Send the next read's data with the wrong parity */
+void swd_sim_corrupt_next_read(void);
+/* Whether the target is between requests, rather than waiting for a line reset or mid transaction */
+bool swd_sim_idle(void);
+void swd_sim_get_stats(swd_sim_stats_s *stats);
+
+#endif /* __SWD_SIM_H */
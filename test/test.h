@@ -0,0 +1,27 @@
+/*
+ * Minimal checks for the host tests
+ *
+ * A failed CHECK reports where it was and carries on, so one run shows
+ * every failure. Each test's main() ends with TEST_RESULT().
+ */
+
+#ifndef __TEST_H
+#define __TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond)                                                                   \
+	do {                                                                              \
+		if (!(cond)) {                                                                \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+			++test_failures;                                                          \
+		}                                                                             \
+	} while (0)
+
+#define TEST_RESULT()                                                 \
+	(test_failures ? (fprintf(stderr, "%d failed\n", test_failures), 1) \
+				   : (printf("%s: all passed\n", __FILE__), 0))
+
+#endif /* __TEST_H */
@@ -0,0 +1,455 @@
+/*
+ * Host tests for the differential flash loads
+ *
+ * Loads are run through flash_delta into a simulated target with three flash
+ * regions: one with small blocks, one with blocks too large to stage and one
+ * that erases to 0x00. The same erases and writes are applied straight to a
+ * reference copy, as a load without flash_delta would, and the two have to
+ * match afterwards. Writes to flash that isn't erased are caught as they
+ * happen, as are erases and writes outside the flash.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "target_internal.h"
+#include "crc_stub.h"
+#include "flash_pipeline.h"
+#include "flash_delta.h"
+#include "esp_rom_crc.h"
+#include "test.h"
+
+#define FLASH_START  0x08000000U
+#define SMALL_START  FLASH_START
+#define SMALL_SIZE   (64U * 1024U)
+#define SMALL_BLOCK  1024U
+#define LARGE_START  (SMALL_START + SMALL_SIZE)
+#define LARGE_SIZE   (64U * 1024U)
+#define LARGE_BLOCK  (32U * 1024U)
+#define ZERO_START   (LARGE_START + LARGE_SIZE)
+#define ZERO_SIZE    (32U * 1024U)
+#define ZERO_BLOCK   4096U
+#define FLASH_SIZE   (SMALL_SIZE + LARGE_SIZE + ZERO_SIZE)
+#define FLASH_END    (FLASH_START + FLASH_SIZE)
+
+#define MAX_WRITES 1024U
+
+static target_flash_s zero_flash = {
+	.start = ZERO_START,
+	.length = ZERO_SIZE,
+	.blocksize = ZERO_BLOCK,
+	.erased = 0x00U,
+};
+static target_flash_s large_flash = {
+	.start = LARGE_START,
+	.length = LARGE_SIZE,
+	.blocksize = LARGE_BLOCK,
+	.erased = 0xffU,
+	.next = &zero_flash,
+};
+static target_flash_s small_flash = {
+	.start = SMALL_START,
+	.length = SMALL_SIZE,
+	.blocksize = SMALL_BLOCK,
+	.erased = 0xffU,
+	.next = &large_flash,
+};
+static target_s target = {.flash = &small_flash};
+
+static uint8_t flash_mem[FLASH_SIZE];
+/* What a load without flash_delta would have left */
+static uint8_t reference[FLASH_SIZE];
+/* Bytes the reference had erased in this load, where writes may go */
+static bool reference_erased[FLASH_SIZE];
+static bool flash_failed;
+static size_t erased_blocks;
+static size_t written_bytes;
+static uint32_t random_state = 0x2545f491U;
+
+typedef struct write {
+	target_addr32_t addr;
+	size_t len;
+} write_s;
+
+static write_s writes[MAX_WRITES];
+
+static uint32_t random_next(void)
+{
+	random_state ^= random_state << 13U;
+	random_state ^= random_state >> 17U;
+	random_state ^= random_state << 5U;
+	return random_state;
+}
+
+static target_flash_s *flash_at(const target_addr_t addr)
+{
+	for (target_flash_s *flash = target.flash; flash; flash = flash->next) {
+		if (addr >= flash->start && addr - flash->start < flash->length)
+			return flash;
+	}
+	return NULL;
+}
+
+/* Whole blocks go, in whichever regions the range covers, as target_flash_erase() does */
+static bool erase_blocks(uint8_t *const mem, target_addr_t addr, const size_t len, const bool count)
+{
+	const target_addr_t end = addr + len;
+	while (addr < end) {
+		const target_flash_s *const flash = flash_at(addr);
+		if (!flash)
+			return false;
+		const target_addr_t block = addr - (addr - flash->start) % flash->blocksize;
+		memset(mem + (block - FLASH_START), flash->erased, flash->blocksize);
+		if (mem == reference) {
+			for (size_t i = 0; i < flash->blocksize; ++i)
+				reference_erased[block - FLASH_START + i] = true;
+		}
+		if (count)
+			++erased_blocks;
+		addr = block + flash->blocksize;
+	}
+	return true;
+}
+
+bool target_flash_erase(target_s *const t, const target_addr_t addr, const size_t len)
+{
+	CHECK(t == &target);
+	if (!erase_blocks(flash_mem, addr, len, true)) {
+		flash_failed = true;
+		return false;
+	}
+	return true;
+}
+
+bool target_flash_write(target_s *const t, const target_addr_t dest, const void *const src, const size_t len)
+{
+	CHECK(t == &target);
+	if (dest < FLASH_START || dest - FLASH_START + len > FLASH_SIZE) {
+		flash_failed = true;
+		return false;
+	}
+	for (size_t i = 0; i < len; ++i) {
+		if (flash_mem[dest - FLASH_START + i] != flash_at(dest + i)->erased)
+			flash_failed = true;
+	}
+	memcpy(flash_mem + (dest - FLASH_START), src, len);
+	written_bytes += len;
+	return true;
+}
+
+bool target_flash_complete(target_s *const t)
+{
+	(void)t;
+	return true;
+}
+
+bool target_mem32_read(target_s *const t, void *const dest, const target_addr_t src, const size_t len)
+{
+	CHECK(t == &target);
+	if (src < FLASH_START || src - FLASH_START + len > FLASH_SIZE)
+		return true;
+	memcpy(dest, flash_mem + (src - FLASH_START), len);
+	return false;
+}
+
+/* MSB first, initial value ~0 and no final inversion, a bit at a time as the stub does it on the target */
+bool crc_stub_crc32(target_s *const t, uint32_t *const result, const target_addr32_t base, const size_t len)
+{
+	CHECK(t == &target);
+	if (base < FLASH_START || base - FLASH_START + len > FLASH_SIZE)
+		return false;
+	uint32_t crc = UINT32_MAX;
+	for (size_t i = 0; i < len; ++i) {
+		crc ^= (uint32_t)flash_mem[base - FLASH_START + i] << 24U;
+		for (size_t bit = 0; bit < 8U; ++bit)
+			crc = crc & 0x80000000U ? (crc << 1U) ^ 0x04c11db7U : crc << 1U;
+	}
+	*result = crc;
+	return true;
+}
+
+uint32_t esp_rom_crc32_be(uint32_t crc, const uint8_t *const buf, const uint32_t len)
+{
+	crc = ~crc;
+	for (uint32_t i = 0; i < len; ++i) {
+		crc ^= (uint32_t)buf[i] << 24U;
+		for (size_t bit = 0; bit < 8U; ++bit)
+			crc = crc & 0x80000000U ? (crc << 1U) ^ 0x04c11db7U : crc << 1U;
+	}
+	return ~crc;
+}
+
+bool flash_pipeline_enabled(void)
+{
+	return false;
+}
+
+bool flash_pipeline_write(target_s *const t, const target_addr32_t addr, const void *const data, const size_t len)
+{
+	(void)t;
+	(void)addr;
+	(void)data;
+	(void)len;
+	CHECK(false);
+	return false;
+}
+
+/* The target holds an older image, and a load starts */
+static void begin(void)
+{
+	for (size_t i = 0; i < FLASH_SIZE; ++i)
+		flash_mem[i] = (uint8_t)random_next();
+	/* With a few blocks blank, as unused flash is */
+	for (size_t i = 0; i < 8U; ++i) {
+		const target_addr_t addr = FLASH_START + random_next() % FLASH_SIZE;
+		erase_blocks(flash_mem, addr, 1U, false);
+	}
+	memcpy(reference, flash_mem, sizeof(reference));
+	memset(reference_erased, 0, sizeof(reference_erased));
+	flash_failed = false;
+	erased_blocks = 0;
+	written_bytes = 0;
+	flash_delta_begin();
+}
+
+static void load_erase(const target_addr_t addr, const size_t len)
+{
+	CHECK(erase_blocks(reference, addr, len, false));
+	CHECK(flash_delta_erase(&target, addr, len));
+}
+
+/* Write len bytes, the same as the target had at offset from unless from is 0 */
+static void load_write(const target_addr_t addr, const size_t len, const target_addr_t from)
+{
+	static uint8_t data[FLASH_SIZE];
+	for (size_t i = 0; i < len; ++i) {
+		CHECK(reference_erased[addr - FLASH_START + i]);
+		data[i] = from ? flash_mem[from - FLASH_START + i] : (uint8_t)random_next();
+	}
+	memcpy(reference + (addr - FLASH_START), data, len);
+	CHECK(flash_delta_write(&target, addr, data, len));
+}
+
+static bool load_done(void)
+{
+	const int failures = test_failures;
+	CHECK(flash_delta_done(&target));
+	CHECK(!flash_failed);
+	for (size_t i = 0; i < FLASH_SIZE; ++i) {
+		if (flash_mem[i] != reference[i]) {
+			fprintf(stderr, "  0x%08zx is 0x%02x, should be 0x%02x\n", FLASH_START + i, flash_mem[i], reference[i]);
+			++test_failures;
+			break;
+		}
+	}
+	return test_failures == failures;
+}
+
+static void test_unchanged(void)
+{
+	/* The image the target already has, in pieces that don't line up with the blocks */
+	begin();
+	load_erase(SMALL_START, 8U * SMALL_BLOCK);
+	for (target_addr_t addr = SMALL_START; addr < SMALL_START + 8U * SMALL_BLOCK; addr += 0x3f0U) {
+		const size_t len = MIN(0x3f0U, SMALL_START + 8U * SMALL_BLOCK - addr);
+		load_write(addr, len, addr);
+	}
+	CHECK(load_done());
+	CHECK(!erased_blocks && !written_bytes);
+	flash_delta_stats_s stats;
+	flash_delta_get_stats(&stats);
+	CHECK(stats.blocks == 8U && stats.skipped == 8U);
+
+	/* One byte different, only its block is programmed */
+	begin();
+	load_erase(SMALL_START, 8U * SMALL_BLOCK);
+	load_write(SMALL_START, 3U * SMALL_BLOCK + 100U, SMALL_START);
+	load_write(SMALL_START + 3U * SMALL_BLOCK + 100U, 1U, 0);
+	const bool changed = flash_mem[3U * SMALL_BLOCK + 100U] != reference[3U * SMALL_BLOCK + 100U];
+	load_write(SMALL_START + 3U * SMALL_BLOCK + 101U, 5U * SMALL_BLOCK - 101U, SMALL_START + 3U * SMALL_BLOCK + 101U);
+	CHECK(load_done());
+	CHECK(erased_blocks == (changed ? 1U : 0U));
+	flash_delta_get_stats(&stats);
+	CHECK(stats.blocks == 8U && stats.skipped == (changed ? 7U : 8U));
+}
+
+static void test_rewrite(void)
+{
+	/* GDB going back to a block it already wrote, after one in between */
+	begin();
+	load_erase(SMALL_START, 4U * SMALL_BLOCK);
+	load_write(SMALL_START, 300U, 0);
+	load_write(SMALL_START + SMALL_BLOCK, SMALL_BLOCK, 0);
+	load_write(SMALL_START + 300U, 200U, 0);
+	CHECK(load_done());
+
+	/* Straight back to the block just committed, with another erase in between */
+	begin();
+	load_erase(SMALL_START + 8U * SMALL_BLOCK, 2U * SMALL_BLOCK);
+	load_write(SMALL_START + 8U * SMALL_BLOCK, 100U, 0);
+	load_erase(SMALL_START + 20U * SMALL_BLOCK, SMALL_BLOCK);
+	load_write(SMALL_START + 8U * SMALL_BLOCK + 500U, 100U, 0);
+	load_write(SMALL_START + 20U * SMALL_BLOCK + 10U, 10U, 0);
+	load_write(SMALL_START + 8U * SMALL_BLOCK + 200U, 100U, 0);
+	CHECK(load_done());
+
+	/* Erased again after it was committed, it goes back to blank */
+	begin();
+	load_erase(SMALL_START, SMALL_BLOCK);
+	load_write(SMALL_START, SMALL_BLOCK, 0);
+	load_erase(SMALL_START, SMALL_BLOCK);
+	load_write(SMALL_START + 16U, 16U, 0);
+	CHECK(load_done());
+}
+
+static void test_unstageable(void)
+{
+	/* Blocks too large to stage are erased and written as they come, also in an erase that spans regions */
+	begin();
+	load_erase(LARGE_START - 2U * SMALL_BLOCK, 2U * SMALL_BLOCK + LARGE_BLOCK + 1U);
+	load_write(LARGE_START - 1000U, 3000U, 0);
+	load_write(LARGE_START + LARGE_BLOCK + 10U, 100U, 0);
+	load_write(LARGE_START - 2U * SMALL_BLOCK, 10U, 0);
+	load_write(LARGE_START + 5000U, 10U, 0);
+	CHECK(load_done());
+
+	/* And blocks that erase to 0x00 are staged as such */
+	begin();
+	load_erase(ZERO_START, ZERO_SIZE);
+	load_write(ZERO_START + ZERO_BLOCK + 7U, ZERO_BLOCK, 0);
+	load_write(ZERO_START + 5U * ZERO_BLOCK, 3U, 0);
+	CHECK(load_done());
+}
+
+static void test_ranges(void)
+{
+	/* More separate erases than there are ranges, each written in its middle block so it splits */
+	for (size_t written = 0; written < 3U; ++written) {
+		begin();
+		for (size_t i = 0; i < 12U; ++i)
+			load_erase(SMALL_START + i * 4U * SMALL_BLOCK, 3U * SMALL_BLOCK);
+		for (size_t i = 0; i < 12U; ++i) {
+			const target_addr_t range = SMALL_START + i * 4U * SMALL_BLOCK;
+			load_write(range + SMALL_BLOCK + 100U, 50U, 0);
+			/* Then the first block as well, or the last */
+			if (written == 1U)
+				load_write(range + 10U, 50U, 0);
+			else if (written == 2U)
+				load_write(range + 2U * SMALL_BLOCK + 10U, 50U, 0);
+		}
+		CHECK(load_done());
+	}
+
+	/* Erases that overlap once they're rounded out to whole blocks */
+	begin();
+	load_erase(SMALL_START + 0x100U, 2U * SMALL_BLOCK);
+	load_erase(SMALL_START + SMALL_BLOCK + 0x200U, 2U * SMALL_BLOCK);
+	load_write(SMALL_START + SMALL_BLOCK, SMALL_BLOCK, 0);
+	CHECK(load_done());
+	begin();
+	load_erase(SMALL_START + 2U * SMALL_BLOCK, 2U * SMALL_BLOCK);
+	load_erase(SMALL_START, 8U * SMALL_BLOCK);
+	load_write(SMALL_START + 3U * SMALL_BLOCK, 10U, 0);
+	CHECK(load_done());
+
+	/* The block just committed erased straight away, with every range in use */
+	begin();
+	load_erase(SMALL_START, SMALL_BLOCK);
+	for (size_t i = 1U; i < 8U; ++i)
+		load_erase(SMALL_START + i * 2U * SMALL_BLOCK, SMALL_BLOCK);
+	load_write(SMALL_START, SMALL_BLOCK, 0);
+	load_erase(SMALL_START + 16U * SMALL_BLOCK, SMALL_BLOCK);
+	load_erase(SMALL_START, SMALL_BLOCK);
+	load_write(SMALL_START + 100U, 10U, 0);
+	CHECK(load_done());
+}
+
+static void test_blank_check(void)
+{
+	/* Erased and never written: only blocks that aren't blank already get erased */
+	begin();
+	load_erase(SMALL_START + 32U * SMALL_BLOCK, 8U * SMALL_BLOCK);
+	load_write(SMALL_START + 34U * SMALL_BLOCK, 100U, 0);
+	load_write(SMALL_START + 37U * SMALL_BLOCK + 900U, 200U, 0);
+	/* Make one of the blocks left alone blank, and see it isn't erased */
+	memset(flash_mem + 39U * SMALL_BLOCK, 0xff, SMALL_BLOCK);
+	size_t expected = 0;
+	for (size_t block = 32U; block < 40U; ++block) {
+		for (size_t i = 0; i < SMALL_BLOCK; ++i) {
+			if (flash_mem[block * SMALL_BLOCK + i] != 0xffU) {
+				++expected;
+				break;
+			}
+		}
+	}
+	CHECK(load_done());
+	CHECK(erased_blocks == expected);
+}
+
+/* Erases in address order that may overlap, then writes to random parts of them, now and then going back */
+static bool random_load(void)
+{
+	begin();
+	target_addr_t addr = FLASH_START + random_next() % (16U * SMALL_BLOCK);
+	const size_t erases = 1U + random_next() % 14U;
+	for (size_t i = 0; i < erases && addr < FLASH_END; ++i) {
+		size_t len = 1U + random_next() % (10U * SMALL_BLOCK);
+		len = MIN(len, FLASH_END - addr);
+		load_erase(addr, len);
+		addr += random_next() % (3U * SMALL_BLOCK) + (random_next() % 2U ? len : 0U);
+		if (random_next() % 4U == 0)
+			addr += random_next() % LARGE_SIZE;
+	}
+
+	size_t count = 0;
+	for (size_t offset = 0; offset < FLASH_SIZE && count < MAX_WRITES;) {
+		if (!reference_erased[offset]) {
+			++offset;
+			continue;
+		}
+		size_t run = 0;
+		while (offset + run < FLASH_SIZE && reference_erased[offset + run])
+			++run;
+		offset += random_next() % 2U ? random_next() % MIN(run, 512U) : 0U;
+		run = 0;
+		while (offset + run < FLASH_SIZE && reference_erased[offset + run])
+			++run;
+		if (!run)
+			continue;
+		const size_t len = 1U + random_next() % MIN(run, 2048U);
+		writes[count++] = (write_s){.addr = FLASH_START + offset, .len = len};
+		offset += len + (random_next() % 4U ? 0U : random_next() % (4U * SMALL_BLOCK));
+	}
+	for (size_t i = 0; i + 1U < count; ++i) {
+		if (random_next() % 8U == 0) {
+			const write_s swap = writes[i];
+			writes[i] = writes[i + 1U];
+			writes[i + 1U] = swap;
+		}
+	}
+	for (size_t i = 0; i < count; ++i)
+		load_write(writes[i].addr, writes[i].len, random_next() % 2U ? writes[i].addr : 0);
+	return load_done();
+}
+
+static void test_random(void)
+{
+	for (size_t load = 0; load < 300U; ++load) {
+		const uint32_t seed = random_state;
+		if (!random_load()) {
+			fprintf(stderr, "  in random load %zu, seed 0x%08" PRIx32 "\n", load, seed);
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	CHECK(flash_delta_enabled());
+	test_unchanged();
+	test_rewrite();
+	test_unstageable();
+	test_ranges();
+	test_blank_check();
+	test_random();
+	return TEST_RESULT();
+}
@@ -0,0 +1,379 @@
+/*
+ * Host tests for the agent expression interpreter and condition parsing
+ */
+
+#include "general.h"
+#include "target_internal.h"
+#include "gdb_cache.h"
+#include "gdb_ax.h"
+#include "test.h"
+
+/* Little endian target memory at 0x1000, and registers n holding 0x100 + n */
+#define MEMORY_BASE 0x1000U
+
+static uint8_t memory[64];
+static target_s target;
+
+bool target_mem32_read(target_s *const t, void *const dest, const target_addr_t src, const size_t len)
+{
+	(void)t;
+	if (src < MEMORY_BASE || src - MEMORY_BASE + len > sizeof(memory))
+		return true;
+	memcpy(dest, memory + (src - MEMORY_BASE), len);
+	return false;
+}
+
+size_t gdb_cache_reg_read(target_s *const t, const uint32_t reg, void *const data, const size_t max)
+{
+	(void)t;
+	if (reg >= 16U || max < 4U)
+		return 0;
+	const uint32_t value = 0x100U + reg;
+	memcpy(data, &value, sizeof(value));
+	return sizeof(value);
+}
+
+static bool mem_read(void *const priv, const uint64_t addr, void *const dest, const size_t len)
+{
+	if (addr > UINT32_MAX)
+		return true;
+	return target_mem32_read((target_s *)priv, dest, (target_addr_t)addr, len);
+}
+
+static bool reg_read(void *const priv, const uint32_t reg, uint64_t *const value)
+{
+	uint32_t data = 0;
+	if (!gdb_cache_reg_read((target_s *)priv, reg, &data, sizeof(data)))
+		return true;
+	*value = data;
+	return false;
+}
+
+static const gdb_ax_access_s access = {
+	.mem_read = mem_read,
+	.reg_read = reg_read,
+	.priv = &target,
+};
+
+#define EVAL(status, value, ...) eval_check((const uint8_t[]){__VA_ARGS__}, sizeof((const uint8_t[]){__VA_ARGS__}), \
+	status, value, __LINE__)
+
+static void eval_check(const uint8_t *const code, const size_t len, const gdb_ax_status_e expected,
+	const uint64_t expected_value, const int line)
+{
+	uint64_t value = 0xdeadbeefU;
+	const gdb_ax_status_e status = gdb_ax_eval(code, len, &access, &value);
+	if (status != expected || (status == GDB_AX_OK && value != expected_value)) {
+		fprintf(stderr, "%s:%d: got status %u value 0x%" PRIx64 ", expected %u value 0x%" PRIx64 "\n", __FILE__,
+			line, status, value, expected, expected_value);
+		++test_failures;
+	}
+}
+
+/* Opcodes, from GDB's ax.def */
+#define ADD      0x02U
+#define SUB      0x03U
+#define MUL      0x04U
+#define DIV_S    0x05U
+#define DIV_U    0x06U
+#define REM_S    0x07U
+#define REM_U    0x08U
+#define LSH      0x09U
+#define RSH_S    0x0aU
+#define RSH_U    0x0bU
+#define TRACE    0x0cU
+#define TRACE_Q  0x0dU
+#define LOG_NOT  0x0eU
+#define BIT_AND  0x0fU
+#define BIT_OR   0x10U
+#define BIT_XOR  0x11U
+#define BIT_NOT  0x12U
+#define EQUAL    0x13U
+#define LESS_S   0x14U
+#define LESS_U   0x15U
+#define EXT      0x16U
+#define REF8     0x17U
+#define REF16    0x18U
+#define REF32    0x19U
+#define REF64    0x1aU
+#define IF_GOTO  0x20U
+#define GOTO     0x21U
+#define CONST8   0x22U
+#define CONST16  0x23U
+#define CONST32  0x24U
+#define CONST64  0x25U
+#define REG      0x26U
+#define END      0x27U
+#define DUP      0x28U
+#define POP      0x29U
+#define ZERO_EXT 0x2aU
+#define SWAP     0x2bU
+#define TRACEV   0x2eU
+#define TRACENZ  0x2fU
+#define TRACE16  0x30U
+#define PICK     0x32U
+#define ROT      0x33U
+
+static void test_arithmetic(void)
+{
+	EVAL(GDB_AX_OK, 5U, CONST8, 2, CONST8, 3, ADD, END);
+	EVAL(GDB_AX_OK, UINT64_MAX, CONST8, 2, CONST8, 3, SUB, END);
+	EVAL(GDB_AX_OK, 42U, CONST8, 6, CONST8, 7, MUL, END);
+	/* -7 / 2 truncates towards zero, -7 % 2 takes the dividend's sign */
+	EVAL(GDB_AX_OK, (uint64_t)-3, CONST8, 0xf9, EXT, 8, CONST8, 2, DIV_S, END);
+	EVAL(GDB_AX_OK, (uint64_t)-1, CONST8, 0xf9, EXT, 8, CONST8, 2, REM_S, END);
+	EVAL(GDB_AX_OK, 3U, CONST8, 7, CONST8, 2, DIV_U, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 7, CONST8, 2, REM_U, END);
+	EVAL(GDB_AX_ERROR_DIVIDE, 0U, CONST8, 7, CONST8, 0, DIV_S, END);
+	EVAL(GDB_AX_ERROR_DIVIDE, 0U, CONST8, 7, CONST8, 0, REM_U, END);
+	/* INT64_MIN / -1 wraps rather than trapping */
+	EVAL(GDB_AX_OK, UINT64_C(0x8000000000000000), CONST64, 0x80, 0, 0, 0, 0, 0, 0, 0, CONST8, 0xff, EXT, 8, DIV_S,
+		END);
+	EVAL(GDB_AX_OK, 0U, CONST64, 0x80, 0, 0, 0, 0, 0, 0, 0, CONST8, 0xff, EXT, 8, REM_S, END);
+}
+
+static void test_shifts(void)
+{
+	EVAL(GDB_AX_OK, 0x100U, CONST8, 1, CONST8, 8, LSH, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 1, CONST8, 64, LSH, END);
+	EVAL(GDB_AX_OK, 0x01U, CONST16, 0x01, 0x00, CONST8, 8, RSH_U, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 0xff, CONST8, 64, RSH_U, END);
+	/* Arithmetic shift keeps the sign, and saturates at 63 */
+	EVAL(GDB_AX_OK, UINT64_C(0xf800000000000000), CONST64, 0x80, 0, 0, 0, 0, 0, 0, 0, CONST8, 4, RSH_S, END);
+	EVAL(GDB_AX_OK, UINT64_MAX, CONST64, 0x80, 0, 0, 0, 0, 0, 0, 0, CONST8, 200, RSH_S, END);
+	EVAL(GDB_AX_OK, 0x08U, CONST8, 0x80, CONST8, 4, RSH_S, END);
+	EVAL(GDB_AX_OK, 0x80U, CONST8, 0x80, CONST8, 0, RSH_S, END);
+}
+
+static void test_logic(void)
+{
+	EVAL(GDB_AX_OK, 1U, CONST8, 0, LOG_NOT, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 5, LOG_NOT, END);
+	EVAL(GDB_AX_OK, 0x0cU, CONST8, 0x3c, CONST8, 0x0f, BIT_AND, END);
+	EVAL(GDB_AX_OK, 0x3fU, CONST8, 0x3c, CONST8, 0x0f, BIT_OR, END);
+	EVAL(GDB_AX_OK, 0x33U, CONST8, 0x3c, CONST8, 0x0f, BIT_XOR, END);
+	EVAL(GDB_AX_OK, ~UINT64_C(0x3c), CONST8, 0x3c, BIT_NOT, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 9, CONST16, 0, 9, EQUAL, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 9, CONST8, 8, EQUAL, END);
+	/* -1 < 1 signed, but not unsigned */
+	EVAL(GDB_AX_OK, 1U, CONST8, 0xff, EXT, 8, CONST8, 1, LESS_S, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 0xff, EXT, 8, CONST8, 1, LESS_U, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 1, CONST8, 1, LESS_S, END);
+	EVAL(GDB_AX_OK, 0U, CONST8, 1, CONST8, 1, LESS_U, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 1, CONST8, 2, LESS_U, END);
+}
+
+static void test_extend(void)
+{
+	EVAL(GDB_AX_OK, UINT64_C(0xffffffffffffff80), CONST8, 0x80, EXT, 8, END);
+	EVAL(GDB_AX_OK, 0x7fU, CONST8, 0x7f, EXT, 8, END);
+	EVAL(GDB_AX_OK, 0x0fU, CONST16, 0xff, 0xff, ZERO_EXT, 4, END);
+	/* 0 and 64 bits leave the value alone */
+	EVAL(GDB_AX_OK, 0xffffU, CONST16, 0xff, 0xff, ZERO_EXT, 0, END);
+	EVAL(GDB_AX_OK, 0xffffU, CONST16, 0xff, 0xff, EXT, 64, END);
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, CONST8, 1, EXT);
+}
+
+static void test_constants_and_stack(void)
+{
+	/* Operands are big endian */
+	EVAL(GDB_AX_OK, 0x1234U, CONST16, 0x12, 0x34, END);
+	EVAL(GDB_AX_OK, 0x12345678U, CONST32, 0x12, 0x34, 0x56, 0x78, END);
+	EVAL(GDB_AX_OK, UINT64_C(0x0102030405060708), CONST64, 1, 2, 3, 4, 5, 6, 7, 8, END);
+	EVAL(GDB_AX_OK, 6U, CONST8, 3, DUP, ADD, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 1, CONST8, 2, POP, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 1, CONST8, 2, SWAP, END);
+	EVAL(GDB_AX_OK, 2U, CONST8, 1, CONST8, 2, SWAP, POP, END);
+	/* pick 0 duplicates the top, pick 2 copies from three down */
+	EVAL(GDB_AX_OK, 3U, CONST8, 1, CONST8, 2, CONST8, 3, PICK, 0, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 1, CONST8, 2, CONST8, 3, PICK, 2, END);
+	/* a b c rot => c a b */
+	EVAL(GDB_AX_OK, 2U, CONST8, 1, CONST8, 2, CONST8, 3, ROT, END);
+	EVAL(GDB_AX_OK, 3U, CONST8, 1, CONST8, 2, CONST8, 3, ROT, POP, POP, END);
+	/* Tracing only pops what it consumes */
+	EVAL(GDB_AX_OK, 7U, CONST8, 7, CONST8, 1, CONST8, 4, TRACE, TRACE_Q, 4, TRACEV, 0, 1, TRACE16, 0, 2, END);
+	EVAL(GDB_AX_OK, 7U, CONST8, 7, CONST8, 1, CONST8, 4, TRACENZ, END);
+}
+
+static void test_stack_limits(void)
+{
+	EVAL(GDB_AX_ERROR_STACK, 0U, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, CONST8, 1, ADD, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, POP, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, CONST8, 1, CONST8, 2, ROT, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, CONST8, 1, PICK, 1, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, CONST8, 1, TRACE, END);
+
+	/* The stack holds exactly GDB_AX_STACK_SIZE values */
+	uint8_t code[GDB_AX_STACK_SIZE * 2U + 2U];
+	size_t len = 0;
+	for (size_t i = 0; i < GDB_AX_STACK_SIZE; ++i) {
+		code[len++] = CONST8;
+		code[len++] = (uint8_t)i;
+	}
+	code[len++] = END;
+	uint64_t value = 0;
+	CHECK(gdb_ax_eval(code, len, &access, &value) == GDB_AX_OK);
+	CHECK(value == GDB_AX_STACK_SIZE - 1U);
+	code[len - 1U] = DUP;
+	code[len++] = END;
+	CHECK(gdb_ax_eval(code, len, &access, &value) == GDB_AX_ERROR_STACK);
+	code[len - 2U] = REG;
+	code[len - 1U] = 0;
+	code[len++] = 0;
+	CHECK(gdb_ax_eval(code, len, &access, &value) == GDB_AX_ERROR_STACK);
+}
+
+static void test_jumps(void)
+{
+	/* if_goto pops its condition and jumps to an offset from the start */
+	EVAL(GDB_AX_OK, 2U, CONST8, 1, IF_GOTO, 0, 8, CONST8, 1, END, CONST8, 2, END);
+	EVAL(GDB_AX_OK, 1U, CONST8, 0, IF_GOTO, 0, 8, CONST8, 1, END, CONST8, 2, END);
+	EVAL(GDB_AX_OK, 2U, GOTO, 0, 6, CONST8, 1, END, CONST8, 2, END);
+	/* The last opcode is a valid target, one past it isn't */
+	EVAL(GDB_AX_ERROR_STACK, 0U, GOTO, 0, 3, END);
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, GOTO, 0, 4, END);
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, CONST8, 1, IF_GOTO, 0xff, 0xff, END);
+	/* A condition not taken doesn't check the target */
+	EVAL(GDB_AX_OK, 3U, CONST8, 0, IF_GOTO, 0xff, 0xff, CONST8, 3, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, IF_GOTO, 0, 0, END);
+	/* Truncated operands */
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, GOTO, 0);
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, CONST32, 1, 2, 3);
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, REG, 0);
+	/* Running off the end, and looping forever */
+	EVAL(GDB_AX_ERROR_BOUNDS, 0U, CONST8, 1);
+	EVAL(GDB_AX_ERROR_LIMIT, 0U, GOTO, 0, 0);
+}
+
+static void test_target_access(void)
+{
+	for (size_t i = 0; i < sizeof(memory); ++i)
+		memory[i] = (uint8_t)(0x10U + i);
+	/* ref reads little endian memory */
+	EVAL(GDB_AX_OK, 0x10U, CONST16, 0x10, 0x00, REF8, END);
+	EVAL(GDB_AX_OK, 0x1211U, CONST16, 0x10, 0x01, REF16, END);
+	EVAL(GDB_AX_OK, 0x13121110U, CONST16, 0x10, 0x00, REF32, END);
+	EVAL(GDB_AX_OK, UINT64_C(0x1f1e1d1c1b1a1918), CONST16, 0x10, 0x08, REF64, END);
+	EVAL(GDB_AX_ERROR_MEMORY, 0U, CONST8, 0, REF32, END);
+	EVAL(GDB_AX_ERROR_STACK, 0U, REF32, END);
+	EVAL(GDB_AX_OK, 0x105U, REG, 0, 5, END);
+	EVAL(GDB_AX_ERROR_REGISTER, 0U, REG, 0, 16, END);
+
+	/* Without access functions target reads fail cleanly */
+	uint64_t value = 0;
+	CHECK(gdb_ax_eval((const uint8_t[]){REG, 0, 1, END}, 4U, NULL, &value) == GDB_AX_ERROR_REGISTER);
+	CHECK(gdb_ax_eval((const uint8_t[]){CONST8, 0, REF8, END}, 4U, NULL, &value) == GDB_AX_ERROR_MEMORY);
+}
+
+static void test_opcodes_rejected(void)
+{
+	/* float, and opcodes GDB doesn't define */
+	EVAL(GDB_AX_ERROR_OPCODE, 0U, 0x01, END);
+	EVAL(GDB_AX_ERROR_OPCODE, 0U, 0x00, END);
+	EVAL(GDB_AX_ERROR_OPCODE, 0U, 0x2c, END);
+	EVAL(GDB_AX_ERROR_OPCODE, 0U, 0xff, END);
+}
+
+static void test_conditions(void)
+{
+	gdb_ax_bp_clear_all();
+	/* reg 1 == 0x101 */
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, "X8,2600012301011327"));
+	const gdb_ax_breakpoint_s *breakpoint = gdb_ax_bp_find(0x2000U);
+	CHECK(breakpoint && breakpoint->cond_count == 1U && breakpoint->code_len == 10U);
+	CHECK(breakpoint && breakpoint->code[0] == 0 && breakpoint->code[1] == 8 && breakpoint->code[2] == REG);
+	CHECK(breakpoint && gdb_ax_bp_condition(&target, breakpoint));
+
+	/* Two false conditions, lower case hex, and commands after the ';' */
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, "X3,220027X6,220022011327;cmds"));
+	breakpoint = gdb_ax_bp_find(0x2000U);
+	CHECK(breakpoint && breakpoint->cond_count == 2U && breakpoint->code_len == 13U);
+	gdb_ax_reset_stats();
+	CHECK(breakpoint && !gdb_ax_bp_condition(&target, breakpoint));
+	/* A condition that can't be evaluated reports the hit */
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, "X1,29"));
+	breakpoint = gdb_ax_bp_find(0x2000U);
+	CHECK(breakpoint && gdb_ax_bp_condition(&target, breakpoint));
+	gdb_ax_stats_s stats;
+	gdb_ax_get_stats(&stats);
+	CHECK(stats.evaluations == 2U && stats.suppressed == 1U && stats.errors == 1U);
+
+	/* Malformed lists are refused and leave the breakpoint as it was */
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X,27"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X0,"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X2"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X2,22"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X1,2g"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "X1,27junk"));
+	CHECK(!gdb_ax_bp_set(0, 0x2000U, 2, "Xffff,27"));
+	breakpoint = gdb_ax_bp_find(0x2000U);
+	CHECK(breakpoint && breakpoint->cond_count == 1U && breakpoint->code_len == 3U);
+
+	/* Dropping the conditions frees the slot, as does clearing it */
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, NULL));
+	CHECK(!gdb_ax_bp_find(0x2000U));
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, "X1,27"));
+	gdb_ax_bp_clear(0, 0x2000U, 2);
+	CHECK(!gdb_ax_bp_find(0x2000U));
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, "X1,27;cmds"));
+	CHECK(gdb_ax_bp_set(0, 0x2000U, 2, ";cmds"));
+	CHECK(!gdb_ax_bp_find(0x2000U));
+}
+
+static void test_breakpoint_table(void)
+{
+	gdb_ax_bp_clear_all();
+	/* Whether a breakpoint is inserted is up to the target, conditional or not */
+	breakwatch_s breakwatches[GDB_AX_BP_COUNT + 8U];
+	target.bw_list = NULL;
+	for (uint32_t i = 0; i < ARRAY_LENGTH(breakwatches); ++i) {
+		const target_addr32_t addr = 0x3000U + i * 4U;
+		CHECK(!gdb_ax_bp_inserted(&target, TARGET_BREAK_HARD, addr, 4));
+		breakwatches[i] = (breakwatch_s){.next = target.bw_list, .type = TARGET_BREAK_HARD, .addr = addr, .size = 4};
+		target.bw_list = &breakwatches[i];
+		/* Plain breakpoints don't use up slots */
+		CHECK(gdb_ax_bp_set(TARGET_BREAK_HARD, addr, 4, NULL));
+		CHECK(gdb_ax_bp_inserted(&target, TARGET_BREAK_HARD, addr, 4));
+	}
+	CHECK(!gdb_ax_bp_inserted(&target, TARGET_BREAK_SOFT, 0x3000U, 4));
+	CHECK(!gdb_ax_bp_inserted(&target, TARGET_BREAK_HARD, 0x3000U, 2));
+	CHECK(!gdb_ax_bp_find(0x3000U));
+
+	/* Any of them can be given conditions later, up to the number of slots, including the last set */
+	for (uint32_t i = ARRAY_LENGTH(breakwatches); i-- > ARRAY_LENGTH(breakwatches) - GDB_AX_BP_COUNT;)
+		CHECK(gdb_ax_bp_set(TARGET_BREAK_HARD, 0x3000U + i * 4U, 4, "X1,27"));
+	CHECK(gdb_ax_bp_find(0x3000U + (ARRAY_LENGTH(breakwatches) - 1U) * 4U));
+	CHECK(!gdb_ax_bp_set(TARGET_BREAK_HARD, 0x3000U, 4, "X1,27"));
+	CHECK(!gdb_ax_bp_find(0x3000U));
+	/* Updating the conditions of one already in the table still works when it's full */
+	CHECK(gdb_ax_bp_set(TARGET_BREAK_HARD, 0x3000U + 8U * 4U, 4, "X2,2227"));
+	const gdb_ax_breakpoint_s *const breakpoint = gdb_ax_bp_find(0x3000U + 8U * 4U);
+	CHECK(breakpoint && breakpoint->code_len == 4U);
+
+	/* A Z without conditions makes room for another */
+	CHECK(gdb_ax_bp_set(TARGET_BREAK_HARD, 0x3000U + 10U * 4U, 4, NULL));
+	CHECK(!gdb_ax_bp_find(0x3000U + 10U * 4U));
+	CHECK(gdb_ax_bp_set(TARGET_BREAK_HARD, 0x3000U, 4, "X1,27"));
+	CHECK(gdb_ax_bp_find(0x3000U));
+
+	gdb_ax_bp_clear_all();
+	CHECK(!gdb_ax_bp_find(0x3000U));
+	target.bw_list = NULL;
+}
+
+int main(void)
+{
+	test_arithmetic();
+	test_shifts();
+	test_logic();
+	test_extend();
+	test_constants_and_stack();
+	test_stack_limits();
+	test_jumps();
+	test_target_access();
+	test_opcodes_rejected();
+	test_conditions();
+	test_breakpoint_table();
+	return TEST_RESULT();
+}
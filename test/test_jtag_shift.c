@@ -0,0 +1,201 @@
+/*
+ * Host tests for the word-wide JTAG shifts
+ *
+ * The GPIO registers are modelled with a TAP in Shift-DR on the other end of
+ * the pins: it samples TDI and TMS as TCK rises and moves TDO on to its next
+ * bit as TCK falls. Each sequence is checked against that edge by edge, for
+ * lengths either side of a whole word, with and without the delay loop.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "jtagtap.h"
+#include "jtag_shift.h"
+#include "test.h"
+
+#define TCK (1U << TCK_PIN)
+#define TMS (1U << TMS_PIN)
+#define TDI (1U << TDI_PIN)
+#define TDO (1U << TDO_PIN)
+/* Outputs that aren't JTAG's, which the shifts must leave alone */
+#define OTHER_PINS 0x00f000a0U
+
+#define MAX_BITS 128U
+
+uint32_t target_clk_divider;
+jtag_proc_s jtag_proc;
+
+static uint32_t gpio_out;
+static size_t rising_edges;
+static size_t falling_edges;
+static bool tdi_sampled[MAX_BITS];
+static bool tms_sampled[MAX_BITS];
+/* What the TAP shifts out, a bit per clock */
+static uint8_t tdo[MAX_BITS / 8U];
+static size_t tdo_reads;
+static size_t tdo_reads_tck_low;
+/* Writes that changed TDI or TMS with TCK high, or in the same store that raised it */
+static size_t glitches;
+static size_t bit_calls;
+static uint32_t random_state = 0x12345678U;
+
+void platform_reg_write(const uint32_t reg, const uint32_t value)
+{
+	uint32_t out = gpio_out;
+	if (reg == GPIO_OUT_W1TS_REG)
+		out |= value;
+	else {
+		CHECK(reg == GPIO_OUT_W1TC_REG);
+		out &= ~value;
+	}
+	if ((out & TCK) && ((out ^ gpio_out) & (TDI | TMS)))
+		++glitches;
+	if ((out & TCK) && !(gpio_out & TCK)) {
+		if (rising_edges < MAX_BITS) {
+			tdi_sampled[rising_edges] = out & TDI;
+			tms_sampled[rising_edges] = out & TMS;
+		}
+		++rising_edges;
+	} else if (!(out & TCK) && (gpio_out & TCK))
+		++falling_edges;
+	gpio_out = out;
+}
+
+/* Every other input reads high, so TDO has to be picked out of the register */
+uint32_t platform_reg_read(const uint32_t reg)
+{
+	CHECK(reg == GPIO_IN_REG);
+	++tdo_reads;
+	if (!(gpio_out & TCK))
+		++tdo_reads_tck_low;
+	const bool bit = falling_edges < MAX_BITS && (tdo[falling_edges / 8U] >> (falling_edges % 8U)) & 1U;
+	return ~TDO | (bit ? TDO : 0U);
+}
+
+/* jtagtap.c's bit at a time sequences, only ever counted */
+static void bit_tdi_tdo_seq(uint8_t *const data_out, const bool final_tms, const uint8_t *const data_in,
+	const size_t clock_cycles)
+{
+	(void)data_out;
+	(void)final_tms;
+	(void)data_in;
+	(void)clock_cycles;
+	++bit_calls;
+}
+
+static void bit_tdi_seq(const bool final_tms, const uint8_t *const data_in, const size_t clock_cycles)
+{
+	(void)final_tms;
+	(void)data_in;
+	(void)clock_cycles;
+	++bit_calls;
+}
+
+static uint8_t random_byte(void)
+{
+	random_state ^= random_state << 13U;
+	random_state ^= random_state >> 17U;
+	random_state ^= random_state << 5U;
+	return (uint8_t)random_state;
+}
+
+static bool get_bit(const uint8_t *const data, const size_t bit)
+{
+	return (data[bit / 8U] >> (bit % 8U)) & 1U;
+}
+
+static void shift_check(const size_t bits, const bool final_tms, const bool capture, const uint32_t divider)
+{
+	uint8_t data_in[MAX_BITS / 8U];
+	uint8_t data_out[MAX_BITS / 8U];
+	for (size_t i = 0; i < sizeof(data_in); ++i) {
+		data_in[i] = random_byte();
+		tdo[i] = random_byte();
+	}
+	memset(data_out, 0xa5, sizeof(data_out));
+	/* TCK low and TMS high, as after the TMS sequence that led into Shift-DR */
+	gpio_out = OTHER_PINS | TMS;
+	rising_edges = 0;
+	falling_edges = 0;
+	tdo_reads = 0;
+	tdo_reads_tck_low = 0;
+	glitches = 0;
+	target_clk_divider = divider;
+
+	const int failures = test_failures;
+	if (capture)
+		jtag_proc.jtagtap_tdi_tdo_seq(data_out, final_tms, data_in, bits);
+	else
+		jtag_proc.jtagtap_tdi_seq(final_tms, data_in, bits);
+
+	/* One clock per bit, TCK left low and nothing but TCK, TMS and TDI touched */
+	CHECK(rising_edges == bits);
+	CHECK(falling_edges == bits);
+	CHECK(!(gpio_out & TCK));
+	CHECK((gpio_out & ~(TCK | TMS | TDI)) == OTHER_PINS);
+	CHECK(!glitches);
+
+	for (size_t i = 0; i < bits && i < MAX_BITS; ++i) {
+		CHECK(tdi_sampled[i] == get_bit(data_in, i));
+		/* TMS only goes to final_tms for the last bit */
+		CHECK(tms_sampled[i] == (final_tms && i + 1U == bits));
+	}
+
+	if (capture) {
+		/* Read with TCK high, between the rising edge and the next falling one */
+		CHECK(tdo_reads == bits);
+		CHECK(!tdo_reads_tck_low);
+		for (size_t i = 0; i < bits; ++i)
+			CHECK(get_bit(data_out, i) == get_bit(tdo, i));
+		for (size_t i = (bits + 7U) / 8U; i < sizeof(data_out); ++i)
+			CHECK(data_out[i] == 0xa5U);
+	} else
+		CHECK(!tdo_reads);
+
+	if (test_failures != failures)
+		fprintf(stderr, "  in a %zu bit %s with final_tms %d and divider 0x%" PRIx32 "\n", bits,
+			capture ? "tdi_tdo_seq" : "tdi_seq", final_tms, divider);
+}
+
+static void test_lengths(void)
+{
+	static const size_t lengths[] = {0U, 1U, 8U, 31U, 32U, 33U, 41U, 63U, 64U, 65U, 96U, 127U, 128U};
+	static const uint32_t dividers[] = {UINT32_MAX, 0U, 3U};
+	for (size_t length = 0; length < ARRAY_LENGTH(lengths); ++length) {
+		for (size_t divider = 0; divider < ARRAY_LENGTH(dividers); ++divider) {
+			for (size_t i = 0; i < 4U; ++i)
+				shift_check(lengths[length], i & 1U, i & 2U, dividers[divider]);
+		}
+	}
+}
+
+static void test_enable(void)
+{
+	CHECK(jtag_shift_enabled());
+	jtag_shift_enable(false);
+	CHECK(!jtag_shift_enabled());
+	CHECK(jtag_proc.jtagtap_tdi_tdo_seq == bit_tdi_tdo_seq);
+	CHECK(jtag_proc.jtagtap_tdi_seq == bit_tdi_seq);
+	uint8_t data[4] = {0};
+	jtag_proc.jtagtap_tdi_tdo_seq(data, false, data, 32U);
+	jtag_proc.jtagtap_tdi_seq(false, data, 32U);
+	CHECK(bit_calls == 2U);
+
+	jtag_shift_enable(true);
+	CHECK(jtag_proc.jtagtap_tdi_tdo_seq != bit_tdi_tdo_seq);
+	CHECK(jtag_proc.jtagtap_tdi_seq != bit_tdi_seq);
+	shift_check(41U, true, true, UINT32_MAX);
+	CHECK(bit_calls == 2U);
+}
+
+int main(void)
+{
+	/* As jtagtap_init() leaves it, before a scan attaches the shifts */
+	jtag_proc.jtagtap_tdi_tdo_seq = bit_tdi_tdo_seq;
+	jtag_proc.jtagtap_tdi_seq = bit_tdi_seq;
+	jtag_shift_attach();
+
+	test_lengths();
+	test_enable();
+	return TEST_RESULT();
+}
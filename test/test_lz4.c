@@ -0,0 +1,393 @@
+/*
+ * Host tests for the LZ4 codec and the compressed flash upload
+ *
+ * Blocks are round tripped through lz4_compress() and the decoder, fed in
+ * pieces of every size so sequences are split at every point. Frames made by
+ * the lz4 tool, and longer ones made here, are then programmed into a
+ * simulated flash through flash_upload_lz4() to cover the frame header, the
+ * block checksums that are skipped and frames cut short.
+ */
+
+#include "general.h"
+#include "target_internal.h"
+#include "gdb_main.h"
+#include "gdb_cache.h"
+#include "lz4.h"
+#include "flash_upload.h"
+#include "test.h"
+
+#define FLASH_START     0x08000000U
+#define FLASH_SIZE      (256U * 1024U)
+#define FLASH_BLOCKSIZE 2048U
+#define IMAGE_SIZE      150000U
+
+/* "Black Magic Probe " 20 times then 200 bytes of 0xff, from lz4 -B4 */
+static const uint8_t frame_tool[] = {
+	0x04, 0x22, 0x4d, 0x18, 0x64, 0x40, 0xa7, 0x23, 0x00, 0x00, 0x00, 0xff, 0x03, 0x42, 0x6c, 0x61, 0x63, 0x6b,
+	0x20, 0x4d, 0x61, 0x67, 0x69, 0x63, 0x20, 0x50, 0x72, 0x6f, 0x62, 0x65, 0x20, 0x12, 0x00, 0xff, 0x44, 0x1f,
+	0xff, 0x01, 0x00, 0xaf, 0x50, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x39, 0x11, 0x9b, 0x8e,
+};
+
+/* The same with lz4 -B4 -BX --content-size, so block checksums and the content size */
+static const uint8_t frame_tool_checksums[] = {
+	0x04, 0x22, 0x4d, 0x18, 0x7c, 0x40, 0x30, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xc8, 0x23, 0x00, 0x00,
+	0x00, 0xff, 0x03, 0x42, 0x6c, 0x61, 0x63, 0x6b, 0x20, 0x4d, 0x61, 0x67, 0x69, 0x63, 0x20, 0x50, 0x72, 0x6f,
+	0x62, 0x65, 0x20, 0x12, 0x00, 0xff, 0x44, 0x1f, 0xff, 0x01, 0x00, 0xaf, 0x50, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0x61, 0x7c, 0x75, 0xc6, 0x00, 0x00, 0x00, 0x00, 0x39, 0x11, 0x9b, 0x8e,
+};
+
+/* 24 random bytes with lz4 -B4 -BX, which stores them as a raw block */
+static const uint8_t frame_tool_raw[] = {
+	0x04, 0x22, 0x4d, 0x18, 0x74, 0x40, 0xbd, 0x18, 0x00, 0x00, 0x80, 0xa5, 0x4d, 0xca, 0x18, 0x25,
+	0x30, 0xbb, 0x1d, 0x6d, 0x13, 0x2c, 0xde, 0xd6, 0x23, 0x7b, 0x2e, 0xd9, 0x1e, 0x3f, 0x72, 0x1f,
+	0xcb, 0x19, 0x71, 0x4b, 0x17, 0xc4, 0xa0, 0x00, 0x00, 0x00, 0x00, 0x4b, 0x17, 0xc4, 0xa0,
+};
+
+static const uint8_t raw_data[] = {
+	0xa5, 0x4d, 0xca, 0x18, 0x25, 0x30, 0xbb, 0x1d, 0x6d, 0x13, 0x2c, 0xde,
+	0xd6, 0x23, 0x7b, 0x2e, 0xd9, 0x1e, 0x3f, 0x72, 0x1f, 0xcb, 0x19, 0x71,
+};
+
+bool gdb_target_running;
+target_s *cur_target;
+
+static uint8_t flash_mem[FLASH_SIZE];
+static bool flash_failed; /* A write to flash that wasn't erased, or an unaligned erase */
+static target_flash_s flash = {
+	.start = FLASH_START,
+	.length = FLASH_SIZE,
+	.blocksize = FLASH_BLOCKSIZE,
+};
+static target_s target = {.flash = &flash};
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t frame[IMAGE_SIZE * 2U];
+static uint8_t block[LZ4_MAX_INPUT_SIZE * 2U];
+static uint8_t decoded[LZ4_MAX_INPUT_SIZE];
+static uint16_t table[LZ4_HASH_SIZE];
+
+void gdb_cache_invalidate(void)
+{
+}
+
+bool target_mem32_read(target_s *const t, void *const dest, const target_addr_t src, const size_t len)
+{
+	(void)t;
+	(void)dest;
+	(void)src;
+	(void)len;
+	return true;
+}
+
+bool target_flash_erase(target_s *const t, const target_addr_t addr, const size_t len)
+{
+	(void)t;
+	if (addr < FLASH_START || addr - FLASH_START + len > FLASH_SIZE) {
+		flash_failed = true;
+		return false;
+	}
+	/* Whole flash blocks go, as on a real part */
+	const size_t start = (addr - FLASH_START) / FLASH_BLOCKSIZE * FLASH_BLOCKSIZE;
+	const size_t end = (addr - FLASH_START + len + FLASH_BLOCKSIZE - 1U) / FLASH_BLOCKSIZE * FLASH_BLOCKSIZE;
+	memset(flash_mem + start, 0xff, MIN(end, FLASH_SIZE) - start);
+	return true;
+}
+
+bool target_flash_write(target_s *const t, const target_addr_t dest, const void *const src, const size_t len)
+{
+	t->flash_mode = true;
+	if (dest < FLASH_START || dest - FLASH_START + len > FLASH_SIZE) {
+		flash_failed = true;
+		return false;
+	}
+	uint8_t *const mem = flash_mem + (dest - FLASH_START);
+	for (size_t i = 0; i < len; ++i) {
+		if (mem[i] != 0xffU)
+			flash_failed = true;
+	}
+	memcpy(mem, src, len);
+	return true;
+}
+
+bool target_flash_complete(target_s *const t)
+{
+	t->flash_mode = false;
+	return true;
+}
+
+/* Frame source handing out at most piece bytes per read, 0 meaning a varying size */
+typedef struct frame_reader {
+	const uint8_t *data;
+	size_t len;
+	size_t offset;
+	size_t piece;
+	uint32_t seed;
+} frame_reader_s;
+
+static int frame_read(void *const ctx, void *const data, const size_t len)
+{
+	frame_reader_s *const reader = (frame_reader_s *)ctx;
+	size_t amount = reader->len - reader->offset;
+	size_t piece = reader->piece;
+	if (!piece) {
+		reader->seed = reader->seed * 1103515245U + 12345U;
+		piece = 1U + (reader->seed >> 16U) % 3000U;
+	}
+	amount = MIN(amount, MIN(len, piece));
+	memcpy(data, reader->data + reader->offset, amount);
+	reader->offset += amount;
+	return (int)amount;
+}
+
+static flash_upload_status_e upload(const uint8_t *const data, const size_t len, const size_t piece, size_t *const written)
+{
+	memset(flash_mem, 0, sizeof(flash_mem));
+	flash_failed = false;
+	cur_target = &target;
+	frame_reader_s reader = {.data = data, .len = len, .piece = piece, .seed = (uint32_t)len};
+	return flash_upload_lz4(FLASH_START, frame_read, &reader, written);
+}
+
+/* Firmware-like contents: code-ish words, runs of 0xff padding and some noise */
+static void fill_image(uint8_t *const data, const size_t len, uint32_t seed)
+{
+	for (size_t i = 0; i < len; ++i) {
+		seed = seed * 1103515245U + 12345U;
+		if ((i / 4096U) % 3U == 2U)
+			data[i] = 0xffU;
+		else if ((i / 512U) % 5U == 4U)
+			data[i] = (uint8_t)(seed >> 16U);
+		else
+			data[i] = (uint8_t)((i % 64U) * 7U);
+	}
+}
+
+static bool decode(const uint8_t *const data, const size_t len, const size_t piece, const size_t capacity, size_t *const out)
+{
+	lz4_decoder_s decoder;
+	lz4_decoder_init(&decoder, decoded, capacity);
+	for (size_t offset = 0; offset < len; offset += piece) {
+		if (!lz4_decode(&decoder, data + offset, MIN(piece, len - offset)))
+			return false;
+	}
+	*out = decoder.len;
+	return lz4_decoder_done(&decoder);
+}
+
+static void test_round_trip(void)
+{
+	static const size_t sizes[] = {1U, 5U, 12U, 13U, 100U, 4096U, 33333U, LZ4_MAX_INPUT_SIZE};
+	for (uint32_t pattern = 0; pattern < 4U; ++pattern) {
+		for (size_t i = 0; i < ARRAY_LENGTH(sizes); ++i) {
+			const size_t size = sizes[i];
+			if (pattern == 0)
+				memset(image, 0xff, size);
+			else if (pattern == 1)
+				fill_image(image, size, 1);
+			else {
+				/* Noise doesn't compress, so the block ends up larger than its input */
+				uint32_t seed = pattern;
+				for (size_t j = 0; j < size; ++j) {
+					seed = seed * 1103515245U + 12345U;
+					image[j] = pattern == 2 ? (uint8_t)(seed >> 16U) : (uint8_t)j;
+				}
+			}
+			const size_t len = lz4_compress(image, size, block, sizeof(block), table);
+			CHECK(len);
+			if (pattern == 0 && size >= 4096U)
+				CHECK(len < size / 100U);
+			/* Whole, then in pieces that split lengths, offsets and literals everywhere */
+			static const size_t pieces[] = {SIZE_MAX, 1U, 2U, 3U, 7U, 1024U};
+			for (size_t k = 0; k < ARRAY_LENGTH(pieces); ++k) {
+				size_t out = 0;
+				memset(decoded, 0, size);
+				CHECK(decode(block, len, pieces[k], sizeof(decoded), &out));
+				CHECK(out == size);
+				CHECK(!memcmp(decoded, image, size));
+			}
+		}
+	}
+}
+
+static void test_block_limits(void)
+{
+	fill_image(image, 4096U, 2);
+	const size_t len = lz4_compress(image, 4096U, block, sizeof(block), table);
+	CHECK(len);
+	/* The block has to fit in capacity, as does what it decodes to */
+	CHECK(!lz4_compress(image, 4096U, block, len - 1U, table));
+	size_t out = 0;
+	CHECK(!decode(block, len, SIZE_MAX, 4095U, &out));
+	CHECK(decode(block, len, SIZE_MAX, 4096U, &out));
+	CHECK(!lz4_compress(image, LZ4_MAX_INPUT_SIZE + 1U, block, sizeof(block), table));
+
+	/* Cut short, a block either fails or ends early on a sequence boundary */
+	for (size_t cut = 0; cut < len; ++cut) {
+		out = 0;
+		if (decode(block, cut, 5U, sizeof(decoded), &out))
+			CHECK(out < 4096U);
+	}
+
+	/* Matches can't reach back past the start of the block, nor have offset 0 */
+	static const uint8_t before_start[] = {0x14, 'a', 0x02, 0x00, 0x00};
+	static const uint8_t zero_offset[] = {0x14, 'a', 0x00, 0x00, 0x00};
+	static const uint8_t overlapping[] = {0x14, 'a', 0x01, 0x00, 0x00};
+	CHECK(!decode(before_start, sizeof(before_start), SIZE_MAX, sizeof(decoded), &out));
+	CHECK(!decode(zero_offset, sizeof(zero_offset), SIZE_MAX, sizeof(decoded), &out));
+	CHECK(decode(overlapping, sizeof(overlapping), 1U, sizeof(decoded), &out));
+	CHECK(out == 9U && !memcmp(decoded, "aaaaaaaaa", 9U));
+}
+
+static void test_tool_frames(void)
+{
+	uint8_t expected[560];
+	for (size_t i = 0; i < 20U; ++i)
+		memcpy(expected + i * 18U, "Black Magic Probe ", 18U);
+	memset(expected + 360U, 0xff, 200U);
+
+	size_t written = 0;
+	CHECK(upload(frame_tool, sizeof(frame_tool), 0, &written) == FLASH_UPLOAD_OK);
+	CHECK(written == sizeof(expected) && !memcmp(flash_mem, expected, sizeof(expected)) && !flash_failed);
+	CHECK(!target.flash_mode);
+
+	for (size_t piece = 1; piece <= 8U; ++piece) {
+		CHECK(upload(frame_tool_checksums, sizeof(frame_tool_checksums), piece, &written) == FLASH_UPLOAD_OK);
+		CHECK(written == sizeof(expected) && !memcmp(flash_mem, expected, sizeof(expected)) && !flash_failed);
+	}
+
+	CHECK(upload(frame_tool_raw, sizeof(frame_tool_raw), 1, &written) == FLASH_UPLOAD_OK);
+	CHECK(written == sizeof(raw_data) && !memcmp(flash_mem, raw_data, sizeof(raw_data)) && !flash_failed);
+}
+
+static size_t put_le32(uint8_t *const out, const uint32_t value)
+{
+	for (size_t i = 0; i < 4U; ++i)
+		out[i] = (uint8_t)(value >> (i * 8U));
+	return 4U;
+}
+
+/* Frame the image in 64 KiB blocks, the middle one stored raw. Checksums are left 0, they aren't checked */
+static size_t make_frame(const uint8_t flags, const uint8_t block_size)
+{
+	size_t len = put_le32(frame, 0x184d2204U);
+	frame[len++] = flags;
+	frame[len++] = block_size;
+	if (flags & 0x08U) {
+		len += put_le32(frame + len, IMAGE_SIZE);
+		len += put_le32(frame + len, 0);
+	}
+	frame[len++] = 0; /* Header checksum */
+	for (size_t offset = 0, index = 0; offset < IMAGE_SIZE; offset += LZ4_MAX_INPUT_SIZE, ++index) {
+		const size_t size = MIN(LZ4_MAX_INPUT_SIZE, IMAGE_SIZE - offset);
+		const size_t compressed =
+			index == 1U ? 0 : lz4_compress(image + offset, size, frame + len + 4U, sizeof(frame) - len - 4U, table);
+		if (compressed) {
+			len += put_le32(frame + len, (uint32_t)compressed);
+			len += compressed;
+		} else {
+			len += put_le32(frame + len, (uint32_t)size | 0x80000000U);
+			memcpy(frame + len, image + offset, size);
+			len += size;
+		}
+		if (flags & 0x10U)
+			len += put_le32(frame + len, 0);
+	}
+	len += put_le32(frame + len, 0); /* End mark */
+	if (flags & 0x04U)
+		len += put_le32(frame + len, 0);
+	return len;
+}
+
+static void test_multi_block_frames(void)
+{
+	fill_image(image, IMAGE_SIZE, 3);
+	/* Plain, with block checksums, with content size and content checksum */
+	static const uint8_t flags[] = {0x60U, 0x70U, 0x6cU, 0x7cU};
+	for (size_t i = 0; i < ARRAY_LENGTH(flags); ++i) {
+		const size_t len = make_frame(flags[i], 0x40U);
+		/* Reads of one byte, of sizes that straddle the 1 KiB decode chunks, and all at once */
+		static const size_t pieces[] = {0, 1U, 1023U, 1025U, SIZE_MAX};
+		for (size_t k = 0; k < ARRAY_LENGTH(pieces); ++k) {
+			size_t written = 0;
+			CHECK(upload(frame, len, pieces[k], &written) == FLASH_UPLOAD_OK);
+			CHECK(written == IMAGE_SIZE);
+			CHECK(!memcmp(flash_mem, image, IMAGE_SIZE));
+			CHECK(!flash_failed);
+		}
+	}
+}
+
+static void test_bad_headers(void)
+{
+	size_t written = 0;
+	uint8_t bad[sizeof(frame_tool)];
+
+	/* Magic, version, linked blocks, dictionary ID, and block sizes other than 64 KiB */
+	static const struct {
+		size_t offset;
+		uint8_t value;
+	} changes[] = {
+		{0, 0x05U},
+		{4, 0x24U},
+		{4, 0x84U},
+		{4, 0x44U},
+		{4, 0x65U},
+		{5, 0x50U},
+		{5, 0x70U},
+		{5, 0x00U},
+	};
+	for (size_t i = 0; i < ARRAY_LENGTH(changes); ++i) {
+		memcpy(bad, frame_tool, sizeof(bad));
+		bad[changes[i].offset] = changes[i].value;
+		CHECK(upload(bad, sizeof(bad), 0, &written) == FLASH_UPLOAD_BAD_FORMAT);
+		CHECK(!written);
+	}
+
+	/* A block claiming more than 64 KiB */
+	fill_image(image, IMAGE_SIZE, 4);
+	const size_t len = make_frame(0x60U, 0x40U);
+	put_le32(frame + 7U, LZ4_MAX_INPUT_SIZE + 1U);
+	CHECK(upload(frame, len, 0, &written) == FLASH_UPLOAD_BAD_FORMAT);
+
+	/* A compressed block that is corrupt */
+	memcpy(bad, frame_tool, sizeof(bad));
+	bad[31] = 0xffU; /* Match offset past the start of the block */
+	CHECK(upload(bad, sizeof(bad), 0, &written) == FLASH_UPLOAD_BAD_FORMAT);
+
+	cur_target = NULL;
+	frame_reader_s reader = {.data = frame_tool, .len = sizeof(frame_tool), .piece = SIZE_MAX};
+	CHECK(flash_upload_lz4(FLASH_START, frame_read, &reader, &written) == FLASH_UPLOAD_NO_TARGET);
+}
+
+static void test_truncated(void)
+{
+	size_t written = 0;
+	/* Everything up to the end mark is needed, the content checksum after it isn't */
+	for (size_t cut = 0; cut < sizeof(frame_tool_checksums) - 4U; ++cut) {
+		CHECK(upload(frame_tool_checksums, cut, 0, &written) == FLASH_UPLOAD_READ_ERROR);
+		/* The block is programmed once its checksum is in */
+		CHECK(written == (cut >= sizeof(frame_tool_checksums) - 8U ? 560U : 0));
+	}
+	CHECK(upload(frame_tool_checksums, sizeof(frame_tool_checksums) - 4U, 0, &written) == FLASH_UPLOAD_OK);
+
+	/* Blocks before the cut are programmed, the one cut short isn't */
+	fill_image(image, IMAGE_SIZE, 5);
+	const size_t len = make_frame(0x70U, 0x40U);
+	for (size_t cut = 7U; cut < len - 4U; cut += 997U) {
+		CHECK(upload(frame, cut, 0, &written) == FLASH_UPLOAD_READ_ERROR);
+		CHECK(written % LZ4_MAX_INPUT_SIZE == 0 && written < IMAGE_SIZE);
+		CHECK(!memcmp(flash_mem, image, written));
+		CHECK(!target.flash_mode);
+	}
+}
+
+int main(void)
+{
+	test_round_trip();
+	test_block_limits();
+	test_tool_frames();
+	test_multi_block_frames();
+	test_bad_headers();
+	test_truncated();
+	return TEST_RESULT();
+}
@@ -0,0 +1,329 @@
+/*
+ * Host tests for the SWD sequence engine
+ *
+ * swd_proc is pointed at the engine with the simulated target behind it, and
+ * DP/AP accesses are made the way adiv5_swd.c makes them: the request, the
+ * ACK, then the data and its parity, with idle clocks after. The simulated
+ * target checks the framing clock by clock, so any bit out of place or any
+ * turnaround missed or doubled shows up in its protocol error count.
+ */
+
+#include "general.h"
+#include "swd.h"
+#include "swd_engine.h"
+#include "swd_sim.h"
+#include "test.h"
+
+#define ACK_OK    1U
+#define ACK_WAIT  2U
+#define ACK_FAULT 4U
+#define ACK_NONE  7U /* Nothing driving the line, the pull-up reads as 1s */
+
+#define DP_DPIDR    0x0U
+#define DP_ABORT    0x0U
+#define DP_CTRLSTAT 0x4U
+#define DP_SELECT   0x8U
+#define DP_RDBUFF   0xcU
+#define AP_CSW      0x0U
+#define AP_TAR      0x4U
+#define AP_DRW      0xcU
+#define AP_IDR      0xcU /* In bank 0xf */
+
+#define CSW_WORD_INCREMENT 0x23000012U
+
+static uint8_t make_request(const bool ap, const bool read, const uint8_t reg)
+{
+	uint8_t request = 0x81U | ((reg << 1U) & 0x18U);
+	if (ap)
+		request |= 0x02U;
+	if (read)
+		request |= 0x04U;
+	if (__builtin_parity(request & 0x1eU))
+		request |= 0x20U;
+	return request;
+}
+
+/* One access as adiv5_swd.c makes it, returns the ACK. parity_ok is false if a read came back bad */
+static uint32_t access(const bool ap, const bool read, const uint8_t reg, uint32_t *const value, bool *const parity_ok)
+{
+	swd_proc.seq_out(make_request(ap, read, reg), 8U);
+	const uint32_t ack = swd_proc.seq_in(3U);
+	if (ack == ACK_OK) {
+		if (read) {
+			const bool ok = swd_proc.seq_in_parity(value, 32U);
+			if (parity_ok)
+				*parity_ok = ok;
+		} else
+			swd_proc.seq_out_parity(*value, 32U);
+	}
+	swd_proc.seq_out(0U, 8U);
+	return ack;
+}
+
+static uint32_t dp_read(const uint8_t reg, uint32_t *const value)
+{
+	bool parity_ok = false;
+	const uint32_t ack = access(false, true, reg, value, &parity_ok);
+	CHECK(ack != ACK_OK || parity_ok);
+	return ack;
+}
+
+static uint32_t dp_write(const uint8_t reg, uint32_t value)
+{
+	return access(false, false, reg, &value, NULL);
+}
+
+static uint32_t ap_read(const uint8_t reg, uint32_t *const value)
+{
+	bool parity_ok = false;
+	const uint32_t ack = access(true, true, reg, value, &parity_ok);
+	CHECK(ack != ACK_OK || parity_ok);
+	return ack;
+}
+
+static uint32_t ap_write(const uint8_t reg, uint32_t value)
+{
+	return access(true, false, reg, &value, NULL);
+}
+
+static void line_reset(void)
+{
+	swd_proc.seq_out(0xffffffffU, 32U);
+	swd_proc.seq_out(0x000fffffU, 24U);
+}
+
+/* Power the simulated target up and get it talking, as a scan would */
+static void connect(void)
+{
+	swd_sim_reset();
+	swd_engine_attach(&swd_engine_sim);
+	line_reset();
+	uint32_t value = 0;
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_DPIDR);
+}
+
+static uint32_t protocol_errors(void)
+{
+	swd_sim_stats_s stats;
+	swd_sim_get_stats(&stats);
+	return stats.protocol_errors;
+}
+
+static void test_line_reset(void)
+{
+	swd_sim_reset();
+	swd_engine_attach(&swd_engine_sim);
+	uint32_t value = 0;
+	/* Nothing answers before a line reset */
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_NONE);
+	line_reset();
+	CHECK(swd_sim_idle());
+	/* Then DPIDR has to be read first */
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_DPIDR);
+	CHECK(protocol_errors() == 0);
+}
+
+static void test_framing(void)
+{
+	connect();
+	swd_engine_reset_stats();
+	uint32_t value = 0;
+	CHECK(dp_write(DP_SELECT, 0) == ACK_OK);
+	CHECK(dp_write(DP_CTRLSTAT, SWD_SIM_CTRLSTAT_POWERUP) == ACK_OK);
+	CHECK(dp_read(DP_CTRLSTAT, &value) == ACK_OK);
+	CHECK(value == 0xf0000000U);
+	CHECK(swd_sim_idle());
+
+	/* Every request went out in one transfer with its turnaround and ACK */
+	swd_engine_stats_s stats;
+	swd_engine_get_stats(&stats);
+	CHECK(stats.requests_merged == 3U);
+	/* Each access is the request with its ACK, the data, and the idle clocks */
+	CHECK(stats.transfers == 9U);
+	/* 8 + 1 + 3 request and ACK, 1 + 33 write or 33 + 1 read, 8 idle */
+	CHECK(stats.bits == 3U * (12U + 34U + 8U));
+
+	/* Data of every bit pattern, through a register that reads back as written */
+	CHECK(ap_write(AP_CSW, CSW_WORD_INCREMENT) == ACK_OK);
+	static const uint32_t patterns[] = {0U, 1U, 0x80000000U, 0xffffffffU, 0x55555555U, 0xaaaaaaaaU, 0x20000004U};
+	for (size_t i = 0; i < ARRAY_LENGTH(patterns); ++i) {
+		CHECK(ap_write(AP_TAR, patterns[i]) == ACK_OK);
+		/* AP reads are posted, the value comes back from the next one or RDBUFF */
+		CHECK(ap_read(AP_TAR, &value) == ACK_OK);
+		CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+		CHECK(value == patterns[i]);
+	}
+
+	/* A line reset part way through a session needs DPIDR read again, and nothing else */
+	line_reset();
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(protocol_errors() == 0);
+}
+
+static void test_parity(void)
+{
+	connect();
+	uint32_t value = 0;
+	bool parity_ok = true;
+	/* A read with the wrong parity is reported, and the transaction still ends in step */
+	swd_sim_corrupt_next_read();
+	CHECK(access(false, true, DP_DPIDR, &value, &parity_ok) == ACK_OK);
+	CHECK(!parity_ok);
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_DPIDR);
+
+	/* A write with the wrong parity is dropped and flagged in WDATAERR */
+	CHECK(ap_write(AP_CSW, CSW_WORD_INCREMENT) == ACK_OK);
+	swd_proc.seq_out(make_request(true, false, AP_TAR), 8U);
+	CHECK(swd_proc.seq_in(3U) == ACK_OK);
+	swd_proc.seq_out(0x12345678U, 32U);
+	swd_proc.seq_out(0U, 1U);
+	swd_proc.seq_out(0U, 8U);
+	CHECK(dp_read(DP_CTRLSTAT, &value) == ACK_OK);
+	CHECK(value & SWD_SIM_CTRLSTAT_WDATAERR);
+	CHECK(ap_read(AP_TAR, &value) == ACK_FAULT);
+	CHECK(dp_write(DP_ABORT, SWD_SIM_ABORT_WDERRCLR) == ACK_OK);
+	CHECK(ap_read(AP_TAR, &value) == ACK_OK);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+	CHECK(value == 0);
+	CHECK(protocol_errors() == 0);
+
+	/* A request with the wrong parity isn't answered, until a line reset */
+	const uint32_t errors = protocol_errors();
+	swd_proc.seq_out(make_request(false, true, DP_DPIDR) ^ 0x20U, 8U);
+	CHECK(swd_proc.seq_in(3U) == ACK_NONE);
+	swd_proc.seq_out(0U, 8U);
+	CHECK(protocol_errors() == errors + 1U);
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_NONE);
+	line_reset();
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_DPIDR);
+	CHECK(protocol_errors() == errors + 1U);
+}
+
+static void test_wait(void)
+{
+	connect();
+	uint32_t value = 0;
+	CHECK(ap_write(AP_CSW, CSW_WORD_INCREMENT) == ACK_OK);
+	CHECK(ap_write(AP_TAR, SWD_SIM_MEM_BASE) == ACK_OK);
+	memcpy(swd_sim_mem, "\x11\x22\x33\x44\x55\x66\x77\x88", 8U);
+
+	/* A WAIT has no data phase, and the access isn't done: TAR doesn't move */
+	swd_sim_wait_next(3U);
+	for (size_t i = 0; i < 3U; ++i)
+		CHECK(ap_read(AP_DRW, &value) == ACK_WAIT);
+	CHECK(ap_read(AP_DRW, &value) == ACK_OK);
+	swd_sim_wait_next(2U);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_WAIT);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_WAIT);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+	CHECK(value == 0x44332211U);
+	CHECK(ap_read(AP_TAR, &value) == ACK_OK);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_MEM_BASE + 4U);
+
+	/* Writes the same, the data isn't sent after a WAIT */
+	swd_sim_wait_next(1U);
+	CHECK(ap_write(AP_DRW, 0xcafef00dU) == ACK_WAIT);
+	CHECK(ap_write(AP_DRW, 0xcafef00dU) == ACK_OK);
+	CHECK(!memcmp(swd_sim_mem + 4U, "\x0d\xf0\xfe\xca", 4U));
+
+	/* DP registers other than RDBUFF are never held up */
+	swd_sim_wait_next(1U);
+	CHECK(dp_read(DP_CTRLSTAT, &value) == ACK_OK);
+	CHECK(ap_read(AP_CSW, &value) == ACK_WAIT);
+
+	swd_sim_stats_s stats;
+	swd_sim_get_stats(&stats);
+	CHECK(stats.waits == 7U);
+	CHECK(stats.protocol_errors == 0);
+}
+
+static void test_fault(void)
+{
+	connect();
+	uint32_t value = 0;
+	CHECK(ap_write(AP_CSW, CSW_WORD_INCREMENT) == ACK_OK);
+	/* A read outside the RAM is posted, so only the accesses after it see the error */
+	CHECK(ap_write(AP_TAR, SWD_SIM_MEM_BASE - 4U) == ACK_OK);
+	CHECK(ap_read(AP_DRW, &value) == ACK_OK);
+	CHECK(ap_read(AP_DRW, &value) == ACK_FAULT);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_FAULT);
+	CHECK(ap_write(AP_TAR, SWD_SIM_MEM_BASE) == ACK_FAULT);
+	CHECK(dp_write(DP_SELECT, 0) == ACK_FAULT);
+
+	/* DPIDR, CTRL/STAT and ABORT still get through, the last to clear it */
+	CHECK(dp_read(DP_DPIDR, &value) == ACK_OK);
+	CHECK(dp_read(DP_CTRLSTAT, &value) == ACK_OK);
+	CHECK(value & SWD_SIM_CTRLSTAT_STICKYERR);
+	CHECK(dp_write(DP_ABORT, SWD_SIM_ABORT_STKERRCLR) == ACK_OK);
+	CHECK(dp_read(DP_CTRLSTAT, &value) == ACK_OK);
+	CHECK(!(value & SWD_SIM_CTRLSTAT_STICKYERR));
+	CHECK(ap_write(AP_TAR, SWD_SIM_MEM_BASE) == ACK_OK);
+
+	/* A FAULT wins over a WAIT, the access couldn't go ahead anyway */
+	CHECK(ap_write(AP_TAR, SWD_SIM_MEM_BASE + SWD_SIM_MEM_SIZE) == ACK_OK);
+	CHECK(ap_write(AP_DRW, 0) == ACK_OK);
+	swd_sim_wait_next(1U);
+	CHECK(ap_read(AP_CSW, &value) == ACK_FAULT);
+
+	swd_sim_stats_s stats;
+	swd_sim_get_stats(&stats);
+	CHECK(stats.bus_errors == 2U);
+	CHECK(stats.faults == 5U);
+	CHECK(stats.protocol_errors == 0);
+}
+
+static void test_banked_registers(void)
+{
+	connect();
+	uint32_t value = 0;
+	CHECK(dp_write(DP_SELECT, 0xf0U) == ACK_OK);
+	CHECK(ap_read(AP_IDR, &value) == ACK_OK);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+	CHECK(value == SWD_SIM_AP_IDR);
+	/* An AP that isn't there reads as 0 */
+	CHECK(dp_write(DP_SELECT, 0x010000f0U) == ACK_OK);
+	CHECK(ap_read(AP_IDR, &value) == ACK_OK);
+	CHECK(dp_read(DP_RDBUFF, &value) == ACK_OK);
+	CHECK(value == 0);
+	CHECK(protocol_errors() == 0);
+}
+
+static void test_backend_selection(void)
+{
+	/* swd_scan with the bit-banged engine selected takes the backend off swd_proc */
+	connect();
+	swd_engine_set_frequency(2000000U);
+	CHECK(swd_engine_active());
+	CHECK(swd_engine_get_frequency() == 2000000U);
+	swd_engine_select(SWD_ENGINE_BITBANG);
+	__wrap_swdptap_init();
+	CHECK(!swd_engine_active());
+	CHECK(swd_engine_transport_swd());
+	CHECK(!swd_proc.seq_in);
+
+	/* SPI selected but not available, it stays bit-banged */
+	swd_engine_select(SWD_ENGINE_SPI);
+	__wrap_swdptap_init();
+	CHECK(!swd_engine_active());
+	CHECK(!swd_proc.seq_in);
+
+	__wrap_jtagtap_init();
+	CHECK(!swd_engine_transport_swd());
+}
+
+int main(void)
+{
+	test_line_reset();
+	test_framing();
+	test_parity();
+	test_wait();
+	test_fault();
+	test_banked_registers();
+	test_backend_selection();
+	return TEST_RESULT();
+}
@@ -0,0 +1,350 @@
+/*
+ * Host tests for the queued SWD transactions
+ *
+ * The queue runs through the SWD engine into the simulated target, the same
+ * way it runs on the probe. Memory reads go through the hooked DP mem_read
+ * and are checked against the simulated RAM, with and without WAITs injected
+ * into a fifth of the AP accesses. The model's TAR only auto-increments
+ * within 1 KiB and its AP reads are posted, so a burst that isn't split at a
+ * 1 KiB boundary, or a result handed to the wrong read, shows up in the data.
+ */
+
+#include "general.h"
+#include "platform.h"
+#include "exception.h"
+#include "target_internal.h"
+#include "adiv5.h"
+#include "cortex_internal.h"
+#include "swd.h"
+#include "swd_engine.h"
+#include "swd_queue.h"
+#include "swd_sim.h"
+#include "test.h"
+
+/* The ACK, the data and the turnarounds either side of each access */
+#define CLOCKS_PER_ACCESS 46U
+#define IDLE_CLOCKS       8U
+
+static adiv5_debug_port_s dp;
+static adiv5_access_port_s ap = {.dp = &dp, .apsel = 0, .csw = 0x23000040U};
+static cortex_priv_s priv = {.ap = &ap};
+static target_s target = {.priv = &priv, .priv_free = cortex_priv_free};
+
+static size_t fallback_bytes;
+static size_t fallback_calls;
+static size_t aborts;
+static uint32_t timeout_checks;
+static uint8_t buffer[8192];
+
+void cortex_priv_free(void *const p)
+{
+	(void)p;
+}
+
+/* Time only passes when asked, the WAIT timeout expires on the 100th check */
+void platform_timeout_set(platform_timeout_s *const timeout, const uint32_t ms)
+{
+	timeout->time = ms;
+	timeout_checks = 0;
+}
+
+bool platform_timeout_is_expired(const platform_timeout_s *const timeout)
+{
+	(void)timeout;
+	return ++timeout_checks >= 100U;
+}
+
+/* A DAPABORT cancels whatever the target was stalled on */
+void adiv5_dp_abort(adiv5_debug_port_s *const debug_port, const uint32_t abort)
+{
+	(void)debug_port;
+	CHECK(abort == ADIV5_DP_ABORT_DAPABORT);
+	++aborts;
+	swd_sim_wait_next(0);
+}
+
+/* The DP's own mem_read, as adiv5.c would do it one access at a time */
+static void fallback_mem_read(adiv5_access_port_s *const access_port, void *const dest, const target_addr64_t src, const size_t len)
+{
+	CHECK(access_port == &ap);
+	CHECK(src >= SWD_SIM_MEM_BASE && src + len <= SWD_SIM_MEM_BASE + SWD_SIM_MEM_SIZE);
+	++fallback_calls;
+	fallback_bytes += len;
+	memcpy(dest, swd_sim_mem + (src - SWD_SIM_MEM_BASE), len);
+}
+
+static swd_sim_stats_s sim_stats(void)
+{
+	swd_sim_stats_s stats;
+	swd_sim_get_stats(&stats);
+	return stats;
+}
+
+static swd_queue_stats_s queue_stats(void)
+{
+	swd_queue_stats_s stats;
+	swd_queue_get_stats(&stats);
+	return stats;
+}
+
+/* Power the simulated target up, scan it and attach, as GDB would */
+static void connect(void)
+{
+	swd_sim_reset();
+	for (size_t i = 0; i < SWD_SIM_MEM_SIZE; ++i)
+		swd_sim_mem[i] = (uint8_t)(i * 7U + (i >> 8U));
+	__wrap_swdptap_init();
+	swd_engine_attach(&swd_engine_sim);
+	swd_proc.seq_out(0xffffffffU, 32U);
+	swd_proc.seq_out(0x000fffffU, 24U);
+
+	dp = (adiv5_debug_port_s){.version = 2, .mem_read = fallback_mem_read};
+	swd_queue_s queue;
+	swd_queue_init(&queue, &dp);
+	uint32_t dpidr = 0;
+	CHECK(swd_queue_dp_read(&queue, ADIV5_DP_DPIDR, &dpidr));
+	CHECK(swd_queue_flush(&queue));
+	CHECK(dpidr == SWD_SIM_DPIDR);
+
+	swd_queue_enable(true);
+	swd_queue_attach(&target);
+	swd_queue_reset_stats();
+	fallback_bytes = 0;
+	fallback_calls = 0;
+	aborts = 0;
+}
+
+static bool mem_read(const uint32_t offset, const size_t len)
+{
+	memset(buffer, 0xaa, sizeof(buffer));
+	dp.mem_read(&ap, buffer, SWD_SIM_MEM_BASE + offset, len);
+	return !memcmp(buffer, swd_sim_mem + offset, len);
+}
+
+static void test_attach(void)
+{
+	connect();
+	CHECK(dp.mem_read != fallback_mem_read);
+	/* Attaching again doesn't hook it twice */
+	swd_queue_attach(&target);
+	CHECK(mem_read(0x100U, 16U));
+	CHECK(fallback_calls == 0);
+
+	/* ADIv6 DPs select APs by address, and JTAG has no SWD queue */
+	dp = (adiv5_debug_port_s){.version = 3, .mem_read = fallback_mem_read};
+	swd_queue_attach(&target);
+	CHECK(dp.mem_read == fallback_mem_read);
+	dp.version = 2;
+	__wrap_jtagtap_init();
+	swd_queue_attach(&target);
+	CHECK(dp.mem_read == fallback_mem_read);
+	__wrap_swdptap_init();
+	swd_queue_attach(&target);
+	CHECK(dp.mem_read != fallback_mem_read);
+
+	/* Not a Cortex target */
+	target_s other = {.priv = &priv};
+	dp.mem_read = fallback_mem_read;
+	swd_queue_attach(&other);
+	CHECK(dp.mem_read == fallback_mem_read);
+	swd_queue_attach(NULL);
+}
+
+static void test_flush_order(void)
+{
+	connect();
+	swd_queue_s queue;
+	swd_queue_init(&queue, &dp);
+	uint32_t words[3] = {0};
+	uint32_t ctrlstat = 1;
+	uint32_t tar = 0;
+	uint32_t csw = 0;
+	CHECK(swd_queue_dp_write(&queue, ADIV5_DP_SELECT, 0));
+	CHECK(swd_queue_ap_write(&queue, ADIV5_AP_CSW, 0x23000012U));
+	CHECK(swd_queue_ap_write(&queue, ADIV5_AP_TAR_LOW, SWD_SIM_MEM_BASE + 0x40U));
+	for (size_t i = 0; i < 3U; ++i)
+		CHECK(swd_queue_ap_read(&queue, ADIV5_AP_DRW, &words[i]));
+	/* A DP access after AP reads has RDBUFF collect the last of them first */
+	CHECK(swd_queue_dp_read(&queue, ADIV5_DP_CTRLSTAT, &ctrlstat));
+	CHECK(swd_queue_ap_read(&queue, ADIV5_AP_TAR_LOW, &tar));
+	/* So does an AP write */
+	CHECK(swd_queue_ap_write(&queue, ADIV5_AP_TAR_LOW, SWD_SIM_MEM_BASE));
+	CHECK(swd_queue_ap_read(&queue, ADIV5_AP_CSW, &csw));
+	const size_t queued = queue.count;
+	CHECK(swd_queue_flush(&queue));
+	CHECK(queue.count == 0);
+
+	for (size_t i = 0; i < 3U; ++i) {
+		uint32_t expected;
+		memcpy(&expected, swd_sim_mem + 0x40U + i * 4U, sizeof(expected));
+		CHECK(words[i] == expected);
+	}
+	CHECK(ctrlstat == 0);
+	CHECK(tar == SWD_SIM_MEM_BASE + 0x4cU);
+	CHECK(csw == 0x23000012U);
+
+	/* Three RDBUFF reads: before the DP read, before the AP write and at the end */
+	CHECK(queue_stats().transactions == queued + 3U);
+	CHECK(sim_stats().requests == 1U + queued + 3U);
+	CHECK(sim_stats().protocol_errors == 0);
+	CHECK(queue_stats().bursts == 1U);
+
+	/* Only what was queued fits */
+	swd_queue_init(&queue, &dp);
+	for (size_t i = 0; i < SWD_QUEUE_SIZE; ++i)
+		CHECK(swd_queue_dp_read(&queue, ADIV5_DP_CTRLSTAT, &ctrlstat));
+	CHECK(!swd_queue_dp_read(&queue, ADIV5_DP_CTRLSTAT, &ctrlstat));
+	CHECK(!swd_queue_ap_write(&queue, ADIV5_AP_CSW, 0));
+}
+
+static void test_tar_wrap(void)
+{
+	connect();
+	/* Across a 1 KiB boundary, and over several */
+	CHECK(mem_read(0x3f8U, 64U));
+	CHECK(queue_stats().bursts == 2U);
+	swd_queue_reset_stats();
+	CHECK(mem_read(0x200U, 4096U));
+	CHECK(queue_stats().bursts == 5U);
+	swd_queue_reset_stats();
+	CHECK(mem_read(0x800U, 4096U));
+	CHECK(queue_stats().bursts == 4U);
+	/* Right up to the end of the RAM */
+	CHECK(mem_read(SWD_SIM_MEM_SIZE - 1024U, 1024U));
+	CHECK(fallback_calls == 0);
+	CHECK(sim_stats().bus_errors == 0);
+	CHECK(sim_stats().protocol_errors == 0);
+}
+
+static void test_unaligned(void)
+{
+	connect();
+	for (uint32_t start = 0x1000U; start < 0x1004U; ++start) {
+		for (size_t len = 1U; len <= 12U; ++len) {
+			fallback_bytes = 0;
+			CHECK(mem_read(start, len));
+			/* At most three bytes either side go the slow way, all of them if there's no whole word */
+			const size_t first = (start + 3U) & ~3U;
+			const size_t end = (start + len) & ~(size_t)3U;
+			const size_t words = end > first ? (end - first) / 4U : 0;
+			CHECK(fallback_bytes == len - words * 4U);
+		}
+	}
+
+	/* Disabled, it all goes to the DP's mem_read */
+	swd_queue_enable(false);
+	fallback_bytes = 0;
+	CHECK(mem_read(0x2000U, 256U));
+	CHECK(fallback_bytes == 256U);
+	swd_queue_enable(true);
+	CHECK(sim_stats().protocol_errors == 0);
+}
+
+static void test_waits(void)
+{
+	connect();
+	/* A fifth of the AP accesses and RDBUFF reads answered WAIT, over reads of every alignment and size */
+	swd_sim_wait_percent(20U);
+	uint32_t seed = 1;
+	size_t mismatches = 0;
+	for (size_t i = 0; i < 300U; ++i) {
+		seed = seed * 1103515245U + 12345U;
+		const uint32_t offset = (seed >> 8U) % 30000U;
+		seed = seed * 1103515245U + 12345U;
+		const size_t len = 1U + (seed >> 8U) % 5000U;
+		if (!mem_read(offset, len))
+			++mismatches;
+	}
+	CHECK(mismatches == 0);
+	const swd_sim_stats_s sim = sim_stats();
+	const swd_queue_stats_s queue = queue_stats();
+	CHECK(sim.waits > 0);
+	CHECK(queue.waits == sim.waits);
+	CHECK(queue.faults == 0);
+	CHECK(aborts == 0);
+	CHECK(!dp.fault);
+	CHECK(sim.protocol_errors == 0);
+}
+
+static void test_clocks_per_word(void)
+{
+	connect();
+	/* 4 KiB in 4 bursts: SELECT and CSW once, then TAR, 256 reads, RDBUFF and idle clocks in each */
+	const uint32_t clocks = sim_stats().clocks;
+	CHECK(mem_read(0x1000U, 4096U));
+	const uint32_t burst = (1U + 256U + 1U) * CLOCKS_PER_ACCESS + IDLE_CLOCKS;
+	CHECK(sim_stats().clocks - clocks == 2U * CLOCKS_PER_ACCESS + 4U * burst);
+	/* Under 46.5 clocks a word, where one access at a time, with its idle clocks, takes 54 */
+	CHECK((sim_stats().clocks - clocks) * 10U / 1024U < 465U);
+	CHECK(sim_stats().protocol_errors == 0);
+}
+
+static bool mem_read_raises(const char *const message)
+{
+	volatile bool raised = false;
+	TRY (EXCEPTION_ALL) {
+		mem_read(0x100U, 64U);
+	}
+	CATCH () {
+	case EXCEPTION_ERROR:
+		raised = !strcmp(exception_frame.msg, message);
+		break;
+	default:
+		break;
+	}
+	return raised;
+}
+
+static void test_faults(void)
+{
+	connect();
+	/* Running off the end of the RAM: STICKYERR, the burst stops and the words read as 0 */
+	CHECK(!mem_read(SWD_SIM_MEM_SIZE - 8U, 16U));
+	static const uint8_t zeros[16];
+	CHECK(!memcmp(buffer, zeros, 16U));
+	CHECK(queue_stats().faults == 1U);
+	CHECK(!dp.fault);
+
+	/* It stays until cleared through ABORT, as adiv5_dp_error() does */
+	swd_queue_s queue;
+	swd_queue_init(&queue, &dp);
+	uint32_t ctrlstat = 0;
+	CHECK(swd_queue_dp_read(&queue, ADIV5_DP_CTRLSTAT, &ctrlstat));
+	CHECK(swd_queue_dp_write(&queue, ADIV5_DP_ABORT, ADIV5_DP_ABORT_STKERRCLR));
+	CHECK(swd_queue_flush(&queue));
+	CHECK(ctrlstat & ADIV5_DP_CTRLSTAT_STICKYERR);
+	CHECK(mem_read(0x100U, 64U));
+
+	/* A WAIT that never clears is aborted once the timeout runs out */
+	swd_sim_wait_next(UINT32_MAX);
+	CHECK(!mem_read(0x100U, 64U));
+	CHECK(aborts == 1U);
+	CHECK(dp.fault);
+	/* The first WAIT starts the timeout, which runs out on the 100th check */
+	CHECK(queue_stats().waits == 101U);
+	CHECK(queue_stats().faults == 2U);
+
+	/* A bad read parity is a protocol error and raises */
+	connect();
+	swd_sim_corrupt_next_read();
+	CHECK(mem_read_raises("SWD parity error"));
+	CHECK(dp.fault);
+
+	/* So does no answer at all, from a target left waiting for a line reset by a bad header */
+	connect();
+	swd_proc.seq_out(0x85U, 8U);
+	CHECK(mem_read_raises("SWD invalid ACK"));
+	CHECK(dp.fault);
+}
+
+int main(void)
+{
+	test_attach();
+	test_flush_order();
+	test_tar_wrap();
+	test_unaligned();
+	test_waits();
+	test_clocks_per_word();
+	test_faults();
+	return TEST_RESULT();
+}